@@ -0,0 +1,135 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * affinity.c - cpu affinity of the SO_REUSEPORT listeners.
+ * Implementation idea:
+ * 1. in reuseport mode every epoll loop owns its own listening socket
+ *    and its thread is pinned to one of the cpus the process may use,
+ *    loop i to the i-th of them, so a loop and its connections never
+ *    move between cores
+ * 2. by default the kernel picks the socket of a new connection by the
+ *    hash of its addresses; when there is exactly one loop per cpu and
+ *    the cpus are 0 to n-1, a classic BPF program attached to the group
+ *    picks the socket of the cpu that received the connection instead,
+ *    so the whole connection stays on that core
+ * 3. kept apart from csapp.c because the cpu sets need _GNU_SOURCE, which
+ *    clashes with the declarations of csapp.h
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+#include "affinity.h"
+
+/* Static helper functions for the cpu affinity */
+static int allowed_cpus(cpu_set_t* set);
+
+/*
+ * cpu_count - number of cpus the process may run on
+ */
+int cpu_count() {
+
+    cpu_set_t set;
+
+    return allowed_cpus(&set);
+}
+
+/*
+ * nth_cpu - id of the n-th cpu the process may run on, counted modulo
+ *           their number
+ */
+int nth_cpu(int n) {
+
+    cpu_set_t set;
+    int cpu;
+
+    n %= allowed_cpus(&set);
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &set) && n-- == 0) {
+            return cpu;
+        }
+    }
+    return 0;
+}
+
+/*
+ * pin_thread - run the calling thread on cpu only
+ *              return -1 on error
+ */
+int pin_thread(int cpu) {
+
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0) ?
+           0 : -1;
+}
+
+/*
+ * steer_by_cpu - make the reuseport group of listenfd, listener_num
+ *                sockets opened in the order of their loops, hand a new
+ *                connection to the socket of the cpu that received it
+ *                return -1 if the loops do not match the cpus one to one
+ *                or the program cannot be attached, the kernel then
+ *                keeps spreading by hash
+ */
+int steer_by_cpu(int listenfd, int listener_num) {
+
+    struct sock_filter code[] = {
+        // A = the cpu the connection arrived on
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU),
+        // return A % listener_num, the index of the socket in the group
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, listener_num),
+        BPF_STMT(BPF_RET | BPF_A, 0),
+    };
+    struct sock_fprog program = {sizeof(code) / sizeof(code[0]), code};
+    cpu_set_t set;
+    int cpu;
+
+    if (allowed_cpus(&set) != listener_num) {
+        return -1;
+    }
+    for (cpu = 0; cpu < listener_num; cpu++) {
+        if (!CPU_ISSET(cpu, &set)) {
+            return -1;
+        }
+    }
+
+    if (setsockopt(listenfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+                   &program, sizeof(program)) == -1) {
+        printf("Attach reuseport program error: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * allowed_cpus - the set of cpus the process may run on
+ *                return their number
+ */
+static int allowed_cpus(cpu_set_t* set) {
+
+    long online;
+    int cpu;
+
+    if (sched_getaffinity(0, sizeof(cpu_set_t), set) == 0 &&
+        CPU_COUNT(set) > 0) {
+        return CPU_COUNT(set);
+    }
+
+    // assume the online cpus are 0 to n-1
+    online = sysconf(_SC_NPROCESSORS_ONLN);
+    CPU_ZERO(set);
+    for (cpu = 0; cpu < online && cpu < CPU_SETSIZE; cpu++) {
+        CPU_SET(cpu, set);
+    }
+    return (online > 0) ? online : 1;
+}
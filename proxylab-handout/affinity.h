@@ -0,0 +1,16 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * affinity.h - prototypes and definitions for affinity.c
+ */
+#ifndef __AFFINITY_H__
+#define __AFFINITY_H__
+
+/* Defined function keeping the reuseport listeners on their cpus */
+int cpu_count();
+int nth_cpu(int n);
+int pin_thread(int cpu);
+int steer_by_cpu(int listenfd, int listener_num);
+
+#endif /* __AFFINITY_H__ */
@@ -0,0 +1,172 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * breaker.c - circuit breaker per origin server.
+ * Implementation idea:
+ * 1. index the origins by "host:port" in a hash table, like the upstream
+ *    pool; an origin is only added once it fails
+ * 2. a connect that fails or times out, or a server that sends nothing
+ *    before the first-byte timeout, counts as a failure; a status line
+ *    resets the count
+ * 3. max_failures consecutive failures open the breaker: for cooldown
+ *    seconds every request to the origin fails fast, with a stale cached
+ *    copy if there is one, else a 504, instead of waiting for the timeouts
+ * 4. after the cooldown the breaker is half-open: one request goes to the
+ *    origin as a probe, the others still fail fast; its success closes
+ *    the breaker, its failure opens it for another cooldown; a probe that
+ *    never reports (the client went away) is replaced after a cooldown
+ * 5. while no origin fails, neither check takes the mutex
+ *
+ */
+#include "csapp.h"
+#include "cache.h"
+#include "breaker.h"
+
+/* Static helper functions for the circuit breaker */
+static breaker_origin_t* find_origin(breaker_t* breaker, char* key,
+                                     int create);
+static void set_troubled(breaker_t* breaker, breaker_origin_t* origin,
+                         int troubled);
+
+/*
+ * init_breaker - initialize the breakers, every origin closed
+ *                return a pointer to them
+ */
+breaker_t* init_breaker(int max_failures, int cooldown) {
+
+    breaker_t* breaker = (breaker_t *)Calloc(1, sizeof(breaker_t));
+    breaker -> max_failures = max_failures;
+    breaker -> cooldown = cooldown;
+    Sem_init(&breaker -> mutex, 0, 1);
+    return breaker;
+
+}
+
+/*
+ * breaker_allow - check whether a request may go to host:port, a request
+ *                 let through a half-open breaker is its probe and must
+ *                 be reported
+ *                 return 0 if the request must fail fast
+ */
+int breaker_allow(breaker_t* breaker, char* host, char* port) {
+
+    char key[MAXLINE];
+    breaker_origin_t* origin;
+    time_t now;
+    int allow = 1;
+
+    if (__atomic_load_n(&breaker -> troubled, __ATOMIC_RELAXED) == 0) {
+        return 1;
+    }
+    snprintf(key, MAXLINE, "%s:%s", host, port);
+    now = time(NULL);
+
+    P(&breaker -> mutex);
+    origin = find_origin(breaker, key, 0);
+    if (origin != NULL && origin -> state != BREAKER_CLOSED) {
+        if (now >= origin -> retry_at) {
+            // this request probes the origin, the next one waits for it
+            origin -> state = BREAKER_HALF_OPEN;
+            origin -> retry_at = now +
+                __atomic_load_n(&breaker -> cooldown, __ATOMIC_RELAXED);
+        } else {
+            allow = 0;
+        }
+    }
+    V(&breaker -> mutex);
+    return allow;
+}
+
+/*
+ * breaker_report - record the outcome of a request to host:port, ok is
+ *                  set if the server answered
+ */
+void breaker_report(breaker_t* breaker, char* host, char* port, int ok) {
+
+    char key[MAXLINE];
+    breaker_origin_t* origin;
+    int max_failures = __atomic_load_n(&breaker -> max_failures,
+                                       __ATOMIC_RELAXED);
+
+    // a healthy origin has nothing to reset, a disabled breaker never opens
+    if ((ok && __atomic_load_n(&breaker -> troubled, __ATOMIC_RELAXED) == 0) ||
+        (!ok && max_failures <= 0)) {
+        return;
+    }
+    snprintf(key, MAXLINE, "%s:%s", host, port);
+
+    P(&breaker -> mutex);
+    if ((origin = find_origin(breaker, key, !ok)) == NULL) {
+        V(&breaker -> mutex);
+        return;
+    }
+
+    if (ok) {
+        if (origin -> state != BREAKER_CLOSED) {
+            printf("Origin %s is back.\n", key);
+        }
+        origin -> state = BREAKER_CLOSED;
+        origin -> failures = 0;
+        set_troubled(breaker, origin, 0);
+    } else {
+        origin -> failures++;
+        set_troubled(breaker, origin, 1);
+        // a failed probe, or too many failures in a row
+        if (origin -> state == BREAKER_HALF_OPEN ||
+            (origin -> state == BREAKER_CLOSED &&
+             origin -> failures >= max_failures)) {
+            if (origin -> state == BREAKER_CLOSED) {
+                printf("Origin %s is down after %d failures.\n", key,
+                       origin -> failures);
+            }
+            origin -> state = BREAKER_OPEN;
+            origin -> retry_at = time(NULL) +
+                __atomic_load_n(&breaker -> cooldown, __ATOMIC_RELAXED);
+        }
+    }
+    V(&breaker -> mutex);
+}
+
+/*
+ * find_origin - look up the breaker of an origin, create it if asked
+ *               the caller must hold the mutex
+ */
+static breaker_origin_t* find_origin(breaker_t* breaker, char* key,
+                                     int create) {
+
+    unsigned int index = hash_cache_id(key) & (BREAKER_BUCKET_NUM - 1);
+    breaker_origin_t* origin;
+
+    for (origin = breaker -> buckets[index]; origin; origin = origin -> next) {
+        if (strcmp(origin -> host_key, key) == 0) {
+            return origin;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+
+    origin = (breaker_origin_t *)Calloc(1, sizeof(breaker_origin_t));
+    origin -> host_key = (char *)Malloc(strlen(key) + 1);
+    strcpy(origin -> host_key, key);
+    origin -> state = BREAKER_CLOSED;
+    origin -> next = breaker -> buckets[index];
+    breaker -> buckets[index] = origin;
+    return origin;
+}
+
+/*
+ * set_troubled - count the origin in or out of the troubled ones, which
+ *                make the checks take the mutex
+ *                the caller must hold the mutex
+ */
+static void set_troubled(breaker_t* breaker, breaker_origin_t* origin,
+                         int troubled) {
+
+    if (origin -> troubled != troubled) {
+        origin -> troubled = troubled;
+        __atomic_add_fetch(&breaker -> troubled, troubled ? 1 : -1,
+                           __ATOMIC_RELAXED);
+    }
+}
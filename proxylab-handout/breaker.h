@@ -0,0 +1,50 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * breaker.h - prototypes and definitions for breaker.c
+ */
+#ifndef __BREAKER_H__
+#define __BREAKER_H__
+
+#include "csapp.h"
+
+/* Number of buckets of the origin table, always a power of 2 */
+#define BREAKER_BUCKET_NUM 64
+
+/* Default consecutive failures that mark an origin down */
+#define BREAKER_DEFAULT_FAILURES 5
+
+/* Default seconds an origin stays down before a probe is let through */
+#define BREAKER_DEFAULT_COOLDOWN 10
+
+/* States of the breaker of one origin */
+#define BREAKER_CLOSED    0     // requests go to the origin
+#define BREAKER_OPEN      1     // the origin is down, requests fail fast
+#define BREAKER_HALF_OPEN 2     // one probe request is in flight
+
+/* Defined a struct representing the health of one host:port */
+typedef struct breaker_origin_t {
+    char* host_key;
+    int state;
+    int failures;                   // consecutive, reset by a success
+    time_t retry_at;                // next probe once open or half-open
+    int troubled;                   // counted in breaker_t troubled
+    struct breaker_origin_t* next;
+} breaker_origin_t;
+
+/* Defined a struct representing the breakers of every origin */
+typedef struct breaker_t {
+    breaker_origin_t* buckets[BREAKER_BUCKET_NUM];
+    int max_failures;               // 0 never marks an origin down
+    int cooldown;
+    int troubled;                   // origins failing or not closed
+    sem_t mutex;
+} breaker_t;
+
+/* Defined function failing fast on origins that are down */
+breaker_t* init_breaker(int max_failures, int cooldown);
+int breaker_allow(breaker_t* breaker, char* host, char* port);
+void breaker_report(breaker_t* breaker, char* host, char* port, int ok);
+
+#endif /* __BREAKER_H__ */
@@ -3,19 +3,51 @@
  * Andrew ID: gaoj
  *
  * cache.c - proxy cache implementations.
- * Implementation idea: Use singly linked list for cache.
- * 1. maintain head and rear pointers for the cache to simulate a queue
- * 2. add node to the rear; access node
- *    and move it to the rear to implement lru
- * 3. evict the head node when needed to implement lru
- * 4. cache size is less than MAX_CACHE_SIZE,
- *    cache node size is less than MAX_OBJECT_SIZE
- * 5. maintain a read lock and a write lock for the list
- *    to implement multi-thread
- *
+ * Implementation idea: sharded hash tables plus doubly linked recency lists.
+ * 1. split the cache into CACHE_SHARD_NUM shards by the hash of the
+ *    cache id, every shard has its own lock, lru list and byte budget,
+ *    so threads touching different shards never contend
+ * 2. in every shard, maintain head and rear pointers of a doubly linked
+ *    list to simulate a queue, the head is the least recently used node,
+ *    and index every node in a chained hash table keyed on the cache id
+ * 3. a hit only takes the shard read lock and marks the node referenced;
+ *    eviction gives referenced head nodes a second chance by moving them
+ *    to the rear (clock approximation of lru), so hits never serialize
+ *    on the write lock
+ * 4. lookup, insertion and eviction are all O(1), the table of a shard
+ *    doubles when it holds more nodes than buckets
+ * 5. cache size is less than the capacity, cache node size is less than
+ *    the object size limit, both set at startup and counted in 64 bits
+ * 6. cached objects are immutable and reference counted, a hit pins the
+ *    object instead of copying it, eviction drops the reference of the
+ *    node and the object is freed when its last reader releases it
+ * 7. objects are stored in fixed size segments, a fill appends the
+ *    response chunks as they arrive and is dropped as soon as it passes
+ *    the object size limit; on commit the node header, the cache id and the
+ *    last segment are packed in one block, so an object of one segment
+ *    is a single contiguous allocation
+ * 8. admission and eviction are delegated to a replacement policy picked
+ *    at startup: lru (the clock of 3.), tinylfu (clock plus admission of
+ *    a new object only if a count-min sketch of the request frequencies
+ *    says it is more popular than the objects it would evict) or gdsf
+ *    (greedy dual size frequency, evict the lowest frequency / size
+ *    plus an inflation clock, kept in a min-heap per shard whose keys
+ *    are raised lazily when a stale top is popped)
+ * 9. with a disk tier attached, evicted and rejected objects are queued
+ *    for its writer after the shard is unlocked, and a miss in memory is
+ *    promoted from it (see diskcache.c)
+ * 10. segments and node blocks are carved from size class slabs in an
+ *    arena covering the capacity, reserved at startup so that only the
+ *    pages in use take memory, a page goes back to the arena when its
+ *    last block is freed, and a node is charged the size of its blocks
+ *    so the shard budget counts every header
  */
+#include <sys/uio.h>
+#include <sys/mman.h>
 #include "csapp.h"
 #include "cache.h"
+#include "diskcache.h"
+#include "metrics.h"
 
 #define DEBUG
 #ifdef DEBUG
@@ -24,283 +56,1700 @@
 # define dbg_printf(...)
 #endif
 
+/* Static helper functions for the cache implementation */
+static cache_shard_t* get_shard(cache_list_t* list, unsigned int hash);
+static cache_node_t* search_cache_node(cache_shard_t* shard, char* id,
+                                       unsigned int hash);
+static void link_node_to_rear(cache_shard_t* shard, cache_node_t* node);
+static void unlink_node(cache_shard_t* shard, cache_node_t* node);
+static void insert_node_to_bucket(cache_shard_t* shard, cache_node_t* node);
+static void remove_node_from_bucket(cache_shard_t* shard, cache_node_t* node);
+static void grow_buckets(cache_shard_t* shard);
+static cache_node_t* evict_cache_node(cache_shard_t* shard);
+static const cache_policy_t* find_policy(char* name);
+static void lru_init(cache_shard_t* shard);
+static void lru_access(cache_shard_t* shard, unsigned int hash,
+                       cache_node_t* node);
+static int lru_admit(cache_shard_t* shard, cache_node_t* node);
+static void lru_insert(cache_shard_t* shard, cache_node_t* node);
+static void lru_remove(cache_shard_t* shard, cache_node_t* node);
+static cache_node_t* lru_victim(cache_shard_t* shard);
+static void tinylfu_init(cache_shard_t* shard);
+static void tinylfu_access(cache_shard_t* shard, unsigned int hash,
+                           cache_node_t* node);
+static int tinylfu_admit(cache_shard_t* shard, cache_node_t* node);
+static void tinylfu_insert(cache_shard_t* shard, cache_node_t* node);
+static unsigned char* sketch_counter(cache_shard_t* shard, unsigned int hash,
+                                     int row);
+static unsigned int sketch_estimate(cache_shard_t* shard, unsigned int hash);
+static void gdsf_init(cache_shard_t* shard);
+static void gdsf_access(cache_shard_t* shard, unsigned int hash,
+                        cache_node_t* node);
+static void gdsf_insert(cache_shard_t* shard, cache_node_t* node);
+static void gdsf_remove(cache_shard_t* shard, cache_node_t* node);
+static cache_node_t* gdsf_victim(cache_shard_t* shard);
+static unsigned long long gdsf_priority(cache_node_t* node);
+static void heap_push(cache_shard_t* shard, cache_node_t* node);
+static void heap_sift_up(cache_shard_t* shard, unsigned int i);
+static void heap_sift_down(cache_shard_t* shard, unsigned int i);
+static cache_node_t* create_node_for_object(char* cache_id,
+                                            cache_object_t* object);
+static cache_segment_t* alloc_segment();
+static void free_segments(cache_segment_t* segment);
+static void init_slab_arena(size_t capacity);
+static int slab_class_of(size_t size);
+static size_t slab_charge(size_t size);
+static void* slab_alloc(size_t size);
+static void slab_free(void* block);
+static void demote_cache_node(cache_list_t* list, cache_node_t* node);
+static cache_object_t* read_disk_tier(cache_list_t* list, char* id,
+                                      unsigned int hash);
+
+/* Replacement policies selectable at startup, the first one by default */
+static const cache_policy_t cache_policies[] = {
+    {"lru", lru_init, lru_access, lru_admit, lru_insert, lru_remove,
+     lru_victim},
+    {"tinylfu", tinylfu_init, tinylfu_access, tinylfu_admit, tinylfu_insert,
+     lru_remove, lru_victim},
+    {"gdsf", gdsf_init, gdsf_access, lru_admit, gdsf_insert, gdsf_remove,
+     gdsf_victim},
+};
+
+/* Round up to the alignment of the blocks */
+#define SLAB_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+/* the slab arena, NULL until init_cache_list, every block is malloc'ed */
+static char* slab_arena = NULL;
+static cache_slab_page_t* slab_pages = NULL;
+static size_t slab_page_num = 0;
+static cache_slab_page_t* slab_free_pages = NULL;
+static size_t slab_pages_used = 0;
+static pthread_mutex_t slab_arena_mutex = PTHREAD_MUTEX_INITIALIZER;
+static cache_slab_class_t slab_classes[CACHE_SLAB_CLASS_NUM];
+static int slab_class_num = 0;
+static unsigned long slab_outside = 0;  // blocks malloc'ed, arena full
+
 /*
- * init_cache - initialize cache list
- *              return a pointer to the cache_list
+ * init_cache - initialize cache list with the named replacement policy,
+ *              lru if policy is NULL, holding capacity bytes in objects
+ *              of up to max_object bytes
+ *              return a pointer to the cache_list, NULL on error
  */
-cache_list_t* init_cache_list() {
+cache_list_t* init_cache_list(char* policy, size_t capacity,
+                              size_t max_object) {
+
+    cache_shard_t* shard;
+    int i;
+    cache_list_t* cache_list;
+
+    // look up the policy first
+    const cache_policy_t* cache_policy = find_policy(policy);
+    if (cache_policy == NULL) {
+        printf("Unknown cache policy %s\n", policy);
+        return NULL;
+    }
+    // every shard must be able to hold the largest object
+    if (max_object == 0 || max_object > capacity / CACHE_SHARD_NUM) {
+        printf("Object size limit %zu does not fit in a cache shard "
+               "(%zu bytes)\n", max_object, capacity / CACHE_SHARD_NUM);
+        return NULL;
+    }
 
     // create a cache list
-    cache_list_t* cache_list = (cache_list_t *)malloc(sizeof(cache_list_t));
+    cache_list = (cache_list_t *)calloc(1, sizeof(cache_list_t));
+    if (cache_list == NULL) {
+        printf("Malloc cache list error\n");
+        return NULL;
+    }
+    cache_list -> policy = cache_policy;
+    cache_list -> capacity = capacity;
+    cache_list -> max_object = max_object;
+    init_slab_arena(capacity);
 
-    // initialize the fields of cache list
-    cache_list -> head = NULL;
-    cache_list -> rear = NULL;
-    cache_list -> unassigned_length = MAX_CACHE_SIZE;
-    Sem_init(&cache_list -> read_mutex, 0, 1);
-    Sem_init(&cache_list -> write_mutex, 0, 1);
+    // initialize the fields of every shard
+    for (i = 0; i < CACHE_SHARD_NUM; i++) {
+        shard = &cache_list -> shards[i];
+        shard -> head = NULL;
+        shard -> rear = NULL;
+        shard -> bucket_num = CACHE_BUCKET_NUM;
+        shard -> buckets =
+            (cache_node_t **)Calloc(CACHE_BUCKET_NUM, sizeof(cache_node_t *));
+        shard -> node_num = 0;
+        shard -> capacity = capacity / CACHE_SHARD_NUM;
+        shard -> unassigned_length = shard -> capacity;
+        shard -> policy = cache_policy;
+        cache_policy -> init(shard);
+        pthread_rwlock_init(&shard -> lock, NULL);
+    }
 
     return cache_list;
 
 }
 
 /*
- * create_cache_node - initialize a cache node
+ * attach_disk_cache - use disk as the second tier of the cache, objects
+ *                     evicted from memory are written there and a miss
+ *                     in memory is looked up there
+ */
+void attach_disk_cache(cache_list_t* list, struct disk_cache_t* disk) {
+
+    list -> disk = disk;
+
+}
+
+/*
+ * set_cache_policy - switch every shard to the named replacement policy,
+ *                    the nodes stay, only the policy state starts over
+ *                    return -1 if there is no such policy
+ */
+int set_cache_policy(cache_list_t* list, char* policy) {
+
+    const cache_policy_t* cache_policy = find_policy(policy);
+    cache_shard_t* shard;
+    int i;
+
+    if (cache_policy == NULL) {
+        printf("Unknown cache policy %s\n", policy);
+        return -1;
+    }
+    if (cache_policy == list -> policy) {
+        return 0;
+    }
+
+    for (i = 0; i < CACHE_SHARD_NUM; i++) {
+        shard = &list -> shards[i];
+        pthread_rwlock_wrlock(&shard -> lock);
+        Free(shard -> sketch);
+        Free(shard -> heap);
+        shard -> policy = cache_policy;
+        cache_policy -> init(shard);
+        pthread_rwlock_unlock(&shard -> lock);
+    }
+    list -> policy = cache_policy;
+    return 0;
+}
+
+/*
+ * resize_cache_list - change the capacity and the object size limit, a
+ *                     shard over its new budget evicts by its policy;
+ *                     growing past the arena reserved at startup takes
+ *                     the new blocks from malloc
+ *                     return -1 if the limit does not fit in a shard
+ */
+int resize_cache_list(cache_list_t* list, size_t capacity,
+                      size_t max_object) {
+
+    cache_shard_t* shard;
+    cache_node_t *victim, *evicted;
+    size_t used;
+    int i;
+
+    if (max_object == 0 || max_object > capacity / CACHE_SHARD_NUM) {
+        printf("Object size limit %zu does not fit in a cache shard "
+               "(%zu bytes)\n", max_object, capacity / CACHE_SHARD_NUM);
+        return -1;
+    }
+    // fills started from now on see the new limit
+    __atomic_store_n(&list -> max_object, max_object, __ATOMIC_RELAXED);
+    list -> capacity = capacity;
+
+    for (i = 0; i < CACHE_SHARD_NUM; i++) {
+        shard = &list -> shards[i];
+        evicted = NULL;
+        pthread_rwlock_wrlock(&shard -> lock);
+        used = shard -> capacity - shard -> unassigned_length;
+        shard -> capacity = capacity / CACHE_SHARD_NUM;
+        while (used > shard -> capacity &&
+               (victim = evict_cache_node(shard)) != NULL) {
+            used -= victim -> cache_length;
+            victim -> next = evicted;
+            evicted = victim;
+            metrics_count(COUNT_CACHE_EVICTIONS, 1);
+        }
+        shard -> unassigned_length = shard -> capacity - used;
+        pthread_rwlock_unlock(&shard -> lock);
+
+        // the victims go to the disk tier like any other
+        while ((victim = evicted) != NULL) {
+            evicted = victim -> next;
+            demote_cache_node(list, victim);
+            free_cache_node(victim);
+        }
+    }
+    return 0;
+}
+
+/*
+ * cache_used_bytes - bytes taken by the cached nodes of every shard
+ */
+size_t cache_used_bytes(cache_list_t* list) {
+
+    cache_shard_t* shard;
+    size_t used = 0;
+    int i;
+
+    for (i = 0; i < CACHE_SHARD_NUM; i++) {
+        shard = &list -> shards[i];
+        pthread_rwlock_rdlock(&shard -> lock);
+        used += shard -> capacity - shard -> unassigned_length;
+        pthread_rwlock_unlock(&shard -> lock);
+    }
+    return used;
+}
+
+/*
+ * snapshot_cache_list - queue every cached object for the log of disk,
+ *                       the least recently used ones of a shard first,
+ *                       written by the time disk is closed
+ *                       return the number of objects queued
+ */
+int snapshot_cache_list(cache_list_t* list, struct disk_cache_t* disk) {
+
+    cache_shard_t* shard;
+    cache_node_t* node;
+    int i, stored = 0;
+
+    for (i = 0; i < CACHE_SHARD_NUM; i++) {
+        shard = &list -> shards[i];
+        pthread_rwlock_rdlock(&shard -> lock);
+        for (node = shard -> head; node != NULL; node = node -> next) {
+            if (queue_disk_object(disk, node -> cache_id, node -> hash,
+                                  node -> cache_object, 1) == 0) {
+                stored++;
+            }
+        }
+        pthread_rwlock_unlock(&shard -> lock);
+    }
+    return stored;
+}
+
+/*
+ * create_cache_node - initialize a cache node with a copy of the content,
+ *                     of any size
  *                     return a pointer to the cache node
  */
 cache_node_t* create_cache_node(char* cache_id, char* cache_content,
-                                unsigned int length, cache_node_t* next) {
+                                size_t length, cache_node_t* next) {
+
+    cache_fill_t* fill;
+    cache_node_t* cache_node;
+
+    // copy the content into segments like a fill of one chunk
+    if ((fill = begin_cache_fill(NULL, cache_id)) == NULL) {
+        return NULL;
+    }
+    if (append_cache_fill(fill, cache_content, length) == -1) {
+        abort_cache_fill(fill);
+        return NULL;
+    }
 
-    // create a cache node
-    cache_node_t* cache_node = (cache_node_t *)malloc(sizeof(cache_node_t));
-    // check whether the cache node is created
+    cache_node = create_node_for_object(cache_id, fill -> object);
     if (cache_node == NULL) {
-        printf("Malloc cache node error\n");
+        abort_cache_fill(fill);
         return NULL;
     }
+    cache_node -> next = next;
+
+    Free(fill -> cache_id);
+    Free(fill);
+    return cache_node;
+
+}
+
+/*
+ * create_node_for_object - initialize a cache node taking over the object
+ *                          of a fill: the node, the object header, the id
+ *                          and the last segment are copied into one block
+ *                          and the old header and last segment are freed
+ *                          return a pointer to the cache node, NULL on
+ *                          error, the object is then left as it was
+ */
+static cache_node_t* create_node_for_object(char* cache_id,
+                                            cache_object_t* object) {
+
+    cache_node_t* cache_node;
+    cache_object_t* packed;
+    cache_segment_t *segment, *prev = NULL, *tail = NULL;
+    size_t id_size = SLAB_ALIGN(strlen(cache_id) + 1);
+    size_t tail_length = 0, size, charge;
+    char* block;
+
+    // the last segment is packed with the node, the others stay as they are
+    for (segment = object -> segments; segment; segment = segment -> next) {
+        prev = tail;
+        tail = segment;
+    }
+    if (tail != NULL) {
+        tail_length = tail -> length;
+    }
 
-    // initialize node id
-    cache_node -> cache_id =
-        (char *)malloc(sizeof(char) * (strlen(cache_id) + 1));
-    // check whether malloc succeed
-    if ((cache_node -> cache_id) == NULL) {
-        printf("Create cache id error.\n");
+    // node header, object header, id, then the last segment
+    size = SLAB_ALIGN(sizeof(cache_node_t)) +
+           SLAB_ALIGN(sizeof(cache_object_t)) + id_size;
+    if (tail != NULL) {
+        size += sizeof(cache_segment_t) + tail_length;
+    }
+    if ((block = (char *)slab_alloc(size)) == NULL) {
+        printf("Malloc cache node error\n");
         return NULL;
     }
+    cache_node = (cache_node_t *)block;
+    packed = (cache_object_t *)(block + SLAB_ALIGN(sizeof(cache_node_t)));
+    cache_node -> cache_id = (char *)packed +
+                             SLAB_ALIGN(sizeof(cache_object_t));
     strcpy(cache_node -> cache_id, cache_id);
 
-    // initialize node content
-    cache_node -> cache_content = (char *)malloc(sizeof(char) * length);
-    // check whether malloc succeed
-    if ((cache_node -> cache_content) == NULL) {
-        printf("Create cache content error.\n");
-        return NULL;
+    // the node takes over the reference of the fill
+    packed -> refcnt = object -> refcnt;
+    packed -> length = object -> length;
+    packed -> segments = object -> segments;
+    packed -> block = block;
+    packed -> expires = object -> expires;
+    packed -> lifetime = object -> lifetime;
+    packed -> stale_window = object -> stale_window;
+    packed -> refreshing = 0;
+    charge = slab_charge(size);
+    if (tail != NULL) {
+        segment = (cache_segment_t *)(cache_node -> cache_id + id_size);
+        segment -> length = tail_length;
+        segment -> embedded = 1;
+        segment -> next = NULL;
+        memcpy(segment -> data, tail -> data, tail_length);
+        if (prev == NULL) {
+            packed -> segments = segment;
+        } else {
+            prev -> next = segment;
+        }
+        tail -> next = NULL;
+        free_segments(tail);
+        // every other segment is a full block
+        for (segment = packed -> segments; segment -> next;
+             segment = segment -> next) {
+            charge += slab_charge(CACHE_SEGMENT_BLOCK);
+        }
     }
-    memcpy(cache_node -> cache_content, cache_content, length);
+    slab_free(object -> block);
+    cache_node -> cache_object = packed;
 
-    // initialize cache length and cache next node
-    cache_node -> cache_length = length;
-    cache_node -> next = next;
+    // initialize cache length, hash and links
+    cache_node -> cache_length = charge;
+    cache_node -> hash = hash_cache_id(cache_id);
+    cache_node -> referenced = 0;
+    cache_node -> frequency = 0;
+    cache_node -> inflation = 0;
+    cache_node -> priority = 0;
+    cache_node -> heap_index = 0;
+    cache_node -> on_disk = 0;
+    cache_node -> prev = NULL;
+    cache_node -> next = NULL;
+    cache_node -> hnext = NULL;
 
     return cache_node;
 
 }
 
 /*
- * add_cache_node_to_rear - add new cache node
- *                          and move the recently accessed node to the rear
- *                          return -1 on error
- */
- int add_cache_node_to_rear(cache_list_t* list, cache_node_t* node) {
-
-     // check whether the list is NULL
-     if (list == NULL) {
-         return -1;
-     }
-
-     // multi-thread write control
-     P(&(list -> write_mutex));
-
-     // check whether the cache size is enough for the new node
-     while ((list -> unassigned_length) < (node -> cache_length)) {
-         // if unassigend size is less than node size, evict according to lru
-         evict_cache_node(list);
-     }
-
-     // add node to the cache list
-     if ((list -> head) == NULL) {
-         list -> head = node;
-         list -> rear = node;
-     } else {
-         list -> rear -> next = node;
-         list -> rear = node;
-     }
-     list -> unassigned_length -= node -> cache_length;
-
-     // unlock the cache_list
-     V(&(list -> write_mutex));
-
-     return 0;
- }
-
- /*
-  * search_cache_node - search node in the cache list according to given id
-  *                     return cache node if found; return NULL if not
-  */
- cache_node_t* search_cache_node(cache_list_t* list, char* id) {
-
-     // check whether cache list is NULL
-     if (list == NULL) {
-         return NULL;
-     }
-
-     // multi-thread read lock
-     P(&(list -> read_mutex));
-
-     // search for the given node
-     cache_node_t* node = list -> head;
-     while (node != NULL) {
-         if (strcmp(node -> cache_id, id) == 0) {
-             // if found, unlock the list
-             V(&(list -> read_mutex));
-             return node;
-         }
-         node = (node -> next);
-     }
-     // unlock the list
-     V(&(list -> read_mutex));
-     return NULL;
-
- }
-
- /*
-  * read_cache_list - read cache content from the node in cache list
-  *                   and move the recently accessed node to list rear for lru
-  *                   return -1 if on error
-  */
- int read_cache_list(cache_list_t* list, char* id, char* content) {
-
-	 cache_node_t* node = NULL;
-
-     // check whether the list is NULL
-     if (list == NULL) {
-         return -1;
-     }
-     // check whether the given id is NULL
-     if (id == NULL) {
-         printf("cache id error.\n");
-         return -1;
-     }
-
-     // search for the node in cache list
-     if ((node = search_cache_node(list, id)) == NULL) {
-         // not found
-         printf("cannot find the node in cache");
-         return -1;
-     } else {
-
-         // multi-thread read lock
-         P(&(list -> read_mutex));
-         // found the node, access the cache content
-         memcpy(content, node -> cache_content, node -> cache_length);
-         //unlock the cache list
-         V(&(list -> read_mutex));
-         // delete the node from current position
-         node = delete_cache_node(list, id);
-         // move the node to the rear of cache list
-         add_cache_node_to_rear(list, node);
-     }
-
-     return 0;
- }
- /*
-  * evict_cache_node - evict a cache node when the cache list is full
-  *                    according to lru
-  *                    return -1 on error
-  */
- int evict_cache_node(cache_list_t* list) {
-
-     // check whether the list is NULL
-     if (list == NULL) {
-         return -1;
-     }
-     // check whether the list is empty
-     if (list -> head == NULL) {
-         return -1;
-     }
-
-     // multi-thread write lock
-     P(&(list -> write_mutex));
-
-     // get the evicted node
-     cache_node_t* evicted_node = list -> head;
-     // evict the node
-     list -> head = list -> head -> next;
-
-     // update the list rear if necessary
-     if (evicted_node == list -> rear) {
-         list -> rear = NULL;
-     }
-
-     // update the list length
-     list -> unassigned_length += evicted_node -> cache_length;
-
-     // write unlock
-     V(&(list -> write_mutex));
-
-     // free the space for the cache node
-     free_cache_node(evicted_node);
-
-     return 0;
-
- }
-
- /*
-  * delete_cache_node - delete a node from the cache list by the given id
-  *                     return the deleted node if found; return NULL if Not
-  */
- cache_node_t* delete_cache_node(cache_list_t* list, char* id) {
-
-     // check whether the list is empty
-     if (list == NULL) {
-         return NULL;
-     }
-
-     // multi-thread write lock
-     P(&(list -> write_mutex));
-
-     cache_node_t* pre_node = NULL;
-     cache_node_t* curr_node = list -> head;
-
-     // find the node and delete it
-     while (curr_node != NULL) {
-
-         // if found, delete the node and return
-         if (strcmp(curr_node -> cache_id, id) == 0) {
-             // update the head if necessary
-             if (curr_node == list -> head) {
-                 list -> head = curr_node -> next;
-             }
-
-             if (pre_node != NULL) {
-                 pre_node -> next = curr_node -> next;
-             }
-
-             // update the rear if necessary
-             if (curr_node == list -> rear) {
-                 list -> rear = pre_node;
-                 list -> rear -> next = NULL;
-             }
-
-             // update the unused length of the cache list
-             list -> unassigned_length += curr_node -> cache_length;
-             // unlock the cache List if found
-             V(&(list -> write_mutex));
-
-             return curr_node;
-         }
-
-         pre_node = curr_node;
-         curr_node = curr_node -> next;
-     }
-
-     // unlock the list
-     V(&(list -> write_mutex));
-     
-     return NULL;
-
- }
-
- /*
-  * free_cache_node - free the deleted/evicted node from the cache list
-  */
- void free_cache_node(cache_node_t* node) {
-
-     if (node == NULL) {
-         return;
-     }
-
-     Free(node -> cache_id);
-     Free(node -> cache_content);
-     Free(node);
- }
+ * add_cache_node_to_rear - add new cache node as the most recently used one
+ *                          of its shard, a node with the same id is replaced
+ *                          return -1 on error, CACHE_REJECTED if the policy
+ *                          does not admit it
+ */
+int add_cache_node_to_rear(cache_list_t* list, cache_node_t* node) {
+
+    cache_shard_t* shard;
+    cache_node_t* old_node;
+    cache_node_t* evicted = NULL;
+    cache_node_t* victim;
+    int rc = 0;
+
+    // check whether the list or node is NULL
+    if (list == NULL || node == NULL) {
+        return -1;
+    }
+    shard = get_shard(list, node -> hash);
+
+    // multi-thread write control on the shard only
+    pthread_rwlock_wrlock(&shard -> lock);
+
+    // a node larger than its shard can never fit, a reload may shrink it
+    if ((node -> cache_length) > shard -> capacity) {
+        pthread_rwlock_unlock(&shard -> lock);
+        return -1;
+    }
+
+    // the policy may keep the current nodes instead of the new one,
+    // a node with the same id stays cached then
+    if (!shard -> policy -> admit(shard, node)) {
+        pthread_rwlock_unlock(&shard -> lock);
+        metrics_count(COUNT_CACHE_REJECTIONS, 1);
+        // a rejected object may still be worth keeping on disk
+        demote_cache_node(list, node);
+        return CACHE_REJECTED;
+    }
+
+    // another thread may have cached the same id meanwhile
+    old_node = search_cache_node(shard, node -> cache_id, node -> hash);
+    if (old_node != NULL) {
+        shard -> policy -> remove(shard, old_node);
+        remove_node_from_bucket(shard, old_node);
+        unlink_node(shard, old_node);
+        shard -> unassigned_length += old_node -> cache_length;
+        free_cache_node(old_node);
+    }
+
+    // check whether the shard size is enough for the new node
+    while ((shard -> unassigned_length) < (node -> cache_length)) {
+        // if unassigend size is less than node size, evict by the policy,
+        // the victims are freed after the unlock as they may go to disk
+        if ((victim = evict_cache_node(shard)) == NULL) {
+            // the shard is empty and the node still does not fit
+            rc = -1;
+            break;
+        }
+        victim -> next = evicted;
+        evicted = victim;
+        metrics_count(COUNT_CACHE_EVICTIONS, 1);
+    }
+
+    // add node to the shard and index it
+    if (rc == 0) {
+        link_node_to_rear(shard, node);
+        insert_node_to_bucket(shard, node);
+        shard -> unassigned_length -= node -> cache_length;
+        shard -> policy -> insert(shard, node);
+    }
+
+    // unlock the shard
+    pthread_rwlock_unlock(&shard -> lock);
+
+    // move the victims to the disk tier, if any, and free them
+    while ((victim = evicted) != NULL) {
+        evicted = victim -> next;
+        demote_cache_node(list, victim);
+        free_cache_node(victim);
+    }
+
+    if (rc == 0) {
+        metrics_count(COUNT_CACHE_ADMISSIONS, 1);
+    }
+    return rc;
+}
+
+/*
+ * demote_cache_node - queue the object of a node leaving memory for the
+ *                     disk tier, unless it came from there and is still
+ *                     on disk; it is dropped if the writer lags behind
+ */
+static void demote_cache_node(cache_list_t* list, cache_node_t* node) {
+
+    if (list -> disk == NULL) {
+        return;
+    }
+    if (node -> on_disk &&
+        has_disk_object(list -> disk, node -> cache_id, node -> hash)) {
+        return;
+    }
+    if (queue_disk_object(list -> disk, node -> cache_id, node -> hash,
+                          node -> cache_object, 0) == 0) {
+        metrics_count(COUNT_CACHE_DEMOTIONS, 1);
+    }
+}
+
+/*
+ * read_cache_list - pin the cached object of the given id
+ *                   and mark the node referenced for lru
+ *                   the caller must release_cache_object when done
+ *                   return NULL if not found or on error
+ */
+cache_object_t* read_cache_list(cache_list_t* list, char* id) {
+
+    cache_shard_t* shard;
+    cache_node_t* node = NULL;
+    cache_object_t* object;
+    unsigned int hash;
+
+    // check whether the list is NULL
+    if (list == NULL) {
+        return NULL;
+    }
+    // check whether the given id is NULL
+    if (id == NULL) {
+        printf("cache id error.\n");
+        return NULL;
+    }
+
+    // readers of a shard share its lock
+    hash = hash_cache_id(id);
+    shard = get_shard(list, hash);
+    pthread_rwlock_rdlock(&shard -> lock);
+
+    // search for the node in the shard, the policy sees misses too
+    node = search_cache_node(shard, id, hash);
+    shard -> policy -> access(shard, hash, node);
+    metrics_count(COUNT_CACHE_LOOKUPS, 1);
+    if (node == NULL) {
+        // not found in memory, try the disk tier
+        pthread_rwlock_unlock(&shard -> lock);
+        return read_disk_tier(list, id, hash);
+    }
+
+    // found the node, pin its object so eviction cannot free it under us
+    object = node -> cache_object;
+    __atomic_add_fetch(&object -> refcnt, 1, __ATOMIC_RELAXED);
+
+    pthread_rwlock_unlock(&shard -> lock);
+
+    metrics_count(COUNT_CACHE_HITS, 1);
+    metrics_count(COUNT_CACHE_HIT_BYTES, object -> length);
+    return object;
+}
+
+/*
+ * read_disk_tier - on a miss in memory, copy the object of id out of the
+ *                  disk tier and promote it to memory
+ *                  return the pinned object, NULL if not on disk either
+ */
+static cache_object_t* read_disk_tier(cache_list_t* list, char* id,
+                                      unsigned int hash) {
+
+    cache_object_t* object;
+    cache_node_t* node;
+
+    if (list -> disk == NULL) {
+        return NULL;
+    }
+    if ((object = load_disk_object(list -> disk, id, hash)) == NULL) {
+        return NULL;
+    }
+
+    // the node takes over the reference of the load, the caller gets one more
+    if ((node = create_node_for_object(id, object)) == NULL) {
+        return object;
+    }
+    object = node -> cache_object;
+    __atomic_add_fetch(&object -> refcnt, 1, __ATOMIC_RELAXED);
+    node -> on_disk = 1;
+    if (add_cache_node_to_rear(list, node) != 0) {
+        free_cache_node(node);
+    }
+
+    metrics_count(COUNT_CACHE_HITS, 1);
+    metrics_count(COUNT_CACHE_DISK_HITS, 1);
+    metrics_count(COUNT_CACHE_HIT_BYTES, object -> length);
+    return object;
+}
+
+/*
+ * delete_cache_node - delete a node from the cache list by the given id
+ *                     return the deleted node if found; return NULL if Not
+ */
+cache_node_t* delete_cache_node(cache_list_t* list, char* id) {
+
+    cache_shard_t* shard;
+    cache_node_t* node;
+    unsigned int hash;
+
+    // check whether the list is empty
+    if (list == NULL || id == NULL) {
+        return NULL;
+    }
+
+    // multi-thread write lock
+    hash = hash_cache_id(id);
+    shard = get_shard(list, hash);
+    pthread_rwlock_wrlock(&shard -> lock);
+
+    if ((node = search_cache_node(shard, id, hash)) != NULL) {
+        shard -> policy -> remove(shard, node);
+        remove_node_from_bucket(shard, node);
+        unlink_node(shard, node);
+        // update the unused length of the shard
+        shard -> unassigned_length += node -> cache_length;
+    }
+
+    // unlock the shard
+    pthread_rwlock_unlock(&shard -> lock);
+
+    return node;
+
+}
+
+/*
+ * free_cache_node - free the deleted/evicted node from the cache list,
+ *                   the node shares its block with the object, so the
+ *                   block goes when the last reader releases the object
+ */
+void free_cache_node(cache_node_t* node) {
+
+    if (node == NULL) {
+        return;
+    }
+
+    release_cache_object(node -> cache_object);
+}
+
+/*
+ * release_cache_object - drop a reference taken by read_cache_list,
+ *                        the last reference frees the object
+ */
+void release_cache_object(cache_object_t* object) {
+
+    if (object == NULL) {
+        return;
+    }
+
+    if (__atomic_sub_fetch(&object -> refcnt, 1, __ATOMIC_ACQ_REL) == 0) {
+        free_segments(object -> segments);
+        slab_free(object -> block);
+    }
+}
+
+/*
+ * read_cache_object - copy up to n bytes of the object starting at offset
+ *                     return the number of bytes copied
+ */
+size_t read_cache_object(cache_object_t* object, size_t offset,
+                         char* buf, size_t n) {
+
+    cache_segment_t* segment;
+    size_t count = 0, chunk;
+
+    for (segment = object -> segments; segment && count < n;
+         segment = segment -> next) {
+        if (offset >= segment -> length) {
+            offset -= segment -> length;
+            continue;
+        }
+        chunk = segment -> length - offset;
+        if (chunk > n - count) {
+            chunk = n - count;
+        }
+        memcpy(buf + count, segment -> data + offset, chunk);
+        count += chunk;
+        offset = 0;
+    }
+    return count;
+}
+
+/*
+ * object_iov - describe up to length bytes of the object from offset with
+ *              at most iov_num iovecs pointing into its segments, for a
+ *              writev without copying them
+ *              return the number of iovecs used
+ */
+int object_iov(cache_object_t* object, size_t offset, size_t length,
+               struct iovec* iov, int iov_num) {
+
+    cache_segment_t* segment;
+    int count = 0;
+
+    for (segment = object -> segments;
+         segment && count < iov_num && length > 0;
+         segment = segment -> next) {
+        if (offset >= segment -> length) {
+            offset -= segment -> length;
+            continue;
+        }
+        iov[count].iov_base = segment -> data + offset;
+        iov[count].iov_len = segment -> length - offset;
+        if (iov[count].iov_len > length) {
+            iov[count].iov_len = length;
+        }
+        length -= iov[count].iov_len;
+        count++;
+        offset = 0;
+    }
+    return count;
+}
+
+/*
+ * begin_cache_fill - start filling an object for the given id, limited to
+ *                    the object size of list, unlimited if list is NULL
+ *                    return the fill, NULL on error
+ */
+cache_fill_t* begin_cache_fill(cache_list_t* list, char* cache_id) {
+
+    cache_fill_t* fill = (cache_fill_t *)malloc(sizeof(cache_fill_t));
+    if (fill == NULL) {
+        printf("Malloc cache fill error\n");
+        return NULL;
+    }
+
+    fill -> cache_id = (char *)malloc(strlen(cache_id) + 1);
+    fill -> object = (cache_object_t *)slab_alloc(sizeof(cache_object_t));
+    if (fill -> cache_id == NULL || fill -> object == NULL) {
+        printf("Malloc cache fill error\n");
+        free(fill -> cache_id);
+        slab_free(fill -> object);
+        free(fill);
+        return NULL;
+    }
+    strcpy(fill -> cache_id, cache_id);
+    fill -> object -> refcnt = 1;
+    fill -> object -> length = 0;
+    fill -> object -> segments = NULL;
+    fill -> object -> block = fill -> object;
+    fill -> object -> expires = 0;
+    fill -> object -> lifetime = 0;
+    fill -> object -> stale_window = 0;
+    fill -> object -> refreshing = 0;
+    fill -> tail = NULL;
+    fill -> max_object = (list != NULL) ?
+        __atomic_load_n(&list -> max_object, __ATOMIC_RELAXED) : (size_t)-1;
+
+    return fill;
+}
+
+/*
+ * append_cache_fill - append a chunk of the response to the object,
+ *                     the fill is dropped once it passes max_object
+ *                     return -1 if the object will not be cached
+ */
+int append_cache_fill(cache_fill_t* fill, char* buf, size_t length) {
+
+    cache_object_t* object = fill -> object;
+    cache_segment_t* segment;
+    size_t chunk;
+
+    if (object == NULL) {
+        return -1;
+    }
+
+    // too large to be cached, give the segments back right away
+    if (length >= fill -> max_object - object -> length) {
+        release_cache_object(object);
+        fill -> object = NULL;
+        fill -> tail = NULL;
+        return -1;
+    }
+
+    while (length > 0) {
+        // start a new segment when the last one is full
+        segment = fill -> tail;
+        if (segment == NULL || segment -> length == CACHE_SEGMENT_SIZE) {
+            if ((segment = alloc_segment()) == NULL) {
+                release_cache_object(object);
+                fill -> object = NULL;
+                fill -> tail = NULL;
+                return -1;
+            }
+            if (fill -> tail == NULL) {
+                object -> segments = segment;
+            } else {
+                fill -> tail -> next = segment;
+            }
+            fill -> tail = segment;
+        }
+
+        chunk = CACHE_SEGMENT_SIZE - segment -> length;
+        if (chunk > length) {
+            chunk = length;
+        }
+        memcpy(segment -> data + segment -> length, buf, chunk);
+        segment -> length += chunk;
+        object -> length += chunk;
+        buf += chunk;
+        length -= chunk;
+    }
+    return 0;
+}
+
+/*
+ * prepend_cache_fill - put up to a segment of bytes before the object,
+ *                      in a segment of their own
+ *                      return -1 if the object will not be cached
+ */
+int prepend_cache_fill(cache_fill_t* fill, char* buf, size_t length) {
+
+    cache_object_t* object = fill -> object;
+    cache_segment_t* segment;
+
+    if (object == NULL) {
+        return -1;
+    }
+
+    if (length > CACHE_SEGMENT_SIZE ||
+        length >= fill -> max_object - object -> length ||
+        (segment = alloc_segment()) == NULL) {
+        release_cache_object(object);
+        fill -> object = NULL;
+        fill -> tail = NULL;
+        return -1;
+    }
+
+    memcpy(segment -> data, buf, length);
+    segment -> length = length;
+    segment -> next = object -> segments;
+    object -> segments = segment;
+    object -> length += length;
+    if (fill -> tail == NULL) {
+        fill -> tail = segment;
+    }
+    return 0;
+}
+
+/*
+ * commit_cache_fill - add the filled object to the cache, the segments
+ *                     become the cached object as they are
+ *                     the fill is freed in any case
+ *                     return -1 on error, CACHE_REJECTED if the policy
+ *                     does not admit it
+ */
+int commit_cache_fill(cache_list_t* list, cache_fill_t* fill) {
+
+    cache_node_t* node = NULL;
+    int rc = -1;
+
+    if (fill -> object != NULL) {
+        node = create_node_for_object(fill -> cache_id, fill -> object);
+    }
+    if (node != NULL) {
+        fill -> object = NULL;
+        if ((rc = add_cache_node_to_rear(list, node)) != 0) {
+            free_cache_node(node);
+        }
+    }
+
+    abort_cache_fill(fill);
+    return rc;
+}
+
+/*
+ * abort_cache_fill - drop a fill that will not be cached
+ */
+void abort_cache_fill(cache_fill_t* fill) {
+
+    if (fill == NULL) {
+        return;
+    }
+    release_cache_object(fill -> object);
+    Free(fill -> cache_id);
+    Free(fill);
+}
+
+/*
+ * alloc_segment - take an empty segment from the slab arena
+ *                 return NULL on error
+ */
+static cache_segment_t* alloc_segment() {
+
+    cache_segment_t* segment;
+
+    segment = (cache_segment_t *)slab_alloc(CACHE_SEGMENT_BLOCK);
+    if (segment == NULL) {
+        printf("Malloc cache segment error\n");
+        return NULL;
+    }
+
+    segment -> length = 0;
+    segment -> embedded = 0;
+    segment -> next = NULL;
+    return segment;
+}
+
+/*
+ * free_segments - give a chain of segments back to the slab arena,
+ *                 a segment packed in a node block goes with the node
+ */
+static void free_segments(cache_segment_t* segment) {
+
+    cache_segment_t* next;
+
+    for (; segment != NULL; segment = next) {
+        next = segment -> next;
+        if (!segment -> embedded) {
+            slab_free(segment);
+        }
+    }
+}
+
+/*
+ * init_slab_arena - reserve an arena of capacity bytes and set up the size
+ *                   classes, called once before the threads start
+ */
+static void init_slab_arena(size_t capacity) {
+
+    cache_slab_class_t* class;
+    size_t size = CACHE_SLAB_MIN_SIZE;
+    size_t i;
+
+    if (slab_arena != NULL) {
+        return;
+    }
+
+    // classes grow geometrically, a full segment gets a class of its own
+    while (size <= CACHE_SLAB_PAGE_SIZE / 2 &&
+           slab_class_num < CACHE_SLAB_CLASS_NUM) {
+        if (slab_class_num > 0 &&
+            slab_classes[slab_class_num - 1].size < CACHE_SEGMENT_BLOCK &&
+            size > CACHE_SEGMENT_BLOCK) {
+            size = CACHE_SEGMENT_BLOCK;
+        }
+        class = &slab_classes[slab_class_num++];
+        class -> size = size;
+        class -> per_page = CACHE_SLAB_PAGE_SIZE / size;
+        class -> partial = NULL;
+        pthread_mutex_init(&class -> mutex, NULL);
+        size = SLAB_ALIGN((size_t)(size * CACHE_SLAB_GROWTH));
+    }
+
+    // a mapping of its own, its pages take memory once they are touched
+    slab_page_num = (capacity + CACHE_SLAB_PAGE_SIZE - 1) /
+                    CACHE_SLAB_PAGE_SIZE;
+    slab_arena = mmap(NULL, slab_page_num * CACHE_SLAB_PAGE_SIZE,
+                      PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                      -1, 0);
+    if (slab_arena == MAP_FAILED) {
+        unix_error("Mmap cache arena error");
+    }
+    // huge pages keep the tlb covering the arena as the capacity grows
+    madvise(slab_arena, slab_page_num * CACHE_SLAB_PAGE_SIZE, MADV_HUGEPAGE);
+    slab_pages = (cache_slab_page_t *)Calloc(slab_page_num,
+                                             sizeof(cache_slab_page_t));
+    // the lowest pages are handed out first
+    for (i = slab_page_num; i > 0; i--) {
+        slab_pages[i - 1].class_id = -1;
+        slab_pages[i - 1].next = slab_free_pages;
+        slab_free_pages = &slab_pages[i - 1];
+    }
+}
+
+/*
+ * slab_class_of - the smallest class holding size bytes
+ *                 return -1 if the block is larger than every class
+ */
+static int slab_class_of(size_t size) {
+
+    int i;
+
+    for (i = 0; i < slab_class_num; i++) {
+        if (slab_classes[i].size >= size) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * slab_charge - bytes a block of size takes in the arena
+ */
+static size_t slab_charge(size_t size) {
+
+    int class_id = slab_class_of(size);
+
+    return (class_id < 0) ? size : slab_classes[class_id].size;
+}
+
+/*
+ * slab_alloc - take a block of size bytes from its class, a class out of
+ *              free blocks takes a free page of the arena
+ *              return NULL on error
+ */
+static void* slab_alloc(size_t size) {
+
+    cache_slab_class_t* class;
+    cache_slab_page_t* page;
+    char *base, *block;
+    int class_id = slab_class_of(size);
+    unsigned int i;
+
+    if (slab_arena == NULL || class_id < 0) {
+        return malloc(size);
+    }
+    class = &slab_classes[class_id];
+
+    pthread_mutex_lock(&class -> mutex);
+    if ((page = class -> partial) == NULL) {
+        pthread_mutex_lock(&slab_arena_mutex);
+        if ((page = slab_free_pages) != NULL) {
+            slab_free_pages = page -> next;
+            slab_pages_used++;
+        }
+        pthread_mutex_unlock(&slab_arena_mutex);
+
+        if (page == NULL) {
+            // the arena is full, blocks in flight live outside it
+            pthread_mutex_unlock(&class -> mutex);
+            __atomic_add_fetch(&slab_outside, 1, __ATOMIC_RELAXED);
+            return malloc(size);
+        }
+
+        // split the page into free blocks of the class
+        base = slab_arena + (page - slab_pages) * CACHE_SLAB_PAGE_SIZE;
+        page -> class_id = class_id;
+        page -> used = 0;
+        page -> free = NULL;
+        for (i = class -> per_page; i > 0; i--) {
+            block = base + (i - 1) * class -> size;
+            *(void **)block = page -> free;
+            page -> free = block;
+        }
+        page -> prev = NULL;
+        page -> next = NULL;
+        class -> partial = page;
+    }
+
+    block = page -> free;
+    page -> free = *(void **)block;
+    page -> used++;
+    if (page -> free == NULL) {
+        // full, no longer a candidate
+        class -> partial = page -> next;
+        if (page -> next != NULL) {
+            page -> next -> prev = NULL;
+        }
+    }
+    pthread_mutex_unlock(&class -> mutex);
+
+    return block;
+}
+
+/*
+ * slab_free - give a block back to its page, a page left without blocks
+ *             goes back to the arena for any class
+ */
+static void slab_free(void* block) {
+
+    cache_slab_class_t* class;
+    cache_slab_page_t* page;
+    int was_full;
+
+    if (block == NULL) {
+        return;
+    }
+    if (slab_arena == NULL || (char *)block < slab_arena ||
+        (char *)block >= slab_arena + slab_page_num * CACHE_SLAB_PAGE_SIZE) {
+        free(block);
+        return;
+    }
+
+    page = &slab_pages[((char *)block - slab_arena) / CACHE_SLAB_PAGE_SIZE];
+    class = &slab_classes[page -> class_id];
+
+    pthread_mutex_lock(&class -> mutex);
+    was_full = (page -> free == NULL);
+    *(void **)block = page -> free;
+    page -> free = block;
+    page -> used--;
+
+    if (page -> used == 0) {
+        // unlink the empty page from its class and free it
+        if (!was_full) {
+            if (page -> prev != NULL) {
+                page -> prev -> next = page -> next;
+            } else {
+                class -> partial = page -> next;
+            }
+            if (page -> next != NULL) {
+                page -> next -> prev = page -> prev;
+            }
+        }
+        page -> class_id = -1;
+        pthread_mutex_lock(&slab_arena_mutex);
+        page -> next = slab_free_pages;
+        slab_free_pages = page;
+        slab_pages_used--;
+        pthread_mutex_unlock(&slab_arena_mutex);
+    } else if (was_full) {
+        // it has a free block again
+        page -> prev = NULL;
+        page -> next = class -> partial;
+        if (class -> partial != NULL) {
+            class -> partial -> prev = page;
+        }
+        class -> partial = page;
+    }
+    pthread_mutex_unlock(&class -> mutex);
+}
+
+/*
+ * count_cache_miss_bytes - count bytes served from the servers,
+ *                          the other side of the byte hit ratio
+ */
+void count_cache_miss_bytes(cache_list_t* list, size_t length) {
+
+    metrics_count(COUNT_CACHE_MISS_BYTES, length);
+}
+
+/*
+ * get_cache_stats - take a snapshot of the counters of the cache
+ */
+void get_cache_stats(cache_list_t* list, cache_stats_t* stats) {
+
+    stats -> lookups = metrics_total(COUNT_CACHE_LOOKUPS);
+    stats -> hits = metrics_total(COUNT_CACHE_HITS);
+    stats -> hit_bytes = metrics_total(COUNT_CACHE_HIT_BYTES);
+    stats -> miss_bytes = metrics_total(COUNT_CACHE_MISS_BYTES);
+    stats -> admissions = metrics_total(COUNT_CACHE_ADMISSIONS);
+    stats -> rejections = metrics_total(COUNT_CACHE_REJECTIONS);
+    stats -> evictions = metrics_total(COUNT_CACHE_EVICTIONS);
+    stats -> disk_hits = metrics_total(COUNT_CACHE_DISK_HITS);
+    stats -> demotions = metrics_total(COUNT_CACHE_DEMOTIONS);
+}
+
+/*
+ * print_cache_stats - print the hit ratio and byte hit ratio of the cache
+ */
+void print_cache_stats(cache_list_t* list) {
+
+    cache_stats_t stats;
+    unsigned long bytes;
+
+    get_cache_stats(list, &stats);
+    bytes = stats.hit_bytes + stats.miss_bytes;
+
+    printf("cache policy %s: %lu lookups, %lu hits (%.2f%%), "
+           "%lu of %lu bytes from cache (%.2f%%)\n",
+           list -> policy -> name, stats.lookups, stats.hits,
+           stats.lookups ? 100.0 * stats.hits / stats.lookups : 0.0,
+           stats.hit_bytes, bytes,
+           bytes ? 100.0 * stats.hit_bytes / bytes : 0.0);
+    printf("cache policy %s: %lu admitted, %lu rejected, %lu evicted\n",
+           list -> policy -> name, stats.admissions, stats.rejections,
+           stats.evictions);
+    printf("cache policy %s: %zu of %zu bytes, objects up to %zu bytes\n",
+           list -> policy -> name, cache_used_bytes(list), list -> capacity,
+           list -> max_object);
+    printf("cache policy %s: %zu of %zu arena pages used, "
+           "%lu blocks allocated outside the arena\n",
+           list -> policy -> name,
+           __atomic_load_n(&slab_pages_used, __ATOMIC_RELAXED),
+           slab_page_num,
+           __atomic_load_n(&slab_outside, __ATOMIC_RELAXED));
+    if (list -> disk != NULL) {
+        printf("cache policy %s: %lu hits from disk, %lu demoted to disk\n",
+               list -> policy -> name, stats.disk_hits, stats.demotions);
+    }
+    fflush(stdout);
+}
+
+/*
+ * hash_cache_id - FNV-1a hash of the cache id string
+ */
+unsigned int hash_cache_id(char* id) {
+
+    unsigned int hash = 2166136261u;
+
+    while (*id) {
+        hash ^= (unsigned char)*id++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * get_shard - the shard owning the ids with the given hash,
+ *             the high bits pick the shard, the low ones the bucket
+ */
+static cache_shard_t* get_shard(cache_list_t* list, unsigned int hash) {
+
+    return &list -> shards[(hash >> 16) % CACHE_SHARD_NUM];
+}
+
+/*
+ * search_cache_node - search node in the shard according to given id
+ *                     the caller must hold the shard lock
+ *                     return cache node if found; return NULL if not
+ */
+static cache_node_t* search_cache_node(cache_shard_t* shard, char* id,
+                                       unsigned int hash) {
+
+    cache_node_t* node;
+
+    // only walk the bucket the id hashes to
+    node = shard -> buckets[hash & (shard -> bucket_num - 1)];
+    while (node != NULL) {
+        if (node -> hash == hash && strcmp(node -> cache_id, id) == 0) {
+            return node;
+        }
+        node = node -> hnext;
+    }
+    return NULL;
+
+}
+
+/*
+ * link_node_to_rear - append node to the rear of the recency list
+ */
+static void link_node_to_rear(cache_shard_t* shard, cache_node_t* node) {
+
+    node -> prev = shard -> rear;
+    node -> next = NULL;
+    if (shard -> rear == NULL) {
+        shard -> head = node;
+    } else {
+        shard -> rear -> next = node;
+    }
+    shard -> rear = node;
+}
+
+/*
+ * unlink_node - take node out of the recency list
+ */
+static void unlink_node(cache_shard_t* shard, cache_node_t* node) {
+
+    if (node -> prev == NULL) {
+        shard -> head = node -> next;
+    } else {
+        node -> prev -> next = node -> next;
+    }
+    if (node -> next == NULL) {
+        shard -> rear = node -> prev;
+    } else {
+        node -> next -> prev = node -> prev;
+    }
+    node -> prev = NULL;
+    node -> next = NULL;
+}
+
+/*
+ * insert_node_to_bucket - index node in the hash table
+ */
+static void insert_node_to_bucket(cache_shard_t* shard, cache_node_t* node) {
+
+    unsigned int index;
+
+    // keep the chains short, at most one node per bucket on average
+    if (shard -> node_num >= shard -> bucket_num) {
+        grow_buckets(shard);
+    }
+
+    index = node -> hash & (shard -> bucket_num - 1);
+    node -> hnext = shard -> buckets[index];
+    shard -> buckets[index] = node;
+    shard -> node_num++;
+}
+
+/*
+ * remove_node_from_bucket - drop node from the hash table
+ */
+static void remove_node_from_bucket(cache_shard_t* shard, cache_node_t* node) {
+
+    cache_node_t** link;
+
+    link = &shard -> buckets[node -> hash & (shard -> bucket_num - 1)];
+    while (*link != NULL) {
+        if (*link == node) {
+            *link = node -> hnext;
+            node -> hnext = NULL;
+            shard -> node_num--;
+            return;
+        }
+        link = &(*link) -> hnext;
+    }
+}
+
+/*
+ * grow_buckets - double the hash table and rehash every node
+ */
+static void grow_buckets(cache_shard_t* shard) {
+
+    unsigned int new_num = shard -> bucket_num * 2;
+    cache_node_t** new_buckets;
+    cache_node_t *node, *next;
+    unsigned int i, index;
+
+    // keep the old table if there is no memory for a larger one
+    new_buckets = (cache_node_t **)calloc(new_num, sizeof(cache_node_t *));
+    if (new_buckets == NULL) {
+        return;
+    }
+
+    for (i = 0; i < shard -> bucket_num; i++) {
+        for (node = shard -> buckets[i]; node != NULL; node = next) {
+            next = node -> hnext;
+            index = node -> hash & (new_num - 1);
+            node -> hnext = new_buckets[index];
+            new_buckets[index] = node;
+        }
+    }
+
+    Free(shard -> buckets);
+    shard -> buckets = new_buckets;
+    shard -> bucket_num = new_num;
+}
+
+/*
+ * evict_cache_node - unlink the least recently used node of the shard,
+ *                    a referenced head node gets a second chance
+ *                    and moves to the rear instead
+ *                    return the node, or NULL if the shard is empty
+ */
+static cache_node_t* evict_cache_node(cache_shard_t* shard) {
+
+    cache_node_t* evicted_node = shard -> policy -> victim(shard);
+
+    if (evicted_node == NULL) {
+        return NULL;
+    }
+
+    shard -> policy -> remove(shard, evicted_node);
+    remove_node_from_bucket(shard, evicted_node);
+    unlink_node(shard, evicted_node);
+    shard -> unassigned_length += evicted_node -> cache_length;
+
+    return evicted_node;
+}
+
+/*
+ * find_policy - look up a replacement policy by name, NULL for the default
+ *               return NULL if there is no such policy
+ */
+static const cache_policy_t* find_policy(char* name) {
+
+    int i;
+
+    if (name == NULL) {
+        return &cache_policies[0];
+    }
+    for (i = 0; i < sizeof(cache_policies) / sizeof(cache_policy_t); i++) {
+        if (strcmp(cache_policies[i].name, name) == 0) {
+            return &cache_policies[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * lru_init - lru keeps no state besides the recency list
+ */
+static void lru_init(cache_shard_t* shard) {
+
+    shard -> sketch = NULL;
+    shard -> heap = NULL;
+}
+
+/*
+ * lru_access - mark the node referenced,
+ *              promotion is deferred to eviction
+ */
+static void lru_access(cache_shard_t* shard, unsigned int hash,
+                       cache_node_t* node) {
+
+    if (node != NULL) {
+        __atomic_store_n(&node -> referenced, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * lru_admit - every node is admitted
+ */
+static int lru_admit(cache_shard_t* shard, cache_node_t* node) {
+
+    return 1;
+}
+
+/*
+ * lru_insert - the node is already the most recently used one
+ */
+static void lru_insert(cache_shard_t* shard, cache_node_t* node) {
+
+    return;
+}
+
+/*
+ * lru_remove - the recency list is all the state, nothing else to drop
+ */
+static void lru_remove(cache_shard_t* shard, cache_node_t* node) {
+
+    return;
+}
+
+/*
+ * lru_victim - the least recently used node, referenced head nodes get a
+ *              second chance at the rear first (clock)
+ */
+static cache_node_t* lru_victim(cache_shard_t* shard) {
+
+    cache_node_t* evicted_node;
+
+    // every node is skipped at most once, as its flag gets cleared
+    while ((evicted_node = shard -> head) != NULL &&
+           evicted_node -> referenced) {
+        evicted_node -> referenced = 0;
+        if (evicted_node == shard -> rear) {
+            break;
+        }
+        unlink_node(shard, evicted_node);
+        link_node_to_rear(shard, evicted_node);
+    }
+
+    return evicted_node;
+}
+
+/*
+ * tinylfu_init - allocate the frequency sketch of the shard
+ */
+static void tinylfu_init(cache_shard_t* shard) {
+
+    shard -> sketch = (unsigned char *)Calloc(CACHE_SKETCH_DEPTH *
+                                              CACHE_SKETCH_WIDTH, 1);
+    shard -> heap = NULL;
+    shard -> sketch_additions = 0;
+}
+
+/*
+ * tinylfu_access - count the request of every id, hit or miss,
+ *                  in the sketch; a hit is also marked for the clock
+ */
+static void tinylfu_access(cache_shard_t* shard, unsigned int hash,
+                           cache_node_t* node) {
+
+    unsigned char* counter;
+    int i;
+
+    for (i = 0; i < CACHE_SKETCH_DEPTH; i++) {
+        counter = sketch_counter(shard, hash, i);
+        // readers race here, a counter may pass the max by a few
+        if (__atomic_load_n(counter, __ATOMIC_RELAXED) < CACHE_SKETCH_MAX) {
+            __atomic_add_fetch(counter, 1, __ATOMIC_RELAXED);
+        }
+    }
+    __atomic_add_fetch(&shard -> sketch_additions, 1, __ATOMIC_RELAXED);
+
+    lru_access(shard, hash, node);
+}
+
+/*
+ * tinylfu_admit - admit the node if it fits, or if it was requested more
+ *                 often than every node the clock would evict for it;
+ *                 a node with the same id is replaced, so it frees its
+ *                 bytes without competing
+ */
+static int tinylfu_admit(cache_shard_t* shard, cache_node_t* node) {
+
+    unsigned int frequency = sketch_estimate(shard, node -> hash);
+    size_t freed = shard -> unassigned_length;
+    cache_node_t* victim;
+    cache_node_t* old_node;
+
+    old_node = search_cache_node(shard, node -> cache_id, node -> hash);
+    if (old_node != NULL) {
+        freed += old_node -> cache_length;
+    }
+
+    for (victim = shard -> head; victim && freed < node -> cache_length;
+         victim = victim -> next) {
+        if (victim == old_node) {
+            continue;
+        }
+        if (sketch_estimate(shard, victim -> hash) >= frequency) {
+            return 0;
+        }
+        freed += victim -> cache_length;
+    }
+    return 1;
+}
+
+/*
+ * tinylfu_insert - age the sketch, halving every counter once enough
+ *                  requests were counted so that old popularity fades
+ */
+static void tinylfu_insert(cache_shard_t* shard, cache_node_t* node) {
+
+    int i;
+
+    if (shard -> sketch_additions < CACHE_SKETCH_SAMPLE) {
+        return;
+    }
+    // the write lock keeps the readers out of the sketch
+    for (i = 0; i < CACHE_SKETCH_DEPTH * CACHE_SKETCH_WIDTH; i++) {
+        shard -> sketch[i] >>= 1;
+    }
+    shard -> sketch_additions /= 2;
+}
+
+/*
+ * sketch_counter - the counter of hash in the given row of the sketch
+ */
+static unsigned char* sketch_counter(cache_shard_t* shard, unsigned int hash,
+                                     int row) {
+
+    // a different odd multiplier per row gives independent indices
+    unsigned int h = hash * (0x9E3779B1u + 2 * row);
+
+    return &shard -> sketch[row * CACHE_SKETCH_WIDTH +
+                            ((h ^ (h >> 16)) & (CACHE_SKETCH_WIDTH - 1))];
+}
+
+/*
+ * sketch_estimate - the estimated request count of hash, the smallest
+ *                   of its counters
+ */
+static unsigned int sketch_estimate(cache_shard_t* shard, unsigned int hash) {
+
+    unsigned int estimate = CACHE_SKETCH_MAX + 1;
+    unsigned int count;
+    int i;
+
+    for (i = 0; i < CACHE_SKETCH_DEPTH; i++) {
+        count = __atomic_load_n(sketch_counter(shard, hash, i),
+                                __ATOMIC_RELAXED);
+        if (count < estimate) {
+            estimate = count;
+        }
+    }
+    return estimate;
+}
+
+/*
+ * gdsf_init - allocate the heap of the shard and add the nodes cached
+ *             under the previous policy, keyed on their current counters
+ */
+static void gdsf_init(cache_shard_t* shard) {
+
+    cache_node_t* node;
+
+    shard -> sketch = NULL;
+    shard -> heap_size = CACHE_GDSF_HEAP_SIZE;
+    shard -> heap_num = 0;
+    shard -> heap = (cache_node_t **)Malloc(shard -> heap_size *
+                                            sizeof(cache_node_t *));
+    for (node = shard -> head; node; node = node -> next) {
+        node -> priority = gdsf_priority(node);
+        heap_push(shard, node);
+    }
+}
+
+/*
+ * gdsf_access - count the hit and move the node to the current clock
+ */
+static void gdsf_access(cache_shard_t* shard, unsigned int hash,
+                        cache_node_t* node) {
+
+    if (node != NULL) {
+        __atomic_add_fetch(&node -> frequency, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&node -> inflation,
+                         __atomic_load_n(&shard -> inflation, __ATOMIC_RELAXED),
+                         __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * gdsf_insert - a new node starts at the current clock with one access
+ */
+static void gdsf_insert(cache_shard_t* shard, cache_node_t* node) {
+
+    node -> frequency = 1;
+    node -> inflation = shard -> inflation;
+    node -> priority = gdsf_priority(node);
+    heap_push(shard, node);
+}
+
+/*
+ * gdsf_remove - take the node out of the heap, the last node fills its slot
+ */
+static void gdsf_remove(cache_shard_t* shard, cache_node_t* node) {
+
+    unsigned int i = node -> heap_index;
+    cache_node_t* last = shard -> heap[--shard -> heap_num];
+
+    if (last == node) {
+        return;
+    }
+    shard -> heap[i] = last;
+    last -> heap_index = i;
+    if (i > 0 && last -> priority < shard -> heap[(i - 1) / 2] -> priority) {
+        heap_sift_up(shard, i);
+    } else {
+        heap_sift_down(shard, i);
+    }
+}
+
+/*
+ * gdsf_victim - the node with the lowest clock + frequency / size,
+ *               the clock then moves to its priority so that nodes not
+ *               accessed for long age out;
+ *               readers only raise the priorities of the nodes, so a top
+ *               whose key is current is the lowest, a stale one is
+ *               pushed down with its new key
+ */
+static cache_node_t* gdsf_victim(cache_shard_t* shard) {
+
+    cache_node_t* victim;
+    unsigned long long priority;
+
+    while (shard -> heap_num > 0) {
+        victim = shard -> heap[0];
+        priority = gdsf_priority(victim);
+        if (priority <= victim -> priority) {
+            shard -> inflation = victim -> priority;
+            return victim;
+        }
+        victim -> priority = priority;
+        heap_sift_down(shard, 0);
+    }
+    return NULL;
+}
+
+/*
+ * gdsf_priority - the current clock + frequency / size of the node
+ */
+static unsigned long long gdsf_priority(cache_node_t* node) {
+
+    return node -> inflation + node -> frequency * CACHE_GDSF_SCALE /
+           (node -> cache_length ? node -> cache_length : 1);
+}
+
+/*
+ * heap_push - add the node to the heap of the shard, doubling it when full
+ */
+static void heap_push(cache_shard_t* shard, cache_node_t* node) {
+
+    if (shard -> heap_num == shard -> heap_size) {
+        shard -> heap_size *= 2;
+        shard -> heap = (cache_node_t **)Realloc(shard -> heap,
+                            shard -> heap_size * sizeof(cache_node_t *));
+    }
+    node -> heap_index = shard -> heap_num;
+    shard -> heap[shard -> heap_num++] = node;
+    heap_sift_up(shard, node -> heap_index);
+}
+
+/*
+ * heap_sift_up - move the node at i towards the root past larger keys
+ */
+static void heap_sift_up(cache_shard_t* shard, unsigned int i) {
+
+    cache_node_t** heap = shard -> heap;
+    cache_node_t* node = heap[i];
+    unsigned int parent;
+
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (heap[parent] -> priority <= node -> priority) {
+            break;
+        }
+        heap[i] = heap[parent];
+        heap[i] -> heap_index = i;
+        i = parent;
+    }
+    heap[i] = node;
+    node -> heap_index = i;
+}
+
+/*
+ * heap_sift_down - move the node at i towards the leaves past smaller keys
+ */
+static void heap_sift_down(cache_shard_t* shard, unsigned int i) {
+
+    cache_node_t** heap = shard -> heap;
+    cache_node_t* node = heap[i];
+    unsigned int child;
+
+    while ((child = 2 * i + 1) < shard -> heap_num) {
+        if (child + 1 < shard -> heap_num &&
+            heap[child + 1] -> priority < heap[child] -> priority) {
+            child++;
+        }
+        if (node -> priority <= heap[child] -> priority) {
+            break;
+        }
+        heap[i] = heap[child];
+        heap[i] -> heap_index = i;
+        i = child;
+    }
+    heap[i] = node;
+    node -> heap_index = i;
+}
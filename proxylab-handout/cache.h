@@ -4,33 +4,227 @@
  *
  * cache.h - prototypes and definitions for cache.c
  */
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <sys/uio.h>
 #include "csapp.h"
 
-#define MAX_CACHE_SIZE 1049000
-#define MAX_OBJECT_SIZE 102400
+/* Default cache capacity and object size limit, both set at startup */
+#define DEFAULT_CACHE_SIZE 1049000
+#define DEFAULT_OBJECT_SIZE 102400
+
+/* Initial number of hash buckets per shard, always a power of 2 */
+#define CACHE_BUCKET_NUM 64
+
+/*
+ * Number of cache shards, every shard owns an equal part of the capacity
+ * which must still hold an object of the size limit
+ */
+#define CACHE_SHARD_NUM 8
+
+/*
+ * Cached objects are carved from an arena covering the capacity, reserved
+ * at startup and only backed by memory as its pages are first used, every
+ * page is split into blocks of one size class; classes grow by
+ * CACHE_SLAB_GROWTH from CACHE_SLAB_MIN_SIZE up to half a page, a larger
+ * block or one that finds the arena full is malloc'ed
+ */
+#define CACHE_SLAB_PAGE_SIZE 65536
+#define CACHE_SLAB_MIN_SIZE 64
+#define CACHE_SLAB_GROWTH 1.25
+#define CACHE_SLAB_CLASS_NUM 40
+
+/*
+ * Size of the block of one full segment, always a size class, the data
+ * of a segment is what is left after its header
+ */
+#define CACHE_SEGMENT_BLOCK 16384
+#define CACHE_SEGMENT_SIZE (CACHE_SEGMENT_BLOCK - sizeof(cache_segment_t))
+
+/* Defined a struct representing one page of the slab arena */
+typedef struct cache_slab_page_t {
+    int class_id;                       // -1 while the page is free
+    unsigned int used;                  // blocks handed out
+    void* free;                         // free blocks of the page
+    struct cache_slab_page_t* prev;     // pages of the class with free
+    struct cache_slab_page_t* next;     // blocks, or the free pages
+} cache_slab_page_t;
+
+/* Defined a struct representing one size class of the slab arena */
+typedef struct cache_slab_class_t {
+    unsigned int size;
+    unsigned int per_page;
+    cache_slab_page_t* partial;         // pages with free blocks
+    pthread_mutex_t mutex;
+} cache_slab_class_t;
+
+/*
+ * Defined a struct representing one segment of a cached object,
+ * the last segment of a committed object lives in the block of its node
+ */
+typedef struct cache_segment_t {
+    unsigned int length;
+    unsigned int embedded;              // not a block of its own
+    struct cache_segment_t* next;
+    char data[];
+} cache_segment_t;
+
+/*
+ * Defined a struct representing an immutable cached object, shared by the
+ * node owning it and every reader that pinned it; freed with the last ref
+ */
+typedef struct cache_object_t {
+    int refcnt;
+    size_t length;
+    cache_segment_t* segments;
+    void* block;                    // allocation freed with the last ref
+    time_t expires;                 // fresh until then
+    int lifetime;                   // seconds of freshness, kept on a 304
+    int stale_window;               // seconds served stale while refreshed
+    int refreshing;                 // a background revalidation runs
+} cache_object_t;
+
+/*
+ * Defined a struct representing an object being filled from the server,
+ * the object is NULL once the fill went over max_object
+ */
+typedef struct cache_fill_t {
+    char* cache_id;
+    cache_object_t* object;
+    cache_segment_t* tail;
+    size_t max_object;              // size limit of the object
+} cache_fill_t;
+
+/* Count-min sketch of the id frequencies kept by the tinylfu policy */
+#define CACHE_SKETCH_DEPTH 4
+#define CACHE_SKETCH_WIDTH 4096                      // power of 2
+#define CACHE_SKETCH_MAX 15                          // 4-bit counters
+#define CACHE_SKETCH_SAMPLE (10 * CACHE_SKETCH_WIDTH) // halve after that
+
+/* Fixed point scale of the gdsf priorities */
+#define CACHE_GDSF_SCALE 1000000ULL
+#define CACHE_GDSF_HEAP_SIZE 64     // initial slots of a shard heap
+
+/* add_cache_node_to_rear result when the policy does not admit the node */
+#define CACHE_REJECTED 1
 
 /* Defined a struct representing the cache node in the cache list */
 typedef struct cache_node_t {
     char* cache_id;
-    char* cache_content;
-    unsigned int cache_length;
-    struct cache_node_t* next;
+    cache_object_t* cache_object;   // the node holds one reference
+    size_t cache_length;            // bytes taken, headers included
+    unsigned int hash;
+    int referenced;                 // set by readers, second chance on evict
+    unsigned int frequency;         // hits counted by readers
+    unsigned long long inflation;   // gdsf clock at the last access
+    unsigned long long priority;    // gdsf key in the heap, may lag behind
+    unsigned int heap_index;        // gdsf position in the heap
+    int on_disk;                    // promoted from the disk tier
+    struct cache_node_t* prev;      // recency list, towards the head
+    struct cache_node_t* next;      // recency list, towards the rear
+    struct cache_node_t* hnext;     // next node in the same hash bucket
 } cache_node_t;
 
-typedef struct cache_list_t {
+struct cache_shard_t;
+
+/*
+ * Defined a struct representing a replacement policy:
+ * init sets up the per-shard state of the policy, access is called on
+ * every lookup with the shard read lock held, node is NULL on a miss,
+ * so it may only update its counters atomically;
+ * admit, insert, remove and victim are called with the shard write lock
+ * held, remove when a node leaves the shard (the victim included)
+ */
+typedef struct cache_policy_t {
+    char* name;
+    void (*init)(struct cache_shard_t* shard);
+    void (*access)(struct cache_shard_t* shard, unsigned int hash,
+                   cache_node_t* node);
+    int (*admit)(struct cache_shard_t* shard, cache_node_t* node);
+    void (*insert)(struct cache_shard_t* shard, cache_node_t* node);
+    void (*remove)(struct cache_shard_t* shard, cache_node_t* node);
+    cache_node_t* (*victim)(struct cache_shard_t* shard);
+} cache_policy_t;
+
+/*
+ * Defined a struct representing one cache shard:
+ * head is the least recently used node, rear the most recently used one,
+ * buckets index every node of the shard by the hash of its id
+ */
+typedef struct cache_shard_t {
     struct cache_node_t* head;
     struct cache_node_t* rear;
-    unsigned int unassigned_length;
-    sem_t read_mutex, write_mutex;
+    struct cache_node_t** buckets;
+    unsigned int bucket_num;
+    unsigned int node_num;
+    size_t capacity;                    // byte budget of the shard
+    size_t unassigned_length;
+    const cache_policy_t* policy;
+    unsigned char* sketch;              // tinylfu only
+    unsigned int sketch_additions;
+    unsigned long long inflation;       // gdsf only
+    struct cache_node_t** heap;         // gdsf only, min-heap on priority
+    unsigned int heap_num;
+    unsigned int heap_size;
+    pthread_rwlock_t lock;
+} cache_shard_t;
+
+/*
+ * Defined a struct representing a snapshot of the counters of the cache,
+ * every thread counts into its own metrics block (metrics.c)
+ */
+typedef struct cache_stats_t {
+    unsigned long lookups;
+    unsigned long hits;
+    unsigned long hit_bytes;
+    unsigned long miss_bytes;       // bytes served from the servers
+    unsigned long admissions;
+    unsigned long rejections;
+    unsigned long evictions;
+    unsigned long disk_hits;        // misses in memory promoted from disk
+    unsigned long demotions;        // objects written to the disk tier
+} cache_stats_t;
+
+struct disk_cache_t;
+
+/* Defined a struct representing the cache, split by hash of the id */
+typedef struct cache_list_t {
+    cache_shard_t shards[CACHE_SHARD_NUM];
+    const cache_policy_t* policy;
+    size_t capacity;                // bytes of every shard together
+    size_t max_object;              // larger objects are never cached
+    struct disk_cache_t* disk;      // second tier, NULL if none
 } cache_list_t;
 
 /* Defined function controling the proxy cache */
-cache_list_t* init_cache_list();
+cache_list_t* init_cache_list(char* policy, size_t capacity,
+                              size_t max_object);
+void attach_disk_cache(cache_list_t* list, struct disk_cache_t* disk);
+int set_cache_policy(cache_list_t* list, char* policy);
+int resize_cache_list(cache_list_t* list, size_t capacity,
+                      size_t max_object);
+size_t cache_used_bytes(cache_list_t* list);
+int snapshot_cache_list(cache_list_t* list, struct disk_cache_t* disk);
 cache_node_t* create_cache_node(char* cache_id, char* cache_content,
-                                unsigned int length, cache_node_t* next);
+                                size_t length, cache_node_t* next);
 int add_cache_node_to_rear(cache_list_t* list, cache_node_t* node);
-cache_node_t* search_cache_node(cache_list_t* list, char* id);
-int read_cache_list(cache_list_t* list, char* id, char* content);
-int evict_cache_node(cache_list_t* list);
+cache_object_t* read_cache_list(cache_list_t* list, char* id);
 cache_node_t* delete_cache_node(cache_list_t* list, char* id);
 void free_cache_node(cache_node_t* node);
+void release_cache_object(cache_object_t* object);
+size_t read_cache_object(cache_object_t* object, size_t offset,
+                         char* buf, size_t n);
+int object_iov(cache_object_t* object, size_t offset, size_t length,
+               struct iovec* iov, int iov_num);
+cache_fill_t* begin_cache_fill(cache_list_t* list, char* cache_id);
+int append_cache_fill(cache_fill_t* fill, char* buf, size_t length);
+int prepend_cache_fill(cache_fill_t* fill, char* buf, size_t length);
+int commit_cache_fill(cache_list_t* list, cache_fill_t* fill);
+void abort_cache_fill(cache_fill_t* fill);
+unsigned int hash_cache_id(char* id);
+void count_cache_miss_bytes(cache_list_t* list, size_t length);
+void get_cache_stats(cache_list_t* list, cache_stats_t* stats);
+void print_cache_stats(cache_list_t* list);
+
+#endif /* __CACHE_H__ */
@@ -0,0 +1,185 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * cachebench.c - micro benchmark of cache hits as the capacity grows.
+ * Implementation idea:
+ * 1. for every capacity from BENCH_MIN_CAPACITY (or the first one with
+ *    room for a few objects in every shard) up to the one given, a
+ *    child process sets up a cache of that capacity (the slab arena is
+ *    reserved once per process), so every run starts from a fresh heap
+ * 2. the cache is filled with objects of one size until every shard has
+ *    evicted some, then the ids still cached are collected
+ * 3. random cached ids are looked up the way the proxy serves a hit:
+ *    read_cache_list pins the object, object_iov gathers its segments
+ *    for writev and the object is released; every hit is timed and goes
+ *    into a histogram of metrics.c counting nanoseconds
+ * 4. a flat hit latency shows that lookups stay O(1) as the cache holds
+ *    more objects; what grows is only the cost of cache misses of the
+ *    cpu when the index no longer fits in its caches
+ *
+ * usage: ./cachebench [max-capacity] [object-size] [hits]
+ *        sizes take a K, M or G suffix
+ */
+#include <time.h>
+#include "csapp.h"
+#include "cache.h"
+#include "metrics.h"
+#include "config.h"
+
+/* Smallest capacity benched, every further one is BENCH_STEP times more */
+#define BENCH_MIN_CAPACITY (1UL << 20)
+#define BENCH_STEP 4
+
+/* Objects every shard of the smallest capacity has room for */
+#define BENCH_SHARD_OBJECTS 4
+
+/* Defaults of the command line */
+#define BENCH_MAX_CAPACITY (1UL << 30)
+#define BENCH_OBJECT_SIZE (16UL << 10)
+#define BENCH_HITS 1000000
+
+/* Evictions that make every shard full */
+#define BENCH_FULL_EVICTIONS (CACHE_SHARD_NUM * BENCH_SHARD_OBJECTS)
+
+/* Bytes of one cache id, every id is printed into a slot of that size */
+#define BENCH_ID_SIZE 48
+
+/* the result of every hit feeds this, so that no hit is optimized out */
+static volatile size_t bench_sink;
+
+static long now_ns();
+static void run_capacity(size_t capacity, size_t object_size, long hits);
+static unsigned long long next_random(unsigned long long* seed);
+
+int main(int argc, char **argv) {
+
+    size_t max_capacity = BENCH_MAX_CAPACITY;
+    size_t object_size = BENCH_OBJECT_SIZE;
+    size_t capacity;
+    long hits = BENCH_HITS;
+    pid_t pid;
+
+    if ((argc > 1 && parse_size(argv[1], &max_capacity) == -1) ||
+        (argc > 2 && parse_size(argv[2], &object_size) == -1) ||
+        (argc > 3 && (hits = atol(argv[3])) <= 0) || object_size == 0) {
+        fprintf(stderr, "usage: %s [max-capacity] [object-size] [hits]\n",
+                argv[0]);
+        exit(1);
+    }
+
+    printf("objects of %zu bytes, %ld hits per capacity, "
+           "latencies in ns\n", object_size, hits);
+    printf("%12s %10s %10s %8s %8s %8s %8s %8s\n", "capacity", "objects",
+           "fill ms", "mean", "p50", "p99", "p99.9", "max");
+    fflush(stdout);
+    init_metrics();
+    capacity = BENCH_MIN_CAPACITY;
+    while (capacity / CACHE_SHARD_NUM < BENCH_SHARD_OBJECTS * object_size) {
+        capacity *= BENCH_STEP;
+    }
+    for (; capacity <= max_capacity; capacity *= BENCH_STEP) {
+        if ((pid = Fork()) == 0) {
+            run_capacity(capacity, object_size, hits);
+            exit(0);
+        }
+        Waitpid(pid, NULL, 0);
+    }
+    return 0;
+}
+
+/*
+ * now_ns - monotonic time in nanoseconds
+ */
+static long now_ns() {
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/*
+ * run_capacity - fill a cache of capacity bytes and time hits on it
+ */
+static void run_capacity(size_t capacity, size_t object_size, long hits) {
+
+    cache_list_t* list;
+    cache_stats_t stats;
+    cache_object_t* object;
+    metrics_histogram_t histogram;
+    struct iovec iov[64];
+    unsigned long long seed = 0x9E3779B97F4A7C15ULL;
+    char *content, *ids, *id;
+    size_t inserted = 0, slots = 64, cached = 0, j;
+    long start, fill_ns, i;
+    int count;
+
+    list = init_cache_list("lru", capacity, object_size + 1);
+    if (list == NULL) {
+        exit(1);
+    }
+    content = (char *)Malloc(object_size);
+    memset(content, 'x', object_size);
+    ids = (char *)Malloc(slots * BENCH_ID_SIZE);
+
+    // fill until every shard had to evict
+    start = now_ns();
+    do {
+        if (inserted == slots) {
+            slots *= 2;
+            ids = (char *)Realloc(ids, slots * BENCH_ID_SIZE);
+        }
+        snprintf(ids + inserted * BENCH_ID_SIZE, BENCH_ID_SIZE,
+                 "GET http://bench.local/object/%zu HTTP/1.1", inserted);
+        if (add_cache_node_to_rear(list,
+                create_cache_node(ids + inserted * BENCH_ID_SIZE, content,
+                                  object_size, NULL)) != 0) {
+            app_error("cache insert error");
+        }
+        inserted++;
+        get_cache_stats(list, &stats);
+    } while (stats.evictions < BENCH_FULL_EVICTIONS);
+    fill_ns = now_ns() - start;
+
+    // keep the ids still cached at the front
+    for (j = 0; j < inserted; j++) {
+        id = ids + j * BENCH_ID_SIZE;
+        if ((object = read_cache_list(list, id)) != NULL) {
+            release_cache_object(object);
+            memmove(ids + cached++ * BENCH_ID_SIZE, id, BENCH_ID_SIZE);
+        }
+    }
+
+    // hits on random objects that are still cached
+    memset(&histogram, 0, sizeof(histogram));
+    for (i = 0; i < hits; i++) {
+        id = ids + next_random(&seed) % cached * BENCH_ID_SIZE;
+        start = now_ns();
+        if ((object = read_cache_list(list, id)) == NULL) {
+            app_error("cache miss");
+        }
+        count = object_iov(object, 0, object -> length, iov, 64);
+        bench_sink += count + *(char *)iov[0].iov_base;
+        release_cache_object(object);
+        histogram_record(&histogram, now_ns() - start);
+    }
+
+    printf("%12zu %10zu %10.1f %8.1f %8lu %8lu %8lu %8lu\n", capacity,
+           cached, fill_ns / 1e6, (double)histogram.sum / histogram.count,
+           histogram_percentile(&histogram, 50.0),
+           histogram_percentile(&histogram, 99.0),
+           histogram_percentile(&histogram, 99.9), histogram.max);
+    fflush(stdout);
+}
+
+/*
+ * next_random - xorshift64* step
+ */
+static unsigned long long next_random(unsigned long long* seed) {
+
+    *seed ^= *seed >> 12;
+    *seed ^= *seed << 25;
+    *seed ^= *seed >> 27;
+    return *seed * 2685821657736338717ULL;
+}
@@ -0,0 +1,498 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * conditional.c - answer conditional and range requests from the cache.
+ * Implementation idea:
+ * 1. the cache id does not include the Range and If-* headers, so those
+ *    are parsed apart from the id and applied to the cached full response
+ * 2. the validators (ETag, Last-Modified) are read from the header stored
+ *    at the start of the cached object, no extra state is kept per node
+ * 3. If-None-Match (weak comparison) or else If-Modified-Since give a 304
+ *    built from the cached header; one byte range of a 200 response with
+ *    a known length gives a 206 whose body is a slice of the cached object
+ *    written in place, If-Range falls back to the full response when the
+ *    validator changed, and multiple ranges are answered in full
+ * 4. a client asking for revalidation (no-cache, max-age=0) makes the
+ *    proxy send the cached validators upstream, so an unchanged object
+ *    costs a 304 instead of the whole body (see proxy.c)
+ * 5. a gzip object asked by a client that does not accept gzip is a 200
+ *    decoded while it is written, a range of it is answered in full
+ *    (see encoding.c)
+ *
+ */
+#include "csapp.h"
+#include "cache.h"
+#include "proxy.h"
+#include "conditional.h"
+#include "encoding.h"
+
+/* Static helper functions for conditional and range requests */
+static void copy_value(char* value, char* dest, size_t size);
+static void parse_range(char* value, request_cond_t* cond);
+static int etag_matches(char* list, char* etag);
+static int keep_header_line(char* buf, int answer);
+static int build_head(cache_object_t* object, cached_header_t* header,
+                      int answer, char* extra, char* head,
+                      size_t* head_length);
+
+/*
+ * init_request_cond - a request without any condition
+ */
+void init_request_cond(request_cond_t* cond) {
+
+    cond -> if_none_match[0] = '\0';
+    cond -> if_modified_since = 0;
+    cond -> if_range[0] = '\0';
+    cond -> has_range = 0;
+    cond -> range_first = -1;
+    cond -> range_last = -1;
+    cond -> no_cache = 0;
+    cond -> accept_gzip = 0;
+}
+
+/*
+ * parse_request_cond - record the condition a request header sets
+ *                      return 1 for a Range or If-* header, which must not
+ *                      be forwarded when the proxy revalidates itself
+ */
+int parse_request_cond(http_header_t* header, request_cond_t* cond) {
+
+    char* value = header -> value;
+
+    switch (header -> id) {
+    case HDR_IF_NONE_MATCH:
+        copy_value(value, cond -> if_none_match, MAXLINE);
+        return 1;
+    case HDR_IF_MODIFIED_SINCE:
+        cond -> if_modified_since = parse_http_date(value);
+        return 1;
+    case HDR_IF_RANGE:
+        copy_value(value, cond -> if_range, COND_TAG_SIZE);
+        return 1;
+    case HDR_RANGE:
+        parse_range(value, cond);
+        return 1;
+    case HDR_CACHE_CONTROL:
+        if (contains_token(value, "no-cache") ||
+            contains_token(value, "max-age=0")) {
+            cond -> no_cache = 1;
+        }
+        break;
+    case HDR_PRAGMA:
+        if (contains_token(value, "no-cache")) {
+            cond -> no_cache = 1;
+        }
+        break;
+    case HDR_ACCEPT_ENCODING:
+        cond -> accept_gzip = accepts_gzip(value);
+        break;
+    }
+    return 0;
+}
+
+/*
+ * request_is_conditional - check whether the response to the request may
+ *                          be something else than the full object
+ */
+int request_is_conditional(request_cond_t* cond) {
+
+    return cond -> if_none_match[0] != '\0' ||
+           cond -> if_modified_since != 0 || cond -> has_range;
+}
+
+/*
+ * parse_cached_header - parse the status line and header at the start of
+ *                       a cached response
+ *                       return -1 if the object has no complete header
+ */
+int parse_cached_header(cache_object_t* object, cached_header_t* header) {
+
+    char buf[MAXBUF];
+    char *line, *line_end, *value, *end;
+
+    header -> status = 0;
+    header -> version[0] = '\0';
+    header -> header_length = 0;
+    header -> content_length = -1;
+    header -> chunked = 0;
+    header -> delimited = 0;
+    header -> etag[0] = '\0';
+    header -> last_modified[0] = '\0';
+    header -> content_encoding[0] = '\0';
+    header -> content_type[0] = '\0';
+    header -> vary_encoding = 0;
+
+    // the header is at the start of the object, maybe over two segments
+    end = buf + read_cache_object(object, 0, buf, MAXBUF - 1);
+    *end = '\0';
+
+    for (line = buf; line < end; line = line_end + 1) {
+        if ((line_end = memchr(line, '\n', end - line)) == NULL) {
+            return -1;
+        }
+        if (line == buf) {
+            sscanf(line, "%15s %d", header -> version, &header -> status);
+            continue;
+        }
+        if (line[0] == '\r' || line[0] == '\n') {
+            // the empty line ends the header
+            header -> header_length = line_end + 1 - buf;
+            header -> delimited =
+                (header -> status >= 100 && header -> status < 200) ||
+                header -> status == 204 || header -> status == 304 ||
+                header -> chunked || header -> content_length >= 0;
+            return 0;
+        }
+
+        *line_end = '\0';
+        if ((value = strchr(line, ':')) == NULL) {
+            continue;
+        }
+        value++;
+        if (!strncasecmp(line, "Content-Length:", 15)) {
+            header -> content_length = strtol(value, NULL, 10);
+        } else if (!strncasecmp(line, "Transfer-Encoding:", 18)) {
+            header -> chunked = contains_token(value, "chunked");
+        } else if (!strncasecmp(line, "ETag:", 5)) {
+            copy_value(value, header -> etag, COND_TAG_SIZE);
+        } else if (!strncasecmp(line, "Last-Modified:", 14)) {
+            copy_value(value, header -> last_modified, COND_TAG_SIZE);
+        } else if (!strncasecmp(line, "Content-Encoding:", 17)) {
+            copy_value(value, header -> content_encoding, COND_TAG_SIZE);
+        } else if (!strncasecmp(line, "Content-Type:", 13)) {
+            copy_value(value, header -> content_type, COND_TAG_SIZE);
+        } else if (!strncasecmp(line, "Vary:", 5)) {
+            header -> vary_encoding |= contains_token(value,
+                                                      "accept-encoding");
+        }
+    }
+    return -1;
+}
+
+/*
+ * answer_from_cache - decide how the cached response answers the request,
+ *                     for anything but ANSWER_FULL a new status line and
+ *                     header is built in head (MAXBUF bytes);
+ *                     the client gets head, then length bytes of the
+ *                     object from offset
+ *                     return the kind of answer
+ */
+int answer_from_cache(request_cond_t* cond, cache_object_t* object,
+                      cached_header_t* header, char* head,
+                      size_t* head_length, size_t* offset, size_t* length) {
+
+    char extra[MAXLINE];
+    time_t modified;
+    long first, last, total, decoded;
+
+    *head_length = 0;
+    *offset = 0;
+    *length = object -> length;
+
+    // only a complete 200 response is the full object the client asks about
+    if (header -> status != 200) {
+        return ANSWER_FULL;
+    }
+
+    // If-None-Match takes precedence over If-Modified-Since
+    if (cond -> if_none_match[0] != '\0') {
+        if (etag_matches(cond -> if_none_match, header -> etag) &&
+            build_head(object, header, ANSWER_NOT_MODIFIED, "",
+                       head, head_length) == 0) {
+            *length = 0;
+            return ANSWER_NOT_MODIFIED;
+        }
+    } else if (cond -> if_modified_since != 0 &&
+               header -> last_modified[0] != '\0') {
+        modified = parse_http_date(header -> last_modified);
+        if (modified != 0 && modified <= cond -> if_modified_since &&
+            build_head(object, header, ANSWER_NOT_MODIFIED, "",
+                       head, head_length) == 0) {
+            *length = 0;
+            return ANSWER_NOT_MODIFIED;
+        }
+    }
+
+    // the client cannot take the encoding the object is stored with
+    if (!cond -> accept_gzip && header_is_gzip(header) &&
+        (decoded = gzip_decoded_length(object, header)) >= 0) {
+        snprintf(extra, MAXLINE, "Content-Length: %ld\r\n%s", decoded,
+                 header -> vary_encoding ? "" : "Vary: Accept-Encoding\r\n");
+        if (build_head(object, header, ANSWER_DECODED, extra,
+                       head, head_length) == -1) {
+            return ANSWER_FULL;
+        }
+        *offset = header -> header_length;
+        *length = header -> content_length;
+        return ANSWER_DECODED;
+    }
+
+    // a slice needs a body of known length stored as it is
+    if (!cond -> has_range || header -> chunked ||
+        header -> content_length < 0 ||
+        header -> header_length + header -> content_length !=
+        object -> length) {
+        return ANSWER_FULL;
+    }
+    // If-Range only keeps the range while a strong validator still matches
+    if (cond -> if_range[0] != '\0' &&
+        (strncmp(header -> etag, "W/", 2) == 0 ||
+         strcmp(cond -> if_range, header -> etag)) &&
+        strcmp(cond -> if_range, header -> last_modified)) {
+        return ANSWER_FULL;
+    }
+
+    total = header -> content_length;
+    if (cond -> range_first < 0) {
+        // the last range_last bytes
+        first = (cond -> range_last < total) ? total - cond -> range_last : 0;
+        last = total - 1;
+        if (cond -> range_last == 0) {
+            first = total;
+        }
+    } else {
+        first = cond -> range_first;
+        last = (cond -> range_last < 0 || cond -> range_last >= total) ?
+               total - 1 : cond -> range_last;
+    }
+
+    if (first >= total) {
+        *head_length = snprintf(head, MAXBUF,
+                                "%s 416 Range Not Satisfiable\r\n"
+                                "Content-Range: bytes */%ld\r\n"
+                                "Content-Length: 0\r\n\r\n",
+                                header -> version, total);
+        *length = 0;
+        return ANSWER_UNSATISFIABLE;
+    }
+
+    snprintf(extra, MAXLINE, "Content-Range: bytes %ld-%ld/%ld\r\n"
+             "Content-Length: %ld\r\n", first, last, total, last - first + 1);
+    if (build_head(object, header, ANSWER_PARTIAL, extra,
+                   head, head_length) == -1) {
+        return ANSWER_FULL;
+    }
+    *offset = header -> header_length + first;
+    *length = last - first + 1;
+    return ANSWER_PARTIAL;
+}
+
+/*
+ * add_validators - append the validators of the cached response to the
+ *                  request header (MAXLINE bytes) sent upstream
+ *                  return 1 if the request became conditional
+ */
+int add_validators(cached_header_t* header, char* request_header) {
+
+    size_t used = strlen(request_header);
+    int added = 0;
+
+    if (header -> etag[0] != '\0' &&
+        used + strlen(header -> etag) + 18 < MAXLINE) {
+        used += sprintf(request_header + used, "If-None-Match: %s\r\n",
+                        header -> etag);
+        added = 1;
+    }
+    if (header -> last_modified[0] != '\0' &&
+        used + strlen(header -> last_modified) + 22 < MAXLINE) {
+        sprintf(request_header + used, "If-Modified-Since: %s\r\n",
+                header -> last_modified);
+        added = 1;
+    }
+    return added;
+}
+
+/*
+ * copy_value - copy a header value without the surrounding white space
+ */
+static void copy_value(char* value, char* dest, size_t size) {
+
+    size_t length;
+
+    while (*value == ' ' || *value == '\t') {
+        value++;
+    }
+    length = strcspn(value, "\r\n");
+    while (length > 0 &&
+           (value[length - 1] == ' ' || value[length - 1] == '\t')) {
+        length--;
+    }
+    if (length >= size) {
+        // a truncated validator would never match, drop it
+        length = 0;
+    }
+    memcpy(dest, value, length);
+    dest[length] = '\0';
+}
+
+/*
+ * parse_range - parse a "bytes=first-last" range, a list of ranges or
+ *               an invalid one is ignored and the whole object is sent
+ */
+static void parse_range(char* value, request_cond_t* cond) {
+
+    char* end;
+    long first = -1, last = -1;
+
+    cond -> has_range = 0;
+    while (*value == ' ') {
+        value++;
+    }
+    if (strncasecmp(value, "bytes=", 6) || strchr(value, ',') != NULL) {
+        return;
+    }
+    value += 6;
+
+    if (*value == '-') {
+        // suffix range, the last bytes of the object
+        last = strtol(value + 1, &end, 10);
+        if (end == value + 1 || last < 0) {
+            return;
+        }
+    } else {
+        first = strtol(value, &end, 10);
+        if (end == value || first < 0 || *end != '-') {
+            return;
+        }
+        value = end + 1;
+        if (*value >= '0' && *value <= '9') {
+            last = strtol(value, &end, 10);
+            if (last < first) {
+                return;
+            }
+        }
+    }
+
+    cond -> has_range = 1;
+    cond -> range_first = first;
+    cond -> range_last = last;
+}
+
+/*
+ * parse_http_date - parse an HTTP date (Sun, 06 Nov 1994 08:49:37 GMT)
+ *                   return 0 if it is not one
+ */
+time_t parse_http_date(char* value) {
+
+    static const char* months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    struct tm tm;
+    char month[4];
+    char* found;
+
+    memset(&tm, 0, sizeof(struct tm));
+    if (sscanf(value, " %*[A-Za-z], %d %3s %d %d:%d:%d", &tm.tm_mday, month,
+               &tm.tm_year, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6) {
+        return 0;
+    }
+    if (strlen(month) != 3 || (found = strstr(months, month)) == NULL ||
+        (found - months) % 3 != 0) {
+        return 0;
+    }
+    tm.tm_mon = (found - months) / 3;
+    tm.tm_year -= 1900;
+    return timegm(&tm);
+}
+
+/*
+ * etag_matches - weak comparison of the etag with a list of etags
+ *                return 1 if one of them, or "*", matches
+ */
+static int etag_matches(char* list, char* etag) {
+
+    char* token;
+    size_t length;
+
+    if (etag[0] == '\0') {
+        return 0;
+    }
+    if (!strncmp(etag, "W/", 2)) {
+        etag += 2;
+    }
+
+    for (token = list; *token != '\0'; token += length) {
+        token += strspn(token, " \t,");
+        length = strcspn(token, " \t,");
+        if (length == 1 && token[0] == '*') {
+            return 1;
+        }
+        if (length > 2 && !strncmp(token, "W/", 2)) {
+            if (length - 2 == strlen(etag) &&
+                !strncmp(token + 2, etag, length - 2)) {
+                return 1;
+            }
+        } else if (length == strlen(etag) && !strncmp(token, etag, length)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * keep_header_line - check whether a cached header line goes with the
+ *                    built answer: a 304 only carries the validators
+ *                    and the caching headers, a 206 gets its own length,
+ *                    a decoded 200 loses the encoding and strong ETag
+ */
+static int keep_header_line(char* buf, int answer) {
+
+    if (answer == ANSWER_NOT_MODIFIED) {
+        return !strncasecmp(buf, "ETag:", 5) ||
+               !strncasecmp(buf, "Last-Modified:", 14) ||
+               !strncasecmp(buf, "Cache-Control:", 14) ||
+               !strncasecmp(buf, "Expires:", 8) ||
+               !strncasecmp(buf, "Date:", 5) ||
+               !strncasecmp(buf, "Vary:", 5) ||
+               !strncasecmp(buf, "Content-Location:", 17);
+    }
+    if (answer == ANSWER_DECODED &&
+        (!strncasecmp(buf, "Content-Encoding:", 17) ||
+         (!strncasecmp(buf, "ETag:", 5) &&
+          strncmp(buf + 5 + strspn(buf + 5, " \t"), "W/", 2)))) {
+        return 0;
+    }
+    return strncasecmp(buf, "Content-Length:", 15) &&
+           strncasecmp(buf, "Content-Range:", 14);
+}
+
+/*
+ * build_head - build the status line and header of a 304, 206 or decoded
+ *              answer
+ *              from the cached header, extra lines added at its end
+ *              return -1 if it does not fit in MAXBUF
+ */
+static int build_head(cache_object_t* object, cached_header_t* header,
+                      int answer, char* extra, char* head,
+                      size_t* head_length) {
+
+    char buf[MAXBUF];
+    char *line, *line_end, *end;
+    size_t used;
+
+    if (header -> header_length + strlen(extra) + MAXLINE / 8 > MAXBUF) {
+        return -1;
+    }
+    end = buf + read_cache_object(object, 0, buf, header -> header_length);
+
+    used = sprintf(head, "%s %s\r\n", header -> version,
+                   (answer == ANSWER_NOT_MODIFIED) ? "304 Not Modified" :
+                   (answer == ANSWER_PARTIAL) ? "206 Partial Content" :
+                   "200 OK");
+
+    // the lines between the status line and the empty line
+    line = memchr(buf, '\n', end - buf) + 1;
+    for (; line < end; line = line_end + 1) {
+        line_end = memchr(line, '\n', end - line);
+        if (line[0] == '\r' || line[0] == '\n') {
+            break;
+        }
+        if (keep_header_line(line, answer)) {
+            memcpy(head + used, line, line_end + 1 - line);
+            used += line_end + 1 - line;
+        }
+    }
+
+    used += sprintf(head + used, "%s\r\n", extra);
+    *head_length = used;
+    return 0;
+}
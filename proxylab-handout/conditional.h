@@ -0,0 +1,66 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * conditional.h - prototypes and definitions for conditional.c
+ */
+#ifndef __CONDITIONAL_H__
+#define __CONDITIONAL_H__
+
+#include "csapp.h"
+#include "cache.h"
+#include "httpparse.h"
+
+/* Max length of a validator (ETag, Last-Modified) kept from a header */
+#define COND_TAG_SIZE 256
+
+/* How a cached response answers a request, see answer_from_cache */
+#define ANSWER_FULL          0
+#define ANSWER_NOT_MODIFIED  1
+#define ANSWER_PARTIAL       2
+#define ANSWER_UNSATISFIABLE 3
+#define ANSWER_DECODED       4
+
+/*
+ * Defined a struct representing the conditional and range headers
+ * of a client request
+ */
+typedef struct request_cond_t {
+    char if_none_match[MAXLINE];    // empty if absent
+    time_t if_modified_since;       // 0 if absent
+    char if_range[COND_TAG_SIZE];   // empty if absent
+    int has_range;                  // one byte range was asked
+    long range_first;               // -1 for a suffix range
+    long range_last;                // -1 if open ended, else the last byte
+                                    // or the length of a suffix range
+    int no_cache;                   // the client asks to revalidate
+    int accept_gzip;                // the client takes a gzip body
+} request_cond_t;
+
+/* Defined a struct representing the header of a cached response */
+typedef struct cached_header_t {
+    int status;
+    char version[16];               // of the status line, e.g. HTTP/1.0
+    size_t header_length;           // up to and including the empty line
+    long content_length;            // -1 if the header does not give it
+    int chunked;
+    int delimited;                  // the body does not end with the conn
+    char etag[COND_TAG_SIZE];       // empty if absent
+    char last_modified[COND_TAG_SIZE];
+    char content_encoding[COND_TAG_SIZE];   // empty if absent
+    char content_type[COND_TAG_SIZE];
+    int vary_encoding;              // Vary names Accept-Encoding
+} cached_header_t;
+
+/* Defined function answering requests from cached responses */
+void init_request_cond(request_cond_t* cond);
+int parse_request_cond(http_header_t* header, request_cond_t* cond);
+int request_is_conditional(request_cond_t* cond);
+int parse_cached_header(cache_object_t* object, cached_header_t* header);
+int answer_from_cache(request_cond_t* cond, cache_object_t* object,
+                      cached_header_t* header, char* head,
+                      size_t* head_length, size_t* offset, size_t* length);
+int add_validators(cached_header_t* header, char* request_header);
+time_t parse_http_date(char* value);
+
+#endif /* __CONDITIONAL_H__ */
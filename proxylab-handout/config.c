@@ -0,0 +1,132 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * config.c - configuration file of the proxy.
+ * Implementation idea:
+ * 1. the file holds one "name value" setting per line, blank lines and
+ *    lines starting with # are skipped, a setting is named after the
+ *    long form of its command line option (e.g. "cache-size 2G" for -C)
+ * 2. every setting is handed to the same apply function as the command
+ *    line option, so both accept the same values; the value only lives
+ *    during the call
+ * 3. sizes take an optional K, M or G suffix (powers of 1024) and are
+ *    kept in 64 bits
+ *
+ */
+#include "csapp.h"
+#include "config.h"
+
+/* Static helper functions for the configuration file */
+static char* trim(char* str);
+
+/*
+ * read_config_file - apply every setting of the file at path
+ *                    return -1 if the file cannot be read or has an
+ *                    unknown or illegal setting
+ */
+int read_config_file(char* path, const config_key_t* keys,
+                     config_apply_t apply, void* arg) {
+
+    char line[MAXLINE];
+    char *name, *value;
+    const config_key_t* key;
+    FILE* file;
+    int number = 0, rc = 0;
+
+    if ((file = fopen(path, "r")) == NULL) {
+        printf("Open config file %s error: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    while (rc == 0 && fgets(line, sizeof(line), file) != NULL) {
+        number++;
+        name = trim(line);
+        if (*name == '\0' || *name == '#') {
+            continue;
+        }
+
+        // the name ends at the first blank, the rest is the value
+        value = name + strcspn(name, " \t");
+        if (*value != '\0') {
+            *value++ = '\0';
+        }
+        value = trim(value);
+
+        for (key = keys; key -> name != NULL; key++) {
+            if (!strcmp(key -> name, name)) {
+                break;
+            }
+        }
+        if (key -> name == NULL) {
+            printf("%s:%d: unknown setting %s\n", path, number, name);
+            rc = -1;
+        } else if (apply(arg, key -> opt, value) == -1) {
+            printf("%s:%d: illegal %s \"%s\"\n", path, number, name, value);
+            rc = -1;
+        }
+    }
+
+    fclose(file);
+    return rc;
+}
+
+/*
+ * parse_size - parse a number of bytes with an optional K, M or G suffix
+ *              return -1 if str is not such a size
+ */
+int parse_size(char* str, size_t* size) {
+
+    unsigned long long value;
+    char* end;
+    int shift = 0;
+
+    if (str == NULL || *str < '0' || *str > '9') {
+        return -1;
+    }
+    errno = 0;
+    value = strtoull(str, &end, 10);
+    if (errno != 0) {
+        return -1;
+    }
+
+    switch (*end) {
+    case 'K': case 'k':
+        shift = 10;
+        end++;
+        break;
+    case 'M': case 'm':
+        shift = 20;
+        end++;
+        break;
+    case 'G': case 'g':
+        shift = 30;
+        end++;
+        break;
+    }
+    if (*end != '\0' || value > ((size_t)-1 >> shift)) {
+        return -1;
+    }
+
+    *size = (size_t)value << shift;
+    return 0;
+}
+
+/*
+ * trim - skip the leading blanks of str and cut the trailing ones
+ */
+static char* trim(char* str) {
+
+    char* end;
+
+    while (*str == ' ' || *str == '\t') {
+        str++;
+    }
+    end = str + strlen(str);
+    while (end > str && (end[-1] == ' ' || end[-1] == '\t' ||
+                         end[-1] == '\r' || end[-1] == '\n')) {
+        end--;
+    }
+    *end = '\0';
+    return str;
+}
@@ -0,0 +1,32 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * config.h - prototypes and definitions for config.c
+ */
+#ifndef __CONFIG_H__
+#define __CONFIG_H__
+
+#include "csapp.h"
+
+/*
+ * Defined a struct representing one setting of the configuration file,
+ * named after the long form of its command line option
+ */
+typedef struct config_key_t {
+    char* name;
+    int opt;                        // the command line option letter
+} config_key_t;
+
+/*
+ * Applies the value of one option, the same way for the command line and
+ * the file, returns -1 if the value is illegal
+ */
+typedef int (*config_apply_t)(void* arg, int opt, char* value);
+
+/* Defined function reading the proxy configuration */
+int read_config_file(char* path, const config_key_t* keys,
+                     config_apply_t apply, void* arg);
+int parse_size(char* str, size_t* size);
+
+#endif /* __CONFIG_H__ */
@@ -1,6 +1,13 @@
 /* 
  * csapp.c - Functions for the CS:APP3e book
  *
+ * Updated by gaoj:
+ *   - open_clientfd returns -1 instead of exiting when the host is
+ *     unknown
+ *   - open_reuseport_listenfd opens one of several listening sockets
+ *     sharing a port with SO_REUSEPORT
+ *   - open_clientfd_timeout gives up a connect after a timeout
+ *
  * Updated 8/2014 droh: 
  *   - New versions of open_clientfd and open_listenfd are reentrant and
  *     protocol independent.
@@ -16,8 +23,11 @@
  *   - rio_readnb: removed redundant EINTR check
  */
 /* $begin csapp.c */
+#include <poll.h>
 #include "csapp.h"
 
+static int open_listenfd_with(char *port, int reuseport);
+
 /************************** 
  * Error-handling functions
  **************************/
@@ -932,6 +942,19 @@ ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
  */
 /* $begin open_clientfd */
 int open_clientfd(char *hostname, char *port) {
+    return open_clientfd_timeout(hostname, port, 0);
+}
+/* $end open_clientfd */
+
+/*
+ * open_clientfd_timeout - Same as open_clientfd, but a connect to one
+ *     address gives up after timeout_ms milliseconds (0 waits as long as
+ *     the system does) and the next address is tried.
+ *
+ *     On error, returns -1 and sets errno, ETIMEDOUT if the last connect
+ *     timed out.
+ */
+int open_clientfd_timeout(char *hostname, char *port, int timeout_ms) {
     int clientfd;
     struct addrinfo hints, *listp, *p;
 
@@ -940,7 +963,8 @@ int open_clientfd(char *hostname, char *port) {
     hints.ai_socktype = SOCK_STREAM;  /* Open a connection */
     hints.ai_flags = AI_NUMERICSERV;  /* ... using a numeric port arg. */
     hints.ai_flags |= AI_ADDRCONFIG;  /* Recommended for connections */
-    Getaddrinfo(hostname, port, &hints, &listp);
+    if (getaddrinfo(hostname, port, &hints, &listp) != 0)
+        return -1;
   
     /* Walk the list for one that we can successfully connect to */
     for (p = listp; p; p = p->ai_next) {
@@ -949,7 +973,8 @@ int open_clientfd(char *hostname, char *port) {
             continue; /* Socket failed, try the next */
 
         /* Connect to the server */
-        if (connect(clientfd, p->ai_addr, p->ai_addrlen) != -1) 
+        if (timed_connect(clientfd, p->ai_addr, p->ai_addrlen,
+                          timeout_ms) != -1) 
             break; /* Success */
         Close(clientfd); /* Connect failed, try another */  //line:netp:openclientfd:closefd
     } 
@@ -961,6 +986,49 @@ int open_clientfd(char *hostname, char *port) {
     else    /* The last connect succeeded */
         return clientfd;
 }
+
+/*
+ * timed_connect - connect fd to addr, waiting at most timeout_ms
+ *     milliseconds if it is positive; fd stays blocking afterwards.
+ *
+ *     On error, returns -1 and sets errno.
+ */
+int timed_connect(int fd, SA *addr, socklen_t addrlen, int timeout_ms)
+{
+    struct pollfd pfd;
+    socklen_t length = sizeof(int);
+    int flags, error = 0, rc;
+
+    if (timeout_ms <= 0)
+        return connect(fd, addr, addrlen);
+
+    /* Start the connect without blocking, then wait for it to finish */
+    if ((flags = fcntl(fd, F_GETFL, 0)) < 0 ||
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        return -1;
+    if ((rc = connect(fd, addr, addrlen)) < 0 && errno == EINPROGRESS) {
+        pfd.fd = fd;
+        pfd.events = POLLOUT;
+        while ((rc = poll(&pfd, 1, timeout_ms)) < 0 && errno == EINTR)
+            ;
+        if (rc == 0) {
+            errno = ETIMEDOUT;
+            rc = -1;
+        } else if (rc > 0) {
+            /* The connect finished, with the error it got if any */
+            rc = getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length);
+            if (rc == 0 && error != 0) {
+                errno = error;
+                rc = -1;
+            }
+        }
+    }
+
+    error = errno;
+    fcntl(fd, F_SETFL, flags);
+    errno = error;
+    return (rc < 0) ? -1 : 0;
+}
 /* $end open_clientfd */
 
 /*  
@@ -971,6 +1039,25 @@ int open_clientfd(char *hostname, char *port) {
  */
 /* $begin open_listenfd */
 int open_listenfd(char *port) 
+{
+    return open_listenfd_with(port, 0);
+}
+/* $end open_listenfd */
+
+/*
+ * open_reuseport_listenfd - Open and return a listening socket on port
+ *     with SO_REUSEPORT set, so that every socket opened this way by
+ *     the same user listens on the port and the kernel spreads the
+ *     incoming connections among them.
+ *
+ *     On error, returns -1 and sets errno.
+ */
+int open_reuseport_listenfd(char *port) 
+{
+    return open_listenfd_with(port, 1);
+}
+
+static int open_listenfd_with(char *port, int reuseport) 
 {
     struct addrinfo hints, *listp, *p;
     int listenfd, optval=1;
@@ -991,6 +1078,9 @@ int open_listenfd(char *port)
         /* Eliminates "Address already in use" error from bind */
         Setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR,    //line:netp:csapp:setsockopt
                    (const void *)&optval , sizeof(int));
+        if (reuseport)
+            Setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT,
+                       (const void *)&optval , sizeof(int));
 
         /* Bind the descriptor to the address */
         if (bind(listenfd, p->ai_addr, p->ai_addrlen) == 0)
@@ -1010,7 +1100,6 @@ int open_listenfd(char *port)
     }
     return listenfd;
 }
-/* $end open_listenfd */
 
 /****************************************************
  * Wrappers for reentrant protocol-independent helpers
@@ -1033,6 +1122,15 @@ int Open_listenfd(char *port)
     return rc;
 }
 
+int Open_reuseport_listenfd(char *port) 
+{
+    int rc;
+
+    if ((rc = open_reuseport_listenfd(port)) < 0)
+	unix_error("Open_reuseport_listenfd error");
+    return rc;
+}
+
 /* $end csapp.c */
 
 
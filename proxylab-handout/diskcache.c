@@ -0,0 +1,818 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * diskcache.c - memory mapped on-disk second tier of the proxy cache.
+ * Implementation idea:
+ * 1. the tier is one file of fixed size mapped in memory, a superblock
+ *    followed by a circular log of records (header, cache id, content)
+ * 2. objects evicted from memory are appended at the head of the log,
+ *    when the head catches up with the tail the oldest records are
+ *    dropped, so the tier evicts in fifo order without any compaction;
+ *    the evicting thread only pins the object in a bounded queue, one
+ *    writer thread per tier appends the queued objects in batches
+ * 3. an in-memory hash table indexes the records by the hash of their
+ *    cache id, the id stored in the record resolves collisions, a newer
+ *    record of the same id replaces the entry of the older one
+ * 4. at startup the index is rebuilt by walking the log from tail to
+ *    head, the walk stops at the first torn record: a checksum covers
+ *    the header, another one the id and the content
+ * 5. a batch is placed first, dropping the oldest records for room, and
+ *    the moved tail is synced before their bytes are overwritten; the
+ *    records are then written and synced without the mutex, as no index
+ *    entry points to them yet, and the head is synced last, so the file
+ *    never has its tail or head on bytes of another record
+ * 6. a hit copies the record out of the map into a new cached object,
+ *    which the memory tier then takes over (promotion); one mutex covers
+ *    the map, as the copies are bounded by the object size limit
+ * 7. the same log format carries the cache snapshot of a graceful
+ *    upgrade (upgrade.c), restored into the memory tier oldest first
+ *
+ */
+#include <sys/mman.h>
+#include <limits.h>
+#include "csapp.h"
+#include "cache.h"
+#include "diskcache.h"
+
+/* Round up to the alignment of the records */
+#define DISK_ALIGN(n) (((n) + 7) & ~7ULL)
+
+/* Results of make_room besides 0 (it fits) and -1 (it never fits) */
+#define DISK_ROOM_WRAP 1        /* the head has to wrap to the start */
+#define DISK_ROOM_LATER 2       /* only the records of the batch are left */
+
+/* Static helper functions for the on-disk tier */
+static void *writer_thread(void *vargp);
+static disk_job_t* write_batch(disk_cache_t* disk, disk_job_t* jobs);
+static void write_record(disk_cache_t* disk, disk_job_t* job);
+static int sync_batch(disk_cache_t* disk, disk_job_t* placed);
+static void free_job(disk_job_t* job);
+static int make_room(disk_cache_t* disk, unsigned long long size,
+                     unsigned long long head, unsigned long long added);
+static int drop_tail(disk_cache_t* disk);
+static disk_record_t* record_at(disk_cache_t* disk, unsigned long long offset);
+static int valid_record(disk_cache_t* disk, unsigned long long offset);
+static int valid_content(disk_cache_t* disk, unsigned long long offset);
+static unsigned int record_check(disk_record_t* record);
+static unsigned int content_check(unsigned int check, char* data,
+                                  size_t length);
+static int sync_range(disk_cache_t* disk, unsigned long long start,
+                      unsigned long long length);
+static unsigned long long record_size(disk_record_t* record);
+static disk_entry_t** find_entry(disk_cache_t* disk, char* id,
+                                 unsigned int hash);
+static void index_record(disk_cache_t* disk, unsigned long long offset);
+static void unindex_record(disk_cache_t* disk, unsigned long long offset);
+static void rebuild_index(disk_cache_t* disk);
+static void clear_index(disk_cache_t* disk);
+
+/*
+ * open_disk_cache - map the log file at path, of size bytes, creating it
+ *                   or starting it over if it has another layout, for
+ *                   objects of up to max_object bytes
+ *                   return the tier, NULL on error
+ */
+disk_cache_t* open_disk_cache(char* path, size_t size, size_t max_object) {
+
+    disk_cache_t* disk;
+    struct stat st;
+    int fd;
+
+    if (size < DISK_SUPER_SIZE + 2 * max_object) {
+        printf("Disk cache too small.\n");
+        return NULL;
+    }
+
+    if ((fd = open(path, O_RDWR | O_CREAT, 0644)) == -1) {
+        printf("Open disk cache %s error: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &st) == -1 ||
+        (st.st_size != size && ftruncate(fd, size) == -1)) {
+        printf("Size disk cache %s error: %s\n", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    disk = (disk_cache_t *)Calloc(1, sizeof(disk_cache_t));
+    disk -> fd = fd;
+    disk -> max_object = max_object;
+    disk -> map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (disk -> map == MAP_FAILED) {
+        printf("Map disk cache %s error: %s\n", path, strerror(errno));
+        close(fd);
+        Free(disk);
+        return NULL;
+    }
+    disk -> super = (disk_super_t *)disk -> map;
+    disk -> data = disk -> map + DISK_SUPER_SIZE;
+    pthread_mutex_init(&disk -> mutex, NULL);
+
+    // a file of another layout or size is started over
+    if (disk -> super -> magic != DISK_SUPER_MAGIC ||
+        disk -> super -> version != DISK_VERSION ||
+        disk -> super -> data_size != size - DISK_SUPER_SIZE ||
+        disk -> super -> head >= disk -> super -> data_size ||
+        disk -> super -> tail >= disk -> super -> data_size ||
+        disk -> super -> used > disk -> super -> data_size) {
+        disk -> super -> magic = DISK_SUPER_MAGIC;
+        disk -> super -> version = DISK_VERSION;
+        disk -> super -> data_size = size - DISK_SUPER_SIZE;
+        disk -> super -> head = 0;
+        disk -> super -> tail = 0;
+        disk -> super -> used = 0;
+    }
+
+    rebuild_index(disk);
+
+    pthread_mutex_init(&disk -> queue_mutex, NULL);
+    pthread_cond_init(&disk -> queued, NULL);
+    pthread_cond_init(&disk -> room, NULL);
+    Pthread_create(&disk -> writer, NULL, writer_thread, disk);
+    return disk;
+}
+
+/*
+ * queue_disk_object - pin the object for the writer thread, which appends
+ *                     it to the log, replacing an older record of the
+ *                     same id; with the queue full the object is turned
+ *                     away, or wait is 1 and the caller waits for room
+ *                     return -1 if it is not queued
+ */
+int queue_disk_object(disk_cache_t* disk, char* id, unsigned int hash,
+                      cache_object_t* object, int wait) {
+
+    disk_job_t* job;
+
+    // records keep 32-bit lengths
+    if (object -> length > UINT_MAX) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&disk -> queue_mutex);
+    while (disk -> queue_bytes > 0 &&
+           disk -> queue_bytes + object -> length > DISK_QUEUE_SIZE) {
+        if (!wait) {
+            pthread_mutex_unlock(&disk -> queue_mutex);
+            return -1;
+        }
+        pthread_cond_wait(&disk -> room, &disk -> queue_mutex);
+    }
+
+    job = (disk_job_t *)Malloc(sizeof(disk_job_t));
+    job -> id = (char *)Malloc(strlen(id) + 1);
+    strcpy(job -> id, id);
+    job -> hash = hash;
+    job -> object = object;
+    __atomic_add_fetch(&object -> refcnt, 1, __ATOMIC_RELAXED);
+    job -> size = DISK_ALIGN(sizeof(disk_record_t) + strlen(id) +
+                             (unsigned long long)object -> length);
+    job -> next = NULL;
+
+    if (disk -> queue_tail != NULL) {
+        disk -> queue_tail -> next = job;
+    } else {
+        disk -> queue = job;
+    }
+    disk -> queue_tail = job;
+    disk -> queue_bytes += object -> length;
+    pthread_cond_signal(&disk -> queued);
+    pthread_mutex_unlock(&disk -> queue_mutex);
+    return 0;
+}
+
+/*
+ * load_disk_object - copy the record of id out of the log
+ *                    return a new object with one reference, NULL if
+ *                    the tier does not have it
+ */
+cache_object_t* load_disk_object(disk_cache_t* disk, char* id,
+                                 unsigned int hash) {
+
+    disk_entry_t** link;
+    disk_record_t* record;
+    cache_fill_t* fill;
+    cache_object_t* object = NULL;
+
+    if ((fill = begin_cache_fill(NULL, id)) == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&disk -> mutex);
+    if ((link = find_entry(disk, id, hash)) != NULL) {
+        record = record_at(disk, (*link) -> offset);
+        // a record stored under a larger limit is not promoted
+        if (record -> content_length <= disk -> max_object &&
+            append_cache_fill(fill, (char *)(record + 1) + record -> id_length,
+                              record -> content_length) == 0) {
+            object = fill -> object;
+            object -> expires = record -> expires;
+            object -> lifetime = record -> lifetime;
+            object -> stale_window = record -> stale_window;
+            fill -> object = NULL;
+        }
+    }
+    pthread_mutex_unlock(&disk -> mutex);
+
+    abort_cache_fill(fill);
+    return object;
+}
+
+/*
+ * has_disk_object - check whether the tier still has a record of id
+ */
+int has_disk_object(disk_cache_t* disk, char* id, unsigned int hash) {
+
+    int found;
+
+    pthread_mutex_lock(&disk -> mutex);
+    found = (find_entry(disk, id, hash) != NULL);
+    pthread_mutex_unlock(&disk -> mutex);
+    return found;
+}
+
+/*
+ * restore_disk_objects - put every object of the log into the memory
+ *                        tier of list, oldest first, so the order of
+ *                        the log becomes the recency order of the cache
+ *                        return the number of objects cached
+ */
+int restore_disk_objects(disk_cache_t* disk, cache_list_t* list) {
+
+    disk_super_t* super = disk -> super;
+    disk_record_t* record;
+    disk_entry_t** link;
+    cache_fill_t* fill;
+    unsigned long long offset = super -> tail;
+    unsigned long long walked = 0;
+    char id[MAXLINE];
+    int restored = 0;
+
+    pthread_mutex_lock(&disk -> mutex);
+    while (walked < super -> used) {
+        if (super -> data_size - offset < sizeof(disk_record_t) ||
+            record_at(disk, offset) -> magic == DISK_WRAP_MAGIC) {
+            walked += super -> data_size - offset;
+            offset = 0;
+            continue;
+        }
+        record = record_at(disk, offset);
+        walked += record_size(record);
+
+        // only the newest record of an id is restored
+        if (record -> id_length < MAXLINE) {
+            memcpy(id, record + 1, record -> id_length);
+            id[record -> id_length] = '\0';
+            link = find_entry(disk, id, record -> hash);
+            if (link != NULL && (*link) -> offset == offset &&
+                (fill = begin_cache_fill(list, id)) != NULL) {
+                if (append_cache_fill(fill, (char *)(record + 1) +
+                                      record -> id_length,
+                                      record -> content_length) == 0 &&
+                    fill -> object != NULL) {
+                    fill -> object -> expires = record -> expires;
+                    fill -> object -> lifetime = record -> lifetime;
+                    fill -> object -> stale_window = record -> stale_window;
+                }
+                if (commit_cache_fill(list, fill) == 0) {
+                    restored++;
+                }
+            }
+        }
+
+        offset += record_size(record);
+        if (offset == super -> data_size) {
+            offset = 0;
+        }
+    }
+    pthread_mutex_unlock(&disk -> mutex);
+    return restored;
+}
+
+/*
+ * close_disk_cache - write what is queued, unmap the log and free the
+ *                    tier, the file stays
+ */
+void close_disk_cache(disk_cache_t* disk) {
+
+    pthread_mutex_lock(&disk -> queue_mutex);
+    disk -> stopping = 1;
+    pthread_cond_signal(&disk -> queued);
+    pthread_mutex_unlock(&disk -> queue_mutex);
+    Pthread_join(disk -> writer, NULL);
+    pthread_mutex_destroy(&disk -> queue_mutex);
+    pthread_cond_destroy(&disk -> queued);
+    pthread_cond_destroy(&disk -> room);
+
+    pthread_mutex_lock(&disk -> mutex);
+    clear_index(disk);
+    pthread_mutex_unlock(&disk -> mutex);
+    munmap(disk -> map, DISK_SUPER_SIZE + disk -> super -> data_size);
+    close(disk -> fd);
+    pthread_mutex_destroy(&disk -> mutex);
+    Free(disk);
+}
+
+/*
+ * writer_thread - append the queued objects to the log, a batch at a
+ *                 time, until the tier closes and the queue is empty
+ */
+static void *writer_thread(void *vargp) {
+
+    disk_cache_t* disk = (disk_cache_t *)vargp;
+    disk_job_t* batch;
+
+    pthread_mutex_lock(&disk -> queue_mutex);
+    while (1) {
+        while (disk -> queue == NULL && !disk -> stopping) {
+            pthread_cond_wait(&disk -> queued, &disk -> queue_mutex);
+        }
+        if (disk -> queue == NULL) {
+            break;
+        }
+        batch = disk -> queue;
+        disk -> queue = disk -> queue_tail = NULL;
+        disk -> queue_bytes = 0;
+        pthread_cond_broadcast(&disk -> room);
+        pthread_mutex_unlock(&disk -> queue_mutex);
+
+        // the jobs that did not fit with the others form the next batch
+        while (batch != NULL) {
+            batch = write_batch(disk, batch);
+        }
+
+        pthread_mutex_lock(&disk -> queue_mutex);
+    }
+    pthread_mutex_unlock(&disk -> queue_mutex);
+    return NULL;
+}
+
+/*
+ * write_batch - place, write and sync the records of jobs, in order
+ *               return the jobs left for another batch, which only
+ *               had room in place of the records of this one
+ */
+static disk_job_t* write_batch(disk_cache_t* disk, disk_job_t* jobs) {
+
+    disk_super_t* super = disk -> super;
+    disk_job_t *job, *marker, *placed = NULL, **last = &placed;
+    unsigned long long head, added = 0;
+    unsigned long long tail, used;
+    int rc = 0;
+
+    // place the records, the dropped ones leave the index at once
+    pthread_mutex_lock(&disk -> mutex);
+    tail = super -> tail;
+    used = super -> used;
+    head = super -> head;
+    while ((job = jobs) != NULL) {
+        if ((rc = make_room(disk, job -> size, head, added)) ==
+            DISK_ROOM_LATER) {
+            break;
+        }
+        if (rc == DISK_ROOM_WRAP) {
+            // skip the end of the area, the walk knows to wrap there
+            if (super -> data_size - head >= sizeof(disk_record_t)) {
+                marker = (disk_job_t *)Calloc(1, sizeof(disk_job_t));
+                marker -> offset = head;
+                marker -> size = sizeof(disk_record_t);
+                *last = marker;
+                last = &marker -> next;
+            }
+            added += super -> data_size - head;
+            head = 0;
+            continue;
+        }
+        if (super -> used == 0 && added == 0) {
+            head = 0;
+        }
+        jobs = job -> next;
+        job -> next = NULL;
+        if (rc == -1) {
+            free_job(job);
+            continue;
+        }
+        job -> offset = head;
+        *last = job;
+        last = &job -> next;
+        head += job -> size;
+        if (head == super -> data_size) {
+            head = 0;
+        }
+        added += job -> size;
+    }
+    pthread_mutex_unlock(&disk -> mutex);
+
+    // the file drops the records before their bytes are overwritten
+    if ((super -> tail != tail || super -> used != used) &&
+        sync_range(disk, 0, DISK_SUPER_SIZE) == -1) {
+        added = 0;
+    }
+
+    // nothing points to the placed bytes yet, write them unlocked
+    for (job = placed; added > 0 && job != NULL; job = job -> next) {
+        write_record(disk, job);
+    }
+    if (added > 0 && sync_batch(disk, placed) == 0) {
+        pthread_mutex_lock(&disk -> mutex);
+        for (job = placed; job != NULL; job = job -> next) {
+            if (job -> object != NULL) {
+                index_record(disk, job -> offset);
+            }
+        }
+        super -> head = head;
+        super -> used += added;
+        pthread_mutex_unlock(&disk -> mutex);
+        sync_range(disk, 0, DISK_SUPER_SIZE);
+    }
+
+    while ((job = placed) != NULL) {
+        placed = job -> next;
+        free_job(job);
+    }
+    return jobs;
+}
+
+/*
+ * write_record - copy the record of a placed job into the log, or the
+ *                wrap marker of a job without object
+ */
+static void write_record(disk_cache_t* disk, disk_job_t* job) {
+
+    disk_record_t record;
+    cache_object_t* object = job -> object;
+    cache_segment_t* segment;
+    char* dest = disk -> data + job -> offset;
+
+    if (object == NULL) {
+        record_at(disk, job -> offset) -> magic = DISK_WRAP_MAGIC;
+        return;
+    }
+
+    record.magic = DISK_RECORD_MAGIC;
+    record.hash = job -> hash;
+    record.id_length = strlen(job -> id);
+    record.content_length = object -> length;
+    record.lifetime = object -> lifetime;
+    record.expires = object -> expires;
+    record.stale_window = object -> stale_window;
+    record.content_check = content_check(2166136261u, job -> id,
+                                         record.id_length);
+    for (segment = object -> segments; segment; segment = segment -> next) {
+        record.content_check = content_check(record.content_check,
+                                             segment -> data,
+                                             segment -> length);
+    }
+    record.check = record_check(&record);
+
+    // header, id, then the content segment by segment
+    memcpy(dest, &record, sizeof(disk_record_t));
+    dest += sizeof(disk_record_t);
+    memcpy(dest, job -> id, record.id_length);
+    dest += record.id_length;
+    for (segment = object -> segments; segment; segment = segment -> next) {
+        memcpy(dest, segment -> data, segment -> length);
+        dest += segment -> length;
+    }
+}
+
+/*
+ * sync_batch - sync the placed records, one msync per contiguous run
+ *              return -1 on error
+ */
+static int sync_batch(disk_cache_t* disk, disk_job_t* placed) {
+
+    unsigned long long start = 0, end = 0;
+    disk_job_t* job;
+
+    for (job = placed; job != NULL; job = job -> next) {
+        if (job -> offset != end) {
+            if (end > start &&
+                sync_range(disk, DISK_SUPER_SIZE + start, end - start) == -1) {
+                return -1;
+            }
+            start = job -> offset;
+        }
+        end = job -> offset + job -> size;
+    }
+    if (end > start) {
+        return sync_range(disk, DISK_SUPER_SIZE + start, end - start);
+    }
+    return 0;
+}
+
+/*
+ * free_job - unpin the object of a job and free it
+ */
+static void free_job(disk_job_t* job) {
+
+    if (job -> object != NULL) {
+        release_cache_object(job -> object);
+        Free(job -> id);
+    }
+    Free(job);
+}
+
+/*
+ * make_room - drop the oldest records until size contiguous bytes are
+ *             free at head, the head of a batch that placed added bytes
+ *             so far; those are not written yet and are never dropped,
+ *             an empty log starts over at 0
+ *             the caller must hold the mutex
+ *             return 0 if the record fits at head, DISK_ROOM_WRAP if the
+ *             head has to wrap to the start of the area first,
+ *             DISK_ROOM_LATER if only the batch could make room, -1 if
+ *             the record can never fit
+ */
+static int make_room(disk_cache_t* disk, unsigned long long size,
+                     unsigned long long head, unsigned long long added) {
+
+    disk_super_t* super = disk -> super;
+
+    if (size > super -> data_size) {
+        return -1;
+    }
+
+    while (1) {
+        if (super -> used == 0 && added == 0) {
+            super -> head = super -> tail = head = 0;
+        }
+
+        if ((super -> used == 0 && added == 0) || head > super -> tail) {
+            // records in [tail, head), free space up to the end
+            return (super -> data_size - head >= size) ? 0 : DISK_ROOM_WRAP;
+        }
+        // records in [tail, end) and [0, head), free space up to tail
+        if (super -> tail - head >= size) {
+            return 0;
+        }
+        if (super -> used == 0) {
+            return DISK_ROOM_LATER;
+        }
+        if (drop_tail(disk) == -1) {
+            return -1;
+        }
+    }
+}
+
+/*
+ * drop_tail - drop the oldest record, or the skipped end of the area
+ *             the caller must hold the mutex
+ *             return -1 if the log is inconsistent
+ */
+static int drop_tail(disk_cache_t* disk) {
+
+    disk_super_t* super = disk -> super;
+    unsigned long long size;
+
+    if (super -> data_size - super -> tail < sizeof(disk_record_t) ||
+        record_at(disk, super -> tail) -> magic == DISK_WRAP_MAGIC) {
+        size = super -> data_size - super -> tail;
+    } else if (valid_record(disk, super -> tail)) {
+        size = record_size(record_at(disk, super -> tail));
+        unindex_record(disk, super -> tail);
+    } else {
+        // should not happen, every record up to the head is dropped
+        printf("Disk cache log corrupted, dropped.\n");
+        clear_index(disk);
+        super -> tail = super -> head;
+        super -> used = 0;
+        return 0;
+    }
+
+    super -> tail += size;
+    if (super -> tail >= super -> data_size) {
+        super -> tail = 0;
+    }
+    super -> used -= size;
+    return 0;
+}
+
+/*
+ * record_at - the record header at offset of the data area
+ */
+static disk_record_t* record_at(disk_cache_t* disk, unsigned long long offset) {
+
+    return (disk_record_t *)(disk -> data + offset);
+}
+
+/*
+ * valid_record - check that a complete record starts at offset
+ */
+static int valid_record(disk_cache_t* disk, unsigned long long offset) {
+
+    disk_record_t* record;
+
+    if (disk -> super -> data_size - offset < sizeof(disk_record_t)) {
+        return 0;
+    }
+    record = record_at(disk, offset);
+    return record -> magic == DISK_RECORD_MAGIC &&
+           record -> check == record_check(record) &&
+           record_size(record) <= disk -> super -> data_size - offset;
+}
+
+/*
+ * valid_content - check the id and the content of a valid record
+ */
+static int valid_content(disk_cache_t* disk, unsigned long long offset) {
+
+    disk_record_t* record = record_at(disk, offset);
+
+    return record -> content_check ==
+           content_check(2166136261u, (char *)(record + 1),
+                         record -> id_length +
+                         (size_t)record -> content_length);
+}
+
+/*
+ * record_check - checksum of the header fields
+ */
+static unsigned int record_check(disk_record_t* record) {
+
+    unsigned int check = record -> magic;
+
+    check = check * 16777619u ^ record -> hash;
+    check = check * 16777619u ^ record -> id_length;
+    check = check * 16777619u ^ record -> content_length;
+    check = check * 16777619u ^ (unsigned int)record -> expires;
+    check = check * 16777619u ^ record -> content_check;
+    return check;
+}
+
+/*
+ * content_check - continue the fnv-1a checksum check over length bytes
+ */
+static unsigned int content_check(unsigned int check, char* data,
+                                  size_t length) {
+
+    unsigned char* p = (unsigned char *)data;
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        check = (check ^ p[i]) * 16777619u;
+    }
+    return check;
+}
+
+/*
+ * sync_range - write the length bytes at start of the file through to
+ *              it, from the start of their first page
+ *              return -1 on error
+ */
+static int sync_range(disk_cache_t* disk, unsigned long long start,
+                      unsigned long long length) {
+
+    unsigned long long page = sysconf(_SC_PAGESIZE);
+    unsigned long long aligned = start & ~(page - 1);
+
+    if (msync(disk -> map + aligned, start - aligned + length,
+              MS_SYNC) == -1) {
+        printf("Sync disk cache error: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * record_size - bytes taken by the record in the log
+ */
+static unsigned long long record_size(disk_record_t* record) {
+
+    return DISK_ALIGN(sizeof(disk_record_t) + (unsigned long long)
+                      record -> id_length + record -> content_length);
+}
+
+/*
+ * find_entry - look up the index entry of id
+ *              the caller must hold the mutex
+ *              return the link to the entry, NULL if not found
+ */
+static disk_entry_t** find_entry(disk_cache_t* disk, char* id,
+                                 unsigned int hash) {
+
+    disk_entry_t** link = &disk -> buckets[hash & (DISK_BUCKET_NUM - 1)];
+    disk_record_t* record;
+    size_t id_length = strlen(id);
+
+    for (; *link != NULL; link = &(*link) -> next) {
+        if ((*link) -> hash != hash) {
+            continue;
+        }
+        record = record_at(disk, (*link) -> offset);
+        if (record -> id_length == id_length &&
+            memcmp(record + 1, id, id_length) == 0) {
+            return link;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * index_record - index the record at offset, replacing the entry of an
+ *                older record of the same id
+ *                the caller must hold the mutex
+ */
+static void index_record(disk_cache_t* disk, unsigned long long offset) {
+
+    disk_record_t* record = record_at(disk, offset);
+    disk_entry_t** link;
+    disk_entry_t* entry;
+    char id[MAXLINE];
+
+    if (record -> id_length >= MAXLINE) {
+        return;
+    }
+    memcpy(id, record + 1, record -> id_length);
+    id[record -> id_length] = '\0';
+
+    if ((link = find_entry(disk, id, record -> hash)) != NULL) {
+        (*link) -> offset = offset;
+        return;
+    }
+
+    entry = (disk_entry_t *)Malloc(sizeof(disk_entry_t));
+    entry -> hash = record -> hash;
+    entry -> offset = offset;
+    entry -> next = disk -> buckets[record -> hash & (DISK_BUCKET_NUM - 1)];
+    disk -> buckets[record -> hash & (DISK_BUCKET_NUM - 1)] = entry;
+    disk -> entry_num++;
+}
+
+/*
+ * unindex_record - remove the entry pointing at the record at offset,
+ *                  if a newer record did not take it over
+ *                  the caller must hold the mutex
+ */
+static void unindex_record(disk_cache_t* disk, unsigned long long offset) {
+
+    disk_record_t* record = record_at(disk, offset);
+    disk_entry_t** link = &disk -> buckets[record -> hash &
+                                           (DISK_BUCKET_NUM - 1)];
+    disk_entry_t* entry;
+
+    for (; (entry = *link) != NULL; link = &entry -> next) {
+        if (entry -> offset == offset) {
+            *link = entry -> next;
+            Free(entry);
+            disk -> entry_num--;
+            return;
+        }
+    }
+}
+
+/*
+ * rebuild_index - index every record from tail to head, the log is cut
+ *                 at the first record that is not complete
+ */
+static void rebuild_index(disk_cache_t* disk) {
+
+    disk_super_t* super = disk -> super;
+    unsigned long long offset = super -> tail;
+    unsigned long long walked = 0, size;
+
+    while (walked < super -> used) {
+        if (super -> data_size - offset < sizeof(disk_record_t) ||
+            record_at(disk, offset) -> magic == DISK_WRAP_MAGIC) {
+            // the skipped end of the area
+            walked += super -> data_size - offset;
+            offset = 0;
+            continue;
+        }
+        if (!valid_record(disk, offset) || !valid_content(disk, offset)) {
+            printf("Disk cache log cut at a torn record.\n");
+            super -> head = offset;
+            super -> used = walked;
+            break;
+        }
+        size = record_size(record_at(disk, offset));
+        index_record(disk, offset);
+        walked += size;
+        offset += size;
+        if (offset == super -> data_size) {
+            offset = 0;
+        }
+    }
+
+    printf("Disk cache: %u objects indexed.\n", disk -> entry_num);
+    fflush(stdout);
+}
+
+/*
+ * clear_index - free every index entry
+ *               the caller must hold the mutex
+ */
+static void clear_index(disk_cache_t* disk) {
+
+    disk_entry_t* entry;
+    int i;
+
+    for (i = 0; i < DISK_BUCKET_NUM; i++) {
+        while ((entry = disk -> buckets[i]) != NULL) {
+            disk -> buckets[i] = entry -> next;
+            Free(entry);
+        }
+    }
+    disk -> entry_num = 0;
+}
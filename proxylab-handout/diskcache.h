@@ -0,0 +1,116 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * diskcache.h - prototypes and definitions for diskcache.c
+ */
+#ifndef __DISKCACHE_H__
+#define __DISKCACHE_H__
+
+#include "csapp.h"
+#include "cache.h"
+
+/* Number of buckets of the in-memory index, always a power of 2 */
+#define DISK_BUCKET_NUM 4096
+
+/* Default size of the log file in megabytes */
+#define DISK_DEFAULT_SIZE 64
+
+/* Bytes reserved at the start of the file for the superblock */
+#define DISK_SUPER_SIZE 4096
+
+/* Magic numbers of the superblock, the records and the wrap marker */
+#define DISK_SUPER_MAGIC  0x50584443u  /* "PXDC" */
+#define DISK_RECORD_MAGIC 0x52454344u  /* "RECD" */
+#define DISK_WRAP_MAGIC   0x57524150u  /* "WRAP" */
+
+/* Bytes of objects waiting for the writer before more are turned away */
+#define DISK_QUEUE_SIZE (16UL << 20)
+
+/* Version of the file layout, a file of another version is discarded */
+#define DISK_VERSION 3
+
+/*
+ * Defined a struct representing the superblock at the start of the file:
+ * records live in a circular log in the data area, tail is the oldest
+ * record, head where the next one is written, used counts the bytes
+ * between them including the unused end of the area before a wrap
+ */
+typedef struct disk_super_t {
+    unsigned int magic;
+    unsigned int version;
+    unsigned long long data_size;
+    unsigned long long head;
+    unsigned long long tail;
+    unsigned long long used;
+} disk_super_t;
+
+/*
+ * Defined a struct representing the header of one record, followed by
+ * the cache id and the content, the whole record padded to 8 bytes
+ */
+typedef struct disk_record_t {
+    unsigned int magic;
+    unsigned int hash;
+    unsigned int id_length;
+    unsigned int content_length;
+    unsigned int check;             // detects a torn header
+    int lifetime;                   // freshness of the object
+    long long expires;
+    int stale_window;
+    unsigned int content_check;     // detects a torn id or content
+} disk_record_t;
+
+/*
+ * Defined a struct representing one object waiting for the writer thread,
+ * or a wrap marker once a batch placed it (object NULL)
+ */
+typedef struct disk_job_t {
+    char* id;
+    unsigned int hash;
+    cache_object_t* object;         // pinned until it is written
+    unsigned long long offset;      // of its record in the data area
+    unsigned long long size;
+    struct disk_job_t* next;
+} disk_job_t;
+
+/* Defined a struct representing the index entry of one record */
+typedef struct disk_entry_t {
+    unsigned int hash;
+    unsigned long long offset;      // of the record in the data area
+    struct disk_entry_t* next;
+} disk_entry_t;
+
+/* Defined a struct representing the on-disk second tier of the cache */
+typedef struct disk_cache_t {
+    int fd;
+    char* map;                      // the whole file
+    disk_super_t* super;
+    char* data;                     // the data area after the superblock
+    disk_entry_t* buckets[DISK_BUCKET_NUM];
+    unsigned int entry_num;
+    size_t max_object;              // object size limit of the cache
+    pthread_mutex_t mutex;
+
+    /* objects queued for the writer thread, under queue_mutex */
+    disk_job_t* queue;
+    disk_job_t* queue_tail;
+    size_t queue_bytes;
+    int stopping;
+    pthread_t writer;
+    pthread_mutex_t queue_mutex;
+    pthread_cond_t queued;          // jobs or the stop, to the writer
+    pthread_cond_t room;            // the queue was taken, to the producers
+} disk_cache_t;
+
+/* Defined function managing the on-disk tier */
+disk_cache_t* open_disk_cache(char* path, size_t size, size_t max_object);
+int queue_disk_object(disk_cache_t* disk, char* id, unsigned int hash,
+                      cache_object_t* object, int wait);
+cache_object_t* load_disk_object(disk_cache_t* disk, char* id,
+                                 unsigned int hash);
+int has_disk_object(disk_cache_t* disk, char* id, unsigned int hash);
+int restore_disk_objects(disk_cache_t* disk, cache_list_t* list);
+void close_disk_cache(disk_cache_t* disk);
+
+#endif /* __DISKCACHE_H__ */
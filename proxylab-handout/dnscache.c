@@ -0,0 +1,394 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * dnscache.c - resolved address cache for the connections to servers.
+ * Implementation idea:
+ * 1. index the resolved addresses by "host:port" in a hash table,
+ *    an entry is trusted for ttl seconds since getaddrinfo gives no TTL
+ * 2. a host that cannot be resolved is remembered as a negative entry
+ *    for a shorter time, so a bad host does not hit the resolver on
+ *    every request
+ * 3. with refresh ahead, a hit on an entry close to its expiry starts
+ *    one detached thread to resolve it again, the hit itself returns
+ *    the current addresses and never waits for the resolver
+ * 4. a lookup is split into dns_cached, which never calls the resolver,
+ *    and dns_resolve, which does and stores the answer; a thread simply
+ *    does both (dns_lookup), an event loop hands dns_resolve to another
+ *    thread on a miss so that it never waits for the resolver
+ * 5. the cache is off until init_dns_cache, every lookup then goes
+ *    straight to the resolver
+ * 6. the resolver is a hook, getaddrinfo by default, so that a stub
+ *    can stand in for it (see dnscheck.c)
+ *
+ */
+#include "csapp.h"
+#include "cache.h"
+#include "dnscache.h"
+
+/* Defined a struct representing the arguments of a background refresh */
+typedef struct dns_refresh_t {
+    char* host;
+    char* port;
+} dns_refresh_t;
+
+/* the cache shared by every thread, NULL while it is disabled */
+static dns_cache_t* dns_cache = NULL;
+
+/* Static helper functions for the address cache */
+static dns_entry_t* find_entry(char* key, unsigned int hash);
+static void store_entry(char* key, dns_addr_t* addrs, int addr_num);
+static void remove_expired(time_t now);
+static void start_refresh(dns_entry_t* entry, char* host, char* port);
+static void *refresh_thread(void *vargp);
+static int cacheable_error(int rc);
+static int resolve_getaddrinfo(char* host, char* port,
+                               dns_addr_t* addrs, int max_addr);
+
+/* resolver called on a miss and by the refresh threads */
+static dns_resolver_t dns_resolver = resolve_getaddrinfo;
+
+/*
+ * init_dns_cache - enable the cache, ttl 0 leaves it disabled;
+ *                  called once before the first lookup
+ */
+void init_dns_cache(int ttl, int negative_ttl, int refresh_ahead) {
+
+    dns_cache_t* cache;
+
+    if (ttl <= 0) {
+        return;
+    }
+
+    cache = (dns_cache_t *)Calloc(1, sizeof(dns_cache_t));
+    cache -> ttl = ttl;
+    cache -> negative_ttl = negative_ttl;
+    cache -> refresh_ahead = refresh_ahead;
+    Sem_init(&cache -> mutex, 0, 1);
+    dns_cache = cache;
+
+}
+
+/*
+ * set_dns_resolver - replace the resolver, NULL restores getaddrinfo;
+ *                    called before init_dns_cache, while no thread
+ *                    resolves
+ */
+void set_dns_resolver(dns_resolver_t resolver) {
+
+    dns_resolver = (resolver != NULL) ? resolver : resolve_getaddrinfo;
+
+}
+
+/*
+ * dns_lookup - get up to max_addr addresses of host:port, asking the
+ *              resolver on a miss
+ *              return the number of addresses, -1 if it cannot be resolved
+ */
+int dns_lookup(char* host, char* port, dns_addr_t* addrs, int max_addr) {
+
+    int n;
+
+    if ((n = dns_cached(host, port, addrs, max_addr)) == DNS_MISS) {
+        n = dns_resolve(host, port, addrs, max_addr);
+    }
+    return n;
+}
+
+/*
+ * dns_cached - get up to max_addr addresses of host:port from the cache
+ *              only, the resolver is never called
+ *              return the number of addresses, -1 for a negative entry,
+ *              DNS_MISS if it has to be resolved
+ */
+int dns_cached(char* host, char* port, dns_addr_t* addrs, int max_addr) {
+
+    char key[MAXLINE];
+    dns_entry_t* entry;
+    time_t now;
+    int n;
+
+    if (dns_cache == NULL) {
+        return DNS_MISS;
+    }
+    if (max_addr > DNS_MAX_ADDR) {
+        max_addr = DNS_MAX_ADDR;
+    }
+
+    snprintf(key, MAXLINE, "%s:%s", host, port);
+    now = time(NULL);
+
+    P(&dns_cache -> mutex);
+    entry = find_entry(key, hash_cache_id(key));
+    if (entry == NULL || entry -> expire <= now) {
+        V(&dns_cache -> mutex);
+        return DNS_MISS;
+    }
+
+    // hit, copy the addresses out while holding the lock
+    n = (entry -> addr_num < max_addr) ? entry -> addr_num : max_addr;
+    memcpy(addrs, entry -> addrs, n * sizeof(dns_addr_t));
+    if (n > 0 && dns_cache -> refresh_ahead && !entry -> refreshing &&
+        entry -> expire - now <= dns_cache -> ttl / DNS_REFRESH_DIV) {
+        start_refresh(entry, host, port);
+    }
+    V(&dns_cache -> mutex);
+    return (n > 0) ? n : -1;
+}
+
+/*
+ * dns_resolve - ask the resolver for up to max_addr addresses of
+ *               host:port and store the answer, blocks the calling thread
+ *               return the number of addresses, -1 if it cannot be resolved
+ */
+int dns_resolve(char* host, char* port, dns_addr_t* addrs, int max_addr) {
+
+    char key[MAXLINE];
+    dns_addr_t resolved[DNS_MAX_ADDR];
+    int rc, n;
+
+    if (max_addr > DNS_MAX_ADDR) {
+        max_addr = DNS_MAX_ADDR;
+    }
+
+    // cache disabled, nothing to store
+    if (dns_cache == NULL) {
+        rc = dns_resolver(host, port, addrs, max_addr);
+        return (rc > 0) ? rc : -1;
+    }
+
+    // resolve without holding the lock
+    snprintf(key, MAXLINE, "%s:%s", host, port);
+    rc = dns_resolver(host, port, resolved, DNS_MAX_ADDR);
+    if (rc > 0) {
+        store_entry(key, resolved, rc);
+        n = (rc < max_addr) ? rc : max_addr;
+        memcpy(addrs, resolved, n * sizeof(dns_addr_t));
+        return n;
+    }
+    if (cacheable_error(rc)) {
+        store_entry(key, NULL, 0);
+    }
+    return -1;
+}
+
+/*
+ * open_cached_clientfd - open_clientfd_timeout resolving host:port
+ *                        through the cache
+ *                        return -1 on error with errno set as
+ *                        open_clientfd_timeout does
+ */
+int open_cached_clientfd(char* host, char* port, int timeout_ms) {
+
+    dns_addr_t addrs[DNS_MAX_ADDR];
+    int clientfd, i, n;
+
+    if ((n = dns_lookup(host, port, addrs, DNS_MAX_ADDR)) < 0) {
+        return -1;
+    }
+
+    // walk the list for one that accepts the connection
+    for (i = 0; i < n; i++) {
+        if ((clientfd = socket(addrs[i].family, addrs[i].socktype,
+                               addrs[i].protocol)) < 0) {
+            continue;
+        }
+        if (timed_connect(clientfd, (SA *)&addrs[i].addr, addrs[i].addrlen,
+                          timeout_ms) != -1) {
+            return clientfd;
+        }
+        Close(clientfd);
+    }
+    return -1;
+}
+
+/*
+ * resolve_getaddrinfo - the default resolver, ask getaddrinfo for the
+ *                       stream addresses of host:port
+ *                       return the number of addresses, or an EAI_* code
+ */
+static int resolve_getaddrinfo(char* host, char* port,
+                               dns_addr_t* addrs, int max_addr) {
+
+    struct addrinfo hints, *listp, *p;
+    int rc, n = 0;
+
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_socktype = SOCK_STREAM;  // open a connection
+    hints.ai_flags = AI_NUMERICSERV;  // using a numeric port arg
+    hints.ai_flags |= AI_ADDRCONFIG;  // recommended for connections
+    if ((rc = getaddrinfo(host, port, &hints, &listp)) != 0) {
+        return rc;
+    }
+
+    for (p = listp; p && n < max_addr; p = p -> ai_next) {
+        if (p -> ai_addrlen > sizeof(struct sockaddr_storage)) {
+            continue;
+        }
+        addrs[n].family = p -> ai_family;
+        addrs[n].socktype = p -> ai_socktype;
+        addrs[n].protocol = p -> ai_protocol;
+        addrs[n].addrlen = p -> ai_addrlen;
+        memcpy(&addrs[n].addr, p -> ai_addr, p -> ai_addrlen);
+        n++;
+    }
+    freeaddrinfo(listp);
+
+    return (n > 0) ? n : EAI_NONAME;
+}
+
+/*
+ * find_entry - look up the entry of key
+ *              the caller must hold the cache mutex
+ */
+static dns_entry_t* find_entry(char* key, unsigned int hash) {
+
+    dns_entry_t* entry = dns_cache -> buckets[hash & (DNS_BUCKET_NUM - 1)];
+
+    for (; entry; entry = entry -> hnext) {
+        if (entry -> hash == hash && strcmp(entry -> key, key) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * store_entry - insert or update the addresses of key, addr_num 0 stores
+ *               a negative entry; nothing is stored if the table is full
+ *               of entries that have not expired
+ */
+static void store_entry(char* key, dns_addr_t* addrs, int addr_num) {
+
+    unsigned int hash = hash_cache_id(key);
+    unsigned int index = hash & (DNS_BUCKET_NUM - 1);
+    dns_entry_t* entry;
+    time_t now = time(NULL);
+
+    P(&dns_cache -> mutex);
+
+    if ((entry = find_entry(key, hash)) == NULL) {
+        if (dns_cache -> entry_num >= DNS_MAX_ENTRY) {
+            remove_expired(now);
+        }
+        if (dns_cache -> entry_num >= DNS_MAX_ENTRY) {
+            V(&dns_cache -> mutex);
+            return;
+        }
+        entry = (dns_entry_t *)Calloc(1, sizeof(dns_entry_t));
+        entry -> key = (char *)Malloc(strlen(key) + 1);
+        strcpy(entry -> key, key);
+        entry -> hash = hash;
+        entry -> hnext = dns_cache -> buckets[index];
+        dns_cache -> buckets[index] = entry;
+        dns_cache -> entry_num++;
+    }
+
+    if (addr_num > 0) {
+        memcpy(entry -> addrs, addrs, addr_num * sizeof(dns_addr_t));
+        entry -> expire = now + dns_cache -> ttl;
+    } else {
+        entry -> expire = now + dns_cache -> negative_ttl;
+    }
+    entry -> addr_num = addr_num;
+
+    V(&dns_cache -> mutex);
+}
+
+/*
+ * remove_expired - free every expired entry that is not being refreshed
+ *                  the caller must hold the cache mutex
+ */
+static void remove_expired(time_t now) {
+
+    dns_entry_t** link;
+    dns_entry_t* entry;
+    int i;
+
+    for (i = 0; i < DNS_BUCKET_NUM; i++) {
+        link = &dns_cache -> buckets[i];
+        while ((entry = *link) != NULL) {
+            if (entry -> expire <= now && !entry -> refreshing) {
+                *link = entry -> hnext;
+                dns_cache -> entry_num--;
+                Free(entry -> key);
+                Free(entry);
+            } else {
+                link = &entry -> hnext;
+            }
+        }
+    }
+}
+
+/*
+ * start_refresh - resolve the entry again in a detached thread,
+ *                 at most one refresh runs per entry
+ *                 the caller must hold the cache mutex
+ */
+static void start_refresh(dns_entry_t* entry, char* host, char* port) {
+
+    dns_refresh_t* refresh;
+    pthread_t tid;
+
+    refresh = (dns_refresh_t *)Malloc(sizeof(dns_refresh_t));
+    refresh -> host = (char *)Malloc(strlen(host) + 1);
+    strcpy(refresh -> host, host);
+    refresh -> port = (char *)Malloc(strlen(port) + 1);
+    strcpy(refresh -> port, port);
+
+    if (pthread_create(&tid, NULL, refresh_thread, refresh) != 0) {
+        // keep serving the current addresses, a later hit retries
+        Free(refresh -> host);
+        Free(refresh -> port);
+        Free(refresh);
+        return;
+    }
+    entry -> refreshing = 1;
+}
+
+/*
+ * refresh_thread - background refresh routine; a failed refresh keeps
+ *                  the current addresses until they expire
+ */
+static void *refresh_thread(void *vargp) {
+
+    dns_refresh_t* refresh = (dns_refresh_t *)vargp;
+    dns_addr_t resolved[DNS_MAX_ADDR];
+    char key[MAXLINE];
+    dns_entry_t* entry;
+    int rc;
+
+    Pthread_detach(pthread_self());
+
+    snprintf(key, MAXLINE, "%s:%s", refresh -> host, refresh -> port);
+    rc = dns_resolver(refresh -> host, refresh -> port,
+                      resolved, DNS_MAX_ADDR);
+    if (rc > 0) {
+        store_entry(key, resolved, rc);
+    }
+
+    P(&dns_cache -> mutex);
+    if ((entry = find_entry(key, hash_cache_id(key))) != NULL) {
+        entry -> refreshing = 0;
+    }
+    V(&dns_cache -> mutex);
+
+    Free(refresh -> host);
+    Free(refresh -> port);
+    Free(refresh);
+    return NULL;
+}
+
+/*
+ * cacheable_error - only a definite answer is cached negatively,
+ *                   a temporary resolver failure is retried next time
+ */
+static int cacheable_error(int rc) {
+
+#ifdef EAI_NODATA
+    if (rc == EAI_NODATA) {
+        return 1;
+    }
+#endif
+    return rc == 0 || rc == EAI_NONAME;
+}
@@ -0,0 +1,76 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * dnscache.h - prototypes and definitions for dnscache.c
+ */
+#ifndef __DNSCACHE_H__
+#define __DNSCACHE_H__
+
+#include "csapp.h"
+
+/* Number of buckets of the resolved address table, always a power of 2 */
+#define DNS_BUCKET_NUM 256
+
+/* Max number of host:port entries kept in the table */
+#define DNS_MAX_ENTRY 1024
+
+/* Max number of addresses kept for one host:port */
+#define DNS_MAX_ADDR 8
+
+/* Default seconds a resolved (or unresolvable) host:port is trusted */
+#define DNS_DEFAULT_TTL 60
+#define DNS_NEGATIVE_TTL 5
+
+/* Refresh in the background once less than ttl / DNS_REFRESH_DIV is left */
+#define DNS_REFRESH_DIV 4
+
+/* Returned by dns_cached when host:port has to be resolved */
+#define DNS_MISS -2
+
+/* Defined a struct representing one resolved server address */
+typedef struct dns_addr_t {
+    int family;
+    int socktype;
+    int protocol;
+    socklen_t addrlen;
+    struct sockaddr_storage addr;
+} dns_addr_t;
+
+/*
+ * Resolver called on a miss, fills up to max_addr addresses
+ * return the number of addresses, or an EAI_* error code
+ */
+typedef int (*dns_resolver_t)(char* host, char* port,
+                              dns_addr_t* addrs, int max_addr);
+
+/* Defined a struct representing the addresses of one host:port */
+typedef struct dns_entry_t {
+    char* key;
+    unsigned int hash;
+    dns_addr_t addrs[DNS_MAX_ADDR];
+    int addr_num;                   // 0 for a negative entry
+    time_t expire;
+    int refreshing;                 // a background refresh is running
+    struct dns_entry_t* hnext;
+} dns_entry_t;
+
+/* Defined a struct representing the resolved address cache */
+typedef struct dns_cache_t {
+    dns_entry_t* buckets[DNS_BUCKET_NUM];
+    int entry_num;
+    int ttl;                        // seconds a resolved entry is trusted
+    int negative_ttl;
+    int refresh_ahead;
+    sem_t mutex;
+} dns_cache_t;
+
+/* Defined function caching the resolution of upstream servers */
+void init_dns_cache(int ttl, int negative_ttl, int refresh_ahead);
+void set_dns_resolver(dns_resolver_t resolver);
+int dns_lookup(char* host, char* port, dns_addr_t* addrs, int max_addr);
+int dns_cached(char* host, char* port, dns_addr_t* addrs, int max_addr);
+int dns_resolve(char* host, char* port, dns_addr_t* addrs, int max_addr);
+int open_cached_clientfd(char* host, char* port, int timeout_ms);
+
+#endif /* __DNSCACHE_H__ */
@@ -0,0 +1,187 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * dnscheck.c - checks of the resolved address cache with a stub resolver.
+ * Implementation idea:
+ * 1. a stub stands in for getaddrinfo (set_dns_resolver) and counts its
+ *    calls per host: "good" hosts resolve to 127.0.0.1, "bad" is
+ *    unknown (EAI_NONAME) and "flaky" fails for now (EAI_AGAIN)
+ * 2. every check looks a host up through dns_lookup and compares the
+ *    number of resolver calls with the expected one: a hit costs none,
+ *    a miss, an expired entry or an expired negative entry one, a
+ *    temporary failure is never cached
+ * 3. the cache trusts an entry for CHECK_TTL seconds, so the checks
+ *    wait on the clock; a hit within the last CHECK_TTL / DNS_REFRESH_DIV
+ *    seconds must start exactly one refresh, which runs in the
+ *    background and extends the entry
+ *
+ * usage: ./dnscheck
+ *        prints one line per check, exits with the number of failures
+ */
+#include "csapp.h"
+#include "dnscache.h"
+
+/* Seconds a resolved and an unresolvable host are trusted */
+#define CHECK_TTL 8
+#define CHECK_NEGATIVE_TTL 1
+
+/* Hosts known to the stub, by index into the call counters */
+#define HOST_GOOD 0
+#define HOST_OTHER 1
+#define HOST_BAD 2
+#define HOST_FLAKY 3
+#define HOST_NUM 4
+
+static char* host_names[HOST_NUM] = {"good", "other", "bad", "flaky"};
+
+/* calls of the stub per host, the refresh threads count too */
+static int resolver_calls[HOST_NUM];
+
+static int failed = 0;
+
+static int stub_resolver(char* host, char* port,
+                         dns_addr_t* addrs, int max_addr);
+static int calls(int host);
+static void check(char* name, int host, int expect_found, int expect_calls);
+static void wait_until(time_t when);
+static int wait_for_calls(int host, int count);
+
+int main(int argc, char **argv) {
+
+    time_t start;
+
+    set_dns_resolver(stub_resolver);
+    init_dns_cache(CHECK_TTL, CHECK_NEGATIVE_TTL, 1);
+    start = time(NULL);
+
+    check("miss", HOST_GOOD, 1, 1);
+    check("hit", HOST_GOOD, 1, 1);
+    check("miss of another host", HOST_OTHER, 1, 1);
+    check("negative miss", HOST_BAD, 0, 1);
+    check("negative hit", HOST_BAD, 0, 1);
+    check("temporary failure", HOST_FLAKY, 0, 1);
+    check("temporary failure not cached", HOST_FLAKY, 0, 2);
+
+    // the negative entry was stored by start + 1
+    wait_until(start + 1 + CHECK_NEGATIVE_TTL + 1);
+    check("negative expiry", HOST_BAD, 0, 2);
+
+    // the entry expires at start + CHECK_TTL (+ 1), the refresh window
+    // of CHECK_TTL / DNS_REFRESH_DIV seconds is open one second earlier
+    wait_until(start + CHECK_TTL - 1);
+    // the refresh may already count when the hit returns
+    check("hit near expiry", HOST_GOOD, 1, -1);
+    if (wait_for_calls(HOST_GOOD, 2) == 0) {
+        printf("dns: refresh ahead: ok\n");
+    } else {
+        printf("dns: refresh ahead: FAILED, %d resolver calls of 2\n",
+               calls(HOST_GOOD));
+        failed++;
+    }
+    check("hit after refresh", HOST_GOOD, 1, 2);
+
+    // the other host was never hit again, its entry is gone by now
+    wait_until(start + 1 + CHECK_TTL + 1);
+    check("expiry", HOST_OTHER, 1, 2);
+    check("hit after expiry", HOST_OTHER, 1, 2);
+
+    printf("dns: %d checks failed.\n", failed);
+    exit(failed);
+}
+
+/*
+ * stub_resolver - count the call and answer for the hosts of the check
+ */
+static int stub_resolver(char* host, char* port,
+                         dns_addr_t* addrs, int max_addr) {
+
+    struct sockaddr_in* addr;
+    int i;
+
+    for (i = 0; i < HOST_NUM; i++) {
+        if (strcmp(host, host_names[i]) == 0) {
+            break;
+        }
+    }
+    if (i == HOST_NUM) {
+        return EAI_NONAME;
+    }
+    __atomic_add_fetch(&resolver_calls[i], 1, __ATOMIC_RELAXED);
+
+    if (i == HOST_BAD) {
+        return EAI_NONAME;
+    }
+    if (i == HOST_FLAKY) {
+        return EAI_AGAIN;
+    }
+
+    memset(&addrs[0], 0, sizeof(dns_addr_t));
+    addr = (struct sockaddr_in *)&addrs[0].addr;
+    addr -> sin_family = AF_INET;
+    addr -> sin_port = htons(atoi(port));
+    addr -> sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addrs[0].family = AF_INET;
+    addrs[0].socktype = SOCK_STREAM;
+    addrs[0].addrlen = sizeof(struct sockaddr_in);
+    return 1;
+}
+
+/*
+ * calls - the number of resolver calls for host so far
+ */
+static int calls(int host) {
+
+    return __atomic_load_n(&resolver_calls[host], __ATOMIC_RELAXED);
+}
+
+/*
+ * check - look host up, expecting an address or not, and expecting
+ *         the resolver to have been called expect_calls times since
+ *         the start, -1 if any number will do
+ */
+static void check(char* name, int host, int expect_found, int expect_calls) {
+
+    dns_addr_t addrs[DNS_MAX_ADDR];
+    int n, found;
+
+    n = dns_lookup(host_names[host], "80", addrs, DNS_MAX_ADDR);
+    found = (n > 0);
+    if (found == expect_found &&
+        (expect_calls < 0 || calls(host) == expect_calls)) {
+        printf("dns: %s: ok\n", name);
+        return;
+    }
+    printf("dns: %s: FAILED, %s with %d resolver calls, expected %s "
+           "with %d\n", name, found ? "found" : "not found", calls(host),
+           expect_found ? "found" : "not found", expect_calls);
+    failed++;
+}
+
+/*
+ * wait_until - sleep until the clock of the cache reaches when
+ */
+static void wait_until(time_t when) {
+
+    while (time(NULL) < when) {
+        usleep(50000);
+    }
+}
+
+/*
+ * wait_for_calls - wait up to a second for the resolver calls of host
+ *                  to reach count
+ *                  return -1 if they did not
+ */
+static int wait_for_calls(int host, int count) {
+
+    int i;
+
+    for (i = 0; i < 20; i++) {
+        if (calls(host) >= count) {
+            return 0;
+        }
+        usleep(50000);
+    }
+    return -1;
+}
@@ -0,0 +1,599 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * encoding.c - cached objects stored compressed and decoded on demand.
+ * Implementation idea:
+ * 1. the server is asked for gzip when the client accepts it and for
+ *    identity otherwise, so the response relayed on a miss always suits
+ *    its client (see check_request_header)
+ * 2. while a 200 response fills the cache, a text body received as
+ *    identity is compressed with gzip and a gzip body that is chunked or
+ *    ends with the connection is copied without its framing, a few bytes
+ *    at a time as they are relayed, so that the commit only ends the
+ *    stream and puts the stored header in front; every gzip object is
+ *    then one plain gzip stream after its header, and the compressed
+ *    object gets Vary: Accept-Encoding and a weak ETag
+ * 3. a gzip body from the server is inflated as it is relayed too, and
+ *    is only cached if it is a single gzip stream of less than 4GB, so
+ *    that its trailer gives the decoded length
+ * 4. a client accepting gzip gets the object as it is, any other client
+ *    gets it decoded buffer by buffer while it is written, with the
+ *    decoded length from the gzip trailer as its Content-Length
+ * 5. one object serves both kinds of clients, so the cache id stays the
+ *    same and Vary: Accept-Encoding is honoured without a second copy;
+ *    Vary on a header the proxy does not send the same way for every
+ *    client makes the response unstorable (see freshness.c)
+ *
+ */
+#include "csapp.h"
+#include "cache.h"
+#include "conditional.h"
+#include "encoding.h"
+
+/* Static helper functions for the compressed objects */
+static int header_is_identity(cached_header_t* header);
+static int type_is_compressible(char* type);
+static void take_body(encoder_t* encoder, char* data, size_t n);
+static void feed_body(encoder_t* encoder, char* data, size_t n);
+static int deflate_body(encoder_t* encoder, int flush);
+static size_t build_stored_head(cache_object_t* object,
+                                cached_header_t* header, int compressed,
+                                long length, char* head);
+
+/*
+ * accepts_gzip - check whether an Accept-Encoding value lets the client
+ *                take gzip: gzip, x-gzip or * without q=0
+ */
+int accepts_gzip(char* value) {
+
+    char *coding, *params;
+    size_t length;
+    int star = 0;
+
+    while (*value != '\0') {
+        value += strspn(value, " \t,");
+        coding = value;
+        length = strcspn(coding, " \t;,\r\n");
+        value += strcspn(value, ",");
+        if (length == 0) {
+            continue;
+        }
+
+        // a q of 0 refuses the coding, any other accepts it
+        params = coding + length;
+        params += strspn(params, " \t;");
+        if (!strncasecmp(params, "q=", 2) && strtod(params + 2, NULL) <= 0) {
+            if (length == 4 && !strncasecmp(coding, "gzip", 4)) {
+                return 0;
+            }
+            continue;
+        }
+        if ((length == 4 && !strncasecmp(coding, "gzip", 4)) ||
+            (length == 6 && !strncasecmp(coding, "x-gzip", 6))) {
+            return 1;
+        }
+        star |= (length == 1 && *coding == '*');
+    }
+    return star;
+}
+
+/*
+ * header_is_gzip - check whether a cached response is gzip encoded
+ */
+int header_is_gzip(cached_header_t* header) {
+
+    return !strcasecmp(header -> content_encoding, "gzip") ||
+           !strcasecmp(header -> content_encoding, "x-gzip");
+}
+
+/*
+ * gzip_decoded_length - length of the decoded body of a cached gzip
+ *                       response stored with a plain body, from the gzip
+ *                       trailer, which encode_cache_fill checked
+ *                       return -1 if the body cannot be decoded this way
+ */
+long gzip_decoded_length(cache_object_t* object, cached_header_t* header) {
+
+    unsigned char trailer[4];
+    long length = header -> content_length;
+
+    if (!header_is_gzip(header) || header -> chunked ||
+        length < GZIP_MIN_LENGTH ||
+        header -> header_length + length != object -> length ||
+        read_cache_object(object, object -> length - 4, (char *)trailer,
+                          4) != 4) {
+        return -1;
+    }
+    // ISIZE, little endian
+    return (long)trailer[0] | (long)trailer[1] << 8 |
+           (long)trailer[2] << 16 | (long)trailer[3] << 24;
+}
+
+/*
+ * begin_encoder - start encoding the body of a fill whose header is
+ *                 complete, a text body received as identity is
+ *                 compressed at level (0 keeps it)
+ *                 return the encoder, NULL if the body is kept as it is
+ */
+encoder_t* begin_encoder(cache_list_t* list, cache_fill_t* fill, int level) {
+
+    cached_header_t header;
+    encoder_t* encoder;
+    int compress, plain;
+
+    // the answer to a HEAD has no body to encode
+    if (fill == NULL || fill -> object == NULL ||
+        !strncmp(fill -> cache_id, "HEAD ", 5) ||
+        parse_cached_header(fill -> object, &header) == -1 ||
+        header.status != 200) {
+        return NULL;
+    }
+    plain = !header.chunked && header.content_length >= 0;
+    compress = level > 0 && header_is_identity(&header) &&
+               type_is_compressible(header.content_type);
+    if (!compress && !header_is_gzip(&header)) {
+        return NULL;
+    }
+
+    encoder = (encoder_t *)Calloc(1, sizeof(encoder_t));
+    encoder -> compress = compress;
+    encoder -> verify = !compress;
+    encoder -> offset = header.header_length;
+    encoder -> chunked = header.chunked;
+    encoder -> remaining = header.chunked ? -1 : header.content_length;
+    encoder -> state = ENCODER_CHUNK_SIZE;
+
+    // 16 + the largest window: a gzip header and trailer around deflate
+    if ((compress &&
+         deflateInit2(&encoder -> deflate, level, Z_DEFLATED, 16 + MAX_WBITS,
+                      8, Z_DEFAULT_STRATEGY) != Z_OK) ||
+        (!compress &&
+         inflateInit2(&encoder -> inflate, 16 + MAX_WBITS) != Z_OK)) {
+        Free(encoder);
+        return NULL;
+    }
+    // a plain gzip body is stored as received once it checked out
+    if ((compress || !plain) &&
+        (encoder -> body = begin_cache_fill(list, fill -> cache_id)) == NULL) {
+        free_encoder(encoder);
+        return NULL;
+    }
+
+    // the body bytes that came with the header
+    run_encoder(encoder, fill);
+    return encoder;
+}
+
+/*
+ * run_encoder - encode the bytes appended to the fill since the last run
+ *               return -1 if the encoding failed, or the fill was dropped
+ */
+int run_encoder(encoder_t* encoder, cache_fill_t* fill) {
+
+    struct iovec iov;
+    cache_object_t* object;
+
+    if (encoder == NULL) {
+        return 0;
+    }
+    if ((object = fill -> object) == NULL) {
+        encoder -> failed = 1;
+    }
+
+    // the new bytes are read in place from the segments of the fill
+    while (!encoder -> failed && encoder -> offset < object -> length &&
+           object_iov(object, encoder -> offset,
+                      object -> length - encoder -> offset, &iov, 1) == 1) {
+        take_body(encoder, (char *)iov.iov_base, iov.iov_len);
+        encoder -> offset += iov.iov_len;
+    }
+    return encoder -> failed ? -1 : 0;
+}
+
+/*
+ * free_encoder - release an encoder and the body it encoded
+ */
+void free_encoder(encoder_t* encoder) {
+
+    if (encoder == NULL) {
+        return;
+    }
+    if (encoder -> compress) {
+        deflateEnd(&encoder -> deflate);
+    } else {
+        inflateEnd(&encoder -> inflate);
+    }
+    if (encoder -> body != NULL) {
+        abort_cache_fill(encoder -> body);
+    }
+    Free(encoder);
+}
+
+/*
+ * encode_cache_fill - prepare a complete fill to be committed with the
+ *                     encoder that followed it, which is freed: a body
+ *                     compressed enough, or a gzip body that was not
+ *                     plain, goes with a new header with Content-Length
+ *                     return the fill to commit, fill itself if it is
+ *                     kept as received, else a new one and fill is
+ *                     aborted; NULL and fill is aborted if it is a gzip
+ *                     body whose trailer does not give its length
+ */
+cache_fill_t* encode_cache_fill(cache_fill_t* fill, encoder_t* encoder) {
+
+    cached_header_t header;
+    cache_fill_t* encoded;
+    char head[MAXBUF + MAXLINE];
+    size_t head_length;
+    long length;
+
+    if (encoder == NULL) {
+        return fill;
+    }
+    run_encoder(encoder, fill);
+    // a body with a broken framing ends early
+    if (encoder -> chunked && encoder -> state != ENCODER_CHUNK_LAST) {
+        encoder -> failed = 1;
+    }
+
+    // a gzip stream is inflated to its end and checked by zlib against
+    // the length modulo 2^32 in its trailer
+    if (encoder -> verify &&
+        (encoder -> failed || !encoder -> ended ||
+         encoder -> inflate.total_out > GZIP_MAX_DECODED)) {
+        free_encoder(encoder);
+        abort_cache_fill(fill);
+        return NULL;
+    }
+
+    // a small body or one that barely shrinks stays as received
+    if (encoder -> compress &&
+        (encoder -> failed || encoder -> length < ENCODING_MIN_LENGTH ||
+         deflate_body(encoder, Z_FINISH) == -1 ||
+         encoder -> body -> object == NULL ||
+         encoder -> body -> object -> length >
+         encoder -> length - encoder -> length / ENCODING_MIN_SAVING)) {
+        free_encoder(encoder);
+        return fill;
+    }
+    if ((encoded = encoder -> body) == NULL || encoded -> object == NULL ||
+        parse_cached_header(fill -> object, &header) == -1) {
+        free_encoder(encoder);
+        return fill;
+    }
+
+    length = encoded -> object -> length;
+    head_length = build_stored_head(fill -> object, &header,
+                                    encoder -> compress, length, head);
+    encoder -> body = NULL;
+    free_encoder(encoder);
+    if (head_length == 0 ||
+        prepend_cache_fill(encoded, head, head_length) == -1) {
+        abort_cache_fill(encoded);
+        return fill;
+    }
+
+    abort_cache_fill(fill);
+    return encoded;
+}
+
+/*
+ * init_gunzip - start decoding the length bytes of gzip body of object
+ *               from offset
+ *               return -1 if it is not a gzip stream
+ */
+int init_gunzip(gunzip_t* gz, cache_object_t* object, size_t offset,
+                size_t length) {
+
+    unsigned char trailer[4];
+
+    if (length < GZIP_MIN_LENGTH ||
+        read_cache_object(object, offset + length - 4, (char *)trailer,
+                          4) != 4) {
+        return -1;
+    }
+    memset(&gz -> stream, 0, sizeof(z_stream));
+    // 16 + the largest window: a gzip header and trailer around deflate
+    if (inflateInit2(&gz -> stream, 16 + MAX_WBITS) != Z_OK) {
+        return -1;
+    }
+    gz -> object = object;
+    gz -> offset = offset;
+    gz -> end = offset + length;
+    gz -> remaining = (unsigned long)trailer[0] |
+                      (unsigned long)trailer[1] << 8 |
+                      (unsigned long)trailer[2] << 16 |
+                      (unsigned long)trailer[3] << 24;
+    gz -> finished = 0;
+    return 0;
+}
+
+/*
+ * read_gunzip - decode up to size bytes of the body into buf, the input
+ *               is taken from the segments of the object in place
+ *               return the number of bytes, 0 once the decoded length
+ *               from the trailer is reached, -1 if the stream is broken
+ *               or ends before
+ */
+ssize_t read_gunzip(gunzip_t* gz, char* buf, size_t size) {
+
+    z_stream* stream = &gz -> stream;
+    struct iovec iov;
+    size_t n;
+    int rc;
+
+    if (size > gz -> remaining) {
+        size = gz -> remaining;
+    }
+    if (size == 0) {
+        return 0;
+    }
+
+    stream -> next_out = (Bytef *)buf;
+    stream -> avail_out = size;
+    while (stream -> avail_out > 0 && !gz -> finished) {
+        // the next segment of the object
+        if (stream -> avail_in == 0) {
+            if (gz -> offset >= gz -> end ||
+                object_iov(gz -> object, gz -> offset,
+                           gz -> end - gz -> offset, &iov, 1) != 1) {
+                break;
+            }
+            stream -> next_in = (Bytef *)iov.iov_base;
+            stream -> avail_in = iov.iov_len;
+            gz -> offset += iov.iov_len;
+        }
+        rc = inflate(stream, Z_NO_FLUSH);
+        if (rc == Z_STREAM_END) {
+            gz -> finished = 1;
+        } else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+            return -1;
+        }
+    }
+
+    n = size - stream -> avail_out;
+    gz -> remaining -= n;
+    return (n > 0) ? (ssize_t)n : -1;
+}
+
+/*
+ * free_gunzip - release the state of a decoding
+ */
+void free_gunzip(gunzip_t* gz) {
+
+    inflateEnd(&gz -> stream);
+}
+
+/*
+ * header_is_identity - check whether a cached response has no encoding
+ */
+static int header_is_identity(cached_header_t* header) {
+
+    return header -> content_encoding[0] == '\0' ||
+           !strcasecmp(header -> content_encoding, "identity");
+}
+
+/*
+ * type_is_compressible - check whether a Content-Type is text that gzip
+ *                        shrinks, images and archives are compressed
+ *                        already
+ */
+static int type_is_compressible(char* type) {
+
+    static const char* types[] = {
+        "application/json", "application/javascript",
+        "application/x-javascript", "application/xml",
+        "application/xhtml+xml", "application/rss+xml",
+        "application/atom+xml", "image/svg+xml", NULL
+    };
+    size_t length = strcspn(type, " ;");
+    int i;
+
+    if (!strncasecmp(type, "text/", 5)) {
+        return 1;
+    }
+    for (i = 0; types[i] != NULL; i++) {
+        if (length == strlen(types[i]) &&
+            !strncasecmp(type, types[i], length)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * take_body - take n bytes of the response after its header, the
+ *             chunked framing and anything past the Content-Length are
+ *             left out of the body
+ */
+static void take_body(encoder_t* encoder, char* data, size_t n) {
+
+    char* end = data + n;
+    size_t count;
+    int digit;
+
+    if (!encoder -> chunked) {
+        if (encoder -> remaining >= 0 && n > (size_t)encoder -> remaining) {
+            n = encoder -> remaining;
+        }
+        if (encoder -> remaining >= 0) {
+            encoder -> remaining -= n;
+        }
+        feed_body(encoder, data, n);
+        return;
+    }
+
+    while (data < end && !encoder -> failed) {
+        switch (encoder -> state) {
+        case ENCODER_CHUNK_SIZE:
+        case ENCODER_CHUNK_EXT:
+            if (*data == '\n') {
+                encoder -> state = (encoder -> chunk == 0) ?
+                    ENCODER_CHUNK_LAST : ENCODER_CHUNK_DATA;
+            } else if (encoder -> state == ENCODER_CHUNK_SIZE &&
+                       isxdigit((unsigned char)*data)) {
+                digit = isdigit((unsigned char)*data) ? *data - '0' :
+                        tolower((unsigned char)*data) - 'a' + 10;
+                // no chunk of a cached object comes near this
+                if (encoder -> chunk > GZIP_MAX_DECODED) {
+                    encoder -> failed = 1;
+                }
+                encoder -> chunk = encoder -> chunk * 16 + digit;
+            } else {
+                encoder -> state = ENCODER_CHUNK_EXT;
+            }
+            data++;
+            break;
+        case ENCODER_CHUNK_DATA:
+            count = end - data;
+            if (count > encoder -> chunk) {
+                count = encoder -> chunk;
+            }
+            feed_body(encoder, data, count);
+            data += count;
+            if ((encoder -> chunk -= count) == 0) {
+                encoder -> state = ENCODER_CHUNK_END;
+            }
+            break;
+        case ENCODER_CHUNK_END:
+            if (*data++ == '\n') {
+                encoder -> state = ENCODER_CHUNK_SIZE;
+            }
+            break;
+        default:
+            // the trailer is not part of the body
+            return;
+        }
+    }
+}
+
+/*
+ * feed_body - encode n bytes of the body
+ */
+static void feed_body(encoder_t* encoder, char* data, size_t n) {
+
+    z_stream* stream = &encoder -> inflate;
+    char scratch[MAXBUF];
+    int rc;
+
+    if (n == 0) {
+        return;
+    }
+    encoder -> length += n;
+
+    if (encoder -> compress) {
+        encoder -> deflate.next_in = (Bytef *)data;
+        encoder -> deflate.avail_in = n;
+        if (deflate_body(encoder, Z_NO_FLUSH) == -1) {
+            encoder -> failed = 1;
+        }
+        return;
+    }
+
+    // anything past the end of the gzip stream is another member
+    if (encoder -> ended) {
+        encoder -> failed = 1;
+        return;
+    }
+    stream -> next_in = (Bytef *)data;
+    stream -> avail_in = n;
+    while (stream -> avail_in > 0 && !encoder -> failed) {
+        stream -> next_out = (Bytef *)scratch;
+        stream -> avail_out = sizeof(scratch);
+        rc = inflate(stream, Z_NO_FLUSH);
+        if (rc == Z_STREAM_END) {
+            encoder -> ended = 1;
+            encoder -> failed = (stream -> avail_in > 0);
+            break;
+        }
+        if (rc != Z_OK) {
+            encoder -> failed = 1;
+        }
+    }
+    if (encoder -> body != NULL && !encoder -> failed &&
+        append_cache_fill(encoder -> body, data, n) == -1) {
+        encoder -> failed = 1;
+    }
+}
+
+/*
+ * deflate_body - compress the pending input of the encoder into its body,
+ *                flush is Z_FINISH to end the gzip stream
+ *                return -1 on error or if the body got too large
+ */
+static int deflate_body(encoder_t* encoder, int flush) {
+
+    z_stream* stream = &encoder -> deflate;
+    char out[MAXBUF];
+    size_t length;
+    int rc;
+
+    do {
+        stream -> next_out = (Bytef *)out;
+        stream -> avail_out = sizeof(out);
+        rc = deflate(stream, flush);
+        if (rc == Z_STREAM_ERROR) {
+            return -1;
+        }
+        length = sizeof(out) - stream -> avail_out;
+        if (length > 0 &&
+            append_cache_fill(encoder -> body, out, length) == -1) {
+            return -1;
+        }
+    } while (stream -> avail_out == 0 ||
+             (flush == Z_FINISH && rc != Z_STREAM_END));
+    return 0;
+}
+
+/*
+ * build_stored_head - the header of a response stored with a plain body
+ *                     of length bytes, compressed by the proxy if asked
+ *                     return its length, 0 if it does not fit in MAXBUF
+ */
+static size_t build_stored_head(cache_object_t* object,
+                                cached_header_t* header, int compressed,
+                                long length, char* head) {
+
+    char buf[MAXBUF];
+    char *line, *line_end, *end, *value;
+    size_t used = 0;
+
+    if (header -> header_length + MAXLINE / 8 > MAXBUF) {
+        return 0;
+    }
+    end = buf + read_cache_object(object, 0, buf, header -> header_length);
+
+    // the status line and every line but the framing
+    for (line = buf; line < end; line = line_end + 1) {
+        line_end = memchr(line, '\n', end - line);
+        if (line != buf && (line[0] == '\r' || line[0] == '\n')) {
+            break;
+        }
+        if (!strncasecmp(line, "Content-Length:", 15) ||
+            !strncasecmp(line, "Transfer-Encoding:", 18)) {
+            continue;
+        }
+        // the bytes changed, a strong validator no longer matches them
+        if (compressed && !strncasecmp(line, "ETag:", 5)) {
+            value = line + 5 + strspn(line + 5, " \t");
+            if (strncmp(value, "W/", 2)) {
+                used += sprintf(head + used, "ETag: W/");
+                memcpy(head + used, value, line_end + 1 - value);
+                used += line_end + 1 - value;
+                continue;
+            }
+        }
+        memcpy(head + used, line, line_end + 1 - line);
+        used += line_end + 1 - line;
+    }
+
+    if (compressed) {
+        used += sprintf(head + used, "Content-Encoding: gzip\r\n");
+    }
+    if (!header -> vary_encoding) {
+        used += sprintf(head + used, "Vary: Accept-Encoding\r\n");
+    }
+    used += sprintf(head + used, "Content-Length: %ld\r\n\r\n", length);
+    return used;
+}
@@ -0,0 +1,82 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * encoding.h - prototypes and definitions for encoding.c
+ */
+#ifndef __ENCODING_H__
+#define __ENCODING_H__
+
+#include <zlib.h>
+#include "csapp.h"
+#include "cache.h"
+#include "conditional.h"
+
+/* Default zlib level of the bodies compressed before they are cached */
+#define ENCODING_DEFAULT_LEVEL 6
+
+/* Smaller bodies are cached as received */
+#define ENCODING_MIN_LENGTH 256
+
+/* A compressed body is only kept if it saves a tenth of the bytes */
+#define ENCODING_MIN_SAVING 10
+
+/* A gzip stream is at least its 10 byte header and 8 byte trailer */
+#define GZIP_MIN_LENGTH 18
+
+/* A gzip trailer counts the decoded bytes modulo 2^32 */
+#define GZIP_MAX_DECODED 0xFFFFFFFFUL
+
+/* States of the chunked framing of a body being encoded */
+#define ENCODER_CHUNK_SIZE 0        // in the size of a chunk
+#define ENCODER_CHUNK_EXT  1        // in the rest of the size line
+#define ENCODER_CHUNK_DATA 2
+#define ENCODER_CHUNK_END  3        // in the line break after the data
+#define ENCODER_CHUNK_LAST 4        // the last chunk was seen
+
+/*
+ * Defined a struct representing the body of a fill encoded while the fill
+ * grows: an identity text body is compressed, a gzip body is checked to
+ * be one gzip stream the trailer of which gives its decoded length, and
+ * a body without a Content-Length is copied without its framing
+ */
+typedef struct encoder_t {
+    z_stream deflate;
+    z_stream inflate;
+    int compress;                   // deflate an identity body
+    int verify;                     // inflate a gzip body
+    cache_fill_t* body;             // the body to store, NULL to keep the fill
+    size_t offset;                  // next byte of the fill to take
+    long remaining;                 // body bytes still to come, -1 unknown
+    int chunked;
+    int state;                      // of the chunked framing
+    unsigned long chunk;            // bytes of the chunk still to come
+    unsigned long length;           // body bytes taken
+    int ended;                      // the gzip stream ended
+    int failed;
+} encoder_t;
+
+/* Defined a struct representing a gzip body of a cached object decoded */
+typedef struct gunzip_t {
+    z_stream stream;
+    cache_object_t* object;         // pinned by the caller
+    size_t offset;                  // next compressed byte to inflate
+    size_t end;                     // end of the compressed body
+    unsigned long remaining;        // decoded bytes still to come
+    int finished;                   // the gzip stream ended
+} gunzip_t;
+
+/* Defined function storing compressed bodies and decoding them */
+int accepts_gzip(char* value);
+int header_is_gzip(cached_header_t* header);
+long gzip_decoded_length(cache_object_t* object, cached_header_t* header);
+encoder_t* begin_encoder(cache_list_t* list, cache_fill_t* fill, int level);
+int run_encoder(encoder_t* encoder, cache_fill_t* fill);
+void free_encoder(encoder_t* encoder);
+cache_fill_t* encode_cache_fill(cache_fill_t* fill, encoder_t* encoder);
+int init_gunzip(gunzip_t* gz, cache_object_t* object, size_t offset,
+                size_t length);
+ssize_t read_gunzip(gunzip_t* gz, char* buf, size_t size);
+void free_gunzip(gunzip_t* gz);
+
+#endif /* __ENCODING_H__ */
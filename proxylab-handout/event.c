@@ -0,0 +1,1166 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * event.c - event-driven proxy mode built on edge-triggered epoll.
+ * Implementation idea:
+ * 1. every loop thread owns an epoll instance; the non-blocking listening
+ *    socket is registered exclusively in each of them so an incoming
+ *    connection wakes up only one loop
+ * 2. client and server sockets are non-blocking and registered once for
+ *    both reading and writing in edge-triggered mode
+ * 3. each connection is a state machine (read request - connect -
+ *    send request - relay header - relay body); on every wake up the
+ *    connection is driven until the current step would block
+ * 4. connections closed while handling a batch of events are freed
+ *    after the batch, because later events of the batch may refer to them
+ * 5. a stale cached object is fetched again in full, unless it is within
+ *    its stale-while-revalidate window, then it is served while a thread
+ *    revalidates it (see refresh_cached_object)
+ * 6. every loop thread counts into its own metrics block, the phases of
+ *    a request are timed from the conn as its state changes
+ * 7. every loop also watches the drain descriptor of upgrade.c, once it
+ *    is readable the loop stops accepting and only serves the
+ *    connections it already has
+ * 8. in reuseport mode every loop has a listening socket of its own,
+ *    the sockets share the port with SO_REUSEPORT, so the kernel spreads
+ *    the connections without any lock shared by the loops, and every
+ *    loop thread is pinned to a cpu (see affinity.c)
+ * 9. a connection to a server is in the waiting list of its loop with a
+ *    deadline: the connect timeout, then the first-byte timeout, renewed
+ *    by the read timeout on every read; while the list is not empty
+ *    epoll_wait wakes up every EVENT_SWEEP_MS to close the late ones,
+ *    with a 504 if the client got nothing yet; origins marked down by the
+ *    breaker get no connection, the client gets the stale copy or a 504
+ * 10. a gzip object asked by a client without gzip is decoded into the
+ *    relay buffer each time the buffer was written (see encoding.c)
+ * 11. a server missing from the address cache is resolved by a detached
+ *    thread, the conn waits in the waiting list meanwhile; the thread
+ *    writes the eventfd of the loop when it is done, the loop then
+ *    connects every conn waiting for that host:port, so no loop ever
+ *    blocks on getaddrinfo
+ *
+ */
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "csapp.h"
+#include "cache.h"
+#include "proxy.h"
+#include "event.h"
+#include "dnscache.h"
+#include "conditional.h"
+#include "metrics.h"
+#include "upgrade.h"
+#include "affinity.h"
+
+//#define DEBUG
+#ifdef DEBUG
+# define dbg_printf(...) printf(__VA_ARGS__)
+#else
+# define dbg_printf(...)
+#endif
+
+/* the ptr registered for the drain descriptor */
+static char drain_marker;
+
+/* the ptr registered for the resolution eventfd of a loop */
+static char resolve_marker;
+
+/* Static helper functions for the event-driven implementation */
+static void init_event_loop(event_loop_t* loop, int listenfd, int exclusive);
+static void start_event_loops(event_loop_t* loops, int loop_num);
+static void *event_thread(void *vargp);
+static void event_loop(event_loop_t* loop);
+static int set_nonblocking(int fd);
+static int register_fd(event_loop_t* loop, int fd, void* ptr);
+static void accept_clients(event_loop_t* loop);
+static void stop_accepting(event_loop_t* loop);
+static void conn_drive(event_loop_t* loop, conn_t* conn);
+static int conn_read_request(event_loop_t* loop, conn_t* conn);
+static int conn_handle_request(event_loop_t* loop, conn_t* conn);
+static int conn_start_connect(event_loop_t* loop, conn_t* conn,
+         char* remote_host_name, char* remote_host_port);
+static int conn_connect(event_loop_t* loop, conn_t* conn,
+                        dns_addr_t* addrs, int n);
+static void start_resolve(event_loop_t* loop, char* host, char* port);
+static void *resolve_thread(void *vargp);
+static void finish_resolves(event_loop_t* loop);
+static int conn_finish_connect(conn_t* conn);
+static int conn_send_request(conn_t* conn);
+static int conn_relay(conn_t* conn);
+static int conn_flush(conn_t* conn);
+static void conn_respond(conn_t* conn, char* response, size_t length);
+static void conn_fail(conn_t* conn, char* response);
+static void conn_respond_cached(conn_t* conn, request_cond_t* cond);
+static void conn_close(event_loop_t* loop, conn_t* conn);
+static void conn_wait_server(event_loop_t* loop, conn_t* conn, int seconds);
+static void conn_set_deadline(conn_t* conn, int seconds);
+static void conn_stop_waiting(event_loop_t* loop, conn_t* conn);
+static void sweep_timeouts(event_loop_t* loop);
+static void conn_timeout(event_loop_t* loop, conn_t* conn);
+
+/*
+ * run_event_loops - start loop_num epoll loops serving listenfd,
+ *                   the calling thread runs the first loop and never returns
+ */
+void run_event_loops(int listenfd, int loop_num) {
+
+    event_loop_t* loops;
+    int i;
+
+    if (loop_num < 1) {
+        loop_num = 1;
+    }
+
+    if (set_nonblocking(listenfd) == -1) {
+        unix_error("Set listenfd non-blocking error");
+    }
+
+    // the loops share the socket, a connection wakes only one of them
+    loops = (event_loop_t *)Calloc(loop_num, sizeof(event_loop_t));
+    for (i = 0; i < loop_num; i++) {
+        init_event_loop(&loops[i], listenfd, 1);
+        loops[i].cpu = -1;
+    }
+    start_event_loops(loops, loop_num);
+}
+
+/*
+ * run_reuseport_loops - start one epoll loop per listening socket of a
+ *                       reuseport group, every loop pinned to a cpu,
+ *                       the calling thread runs the first loop and never
+ *                       returns
+ */
+void run_reuseport_loops(int* listenfds, int loop_num) {
+
+    event_loop_t* loops;
+    int i;
+
+    loops = (event_loop_t *)Calloc(loop_num, sizeof(event_loop_t));
+    for (i = 0; i < loop_num; i++) {
+        if (set_nonblocking(listenfds[i]) == -1) {
+            unix_error("Set listenfd non-blocking error");
+        }
+        init_event_loop(&loops[i], listenfds[i], 0);
+        loops[i].cpu = nth_cpu(i);
+    }
+
+    if (steer_by_cpu(listenfds[0], loop_num) == 0) {
+        printf("Reuseport: %d listeners, connections stay on the cpu "
+               "that received them.\n", loop_num);
+    } else {
+        printf("Reuseport: %d listeners on %d cpus, connections spread "
+               "by hash.\n", loop_num, cpu_count());
+    }
+    fflush(stdout);
+    start_event_loops(loops, loop_num);
+}
+
+/*
+ * init_event_loop - create the epoll instance of a loop and register its
+ *                   listening socket, exclusively if the socket is shared
+ *                   by the loops, the drain descriptor and the
+ *                   eventfd of its resolutions
+ */
+static void init_event_loop(event_loop_t* loop, int listenfd, int exclusive) {
+
+    struct epoll_event ev;
+
+    if ((loop -> epfd = epoll_create1(0)) == -1) {
+        unix_error("epoll_create1 error");
+    }
+    loop -> listenfd = listenfd;
+    loop -> closed = NULL;
+    loop -> waiting = NULL;
+    loop -> last_sweep = metrics_clock();
+    loop -> resolving = NULL;
+    pthread_mutex_init(&loop -> resolve_mutex, NULL);
+    if ((loop -> resolvefd = eventfd(0, EFD_NONBLOCK)) == -1) {
+        unix_error("eventfd error");
+    }
+
+    // the listening socket is the only fd registered with a NULL ptr
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+#ifdef EPOLLEXCLUSIVE
+    if (exclusive) {
+        ev.events |= EPOLLEXCLUSIVE;
+    }
+#endif
+    ev.data.ptr = NULL;
+    if (epoll_ctl(loop -> epfd, EPOLL_CTL_ADD, listenfd, &ev) == -1) {
+        unix_error("epoll_ctl listenfd error");
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = &drain_marker;
+    if (epoll_ctl(loop -> epfd, EPOLL_CTL_ADD, drain_event_fd(), &ev) == -1) {
+        unix_error("epoll_ctl drain fd error");
+    }
+
+    ev.data.ptr = &resolve_marker;
+    if (epoll_ctl(loop -> epfd, EPOLL_CTL_ADD, loop -> resolvefd,
+                  &ev) == -1) {
+        unix_error("epoll_ctl resolve fd error");
+    }
+}
+
+/*
+ * start_event_loops - run the first loop in the calling thread and the
+ *                     others in their own threads
+ */
+static void start_event_loops(event_loop_t* loops, int loop_num) {
+
+    int i;
+
+    for (i = 1; i < loop_num; i++) {
+        Pthread_create(&loops[i].tid, NULL, event_thread, &loops[i]);
+    }
+    event_loop(&loops[0]);
+}
+
+/*
+ * event_thread - Thread routine for the additional loops
+ */
+static void *event_thread(void *vargp) {
+
+    Pthread_detach(pthread_self());
+    event_loop((event_loop_t *)vargp);
+    return NULL;
+
+}
+
+/*
+ * event_loop - wait for events and drive the connections they belong to
+ */
+static void event_loop(event_loop_t* loop) {
+
+    struct epoll_event events[EVENT_BATCH];
+    conn_t* conn;
+    int i, n, timeout;
+
+    if (loop -> cpu >= 0 && pin_thread(loop -> cpu) == -1) {
+        printf("Pin loop to cpu %d error.\n", loop -> cpu);
+    }
+
+    while (1) {
+
+        // wake up in time for the deadlines of the servers, if any
+        timeout = (loop -> waiting != NULL) ? EVENT_SWEEP_MS : -1;
+        if ((n = epoll_wait(loop -> epfd, events, EVENT_BATCH,
+                            timeout)) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            unix_error("epoll_wait error");
+        }
+
+        for (i = 0; i < n; i++) {
+            conn = (conn_t *)events[i].data.ptr;
+            if (conn == NULL) {
+                accept_clients(loop);
+            } else if (conn == (conn_t *)&drain_marker) {
+                stop_accepting(loop);
+            } else if (conn == (conn_t *)&resolve_marker) {
+                finish_resolves(loop);
+            } else if (conn -> state != CONN_DONE) {
+                conn_drive(loop, conn);
+            }
+        }
+        if (loop -> waiting != NULL) {
+            sweep_timeouts(loop);
+        }
+
+        // free the connections closed during this batch
+        while ((conn = loop -> closed) != NULL) {
+            loop -> closed = conn -> next_closed;
+            free_encoder(conn -> encoder);
+            abort_cache_fill(conn -> cache_fill);
+            if (conn -> gunzip != NULL) {
+                free_gunzip(conn -> gunzip);
+                Free(conn -> gunzip);
+            }
+            release_cache_object(conn -> cache_object);
+            Free(conn);
+        }
+    }
+}
+
+/*
+ * set_nonblocking - put fd into non-blocking mode
+ *                   return -1 on error
+ */
+static int set_nonblocking(int fd) {
+
+    int flags;
+
+    if ((flags = fcntl(fd, F_GETFL, 0)) == -1) {
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/*
+ * register_fd - add a connection fd to the loop in edge-triggered mode
+ *               return -1 on error
+ */
+static int register_fd(event_loop_t* loop, int fd, void* ptr) {
+
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = ptr;
+    return epoll_ctl(loop -> epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/*
+ * accept_clients - accept every pending client and start its state machine
+ */
+static void accept_clients(event_loop_t* loop) {
+
+    conn_t* conn;
+    int connfd;
+
+    // an event of the same batch may follow the drain
+    while (!is_draining()) {
+
+        if ((connfd = accept(loop -> listenfd, NULL, NULL)) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // EAGAIN: another loop took it or the backlog is drained
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                printf("Accept error: %s\n", strerror(errno));
+            }
+            return;
+        }
+
+        if (set_nonblocking(connfd) == -1) {
+            close(connfd);
+            continue;
+        }
+
+        conn = (conn_t *)Calloc(1, sizeof(conn_t));
+        conn -> state = CONN_READ_REQUEST;
+        conn -> clientfd = connfd;
+        conn -> serverfd = -1;
+        init_http_request(&conn -> request);
+
+        if (register_fd(loop, connfd, conn) == -1) {
+            printf("Register client error: %s\n", strerror(errno));
+            close(connfd);
+            Free(conn);
+            continue;
+        }
+
+        // the request may already be waiting in the socket
+        metrics_count(COUNT_CONN_OPENED, 1);
+        conn_drive(loop, conn);
+    }
+}
+
+/*
+ * stop_accepting - leave the listening socket to the process that
+ *                  replaces this one
+ */
+static void stop_accepting(event_loop_t* loop) {
+
+    epoll_ctl(loop -> epfd, EPOLL_CTL_DEL, loop -> listenfd, NULL);
+    epoll_ctl(loop -> epfd, EPOLL_CTL_DEL, drain_event_fd(), NULL);
+}
+
+/*
+ * conn_drive - run the state machine of a connection until it would block
+ *
+ * Every step returns 1 if it finished and the next state should run,
+ * 0 if it has to wait for another event and -1 on error.
+ */
+static void conn_drive(event_loop_t* loop, conn_t* conn) {
+
+    int rc = 0;
+
+    while (1) {
+
+        switch (conn -> state) {
+        case CONN_READ_REQUEST:
+            rc = conn_read_request(loop, conn);
+            break;
+        case CONN_RESOLVE:
+            // only finish_resolves moves it on
+            rc = 0;
+            break;
+        case CONN_CONNECT:
+            rc = conn_finish_connect(conn);
+            break;
+        case CONN_SEND_REQUEST:
+            rc = conn_send_request(conn);
+            break;
+        case CONN_RELAY_HEADER:
+        case CONN_RELAY_BODY:
+            rc = conn_relay(conn);
+            break;
+        case CONN_WRITE_CLIENT:
+            if ((rc = conn_flush(conn)) == 1) {
+                // a cache hit is complete once it reached the client
+                if (conn -> cache_object != NULL) {
+                    metrics_record(METRIC_TOTAL, conn -> started);
+                }
+                conn -> state = CONN_DONE;
+            }
+            break;
+        case CONN_DONE:
+            conn_close(loop, conn);
+            return;
+        }
+
+        if (rc == 0) {
+            return;
+        }
+        if (rc == -1) {
+            conn_close(loop, conn);
+            return;
+        }
+    }
+}
+
+/*
+ * conn_read_request - read the client request up to the end of its header
+ */
+static int conn_read_request(event_loop_t* loop, conn_t* conn) {
+
+    ssize_t n;
+    size_t room;
+    int rc;
+
+    // parse what arrived so far, resuming where the last read stopped
+    while ((rc = parse_http_request(&conn -> request, conn -> req_in,
+                                    conn -> req_in_length)) ==
+           HTTP_PARSE_AGAIN) {
+
+        // request header larger than the buffer, reject it
+        room = sizeof(conn -> req_in) - conn -> req_in_length;
+        if (room == 0) {
+            conn_fail(conn, invalid_request_response_str);
+            return 1;
+        }
+
+        n = read(conn -> clientfd, conn -> req_in + conn -> req_in_length,
+                 room);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            return -1;
+        }
+        if (n == 0) {
+            // client closed before sending a complete request
+            return -1;
+        }
+
+        conn -> req_in_length += n;
+    }
+    if (rc == HTTP_PARSE_ERROR) {
+        conn_fail(conn, invalid_request_response_str);
+        return 1;
+    }
+
+    return conn_handle_request(loop, conn);
+}
+
+/*
+ * conn_handle_request - parse a complete request, answer it from the cache
+ *                       or start the connection to the server
+ */
+static int conn_handle_request(event_loop_t* loop, conn_t* conn) {
+
+    http_request_t* req = &conn -> request;
+    http_header_t* header;
+    char *remote_host_name, *remote_host_port, *resource;
+    int flag[HEADER_FLAG_NUM];
+    request_cond_t cond;
+    long now;
+    int i, allowed = -1;
+
+    conn -> started = metrics_clock();
+    for (i = 0; i < HEADER_FLAG_NUM; i++) {
+        flag[i] = 0;
+    }
+    init_request_cond(&cond);
+    dbg_printf("method: %s uri: %s version: %s\n", req -> method, req -> uri,
+               req -> version);
+
+    // check whether the request method is legal (only implement GET)
+    if (strcmp(req -> method, "GET")) {
+        conn_fail(conn, method_error_str);
+        return 1;
+    }
+
+    // check whether the request uri is legal
+    if (strncmp(req -> uri, "http://", 7) || parse_http_uri(req) == -1) {
+        conn_fail(conn, uri_error_str);
+        return 1;
+    }
+    remote_host_name = req -> host;
+    remote_host_port = req -> port;
+    resource = req -> path;
+
+    // the statistics of the proxy itself, not counted as a request
+    if (is_metrics_request(remote_host_name, resource)) {
+        conn_respond(conn, conn -> head,
+                     metrics_response(cache_list, conn -> head,
+                                      sizeof(conn -> head)));
+        return 1;
+    }
+    metrics_count(COUNT_REQUESTS, 1);
+
+    // generate cache id (GET www.cmu.edu:80/home.html HTTP/1.0)
+    if (snprintf(conn -> cache_id, MAXLINE, "%s %s:%s%s %s", req -> method,
+                 remote_host_name, remote_host_port, resource,
+                 req -> version) >= MAXLINE) {
+        conn_fail(conn, uri_error_str);
+        return 1;
+    }
+    dbg_printf("cache_id: %s\n", conn -> cache_id);
+
+    // generate request line and headers according to the client header
+    init_outvec(&conn -> req_out);
+    outvec_add(&conn -> req_out, req -> method, req -> method_length);
+    outvec_add(&conn -> req_out, " ", 1);
+    outvec_add_str(&conn -> req_out, resource);
+    outvec_add(&conn -> req_out, " ", 1);
+    outvec_add(&conn -> req_out, req -> version, req -> version_length);
+    outvec_add(&conn -> req_out, "\r\n", 2);
+    for (i = 0; i < req -> header_num; i++) {
+        header = &req -> headers[i];
+        parse_request_cond(header, &cond);
+        generate_request_header(header, &conn -> req_out, flag, 0);
+    }
+    check_request_header(&conn -> req_out, flag, remote_host_name,
+                         cond.accept_gzip, 0);
+    outvec_add(&conn -> req_out, "\r\n", 2);
+    dbg_printf("Complete request: %zu bytes\n", conn -> req_out.length);
+
+    // cache hit, the object stays pinned until the conn is freed;
+    // a client asking to revalidate gets the object from the server
+    now = metrics_record(METRIC_PARSE, conn -> started);
+    if (!cond.no_cache) {
+        conn -> cache_object = read_cache_list(cache_list, conn -> cache_id);
+        metrics_record(METRIC_LOOKUP, now);
+    }
+    if (conn -> cache_object != NULL) {
+        switch (object_freshness(conn -> cache_object)) {
+        case FRESH_STALE_OK:
+            refresh_cached_object(conn -> cache_object, conn -> cache_id,
+                                  remote_host_name, remote_host_port,
+                                  resource);
+            break;
+        case FRESH_STALE:
+            // no validators in the loop, the fill replaces the stale copy;
+            // it is still served while the origin is down
+            allowed = breaker_allow(origin_breaker, remote_host_name,
+                                    remote_host_port);
+            if (allowed) {
+                release_cache_object(conn -> cache_object);
+                conn -> cache_object = NULL;
+            } else {
+                metrics_count(COUNT_FAIL_FAST, 1);
+            }
+            break;
+        }
+    }
+    if (conn -> cache_object != NULL) {
+        metrics_count(COUNT_HITS, 1);
+        conn_respond_cached(conn, &cond);
+        return 1;
+    }
+
+    // the origin is down, the client gets a 504 at once
+    if (allowed == -1 &&
+        !breaker_allow(origin_breaker, remote_host_name, remote_host_port)) {
+        metrics_count(COUNT_FAIL_FAST, 1);
+        conn_fail(conn, gateway_timeout_response_str);
+        return 1;
+    }
+
+    // the server may answer a Range or If-* request with part of the body
+    conn -> bypass_cache = request_is_conditional(&cond);
+
+    return conn_start_connect(loop, conn, remote_host_name, remote_host_port);
+}
+
+/*
+ * conn_start_connect - connect to the server if its address is cached,
+ *                      else wait for a thread to resolve it
+ */
+static int conn_start_connect(event_loop_t* loop, conn_t* conn,
+         char* remote_host_name, char* remote_host_port) {
+
+    dns_addr_t addrs[DNS_MAX_ADDR];
+    int n;
+
+    // the connect phase includes the resolution, as acquire_upstream does
+    conn -> phase_started = metrics_clock();
+    if ((n = dns_cached(remote_host_name, remote_host_port,
+                        addrs, DNS_MAX_ADDR)) != DNS_MISS) {
+        return conn_connect(loop, conn, addrs, n);
+    }
+
+    // the resolution counts against the connect timeout
+    conn -> state = CONN_RESOLVE;
+    conn_wait_server(loop, conn, connect_timeout);
+    start_resolve(loop, remote_host_name, remote_host_port);
+    return 0;
+}
+
+/*
+ * conn_connect - start a non-blocking connect to one of the n addresses
+ *                of the server, n is -1 if it cannot be resolved
+ */
+static int conn_connect(event_loop_t* loop, conn_t* conn,
+                        dns_addr_t* addrs, int n) {
+
+    int serverfd = -1;
+    int i;
+
+    // walk the list for one that accepts the connect request
+    for (i = 0; i < n; i++) {
+        if ((serverfd = socket(addrs[i].family, addrs[i].socktype,
+                               addrs[i].protocol)) == -1) {
+            continue;
+        }
+        if (set_nonblocking(serverfd) == 0 &&
+            (connect(serverfd, (SA *)&addrs[i].addr,
+                     addrs[i].addrlen) == 0 || errno == EINPROGRESS)) {
+            break;
+        }
+        close(serverfd);
+        serverfd = -1;
+    }
+
+    if (serverfd == -1 || register_fd(loop, serverfd, conn) == -1) {
+        printf("Connection to server error.\n");
+        if (serverfd != -1) {
+            close(serverfd);
+        }
+        conn_stop_waiting(loop, conn);
+        breaker_report(origin_breaker, conn -> request.host,
+                       conn -> request.port, 0);
+        conn_fail(conn, invalid_request_response_str);
+        return 1;
+    }
+
+    conn -> serverfd = serverfd;
+    conn -> state = CONN_CONNECT;
+    conn_wait_server(loop, conn, connect_timeout);
+    return 1;
+}
+
+/*
+ * start_resolve - resolve host:port in a detached thread, unless the loop
+ *                 already waits for it; a loop that cannot start the
+ *                 thread resolves it itself and wakes up on its own
+ */
+static void start_resolve(event_loop_t* loop, char* host, char* port) {
+
+    resolve_job_t* job;
+    pthread_t tid;
+    uint64_t one = 1;
+
+    // only the loop thread adds and removes jobs, host and port are fixed
+    for (job = loop -> resolving; job; job = job -> next) {
+        if (strcmp(job -> host, host) == 0 &&
+            strcmp(job -> port, port) == 0) {
+            return;
+        }
+    }
+
+    job = (resolve_job_t *)Calloc(1, sizeof(resolve_job_t));
+    job -> loop = loop;
+    strncpy(job -> host, host, MAXLINE - 1);
+    strncpy(job -> port, port, MAXLINE - 1);
+    job -> next = loop -> resolving;
+    loop -> resolving = job;
+
+    if (pthread_create(&tid, NULL, resolve_thread, job) != 0) {
+        job -> addr_num = dns_resolve(host, port, job -> addrs, DNS_MAX_ADDR);
+        job -> done = 1;
+        if (write(loop -> resolvefd, &one, sizeof(one)) == -1) {
+            printf("Wake up loop error: %s\n", strerror(errno));
+        }
+    }
+}
+
+/*
+ * resolve_thread - resolve one job and wake up its loop
+ */
+static void *resolve_thread(void *vargp) {
+
+    resolve_job_t* job = (resolve_job_t *)vargp;
+    event_loop_t* loop = job -> loop;
+    uint64_t one = 1;
+
+    Pthread_detach(pthread_self());
+    job -> addr_num = dns_resolve(job -> host, job -> port,
+                                  job -> addrs, DNS_MAX_ADDR);
+
+    pthread_mutex_lock(&loop -> resolve_mutex);
+    job -> done = 1;
+    pthread_mutex_unlock(&loop -> resolve_mutex);
+
+    // the job belongs to the loop from now on
+    if (write(loop -> resolvefd, &one, sizeof(one)) == -1) {
+        printf("Wake up loop error: %s\n", strerror(errno));
+    }
+    return NULL;
+}
+
+/*
+ * finish_resolves - connect the conns waiting for the resolutions that
+ *                   are done and free their jobs
+ */
+static void finish_resolves(event_loop_t* loop) {
+
+    resolve_job_t *job, *done = NULL, **link;
+    conn_t *conn, *next;
+    uint64_t count;
+
+    // reset the eventfd before taking the jobs, a later one wakes us again
+    while (read(loop -> resolvefd, &count, sizeof(count)) == -1 &&
+           errno == EINTR) {
+        ;
+    }
+
+    pthread_mutex_lock(&loop -> resolve_mutex);
+    link = &loop -> resolving;
+    while ((job = *link) != NULL) {
+        if (job -> done) {
+            *link = job -> next;
+            job -> next = done;
+            done = job;
+        } else {
+            link = &job -> next;
+        }
+    }
+    pthread_mutex_unlock(&loop -> resolve_mutex);
+
+    while ((job = done) != NULL) {
+        done = job -> next;
+        // a conn closed or timed out meanwhile is no longer waiting
+        for (conn = loop -> waiting; conn != NULL; conn = next) {
+            next = conn -> next_waiting;
+            if (conn -> state == CONN_RESOLVE &&
+                strcmp(conn -> request.host, job -> host) == 0 &&
+                strcmp(conn -> request.port, job -> port) == 0) {
+                conn_connect(loop, conn, job -> addrs, job -> addr_num);
+                conn_drive(loop, conn);
+            }
+        }
+        Free(job);
+    }
+}
+
+/*
+ * conn_finish_connect - check whether the pending connect has completed
+ */
+static int conn_finish_connect(conn_t* conn) {
+
+    struct sockaddr_storage addr;
+    socklen_t length = sizeof(int);
+    int error = 0;
+
+    if (getsockopt(conn -> serverfd, SOL_SOCKET, SO_ERROR,
+                   &error, &length) == -1 || error != 0) {
+        printf("Connection to server error.\n");
+        breaker_report(origin_breaker, conn -> request.host,
+                       conn -> request.port, 0);
+        conn_fail(conn, invalid_request_response_str);
+        return 1;
+    }
+
+    // no error yet, but the handshake may still be in progress
+    length = sizeof(addr);
+    if (getpeername(conn -> serverfd, (SA *)&addr, &length) == -1) {
+        return (errno == ENOTCONN) ? 0 : -1;
+    }
+
+    metrics_count(COUNT_UPSTREAM_CONNECTS, 1);
+    metrics_record(METRIC_CONNECT, conn -> phase_started);
+    // the request is sent and answered within the first-byte timeout
+    conn_set_deadline(conn, first_byte_timeout);
+    conn -> state = CONN_SEND_REQUEST;
+    return 1;
+}
+
+/*
+ * conn_send_request - write the generated request to the server
+ */
+static int conn_send_request(conn_t* conn) {
+
+    // the whole request with one writev, resumed where it stopped
+    while (conn -> req_out.sent < conn -> req_out.length) {
+        if (outvec_write(conn -> serverfd, &conn -> req_out) == -1) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+    }
+
+    // start filling the response into the cache
+    if (!conn -> bypass_cache) {
+        conn -> cache_fill = begin_cache_fill(cache_list,
+                                            conn -> cache_id);
+    }
+    init_freshness(&conn -> fresh);
+    conn -> state = CONN_RELAY_HEADER;
+    conn -> phase_started = metrics_clock();
+    return 1;
+}
+
+/*
+ * conn_relay - stream the server response to the client
+ *              and keep a copy of it for the cache
+ */
+static int conn_relay(conn_t* conn) {
+
+    static const char header_end[] = "\r\n\r\n";
+    cached_header_t header;
+    ssize_t n, i;
+    int rc, was_header;
+
+    while (1) {
+
+        // flush what was read before reading more; meanwhile the client
+        // is the slow one, the server has no deadline
+        if ((rc = conn_flush(conn)) != 1) {
+            conn -> deadline = 0;
+            return rc;
+        }
+
+        if (conn -> server_eof) {
+            break;
+        }
+
+        n = read(conn -> serverfd, conn -> relay_buf, MAXBUF);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (conn -> deadline == 0) {
+                    conn_set_deadline(conn, conn -> response_length ?
+                                      read_timeout : first_byte_timeout);
+                }
+                return 0;
+            }
+            printf("read response error.\n");
+            return -1;
+        }
+        if (n == 0) {
+            conn -> server_eof = 1;
+            continue;
+        }
+        if (conn -> response_length == 0) {
+            metrics_record(METRIC_FIRST_BYTE, conn -> phase_started);
+            breaker_report(origin_breaker, conn -> request.host,
+                           conn -> request.port, 1);
+        }
+        conn_set_deadline(conn, read_timeout);
+
+        // look for the blank line ending the response header
+        was_header = (conn -> state == CONN_RELAY_HEADER);
+        for (i = 0; i < n && conn -> state == CONN_RELAY_HEADER; i++) {
+            if (conn -> relay_buf[i] == header_end[conn -> header_match]) {
+                if (++conn -> header_match == 4) {
+                    conn -> state = CONN_RELAY_BODY;
+                }
+            } else {
+                conn -> header_match = (conn -> relay_buf[i] == '\r');
+            }
+        }
+
+        conn -> response_length += n;
+
+        // append the chunk to the cache fill if within the size
+        if (conn -> cache_fill != NULL) {
+            append_cache_fill(conn -> cache_fill, conn -> relay_buf, n);
+            run_encoder(conn -> encoder, conn -> cache_fill);
+        }
+
+        // drop a response a shared cache must not keep once its header
+        // ends, or a chunked one the HTTP/1.0 clients of the id cannot read
+        if (was_header && conn -> state != CONN_RELAY_HEADER &&
+            conn -> cache_fill != NULL && conn -> cache_fill -> object != NULL) {
+            if (parse_object_freshness(conn -> cache_fill -> object,
+                                       &conn -> fresh) == -1 ||
+                !response_storable(&conn -> fresh) ||
+                (!strcmp(conn -> request.version, "HTTP/1.0") &&
+                 parse_cached_header(conn -> cache_fill -> object,
+                                     &header) == 0 && header.chunked)) {
+                abort_cache_fill(conn -> cache_fill);
+                conn -> cache_fill = NULL;
+            }
+            // the body is encoded for the cache a read at a time
+            conn -> encoder = begin_encoder(cache_list, conn -> cache_fill,
+                                            compress_level);
+        }
+
+        conn -> out = conn -> relay_buf;
+        conn -> out_length = n;
+        conn -> out_offset = 0;
+    }
+
+    count_cache_miss_bytes(cache_list, conn -> response_length);
+    metrics_count(COUNT_MISSES, 1);
+    metrics_record(METRIC_TOTAL, conn -> started);
+
+    // add cache to cache list, a fill over the size was dropped already
+    if (conn -> cache_fill != NULL && conn -> cache_fill -> object != NULL) {
+        conn -> cache_fill = encode_cache_fill(conn -> cache_fill,
+                                               conn -> encoder);
+        conn -> encoder = NULL;
+        if (conn -> cache_fill != NULL) {
+            set_object_freshness(conn -> cache_fill -> object, &conn -> fresh,
+                                 default_lifetime);
+            if (commit_cache_fill(cache_list, conn -> cache_fill) == -1) {
+                printf("Add to cache error.\n");
+            }
+        }
+        conn -> cache_fill = NULL;
+    }
+    free_encoder(conn -> encoder);
+    conn -> encoder = NULL;
+
+    conn -> state = CONN_DONE;
+    return 1;
+}
+
+/*
+ * conn_flush - write the pending output to the client, then the slice
+ *              of the pinned object of a cache hit, or its body decoded
+ *              buffer by buffer
+ */
+static int conn_flush(conn_t* conn) {
+
+    outvec_t out;
+    size_t head;
+    ssize_t n;
+
+    while (conn -> out_offset < conn -> out_length ||
+           (conn -> cache_object != NULL &&
+            conn -> object_sent < conn -> object_length) ||
+           conn -> gunzip != NULL) {
+        // the buffer was written, decode the next one
+        if (conn -> gunzip != NULL && conn -> out_offset == conn -> out_length) {
+            if ((n = read_gunzip(conn -> gunzip, conn -> relay_buf,
+                                 MAXBUF)) == -1) {
+                printf("Decode cached object error.\n");
+                return -1;
+            }
+            if (n == 0) {
+                free_gunzip(conn -> gunzip);
+                Free(conn -> gunzip);
+                conn -> gunzip = NULL;
+                continue;
+            }
+            conn -> out = conn -> relay_buf;
+            conn -> out_length = n;
+            conn -> out_offset = 0;
+        }
+        // the rest of the head and the object segments in one writev
+        init_outvec(&out);
+        head = conn -> out_length - conn -> out_offset;
+        outvec_add(&out, conn -> out + conn -> out_offset, head);
+        if (conn -> cache_object != NULL) {
+            outvec_add_object(&out, conn -> cache_object,
+                    conn -> object_offset + conn -> object_sent,
+                    conn -> object_length - conn -> object_sent);
+        }
+        if ((n = outvec_write(conn -> clientfd, &out)) == -1) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        if (n == 0) {
+            return -1;
+        }
+        if ((size_t)n <= head) {
+            conn -> out_offset += n;
+        } else {
+            conn -> out_offset = conn -> out_length;
+            conn -> object_sent += n - head;
+        }
+    }
+    return 1;
+}
+
+/*
+ * conn_respond - answer the client with a locally built response
+ */
+static void conn_respond(conn_t* conn, char* response, size_t length) {
+
+    conn -> out = response;
+    conn -> out_length = length;
+    conn -> out_offset = 0;
+    conn -> state = CONN_WRITE_CLIENT;
+}
+
+/*
+ * conn_fail - answer the client with an error and count it
+ */
+static void conn_fail(conn_t* conn, char* response) {
+
+    metrics_count(COUNT_ERRORS, 1);
+    conn_respond(conn, response, strlen(response));
+}
+
+/*
+ * conn_respond_cached - answer the client from the pinned cache object,
+ *                       in full or as a 304, 206, 416 or decoded 200
+ *                       built from it
+ */
+static void conn_respond_cached(conn_t* conn, request_cond_t* cond) {
+
+    cached_header_t header;
+    size_t head_length = 0;
+
+    conn -> object_offset = 0;
+    conn -> object_length = conn -> cache_object -> length;
+    conn -> object_sent = 0;
+    if (parse_cached_header(conn -> cache_object, &header) == 0 &&
+        answer_from_cache(cond, conn -> cache_object, &header, conn -> head,
+                          &head_length, &conn -> object_offset,
+                          &conn -> object_length) == ANSWER_DECODED) {
+        // the body goes through relay_buf instead of in place
+        conn -> gunzip = (gunzip_t *)Malloc(sizeof(gunzip_t));
+        if (init_gunzip(conn -> gunzip, conn -> cache_object,
+                        conn -> object_offset, conn -> object_length) == -1) {
+            Free(conn -> gunzip);
+            conn -> gunzip = NULL;
+            conn_fail(conn, invalid_request_response_str);
+            return;
+        }
+        conn -> object_length = 0;
+    }
+    conn_respond(conn, conn -> head, head_length);
+}
+
+/*
+ * conn_close - close both sockets and queue the conn to be freed
+ */
+static void conn_close(event_loop_t* loop, conn_t* conn) {
+
+    metrics_count(COUNT_CONN_CLOSED, 1);
+    conn_stop_waiting(loop, conn);
+    if (conn -> clientfd >= 0) {
+        close(conn -> clientfd);
+        conn -> clientfd = -1;
+    }
+    if (conn -> serverfd >= 0) {
+        close(conn -> serverfd);
+        conn -> serverfd = -1;
+    }
+
+    conn -> state = CONN_DONE;
+    conn -> next_closed = loop -> closed;
+    loop -> closed = conn;
+}
+
+/*
+ * conn_wait_server - put the conn into the waiting list of the loop, the
+ *                    server has seconds to finish the current step
+ */
+static void conn_wait_server(event_loop_t* loop, conn_t* conn, int seconds) {
+
+    conn_set_deadline(conn, seconds);
+    if (conn -> waiting) {
+        return;
+    }
+    conn -> waiting = 1;
+    conn -> prev_waiting = NULL;
+    conn -> next_waiting = loop -> waiting;
+    if (loop -> waiting != NULL) {
+        loop -> waiting -> prev_waiting = conn;
+    }
+    loop -> waiting = conn;
+}
+
+/*
+ * conn_set_deadline - give the server seconds from now, 0 waits forever
+ */
+static void conn_set_deadline(conn_t* conn, int seconds) {
+
+    conn -> deadline = (seconds > 0) ?
+                       metrics_clock() + seconds * 1000000L : 0;
+}
+
+/*
+ * conn_stop_waiting - take the conn out of the waiting list of the loop
+ */
+static void conn_stop_waiting(event_loop_t* loop, conn_t* conn) {
+
+    if (!conn -> waiting) {
+        return;
+    }
+    if (conn -> prev_waiting != NULL) {
+        conn -> prev_waiting -> next_waiting = conn -> next_waiting;
+    } else {
+        loop -> waiting = conn -> next_waiting;
+    }
+    if (conn -> next_waiting != NULL) {
+        conn -> next_waiting -> prev_waiting = conn -> prev_waiting;
+    }
+    conn -> waiting = 0;
+}
+
+/*
+ * sweep_timeouts - time out the connections whose server is late, at
+ *                  most every EVENT_SWEEP_MS
+ */
+static void sweep_timeouts(event_loop_t* loop) {
+
+    long now = metrics_clock();
+    conn_t *conn, *next;
+
+    if (now - loop -> last_sweep < EVENT_SWEEP_MS * 1000L) {
+        return;
+    }
+    loop -> last_sweep = now;
+
+    for (conn = loop -> waiting; conn != NULL; conn = next) {
+        next = conn -> next_waiting;
+        // a conn answering the client itself no longer waits for a server
+        if (conn -> deadline > 0 && now >= conn -> deadline &&
+            conn -> state >= CONN_RESOLVE && conn -> state <= CONN_RELAY_BODY) {
+            conn_timeout(loop, conn);
+        }
+    }
+}
+
+/*
+ * conn_timeout - give up on the server of a conn, the client gets a 504
+ *                if nothing was relayed yet, else its connection closes
+ */
+static void conn_timeout(event_loop_t* loop, conn_t* conn) {
+
+    printf("Server timed out.\n");
+    metrics_count(COUNT_UPSTREAM_TIMEOUTS, 1);
+    breaker_report(origin_breaker, conn -> request.host,
+                   conn -> request.port, 0);
+
+    if (conn -> response_length > 0) {
+        conn_close(loop, conn);
+        return;
+    }
+    conn_stop_waiting(loop, conn);
+    // a conn still waiting for the resolver has no server socket yet
+    if (conn -> serverfd >= 0) {
+        close(conn -> serverfd);
+        conn -> serverfd = -1;
+    }
+    free_encoder(conn -> encoder);
+    conn -> encoder = NULL;
+    abort_cache_fill(conn -> cache_fill);
+    conn -> cache_fill = NULL;
+    conn_fail(conn, gateway_timeout_response_str);
+    conn_drive(loop, conn);
+}
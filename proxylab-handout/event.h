@@ -0,0 +1,120 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * event.h - prototypes and definitions for event.c
+ */
+#ifndef __EVENT_H__
+#define __EVENT_H__
+
+#include "csapp.h"
+#include "cache.h"
+#include "freshness.h"
+#include "httpparse.h"
+#include "outvec.h"
+#include "encoding.h"
+#include "dnscache.h"
+
+/* Max number of epoll events handled in one round of a loop */
+#define EVENT_BATCH 256
+
+/* Milliseconds between two checks of the upstream timeouts of a loop */
+#define EVENT_SWEEP_MS 250
+
+/* States of the per-connection state machine */
+typedef enum conn_state_t {
+    CONN_READ_REQUEST,     /* reading request line and headers */
+    CONN_RESOLVE,          /* waiting for a thread to resolve the server */
+    CONN_CONNECT,          /* waiting for the upstream connect to finish */
+    CONN_SEND_REQUEST,     /* writing the request to the server */
+    CONN_RELAY_HEADER,     /* relaying the response header */
+    CONN_RELAY_BODY,       /* streaming the response body */
+    CONN_WRITE_CLIENT,     /* flushing a locally built response */
+    CONN_DONE              /* finished, waiting to be freed */
+} conn_state_t;
+
+/* Defined a struct representing one proxied connection */
+typedef struct conn_t {
+    conn_state_t state;
+    int clientfd;
+    int serverfd;
+
+    /* client request accumulated and parsed in place as it arrives */
+    char req_in[MAXLINE];
+    size_t req_in_length;
+    http_request_t request;
+
+    /* request forwarded to the server, gathered from the parsed one */
+    outvec_t req_out;
+
+    /* bytes read from the server (or built locally) not yet sent */
+    char* out;
+    size_t out_length, out_offset;
+    char relay_buf[MAXBUF];
+    int server_eof;
+    size_t response_length;     /* bytes relayed from the server */
+
+    /* number of "\r\n\r\n" bytes matched so far in the response */
+    int header_match;
+
+    /* response filled into the cache while it is relayed */
+    char cache_id[MAXLINE];
+    cache_fill_t* cache_fill;
+    encoder_t* encoder;         /* encodes the body of cache_fill */
+    freshness_t fresh;          /* caching headers of the response */
+
+    /* cached object pinned while a hit is written to the client */
+    cache_object_t* cache_object;
+    size_t object_offset, object_length, object_sent;
+
+    /* gzip object decoded into relay_buf for a client without gzip */
+    gunzip_t* gunzip;
+
+    /* header built for a 304, 206 or 416 answered from the cache */
+    char head[MAXBUF];
+
+    /* the response may be partial, it is not filled into the cache */
+    int bypass_cache;
+
+    /* times the request and its current phase started (metrics.c) */
+    long started, phase_started;
+
+    /* time the server must have answered by, 0 if it may take forever */
+    long deadline;
+    int waiting;                /* in the waiting list of the loop */
+    struct conn_t* prev_waiting;
+    struct conn_t* next_waiting;
+
+    struct conn_t* next_closed;
+} conn_t;
+
+/* Defined a struct representing a resolution run by another thread */
+typedef struct resolve_job_t {
+    struct event_loop_t* loop;
+    char host[MAXLINE];
+    char port[MAXLINE];
+    dns_addr_t addrs[DNS_MAX_ADDR];
+    int addr_num;          /* -1 if the server cannot be resolved */
+    int done;              /* set by the thread, under resolve_mutex */
+    struct resolve_job_t* next;
+} resolve_job_t;
+
+/* Defined a struct representing one epoll loop and its thread */
+typedef struct event_loop_t {
+    int epfd;
+    int listenfd;
+    pthread_t tid;
+    int cpu;               /* the loop thread is pinned to, -1 if none */
+    conn_t* closed;        /* connections to free after the current batch */
+    conn_t* waiting;       /* connections waiting for their server */
+    long last_sweep;       /* time of the last check of their deadlines */
+    resolve_job_t* resolving;   /* resolutions not yet handed to conns */
+    pthread_mutex_t resolve_mutex;
+    int resolvefd;         /* eventfd written once a resolution is done */
+} event_loop_t;
+
+/* Defined function running the event-driven proxy */
+void run_event_loops(int listenfd, int loop_num);
+void run_reuseport_loops(int* listenfds, int loop_num);
+
+#endif /* __EVENT_H__ */
@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+
+# framing-server.py - This is an origin server for the regression tests
+#                     that frames its bodies the ways tiny never does.
+#                     GET /eof/<n> answers HTTP/1.0 with n bytes and no
+#                     Content-Length, the body ends when the connection
+#                     closes; GET /chunked/<n> answers HTTP/1.1 with n
+#                     bytes in chunks of at most 1000, or ending when
+#                     the connection closes for an HTTP/1.0 request.
+#                     The caching checks get n bytes with a Content-Length:
+#                     GET /cond/<n> with validators and a long max-age,
+#                     /maxage/<n> fresh for one second and answering any
+#                     conditional request with a 304, /nostore/<n> with
+#                     Cache-Control: no-store and /gzip/<n> as gzip when
+#                     the request accepts it; GET /count/<kind>/<n>
+#                     answers how many requests and conditional requests
+#                     that path got since the last count, and resets them.
+#
+# usage: framing-server.py <port>
+#
+import gzip
+import socket
+import sys
+import threading
+
+# validators of /cond/<n> and /maxage/<n>
+LAST_MODIFIED = b"Mon, 01 Jan 2024 00:00:00 GMT"
+
+# requests and conditional requests per path, protected by counts_lock
+counts = {}
+counts_lock = threading.Lock()
+
+def body(n):
+  return (b"0123456789abcdef" * (n // 16 + 1))[:n]
+
+def count(path, conditional):
+  with counts_lock:
+    requests, revalidations = counts.get(path, (0, 0))
+    counts[path] = (requests + 1, revalidations + conditional)
+
+def take_count(path):
+  with counts_lock:
+    return counts.pop(path, (0, 0))
+
+def fixed_length(status, headers, content):
+  return (b"HTTP/1.1 " + status + b"\r\n" + headers +
+          b"Content-Length: %d\r\nConnection: close\r\n\r\n" % len(content) +
+          content)
+
+def cached_response(kind, n, request):
+  lines = request.lower().split(b"\r\n")
+  conditional = any(line.startswith((b"if-none-match:",
+                                     b"if-modified-since:"))
+                    for line in lines)
+  accepts_gzip = any(line.startswith(b"accept-encoding:") and b"gzip" in line
+                     for line in lines)
+  content = body(n)
+  count("/%s/%d" % (kind, n), conditional)
+
+  # octet-stream objects are cached as they are, ranges need that
+  if kind == "cond":
+    return fixed_length(b"200 OK",
+                        b"Content-Type: application/octet-stream\r\n"
+                        b"Cache-Control: max-age=600\r\n"
+                        b"ETag: \"c%d\"\r\n" % n +
+                        b"Last-Modified: " + LAST_MODIFIED + b"\r\n",
+                        content)
+  if kind == "maxage":
+    headers = (b"Content-Type: application/octet-stream\r\n"
+               b"Cache-Control: max-age=1\r\n"
+               b"ETag: \"m%d\"\r\n" % n)
+    if conditional:
+      return fixed_length(b"304 Not Modified", headers, b"")
+    return fixed_length(b"200 OK", headers, content)
+  if kind == "nostore":
+    return fixed_length(b"200 OK", b"Content-Type: text/plain\r\n"
+                        b"Cache-Control: no-store\r\n", content)
+  if accepts_gzip:
+    return fixed_length(b"200 OK", b"Content-Type: text/plain\r\n"
+                        b"Content-Encoding: gzip\r\n"
+                        b"Vary: Accept-Encoding\r\n", gzip.compress(content))
+  return fixed_length(b"200 OK", b"Content-Type: text/plain\r\n"
+                      b"Vary: Accept-Encoding\r\n", content)
+
+def serve(channel):
+  request = b""
+  while b"\r\n\r\n" not in request:
+    data = channel.recv(4096)
+    if not data:
+      channel.close()
+      return
+    request += data
+  method, path, version = request.split(b"\r\n")[0].split(b" ")
+  path = path.decode()
+  kind, n = path.strip("/").split("/")[:2]
+
+  if kind == "count":
+    requests, revalidations = take_count(path[len("/count"):])
+    channel.sendall(fixed_length(b"200 OK", b"Content-Type: text/plain\r\n",
+                                 b"%d %d\n" % (requests, revalidations)))
+    channel.close()
+    return
+  if kind in ("cond", "maxage", "nostore", "gzip"):
+    channel.sendall(cached_response(kind, int(n), request))
+    channel.close()
+    return
+
+  content = body(int(n))
+  if kind == "eof" or version == b"HTTP/1.0":
+    channel.sendall(b"HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\n\r\n" +
+                    content)
+  else:
+    response = (b"HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n"
+                b"Transfer-Encoding: chunked\r\nConnection: close\r\n\r\n")
+    for i in range(0, len(content), 1000):
+      chunk = content[i:i + 1000]
+      response += b"%x\r\n" % len(chunk) + chunk + b"\r\n"
+    channel.sendall(response + b"0\r\n\r\n")
+  channel.close()
+
+#create an INET, STREAMing socket
+serversocket = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+serversocket.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+serversocket.bind(('', int(sys.argv[1])))
+serversocket.listen(16)
+
+while 1:
+  channel, details = serversocket.accept()
+  threading.Thread(target=serve, args=(channel,), daemon=True).start()
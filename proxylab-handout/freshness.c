@@ -0,0 +1,270 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * freshness.c - HTTP freshness of cached responses.
+ * Implementation idea:
+ * 1. Cache-Control (s-maxage, max-age, no-store, private, no-cache,
+ *    must-revalidate, stale-while-revalidate), Expires, Date, Age and
+ *    Last-Modified are parsed while the response header is relayed
+ * 2. a no-store or private response is dropped from the cache fill as
+ *    soon as its header is complete, before any body byte is buffered
+ * 3. the lifetime is s-maxage, max-age, Expires - Date, a tenth of the
+ *    age of Last-Modified, or else a default; the object keeps the time
+ *    it expires at, corrected by the age it already had when received
+ * 4. a stale object inside its stale-while-revalidate window is served
+ *    at once while one background revalidation refreshes it; past the
+ *    window it is revalidated before being served (see proxy.c)
+ * 5. the cache id does not include the request headers, so a response
+ *    varying on one is not stored, unless the proxy sends it the same
+ *    for every client (User-Agent, Accept) or serves every variant from
+ *    one object (Accept-Encoding, see encoding.c)
+ *
+ */
+#include "csapp.h"
+#include "cache.h"
+#include "proxy.h"
+#include "conditional.h"
+#include "freshness.h"
+
+/* Static helper functions for the freshness of cached responses */
+static void parse_cache_control(char* value, freshness_t* fresh);
+static long directive_value(char* directive, size_t length);
+static int varies_on_other(char* value);
+
+/*
+ * init_freshness - a response without any caching header
+ */
+void init_freshness(freshness_t* fresh) {
+
+    fresh -> date = 0;
+    fresh -> expires = 0;
+    fresh -> last_modified = 0;
+    fresh -> age = 0;
+    fresh -> max_age = -1;
+    fresh -> s_maxage = 0;
+    fresh -> stale_while_revalidate = 0;
+    fresh -> no_store = 0;
+    fresh -> is_private = 0;
+    fresh -> no_cache = 0;
+    fresh -> must_revalidate = 0;
+    fresh -> vary_other = 0;
+}
+
+/*
+ * parse_freshness_header - record the caching header a response line sets
+ */
+void parse_freshness_header(char* buf, freshness_t* fresh) {
+
+    char* value = strchr(buf, ':');
+    time_t expires;
+
+    if (value == NULL) {
+        return;
+    }
+    value++;
+
+    if (!strncasecmp(buf, "Cache-Control:", 14)) {
+        parse_cache_control(value, fresh);
+    } else if (!strncasecmp(buf, "Expires:", 8)) {
+        // an invalid date means already expired
+        expires = parse_http_date(value);
+        fresh -> expires = (expires > 1) ? expires : 1;
+    } else if (!strncasecmp(buf, "Date:", 5)) {
+        fresh -> date = parse_http_date(value);
+    } else if (!strncasecmp(buf, "Age:", 4)) {
+        fresh -> age = strtol(value, NULL, 10);
+    } else if (!strncasecmp(buf, "Last-Modified:", 14)) {
+        fresh -> last_modified = parse_http_date(value);
+    } else if (!strncasecmp(buf, "Vary:", 5)) {
+        fresh -> vary_other |= varies_on_other(value);
+    }
+}
+
+/*
+ * parse_object_freshness - parse the caching headers at the start of an
+ *                          object, for a fill relayed without parsing
+ *                          return -1 if the object has no complete header
+ */
+int parse_object_freshness(cache_object_t* object, freshness_t* fresh) {
+
+    char buf[MAXBUF];
+    char *line, *line_end, *end;
+
+    init_freshness(fresh);
+    end = buf + read_cache_object(object, 0, buf, MAXBUF - 1);
+    *end = '\0';
+
+    // skip the status line
+    if ((line = memchr(buf, '\n', end - buf)) == NULL) {
+        return -1;
+    }
+    for (line++; line < end; line = line_end + 1) {
+        if ((line_end = memchr(line, '\n', end - line)) == NULL) {
+            return -1;
+        }
+        if (line[0] == '\r' || line[0] == '\n') {
+            return 0;
+        }
+        *line_end = '\0';
+        parse_freshness_header(line, fresh);
+    }
+    return -1;
+}
+
+/*
+ * response_storable - check whether a shared cache may keep the response
+ */
+int response_storable(freshness_t* fresh) {
+
+    return !fresh -> no_store && !fresh -> is_private && !fresh -> vary_other;
+}
+
+/*
+ * set_object_freshness - compute when the object expires from the caching
+ *                        headers of its response, received just now
+ */
+void set_object_freshness(cache_object_t* object, freshness_t* fresh,
+                          int default_lifetime) {
+
+    time_t now = time(NULL);
+    time_t date = (fresh -> date > 0) ? fresh -> date : now;
+    long lifetime, age;
+
+    if (fresh -> no_cache) {
+        lifetime = 0;
+    } else if (fresh -> max_age >= 0) {
+        lifetime = fresh -> max_age;
+    } else if (fresh -> expires > 0) {
+        lifetime = (fresh -> expires > date) ? fresh -> expires - date : 0;
+    } else if (fresh -> last_modified > 0 && fresh -> last_modified < date) {
+        lifetime = (date - fresh -> last_modified) / FRESH_HEURISTIC_DIV;
+        if (lifetime > FRESH_HEURISTIC_MAX) {
+            lifetime = FRESH_HEURISTIC_MAX;
+        }
+    } else {
+        lifetime = default_lifetime;
+    }
+
+    // the age the response already had when it arrived
+    age = (now > date) ? now - date : 0;
+    if (fresh -> age > age) {
+        age = fresh -> age;
+    }
+
+    object -> lifetime = lifetime;
+    object -> expires = now - age + lifetime;
+    object -> stale_window = (fresh -> must_revalidate || fresh -> no_cache) ?
+                             0 : fresh -> stale_while_revalidate;
+}
+
+/*
+ * renew_object_freshness - the server confirmed the object, it is fresh
+ *                          for its lifetime again
+ */
+void renew_object_freshness(cache_object_t* object) {
+
+    __atomic_store_n(&object -> expires, time(NULL) + object -> lifetime,
+                     __ATOMIC_RELAXED);
+}
+
+/*
+ * object_freshness - whether a cached object can be served as it is
+ *                    return FRESH_OK, FRESH_STALE_OK or FRESH_STALE
+ */
+int object_freshness(cache_object_t* object) {
+
+    time_t now = time(NULL);
+    time_t expires = __atomic_load_n(&object -> expires, __ATOMIC_RELAXED);
+
+    if (now < expires) {
+        return FRESH_OK;
+    }
+    if (now < expires + object -> stale_window) {
+        return FRESH_STALE_OK;
+    }
+    return FRESH_STALE;
+}
+
+/*
+ * parse_cache_control - record the directives of a Cache-Control value
+ */
+static void parse_cache_control(char* value, freshness_t* fresh) {
+
+    char* directive;
+    size_t length;
+
+    for (directive = value; *directive != '\0'; directive += length) {
+        directive += strspn(directive, " \t,");
+        length = strcspn(directive, ",\r\n");
+        if (length == 0) {
+            break;
+        }
+
+        if (!strncasecmp(directive, "s-maxage=", 9)) {
+            fresh -> max_age = directive_value(directive, length);
+            fresh -> s_maxage = 1;
+        } else if (!strncasecmp(directive, "max-age=", 8)) {
+            // s-maxage takes precedence in a shared cache
+            if (!fresh -> s_maxage) {
+                fresh -> max_age = directive_value(directive, length);
+            }
+        } else if (!strncasecmp(directive, "stale-while-revalidate=", 23)) {
+            fresh -> stale_while_revalidate =
+                directive_value(directive, length);
+        } else if (!strncasecmp(directive, "no-store", 8)) {
+            fresh -> no_store = 1;
+        } else if (!strncasecmp(directive, "private", 7)) {
+            fresh -> is_private = 1;
+        } else if (!strncasecmp(directive, "no-cache", 8)) {
+            fresh -> no_cache = 1;
+        } else if (!strncasecmp(directive, "must-revalidate", 15) ||
+                   !strncasecmp(directive, "proxy-revalidate", 16)) {
+            fresh -> must_revalidate = 1;
+        }
+    }
+}
+
+/*
+ * directive_value - the number after the '=' of a directive, quoted or not
+ *                   return 0 if it is not a number
+ */
+static long directive_value(char* directive, size_t length) {
+
+    char* value = memchr(directive, '=', length);
+    long number;
+
+    if (value == NULL) {
+        return 0;
+    }
+    value++;
+    if (*value == '"') {
+        value++;
+    }
+    number = strtol(value, NULL, 10);
+    return (number > 0) ? number : 0;
+}
+
+/*
+ * varies_on_other - check whether a Vary value names * or a request header
+ *                   that is not the same in every request the proxy sends
+ */
+static int varies_on_other(char* value) {
+
+    char* name;
+    size_t length;
+
+    for (name = value; *name != '\0'; name += length) {
+        name += strspn(name, " \t,");
+        length = strcspn(name, " \t,\r\n");
+        if (length == 0) {
+            break;
+        }
+        if (!(length == 15 && !strncasecmp(name, "Accept-Encoding", 15)) &&
+            !(length == 10 && !strncasecmp(name, "User-Agent", 10)) &&
+            !(length == 6 && !strncasecmp(name, "Accept", 6))) {
+            return 1;
+        }
+    }
+    return 0;
+}
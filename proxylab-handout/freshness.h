@@ -0,0 +1,51 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * freshness.h - prototypes and definitions for freshness.c
+ */
+#ifndef __FRESHNESS_H__
+#define __FRESHNESS_H__
+
+#include "csapp.h"
+#include "cache.h"
+
+/* Default seconds a response without Cache-Control or Expires is fresh */
+#define FRESH_DEFAULT_LIFETIME 300
+
+/* Heuristic lifetime from Last-Modified: a tenth of its age, capped */
+#define FRESH_HEURISTIC_DIV 10
+#define FRESH_HEURISTIC_MAX 86400
+
+/* States of a cached object, see object_freshness */
+#define FRESH_OK         0      /* serve it */
+#define FRESH_STALE_OK   1      /* serve it and refresh it in background */
+#define FRESH_STALE      2      /* revalidate before serving it */
+
+/* Defined a struct representing the caching headers of a response */
+typedef struct freshness_t {
+    time_t date;                    // 0 if absent
+    time_t expires;                 // 0 if absent, 1 if invalid
+    time_t last_modified;           // 0 if absent
+    long age;                       // Age header, 0 if absent
+    long max_age;                   // s-maxage or max-age, -1 if absent
+    int s_maxage;                   // max_age came from s-maxage
+    long stale_while_revalidate;    // 0 if absent
+    int no_store;
+    int is_private;
+    int no_cache;
+    int must_revalidate;
+    int vary_other;                 // Vary names a header the proxy passes
+} freshness_t;
+
+/* Defined function tracking the freshness of cached responses */
+void init_freshness(freshness_t* fresh);
+void parse_freshness_header(char* buf, freshness_t* fresh);
+int parse_object_freshness(cache_object_t* object, freshness_t* fresh);
+int response_storable(freshness_t* fresh);
+void set_object_freshness(cache_object_t* object, freshness_t* fresh,
+                          int default_lifetime);
+void renew_object_freshness(cache_object_t* object);
+int object_freshness(cache_object_t* object);
+
+#endif /* __FRESHNESS_H__ */
@@ -0,0 +1,431 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * httpparse.c - incremental HTTP/1.x request parser working in place.
+ * Implementation idea:
+ * 1. the parser is fed the same buffer again every time more bytes
+ *    arrived and resumes where it stopped, so a partial read costs
+ *    nothing and no byte is searched twice for the end of its line
+ * 2. the request line and the header lines are tokenized into pointers
+ *    and lengths into the buffer; every token is NUL terminated in place
+ *    (over the separator behind it), nothing is copied
+ * 3. a header name is hashed from its length and three of its characters,
+ *    whatever its length; known names get their HDR_* id from a small
+ *    static table and every header is chained into a per request hash
+ *    table for lookups, a full case-insensitive compare confirms a match
+ * 4. in threaded mode the head is parsed straight out of the rio buffer,
+ *    bytes behind it (a pipelined request) stay there for the next one
+ *
+ */
+#include "csapp.h"
+#include "httpparse.h"
+
+/* Number of slots of the table of known header names, a power of 2 */
+#define KNOWN_SLOT_NUM 64
+
+/* Defined a struct representing a header name the proxy acts on */
+typedef struct known_header_t {
+    const char* name;
+    size_t length;
+    int id;
+    unsigned int hash;              // set by init_known_headers
+} known_header_t;
+
+static known_header_t known_headers[] = {
+    { "Host",              4,  HDR_HOST },
+    { "User-Agent",        10, HDR_USER_AGENT },
+    { "Accept",            6,  HDR_ACCEPT },
+    { "Accept-Encoding",   15, HDR_ACCEPT_ENCODING },
+    { "Connection",        10, HDR_CONNECTION },
+    { "Proxy-Connection",  16, HDR_PROXY_CONNECTION },
+    { "Keep-Alive",        10, HDR_KEEP_ALIVE },
+    { "If-None-Match",     13, HDR_IF_NONE_MATCH },
+    { "If-Modified-Since", 17, HDR_IF_MODIFIED_SINCE },
+    { "If-Range",          8,  HDR_IF_RANGE },
+    { "Range",             5,  HDR_RANGE },
+    { "Cache-Control",     13, HDR_CACHE_CONTROL },
+    { "Pragma",            6,  HDR_PRAGMA },
+};
+
+/* slot -> index + 1 into known_headers, 0 if the slot is empty */
+static int known_slots[KNOWN_SLOT_NUM];
+static pthread_once_t known_once = PTHREAD_ONCE_INIT;
+
+/* default port and path of a uri without them */
+static char default_port[] = "80";
+static char default_path[] = "/";
+
+/* Or-ing 0x20 lowers a letter and keeps the other characters of a header
+ * name distinct enough for a hash */
+#define LOWER(c) ((unsigned char)(c) | 0x20)
+
+/* Static helper functions for the request parser */
+static void init_known_headers();
+static int known_header_id(char* name, size_t length, unsigned int hash);
+static unsigned int hash_name(const char* name, size_t length);
+static int names_equal(const char* a, const char* b, size_t length);
+static int parse_request_line(http_request_t* req, char* line, size_t length);
+static int parse_header_line(http_request_t* req, char* line, size_t length);
+
+/*
+ * init_http_request - prepare req for the parse of a new request head
+ */
+void init_http_request(http_request_t* req) {
+
+    Pthread_once(&known_once, init_known_headers);
+
+    req -> line = 0;
+    req -> scanned = 0;
+    req -> length = 0;
+    req -> has_request_line = 0;
+    req -> header_num = 0;
+    req -> host = NULL;
+    req -> port = NULL;
+    req -> path = NULL;
+    memset(req -> buckets, -1, sizeof(req -> buckets));
+}
+
+/*
+ * parse_http_request - parse the complete lines of buf[0, length), the
+ *                      caller passes the same buffer again once more bytes
+ *                      were appended to it
+ *                      return HTTP_PARSE_DONE when the head is complete
+ *                      (req -> length bytes), HTTP_PARSE_AGAIN if it needs
+ *                      more bytes, HTTP_PARSE_ERROR if it is malformed
+ */
+int parse_http_request(http_request_t* req, char* buf, size_t length) {
+
+    char *line, *end;
+    size_t line_length;
+
+    while (1) {
+        end = memchr(buf + req -> scanned, '\n', length - req -> scanned);
+        if (end == NULL) {
+            req -> scanned = length;
+            return HTTP_PARSE_AGAIN;
+        }
+
+        line = buf + req -> line;
+        line_length = end - line;
+        if (line_length > 0 && line[line_length - 1] == '\r') {
+            line_length--;
+        }
+        req -> line = req -> scanned = end - buf + 1;
+
+        if (!req -> has_request_line) {
+            // empty lines before the request line are ignored
+            if (line_length > 0 &&
+                parse_request_line(req, line, line_length) == -1) {
+                return HTTP_PARSE_ERROR;
+            }
+        } else if (line_length == 0) {
+            req -> length = req -> line;
+            return HTTP_PARSE_DONE;
+        } else if (parse_header_line(req, line, line_length) == -1) {
+            return HTTP_PARSE_ERROR;
+        }
+    }
+}
+
+/*
+ * parse_http_uri - split the absolute uri of a parsed request into host,
+ *                  port and path; host[:port] is moved one byte to the
+ *                  left over the "://" so that it is NUL terminated in
+ *                  place without touching the path, the uri is lost
+ *                  return -1 if the uri has no scheme or no host
+ */
+int parse_http_uri(http_request_t* req) {
+
+    char *authority, *end, *colon;
+
+    if ((authority = strstr(req -> uri, "://")) == NULL) {
+        return -1;
+    }
+    authority += 3;
+    end = authority + strcspn(authority, "/");
+    if (end == authority) {
+        return -1;
+    }
+
+    memmove(authority - 1, authority, end - authority);
+    req -> host = authority - 1;
+    end[-1] = '\0';
+
+    req -> port = default_port;
+    if ((colon = strchr(req -> host, ':')) != NULL) {
+        *colon = '\0';
+        if (colon[1] != '\0') {
+            req -> port = colon + 1;
+        }
+    }
+    req -> path = (*end == '/') ? end : default_path;
+    return 0;
+}
+
+/*
+ * find_http_header - look up a header of a parsed request by its name,
+ *                    ignoring case
+ *                    return NULL if the request does not have it
+ */
+http_header_t* find_http_header(http_request_t* req, const char* name) {
+
+    size_t length = strlen(name);
+    unsigned int hash = hash_name(name, length);
+    http_header_t* header;
+    int i;
+
+    for (i = req -> buckets[hash & (HTTP_BUCKET_NUM - 1)]; i != -1;
+         i = header -> next) {
+        header = &req -> headers[i];
+        if (header -> hash == hash && header -> name_length == length &&
+            names_equal(header -> name, name, length)) {
+            return header;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * rio_read_request - read and parse a request head inside the rio buffer,
+ *                    the head is consumed from it, the tokens stay valid
+ *                    until the next read from rp
+ *                    return 1 on success, 0 if the client closed or timed
+ *                    out, -1 if the head is malformed or too large
+ */
+int rio_read_request(rio_t* rp, http_request_t* req) {
+
+    ssize_t n;
+    int rc;
+
+    init_http_request(req);
+
+    // the head has to fit the buffer, start it at the front
+    if (rp -> rio_bufptr != rp -> rio_buf) {
+        memmove(rp -> rio_buf, rp -> rio_bufptr, rp -> rio_cnt);
+        rp -> rio_bufptr = rp -> rio_buf;
+    }
+
+    while ((rc = parse_http_request(req, rp -> rio_buf, rp -> rio_cnt)) ==
+           HTTP_PARSE_AGAIN) {
+        if (rp -> rio_cnt == RIO_BUFSIZE) {
+            return -1;
+        }
+        n = read(rp -> rio_fd, rp -> rio_buf + rp -> rio_cnt,
+                 RIO_BUFSIZE - rp -> rio_cnt);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 0;
+        }
+        rp -> rio_cnt += n;
+    }
+    if (rc == HTTP_PARSE_ERROR) {
+        return -1;
+    }
+
+    rp -> rio_bufptr += req -> length;
+    rp -> rio_cnt -= req -> length;
+    return 1;
+}
+
+/*
+ * http_append - append n bytes of src to the NUL terminated dest holding
+ *               length bytes out of size, nothing is appended if they do
+ *               not fit
+ *               return the new length of dest
+ */
+size_t http_append(char* dest, size_t length, size_t size,
+                   const char* src, size_t n) {
+
+    if (length + n >= size) {
+        return length;
+    }
+    memcpy(dest + length, src, n);
+    dest[length + n] = '\0';
+    return length + n;
+}
+
+/*
+ * http_append_header - append the line "name: value\r\n" of a parsed
+ *                      header to dest, nothing if it does not fit
+ *                      return the new length of dest
+ */
+size_t http_append_header(char* dest, size_t length, size_t size,
+                          http_header_t* header) {
+
+    size_t n = header -> name_length + header -> value_length + 4;
+
+    if (length + n >= size) {
+        return length;
+    }
+    length = http_append(dest, length, size, header -> name,
+                         header -> name_length);
+    length = http_append(dest, length, size, ": ", 2);
+    length = http_append(dest, length, size, header -> value,
+                         header -> value_length);
+    return http_append(dest, length, size, "\r\n", 2);
+}
+
+/*
+ * init_known_headers - hash the known header names into their slots
+ */
+static void init_known_headers() {
+
+    size_t i, slot;
+    unsigned int hash;
+
+    for (i = 0; i < sizeof(known_headers) / sizeof(known_headers[0]); i++) {
+        hash = hash_name(known_headers[i].name, known_headers[i].length);
+        known_headers[i].hash = hash;
+        slot = hash & (KNOWN_SLOT_NUM - 1);
+        while (known_slots[slot] != 0) {
+            slot = (slot + 1) & (KNOWN_SLOT_NUM - 1);
+        }
+        known_slots[slot] = i + 1;
+    }
+}
+
+/*
+ * known_header_id - the HDR_* id of a header name, HDR_OTHER if unknown
+ */
+static int known_header_id(char* name, size_t length, unsigned int hash) {
+
+    size_t slot = hash & (KNOWN_SLOT_NUM - 1);
+    known_header_t* known;
+
+    for (; known_slots[slot] != 0; slot = (slot + 1) & (KNOWN_SLOT_NUM - 1)) {
+        known = &known_headers[known_slots[slot] - 1];
+        if (known -> hash == hash && known -> length == length &&
+            names_equal(known -> name, name, length)) {
+            return known -> id;
+        }
+    }
+    return HDR_OTHER;
+}
+
+/*
+ * hash_name - hash a header name ignoring case, in constant time
+ */
+static unsigned int hash_name(const char* name, size_t length) {
+
+    unsigned int hash = length;
+
+    if (length > 0) {
+        hash = hash * 31 + LOWER(name[0]);
+        hash = hash * 31 + LOWER(name[length / 2]);
+        hash = hash * 31 + LOWER(name[length - 1]);
+    }
+    hash *= 2654435761u;
+    return hash ^ (hash >> 16);
+}
+
+/*
+ * names_equal - compare two header names of length bytes, ignoring the
+ *               case of ASCII letters
+ */
+static int names_equal(const char* a, const char* b, size_t length) {
+
+    size_t i;
+    unsigned char x, y;
+
+    for (i = 0; i < length; i++) {
+        x = a[i];
+        y = b[i];
+        if (x != y) {
+            if ((x | 0x20) != (y | 0x20) || (x | 0x20) < 'a' ||
+                (x | 0x20) > 'z') {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/*
+ * parse_request_line - split "method uri [version]" in place
+ *                      return -1 if the method or the uri is missing
+ */
+static int parse_request_line(http_request_t* req, char* line,
+                              size_t length) {
+
+    char* end = line + length;
+    char *uri, *uri_end, *version;
+
+    if ((uri_end = memchr(line, ' ', length)) == NULL || uri_end == line) {
+        return -1;
+    }
+    req -> method = line;
+    req -> method_length = uri_end - line;
+
+    for (uri = uri_end; uri < end && *uri == ' '; uri++);
+    if (uri == end) {
+        return -1;
+    }
+    if ((uri_end = memchr(uri, ' ', end - uri)) == NULL) {
+        uri_end = end;
+    }
+    req -> uri = uri;
+    req -> uri_length = uri_end - uri;
+
+    // an old client may leave the version out, it is empty then
+    for (version = uri_end; version < end && *version == ' '; version++);
+    while (end > version && end[-1] == ' ') {
+        end--;
+    }
+    req -> version = version;
+    req -> version_length = end - version;
+
+    req -> method[req -> method_length] = '\0';
+    *uri_end = '\0';
+    *end = '\0';
+    req -> has_request_line = 1;
+    return 0;
+}
+
+/*
+ * parse_header_line - split "name: value" in place and index the header
+ *                     return -1 if the line is malformed or one too many
+ */
+static int parse_header_line(http_request_t* req, char* line, size_t length) {
+
+    http_header_t* header;
+    char* end = line + length;
+    char *colon, *value;
+    unsigned int hash;
+    int bucket;
+
+    // obsolete line folding is refused like RFC 7230 allows
+    if (req -> header_num == HTTP_MAX_HEADERS ||
+        line[0] == ' ' || line[0] == '\t') {
+        return -1;
+    }
+
+    colon = memchr(line, ':', length);
+    if (colon == NULL || colon == line || colon[-1] == ' ') {
+        return -1;
+    }
+    hash = hash_name(line, colon - line);
+
+    for (value = colon + 1; value < end && (*value == ' ' || *value == '\t');
+         value++);
+    while (end > value && (end[-1] == ' ' || end[-1] == '\t')) {
+        end--;
+    }
+
+    header = &req -> headers[req -> header_num];
+    header -> name = line;
+    header -> name_length = colon - line;
+    header -> value = value;
+    header -> value_length = end - value;
+    header -> hash = hash;
+    header -> id = known_header_id(line, colon - line, hash);
+    *colon = '\0';
+    *end = '\0';
+
+    bucket = hash & (HTTP_BUCKET_NUM - 1);
+    header -> next = req -> buckets[bucket];
+    req -> buckets[bucket] = req -> header_num++;
+    return 0;
+}
@@ -0,0 +1,87 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * httpparse.h - prototypes and definitions for httpparse.c
+ */
+#ifndef __HTTPPARSE_H__
+#define __HTTPPARSE_H__
+
+#include "csapp.h"
+
+/* Max header lines of a request, a request with more is rejected */
+#define HTTP_MAX_HEADERS 64
+
+/* Number of buckets of the header table of a request, a power of 2 */
+#define HTTP_BUCKET_NUM 64
+
+/* Results of parse_http_request */
+#define HTTP_PARSE_DONE    1
+#define HTTP_PARSE_AGAIN   0
+#define HTTP_PARSE_ERROR  -1
+
+/* Headers the proxy acts on, recognized while the request is parsed */
+#define HDR_OTHER             0
+#define HDR_HOST              1
+#define HDR_USER_AGENT        2
+#define HDR_ACCEPT            3
+#define HDR_ACCEPT_ENCODING   4
+#define HDR_CONNECTION        5
+#define HDR_PROXY_CONNECTION  6
+#define HDR_KEEP_ALIVE        7
+#define HDR_IF_NONE_MATCH     8
+#define HDR_IF_MODIFIED_SINCE 9
+#define HDR_IF_RANGE          10
+#define HDR_RANGE             11
+#define HDR_CACHE_CONTROL     12
+#define HDR_PRAGMA            13
+
+/*
+ * Defined a struct representing one header line, name and value point
+ * into the request buffer and are NUL terminated in place
+ */
+typedef struct http_header_t {
+    char* name;
+    size_t name_length;
+    char* value;                    // without the surrounding spaces
+    size_t value_length;
+    unsigned int hash;              // of the lower case name
+    int id;                         // HDR_* of a known name
+    int next;                       // next header of the bucket, -1 ends
+} http_header_t;
+
+/*
+ * Defined a struct representing a request head parsed in place,
+ * it is fed the same buffer again as more bytes arrive
+ */
+typedef struct http_request_t {
+    size_t line;                    // start of the line being parsed
+    size_t scanned;                 // bytes searched for its end already
+    size_t length;                  // of the whole head once done
+    int has_request_line;
+    char* method;
+    size_t method_length;
+    char* uri;
+    size_t uri_length;
+    char* version;                  // empty for a request without one
+    size_t version_length;
+    char* host;                     // set by parse_http_uri
+    char* port;
+    char* path;
+    http_header_t headers[HTTP_MAX_HEADERS];
+    int header_num;
+    int buckets[HTTP_BUCKET_NUM];   // first header of the bucket, -1 if none
+} http_request_t;
+
+/* Defined function parsing HTTP/1.x requests without copying them */
+void init_http_request(http_request_t* req);
+int parse_http_request(http_request_t* req, char* buf, size_t length);
+int parse_http_uri(http_request_t* req);
+http_header_t* find_http_header(http_request_t* req, const char* name);
+int rio_read_request(rio_t* rp, http_request_t* req);
+size_t http_append(char* dest, size_t length, size_t size,
+                   const char* src, size_t n);
+size_t http_append_header(char* dest, size_t length, size_t size,
+                          http_header_t* header);
+
+#endif /* __HTTPPARSE_H__ */
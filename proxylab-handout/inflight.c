@@ -0,0 +1,416 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * inflight.c - request coalescing for concurrent cache misses.
+ * Implementation idea:
+ * 1. keep every upstream fetch in flight in a hash table keyed on the
+ *    cache id; the first requester of a missing id becomes the leader
+ *    and talks to the server, later requesters join as followers
+ * 2. the leader appends every response chunk to the flight buffer and
+ *    wakes the followers up, so followers stream the bytes as they
+ *    arrive instead of opening their own upstream connection
+ * 3. a follower may join at any time and starts from offset 0, so the
+ *    buffer keeps the head of the response up to the object size limit;
+ *    past it the flight leaves the table, with no follower the leader
+ *    stops copying, otherwise the buffer becomes a window that drops
+ *    the bytes every follower has read and the leader waits for the
+ *    slowest one when it is full; a follower that reads nothing for
+ *    FLIGHT_DRAIN_TIMEOUT seconds (stuck writing to its client) is
+ *    dropped from the flight and sees it failed
+ * 4. the leader removes the flight from the table when it finishes,
+ *    the flight itself is freed when the last of leader and followers
+ *    leaves it
+ *
+ */
+#include "csapp.h"
+#include "cache.h"
+#include "inflight.h"
+
+/* Initial size of the flight buffer */
+#define FLIGHT_INIT_CAPACITY MAXBUF
+
+/* Static helper functions for the in-flight table */
+static flight_t* create_flight(char* id, unsigned int hash);
+static void unindex_flight(flight_table_t* table, flight_t* flight);
+static void unlink_flight(flight_table_t* table, flight_t* flight);
+static int make_flight_room(flight_t* flight, size_t length);
+static void drop_readers(flight_t* flight, size_t offset);
+
+/*
+ * init_flight_table - initialize an empty in-flight table
+ *                     return a pointer to the table
+ */
+flight_table_t* init_flight_table() {
+
+    flight_table_t* table =
+        (flight_table_t *)Calloc(1, sizeof(flight_table_t));
+    Sem_init(&table -> mutex, 0, 1);
+    return table;
+
+}
+
+/*
+ * join_flight - join the fetch of id in flight as a follower reading
+ *               with reader, or start a new one buffering up to
+ *               max_length bytes for the later followers,
+ *               *leader is set to 1 if the caller has to fetch it
+ *               return the flight, the caller must leave_flight or
+ *               finish_flight it
+ */
+flight_t* join_flight(flight_table_t* table, char* id, size_t max_length,
+                      flight_reader_t* reader, int* leader) {
+
+    flight_t* flight;
+    unsigned int hash = hash_cache_id(id);
+    unsigned int index = hash & (FLIGHT_BUCKET_NUM - 1);
+
+    P(&table -> mutex);
+
+    // subscribe to the fetch already in flight
+    for (flight = table -> buckets[index]; flight; flight = flight -> hnext) {
+        if (flight -> hash == hash && strcmp(flight -> flight_id, id) == 0) {
+            // an indexed flight still has the head of the response
+            pthread_mutex_lock(&flight -> mutex);
+            flight -> refcnt++;
+            reader -> offset = 0;
+            reader -> dropped = 0;
+            reader -> next = flight -> readers;
+            flight -> readers = reader;
+            pthread_mutex_unlock(&flight -> mutex);
+            V(&table -> mutex);
+            *leader = 0;
+            return flight;
+        }
+    }
+
+    // nobody is fetching it, the caller leads a new flight
+    flight = create_flight(id, hash);
+    flight -> max_length = max_length;
+    flight -> table = table;
+    flight -> hnext = table -> buckets[index];
+    table -> buckets[index] = flight;
+
+    V(&table -> mutex);
+    *leader = 1;
+    return flight;
+}
+
+/*
+ * publish_flight - append a chunk of the response and wake the followers
+ *                  return -1 if the chunk is not buffered, because nobody
+ *                  reads it any more or the buffer cannot grow, the
+ *                  followers then see the flight failed
+ */
+int publish_flight(flight_t* flight, char* buf, size_t length) {
+
+    size_t capacity;
+    char* content;
+
+    // only the leader publishes, seals and unindexes the flight
+    if (flight -> sealed) {
+        return -1;
+    }
+    // past the head nobody may join, a new follower would start at 0
+    if (flight -> indexed &&
+        flight -> length + length > flight -> max_length) {
+        unindex_flight(flight -> table, flight);
+    }
+
+    pthread_mutex_lock(&flight -> mutex);
+
+    if (flight -> state != FLIGHT_RUNNING) {
+        pthread_mutex_unlock(&flight -> mutex);
+        return -1;
+    }
+
+    // stop copying once the followers are gone for good
+    if (!flight -> indexed && make_flight_room(flight, length) == -1) {
+        flight -> sealed = 1;
+        pthread_mutex_unlock(&flight -> mutex);
+        return -1;
+    }
+
+    // grow the buffer geometrically, the window bounds it
+    if (flight -> length - flight -> base + length > flight -> capacity) {
+        capacity = flight -> capacity;
+        while (capacity < flight -> length - flight -> base + length) {
+            capacity *= 2;
+        }
+        if ((content = (char *)realloc(flight -> content, capacity)) == NULL) {
+            flight -> state = FLIGHT_FAILED;
+            pthread_cond_broadcast(&flight -> cond);
+            pthread_mutex_unlock(&flight -> mutex);
+            return -1;
+        }
+        flight -> content = content;
+        flight -> capacity = capacity;
+    }
+
+    memcpy(flight -> content + (flight -> length - flight -> base), buf,
+           length);
+    flight -> length += length;
+
+    if (flight -> waiting > 0) {
+        pthread_cond_broadcast(&flight -> cond);
+    }
+    pthread_mutex_unlock(&flight -> mutex);
+    return 0;
+}
+
+/*
+ * finish_flight - the leader is done, ok is 0 if the fetch failed;
+ *                 new requesters no longer join this flight
+ */
+void finish_flight(flight_table_t* table, flight_t* flight, int ok) {
+
+    unindex_flight(table, flight);
+
+    pthread_mutex_lock(&flight -> mutex);
+    if (flight -> state == FLIGHT_RUNNING) {
+        flight -> state = ok ? FLIGHT_DONE : FLIGHT_FAILED;
+    }
+    pthread_cond_broadcast(&flight -> cond);
+    pthread_mutex_unlock(&flight -> mutex);
+
+    leave_flight(flight, NULL);
+}
+
+/*
+ * seal_flight - the leader asks to stop publishing, granted only if no
+ *               follower joined; the flight is then removed from the
+ *               table so that nobody can join it any more
+ *               return 1 if granted
+ */
+int seal_flight(flight_table_t* table, flight_t* flight) {
+
+    int alone;
+
+    // followers join under the table mutex, hold it while checking
+    P(&table -> mutex);
+    pthread_mutex_lock(&flight -> mutex);
+    alone = (flight -> refcnt == 1);
+    flight -> sealed = alone;
+    pthread_mutex_unlock(&flight -> mutex);
+    if (alone) {
+        unlink_flight(table, flight);
+    }
+    V(&table -> mutex);
+
+    return alone;
+}
+
+/*
+ * read_flight - copy up to n bytes of the response at the offset of
+ *               reader, wait for the leader if they have not arrived yet
+ *               return the number of bytes, 0 at the end of a finished
+ *               flight, -1 if the flight failed or dropped the reader
+ */
+ssize_t read_flight(flight_t* flight, flight_reader_t* reader, char* buf,
+                    size_t n) {
+
+    size_t count;
+
+    pthread_mutex_lock(&flight -> mutex);
+
+    while (flight -> length <= reader -> offset &&
+           flight -> state == FLIGHT_RUNNING && !reader -> dropped) {
+        flight -> waiting++;
+        pthread_cond_wait(&flight -> cond, &flight -> mutex);
+        flight -> waiting--;
+    }
+
+    if (flight -> state == FLIGHT_FAILED || reader -> dropped) {
+        pthread_mutex_unlock(&flight -> mutex);
+        return -1;
+    }
+
+    // the window never drops bytes a reader has not read
+    count = flight -> length - reader -> offset;
+    if (count > n) {
+        count = n;
+    }
+    memcpy(buf, flight -> content + (reader -> offset - flight -> base),
+           count);
+    reader -> offset += count;
+
+    if (flight -> blocked) {
+        pthread_cond_signal(&flight -> drained);
+    }
+    pthread_mutex_unlock(&flight -> mutex);
+    return count;
+}
+
+/*
+ * leave_flight - drop the reference of a follower with its reader (or the
+ *                leader with NULL), the last one frees the flight
+ */
+void leave_flight(flight_t* flight, flight_reader_t* reader) {
+
+    flight_reader_t** link;
+    int refcnt;
+
+    pthread_mutex_lock(&flight -> mutex);
+    if (reader != NULL) {
+        for (link = &flight -> readers; *link; link = &(*link) -> next) {
+            if (*link == reader) {
+                *link = reader -> next;
+                break;
+            }
+        }
+        // the leader may be waiting for this reader only
+        if (flight -> blocked) {
+            pthread_cond_signal(&flight -> drained);
+        }
+    }
+    refcnt = --flight -> refcnt;
+    pthread_mutex_unlock(&flight -> mutex);
+
+    if (refcnt == 0) {
+        pthread_mutex_destroy(&flight -> mutex);
+        pthread_cond_destroy(&flight -> cond);
+        pthread_cond_destroy(&flight -> drained);
+        Free(flight -> content);
+        Free(flight -> flight_id);
+        Free(flight);
+    }
+}
+
+/*
+ * create_flight - allocate a running flight owned by its leader
+ */
+static flight_t* create_flight(char* id, unsigned int hash) {
+
+    flight_t* flight = (flight_t *)Calloc(1, sizeof(flight_t));
+
+    flight -> flight_id = (char *)Malloc(strlen(id) + 1);
+    strcpy(flight -> flight_id, id);
+    flight -> hash = hash;
+    flight -> content = (char *)Malloc(FLIGHT_INIT_CAPACITY);
+    flight -> capacity = FLIGHT_INIT_CAPACITY;
+    flight -> base = 0;
+    flight -> length = 0;
+    flight -> state = FLIGHT_RUNNING;
+    flight -> refcnt = 1;
+    flight -> indexed = 1;
+    pthread_mutex_init(&flight -> mutex, NULL);
+    pthread_cond_init(&flight -> cond, NULL);
+    pthread_cond_init(&flight -> drained, NULL);
+
+    return flight;
+}
+
+/*
+ * unindex_flight - remove the flight from the table if it is still there
+ */
+static void unindex_flight(flight_table_t* table, flight_t* flight) {
+
+    P(&table -> mutex);
+    unlink_flight(table, flight);
+    V(&table -> mutex);
+}
+
+/*
+ * unlink_flight - remove the flight from its bucket if it is still there
+ *                 the caller must hold the table mutex
+ */
+static void unlink_flight(flight_table_t* table, flight_t* flight) {
+
+    flight_t** link;
+
+    if (flight -> indexed) {
+        link = &table -> buckets[flight -> hash & (FLIGHT_BUCKET_NUM - 1)];
+        while (*link != NULL) {
+            if (*link == flight) {
+                *link = flight -> hnext;
+                break;
+            }
+            link = &(*link) -> hnext;
+        }
+        flight -> indexed = 0;
+    }
+}
+
+/*
+ * make_flight_room - drop the bytes every follower has read and wait
+ *                    until length more bytes fit in the window,
+ *                    a chunk larger than the window waits for all of it
+ *                    to be read; the slowest followers are dropped once
+ *                    they read nothing for FLIGHT_DRAIN_TIMEOUT seconds;
+ *                    the flight must be out of the table and the caller
+ *                    must hold its mutex
+ *                    return -1 if no follower is left
+ */
+static int make_flight_room(flight_t* flight, size_t length) {
+
+    flight_reader_t* reader;
+    struct timespec deadline;
+    size_t low, stalled_at = 0;
+    int stalled = 0;
+
+    while (flight -> readers != NULL) {
+        low = flight -> length;
+        for (reader = flight -> readers; reader; reader = reader -> next) {
+            if (reader -> offset < low) {
+                low = reader -> offset;
+            }
+        }
+        if (low > flight -> base) {
+            memmove(flight -> content,
+                    flight -> content + (low - flight -> base),
+                    flight -> length - low);
+            flight -> base = low;
+        }
+        if (flight -> length == flight -> base ||
+            flight -> length - flight -> base + length <=
+            flight -> max_length) {
+            return 0;
+        }
+
+        // the deadline restarts whenever the slowest follower moves on
+        if (!stalled || low != stalled_at) {
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += FLIGHT_DRAIN_TIMEOUT;
+            stalled_at = low;
+            stalled = 1;
+        }
+        flight -> blocked = 1;
+        if (pthread_cond_timedwait(&flight -> drained, &flight -> mutex,
+                                   &deadline) == ETIMEDOUT) {
+            drop_readers(flight, low);
+        }
+        flight -> blocked = 0;
+    }
+
+    // nobody reads any more, the bytes go to the leader's client only
+    Free(flight -> content);
+    flight -> content = NULL;
+    flight -> base = flight -> length;
+    flight -> capacity = 0;
+    return -1;
+}
+
+/*
+ * drop_readers - take the followers still at offset out of the flight,
+ *                their next read_flight fails
+ *                the caller must hold the flight mutex
+ */
+static void drop_readers(flight_t* flight, size_t offset) {
+
+    flight_reader_t** link = &flight -> readers;
+    flight_reader_t* reader;
+
+    while ((reader = *link) != NULL) {
+        if (reader -> offset == offset) {
+            printf("Drop a follower stuck at byte %zu.\n", offset);
+            reader -> dropped = 1;
+            *link = reader -> next;
+        } else {
+            link = &reader -> next;
+        }
+    }
+    // a dropped follower may be waiting for bytes
+    if (flight -> waiting > 0) {
+        pthread_cond_broadcast(&flight -> cond);
+    }
+}
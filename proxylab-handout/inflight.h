@@ -0,0 +1,75 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * inflight.h - prototypes and definitions for inflight.c
+ */
+#ifndef __INFLIGHT_H__
+#define __INFLIGHT_H__
+
+#include "csapp.h"
+
+/* Number of buckets of the in-flight table, always a power of 2 */
+#define FLIGHT_BUCKET_NUM 256
+
+/* Seconds the leader waits for the slowest follower to read anything */
+#define FLIGHT_DRAIN_TIMEOUT 5
+
+/* Result of a flight once the leader finished it */
+#define FLIGHT_RUNNING  0
+#define FLIGHT_DONE     1
+#define FLIGHT_FAILED  -1
+
+/* Defined a struct representing the position of one follower */
+typedef struct flight_reader_t {
+    size_t offset;                  // next byte of the response to read
+    int dropped;                    // too slow, the window went on without it
+    struct flight_reader_t* next;
+} flight_reader_t;
+
+struct flight_table_t;
+
+/*
+ * Defined a struct representing one upstream fetch in flight:
+ * the leader appends the response bytes as they arrive,
+ * followers read them at their own offset while the fetch goes on;
+ * content holds the bytes from base to length, at most max_length of them
+ */
+typedef struct flight_t {
+    char* flight_id;
+    unsigned int hash;
+    char* content;
+    size_t base, length, capacity;
+    size_t max_length;
+    int state;
+    int refcnt;                     // leader plus followers
+    int indexed;                    // still reachable from the table
+    int sealed;                     // nobody reads, the leader stops copying
+    int waiting;                    // followers waiting for bytes
+    int blocked;                    // the leader waiting for room
+    flight_reader_t* readers;
+    struct flight_table_t* table;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;            // new bytes or the end, to the followers
+    pthread_cond_t drained;         // bytes read, to the leader
+    struct flight_t* hnext;
+} flight_t;
+
+/* Defined a struct representing every fetch in flight, keyed on cache id */
+typedef struct flight_table_t {
+    flight_t* buckets[FLIGHT_BUCKET_NUM];
+    sem_t mutex;
+} flight_table_t;
+
+/* Defined function coalescing concurrent misses on the same id */
+flight_table_t* init_flight_table();
+flight_t* join_flight(flight_table_t* table, char* id, size_t max_length,
+                      flight_reader_t* reader, int* leader);
+int publish_flight(flight_t* flight, char* buf, size_t length);
+void finish_flight(flight_table_t* table, flight_t* flight, int ok);
+int seal_flight(flight_table_t* table, flight_t* flight);
+ssize_t read_flight(flight_t* flight, flight_reader_t* reader, char* buf,
+                    size_t n);
+void leave_flight(flight_t* flight, flight_reader_t* reader);
+
+#endif /* __INFLIGHT_H__ */
@@ -0,0 +1,64 @@
+#!/bin/bash
+#
+# loadbench.sh - runs the load generator (loadgen.c) against the proxy
+#     in every serving mode: an open-loop run and a closed-loop
+#     keep-alive run with the stub origin, and an open-loop run with
+#     the adder CGI program of tiny as the origin
+#
+#     usage: ./loadbench.sh [seconds] [rate]
+#
+
+SECONDS_PER_RUN=${1:-10}
+RATE=${2:-2000}
+TINY_RATE=300
+MODES="thread pool event reuseport"
+
+#
+# wait_for_port - spins until something listens on the TCP port passed
+#     as an argument, gives up after 5 seconds; a probing connect would
+#     make tiny exit
+#
+function wait_for_port {
+    for i in `seq 50`
+    do
+        netstat --numeric-ports --numeric-hosts -l --protocol=tcpip \
+            | grep -q ":${1} " && return 0
+        sleep 0.1
+    done
+    echo "Error: nothing listens on port $1."
+    return 1
+}
+
+make -s proxy loadgen || exit 1
+if [ ! -x ./tiny/tiny ]
+then
+    (cd ./tiny; make -s)
+fi
+
+tiny_port=`./free-port.sh`
+(cd ./tiny; exec ./tiny ${tiny_port} &> /dev/null) &
+tiny_pid=$!
+wait_for_port ${tiny_port} || exit 1
+
+for mode in ${MODES}
+do
+    proxy_port=`./free-port.sh`
+    ./proxy -m ${mode} ${proxy_port} &> /dev/null &
+    proxy_pid=$!
+    wait_for_port ${proxy_port} || break
+
+    echo "=== ${mode}: stub origin, open loop"
+    ./loadgen -c 32 -r ${RATE} -d ${SECONDS_PER_RUN} localhost ${proxy_port}
+    echo "=== ${mode}: stub origin, closed loop, keep-alive"
+    ./loadgen -c 16 -r 0 -k -d ${SECONDS_PER_RUN} localhost ${proxy_port}
+    echo "=== ${mode}: tiny origin, open loop"
+    ./loadgen -c 8 -r ${TINY_RATE} -d ${SECONDS_PER_RUN} -n 200 \
+        -o localhost:${tiny_port} -u "/cgi-bin/adder?0&" \
+        localhost ${proxy_port}
+    echo ""
+
+    kill ${proxy_pid}
+    wait ${proxy_pid} 2> /dev/null
+done
+
+kill ${tiny_pid}
@@ -0,0 +1,568 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * loadgen.c - open-loop load generator for the proxy.
+ * Implementation idea:
+ * 1. requests are due at a constant rate from the start of the run, each
+ *    connection thread takes the next due slot, waits for its time and
+ *    sends it; the latency is measured from the time the request was due,
+ *    not from when it was sent, so a proxy that falls behind is charged
+ *    for the queueing delay its clients would see (no coordinated
+ *    omission); -r 0 runs closed-loop instead
+ * 2. the URL of every request is drawn from a Zipf distribution over -n
+ *    ids, id i being asked for with a weight of 1 / (i + 1)^s
+ * 3. the origin is an in-process stub answering any path with a body of
+ *    -b bytes, or an external server such as tiny (-o), e.g. its adder
+ *    CGI program, which gives a distinct URL per id
+ * 4. latencies go into the histograms of metrics.c; the hit ratio is read
+ *    from http://proxy.local/stats before and after the run, and from the
+ *    requests that reached the stub
+ *
+ * usage: ./loadgen [-c conns] [-r rate] [-d secs] [-n urls] [-s exponent]
+ *                  [-b bytes] [-o host:port] [-u prefix] [-k]
+ *                  <proxy host> <proxy port>
+ */
+#include <math.h>
+#include <sys/uio.h>
+#include <time.h>
+#include "csapp.h"
+#include "metrics.h"
+
+/* Defaults of the command line options */
+#define LOADGEN_CONNS     16
+#define LOADGEN_RATE      1000
+#define LOADGEN_SECONDS   10
+#define LOADGEN_URLS      1000
+#define LOADGEN_EXPONENT  0.99
+#define LOADGEN_BODY      4096
+#define LOADGEN_PREFIX    "/obj/"
+
+/* Microseconds after its time a request counts as started late */
+#define LOADGEN_LATE_US   1000
+
+/* Seconds a response may take before the request counts as an error */
+#define LOADGEN_TIMEOUT   10
+
+/* Defined a struct representing the run shared by the connections */
+typedef struct loadgen_t {
+    char* proxy_host;
+    char* proxy_port;
+    char origin[MAXLINE];           // host:port of the origin server
+    char* prefix;                   // of the path, the id is appended
+    int keep_alive;
+    double rate;                    // requests per second, 0 closed loop
+    long total;                     // requests of an open-loop run
+    long start, end;                // microseconds, metrics_clock
+    long next;                      // next slot to take
+    double* cdf;                    // Zipf distribution of the ids
+    int url_num;
+} loadgen_t;
+
+/* Defined a struct representing one connection thread */
+typedef struct worker_t {
+    pthread_t tid;
+    int fd;                         // kept open with -k
+    rio_t rio;
+    unsigned long long seed;
+    metrics_histogram_t latency;
+    unsigned long requests, errors, late, bytes;
+} worker_t;
+
+static loadgen_t load;
+
+/* Body of the stub origin and the requests that reached it */
+static char* stub_body;
+static size_t stub_body_length;
+static unsigned long stub_requests;
+
+/* Static helper functions for the load generator */
+static void *worker_thread(void *vargp);
+static int send_request(worker_t* worker, int id);
+static void close_worker(worker_t* worker);
+static int has_close(char* value);
+static double next_random(unsigned long long* seed);
+static int zipf_sample(worker_t* worker);
+static void wait_until(long when);
+static int start_stub(int body_length, char* origin);
+static void *stub_thread(void *vargp);
+static void *stub_serve(void *vargp);
+static int read_proxy_stats(unsigned long* requests, unsigned long* hits);
+static void usage(char *prog);
+
+int main(int argc, char **argv) {
+
+    int conn_num = LOADGEN_CONNS, seconds = LOADGEN_SECONDS;
+    int body_length = LOADGEN_BODY, stub = 1;
+    double exponent = LOADGEN_EXPONENT, sum = 0, elapsed;
+    unsigned long requests = 0, errors = 0, late = 0, bytes = 0;
+    unsigned long before_requests = 0, before_hits = 0;
+    unsigned long after_requests, after_hits;
+    int stats, opt, i;
+    worker_t* workers;
+    metrics_histogram_t* latency;
+
+    Signal(SIGPIPE, SIG_IGN);
+    load.rate = LOADGEN_RATE;
+    load.url_num = LOADGEN_URLS;
+    load.prefix = LOADGEN_PREFIX;
+    load.keep_alive = 0;
+
+    while ((opt = getopt(argc, argv, "b:c:d:kn:o:r:s:u:")) != -1) {
+        switch (opt) {
+        case 'b':
+            body_length = atoi(optarg);
+            break;
+        case 'c':
+            conn_num = atoi(optarg);
+            break;
+        case 'd':
+            seconds = atoi(optarg);
+            break;
+        case 'k':
+            load.keep_alive = 1;
+            break;
+        case 'n':
+            load.url_num = atoi(optarg);
+            break;
+        case 'o':
+            snprintf(load.origin, sizeof(load.origin), "%s", optarg);
+            stub = 0;
+            break;
+        case 'r':
+            load.rate = atof(optarg);
+            break;
+        case 's':
+            exponent = atof(optarg);
+            break;
+        case 'u':
+            load.prefix = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind != 2 || conn_num < 1 || seconds < 1 ||
+        load.url_num < 1 || load.rate < 0 || exponent < 0 ||
+        body_length < 0) {
+        usage(argv[0]);
+    }
+    load.proxy_host = argv[optind];
+    load.proxy_port = argv[optind + 1];
+
+    // the popularity of the ids, normalized into a distribution function
+    load.cdf = (double *)Malloc(load.url_num * sizeof(double));
+    for (i = 0; i < load.url_num; i++) {
+        sum += 1.0 / pow(i + 1, exponent);
+        load.cdf[i] = sum;
+    }
+    for (i = 0; i < load.url_num; i++) {
+        load.cdf[i] /= sum;
+    }
+
+    if (stub && start_stub(body_length, load.origin) == -1) {
+        fprintf(stderr, "cannot start the stub origin\n");
+        exit(1);
+    }
+    stats = read_proxy_stats(&before_requests, &before_hits);
+
+    printf("loadgen: %s to proxy %s:%s, origin %s%s\n",
+           load.rate > 0 ? "open loop" : "closed loop",
+           load.proxy_host, load.proxy_port, load.origin,
+           stub ? " (stub)" : "");
+    printf("loadgen: %d connections, %.0f requests/s, %d s, %d urls, "
+           "zipf s=%.2f%s\n", conn_num, load.rate, seconds, load.url_num,
+           exponent, load.keep_alive ? ", keep-alive" : "");
+
+    load.start = metrics_clock();
+    load.end = load.start + seconds * 1000000L;
+    load.total = (long)(load.rate * seconds);
+    load.next = 0;
+
+    workers = (worker_t *)Calloc(conn_num, sizeof(worker_t));
+    for (i = 0; i < conn_num; i++) {
+        workers[i].fd = -1;
+        workers[i].seed = 0x9e3779b97f4a7c15ULL * (i + 1);
+        Pthread_create(&workers[i].tid, NULL, worker_thread, &workers[i]);
+    }
+
+    latency = (metrics_histogram_t *)Calloc(1, sizeof(metrics_histogram_t));
+    for (i = 0; i < conn_num; i++) {
+        Pthread_join(workers[i].tid, NULL);
+        histogram_merge(latency, &workers[i].latency);
+        requests += workers[i].requests;
+        errors += workers[i].errors;
+        late += workers[i].late;
+        bytes += workers[i].bytes;
+    }
+    elapsed = (metrics_clock() - load.start) / 1e6;
+
+    printf("requests %lu in %.2f s, errors %lu, started late %lu\n",
+           requests, elapsed, errors, late);
+    printf("throughput %.1f requests/s, %.2f MB/s\n", requests / elapsed,
+           bytes / elapsed / 1e6);
+    printf("latency_us mean=%lu p50=%lu p90=%lu p99=%lu p999=%lu max=%lu\n",
+           latency -> count ? latency -> sum / latency -> count : 0,
+           histogram_percentile(latency, 50.0),
+           histogram_percentile(latency, 90.0),
+           histogram_percentile(latency, 99.0),
+           histogram_percentile(latency, 99.9), latency -> max);
+
+    // the proxy counts its hits, the stub the requests it had to answer
+    if (stats == 0 && read_proxy_stats(&after_requests, &after_hits) == 0 &&
+        after_requests > before_requests) {
+        printf("hit ratio %.2f%% (proxy: %lu hits of %lu requests)\n",
+               100.0 * (after_hits - before_hits) /
+               (after_requests - before_requests),
+               after_hits - before_hits, after_requests - before_requests);
+    } else {
+        printf("hit ratio n/a (no http://%s%s)\n", METRICS_HOST,
+               METRICS_PATH);
+    }
+    if (stub && requests > 0) {
+        printf("origin requests %lu (%.2f%% of the requests answered)\n",
+               stub_requests, 100.0 * stub_requests / requests);
+    }
+    return 0;
+}
+
+/*
+ * worker_thread - connection routine, send the due requests until the
+ *                 run is over
+ */
+static void *worker_thread(void *vargp) {
+
+    worker_t* worker = (worker_t *)vargp;
+    long slot, due, now;
+
+    while (1) {
+        slot = __atomic_fetch_add(&load.next, 1, __ATOMIC_RELAXED);
+        if (load.rate > 0) {
+            // open loop, the slot is due at a fixed time from the start
+            if (slot >= load.total) {
+                break;
+            }
+            due = load.start + (long)(slot * 1e6 / load.rate);
+            now = metrics_clock();
+            if (now < due) {
+                wait_until(due);
+            } else if (now - due > LOADGEN_LATE_US) {
+                worker -> late++;
+            }
+        } else {
+            // closed loop, due as soon as the previous one is answered
+            if ((due = metrics_clock()) >= load.end) {
+                break;
+            }
+        }
+
+        if (send_request(worker, zipf_sample(worker)) == -1) {
+            worker -> errors++;
+            close_worker(worker);
+            continue;
+        }
+        histogram_record(&worker -> latency, metrics_clock() - due);
+        worker -> requests++;
+    }
+
+    close_worker(worker);
+    return NULL;
+}
+
+/*
+ * send_request - ask the proxy for the URL of id and read the response,
+ *                a keep-alive connection stays open for the next one
+ *                return -1 on error
+ */
+static int send_request(worker_t* worker, int id) {
+
+    char buf[MAXLINE];
+    struct timeval timeout;
+    long length = -1, left;
+    int status = 0, keep = load.keep_alive;
+    ssize_t n;
+
+    if (worker -> fd < 0) {
+        if ((worker -> fd = open_clientfd(load.proxy_host,
+                                          load.proxy_port)) < 0) {
+            return -1;
+        }
+        timeout.tv_sec = LOADGEN_TIMEOUT;
+        timeout.tv_usec = 0;
+        setsockopt(worker -> fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                   sizeof(timeout));
+        rio_readinitb(&worker -> rio, worker -> fd);
+    }
+
+    n = snprintf(buf, sizeof(buf), "GET http://%s%s%d HTTP/1.%d\r\n"
+                 "Host: %s\r\nConnection: %s\r\n\r\n", load.origin,
+                 load.prefix, id, keep, load.origin,
+                 keep ? "keep-alive" : "close");
+    if (rio_writen(worker -> fd, buf, n) == -1) {
+        return -1;
+    }
+
+    // status line and header, only the framing matters
+    if (rio_readlineb(&worker -> rio, buf, MAXLINE) <= 0 ||
+        sscanf(buf, "HTTP/1.%*d %d", &status) != 1) {
+        return -1;
+    }
+    do {
+        if ((n = rio_readlineb(&worker -> rio, buf, MAXLINE)) <= 0) {
+            return -1;
+        }
+        if (!strncasecmp(buf, "Content-Length:", 15)) {
+            length = strtol(buf + 15, NULL, 10);
+        } else if (!strncasecmp(buf, "Connection:", 11) &&
+                   has_close(buf + 11)) {
+            keep = 0;
+        }
+    } while (strcmp(buf, "\r\n") != 0);
+
+    // the body, up to the length or to the end of the connection
+    left = length;
+    while (length < 0 || left > 0) {
+        n = rio_readnb(&worker -> rio, buf,
+                       (length < 0 || left > MAXLINE) ? MAXLINE : left);
+        if (n <= 0) {
+            break;
+        }
+        worker -> bytes += n;
+        left -= n;
+    }
+    if (n == -1 || (length >= 0 && left > 0)) {
+        return -1;
+    }
+
+    if (!keep || length < 0) {
+        close_worker(worker);
+    }
+    return (status >= 200 && status < 300) ? 0 : -1;
+}
+
+/*
+ * close_worker - close the connection of a worker, if open
+ */
+static void close_worker(worker_t* worker) {
+
+    if (worker -> fd >= 0) {
+        close(worker -> fd);
+        worker -> fd = -1;
+    }
+}
+
+/*
+ * has_close - return 1 if a Connection header value asks to close
+ */
+static int has_close(char* value) {
+
+    for (; *value != '\0'; value++) {
+        if (!strncasecmp(value, "close", 5)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * next_random - xorshift64* step, a uniform number in [0, 1)
+ */
+static double next_random(unsigned long long* seed) {
+
+    *seed ^= *seed >> 12;
+    *seed ^= *seed << 25;
+    *seed ^= *seed >> 27;
+    return ((*seed * 2685821657736338717ULL) >> 11) * (1.0 / (1ULL << 53));
+}
+
+/*
+ * zipf_sample - draw an id, binary search of the distribution function
+ */
+static int zipf_sample(worker_t* worker) {
+
+    double u = next_random(&worker -> seed);
+    int low = 0, high = load.url_num - 1, mid;
+
+    while (low < high) {
+        mid = (low + high) / 2;
+        if (load.cdf[mid] < u) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/*
+ * wait_until - sleep until the metrics_clock time when
+ */
+static void wait_until(long when) {
+
+    struct timespec ts;
+    long now;
+
+    while ((now = metrics_clock()) < when) {
+        ts.tv_sec = (when - now) / 1000000;
+        ts.tv_nsec = (when - now) % 1000000 * 1000;
+        nanosleep(&ts, NULL);
+    }
+}
+
+/*
+ * start_stub - start the stub origin on a free local port
+ *              origin is set to its host:port
+ *              return -1 on error
+ */
+static int start_stub(int body_length, char* origin) {
+
+    struct sockaddr_in addr;
+    socklen_t length = sizeof(addr);
+    pthread_t tid;
+    int listenfd, *fdp;
+
+    stub_body_length = body_length;
+    stub_body = (char *)Malloc(body_length + 1);
+    memset(stub_body, 'x', body_length);
+
+    // port 0, the kernel picks one
+    if ((listenfd = open_listenfd("0")) < 0 ||
+        getsockname(listenfd, (SA *)&addr, &length) == -1) {
+        return -1;
+    }
+    sprintf(origin, "localhost:%d", ntohs(addr.sin_port));
+
+    fdp = (int *)Malloc(sizeof(int));
+    *fdp = listenfd;
+    Pthread_create(&tid, NULL, stub_thread, fdp);
+    return 0;
+}
+
+/*
+ * stub_thread - accept the connections of the proxy to the stub origin
+ */
+static void *stub_thread(void *vargp) {
+
+    int listenfd = *(int *)vargp;
+    int *connfd;
+    pthread_t tid;
+
+    Pthread_detach(pthread_self());
+    Free(vargp);
+    while (1) {
+        connfd = (int *)Malloc(sizeof(int));
+        if ((*connfd = accept(listenfd, NULL, NULL)) < 0) {
+            Free(connfd);
+            continue;
+        }
+        Pthread_create(&tid, NULL, stub_serve, connfd);
+    }
+    return NULL;
+}
+
+/*
+ * stub_serve - answer every request of a connection with the stub body,
+ *              fresh for the whole run, until the proxy closes it
+ */
+static void *stub_serve(void *vargp) {
+
+    int fd = *(int *)vargp;
+    char buf[MAXLINE], head[MAXLINE];
+    struct iovec iov[2];
+    int keep, n;
+    rio_t rio;
+
+    Pthread_detach(pthread_self());
+    Free(vargp);
+    rio_readinitb(&rio, fd);
+
+    while (rio_readlineb(&rio, buf, MAXLINE) > 0) {
+        keep = (strstr(buf, "HTTP/1.1") != NULL);
+        do {
+            if (rio_readlineb(&rio, buf, MAXLINE) <= 0) {
+                close(fd);
+                return NULL;
+            }
+            if (!strncasecmp(buf, "Connection:", 11)) {
+                keep = !has_close(buf + 11);
+            }
+        } while (strcmp(buf, "\r\n") != 0);
+
+        __atomic_add_fetch(&stub_requests, 1, __ATOMIC_RELAXED);
+        n = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\n"
+                     "Content-Type: application/octet-stream\r\n"
+                     "Content-Length: %zu\r\n"
+                     "Cache-Control: max-age=3600\r\n"
+                     "Connection: %s\r\n\r\n", stub_body_length,
+                     keep ? "keep-alive" : "close");
+        // head and body in one write, a second small write would wait
+        // for the delayed ack of the first
+        iov[0].iov_base = head;
+        iov[0].iov_len = n;
+        iov[1].iov_base = stub_body;
+        iov[1].iov_len = stub_body_length;
+        if (writev(fd, iov, 2) != n + (ssize_t)stub_body_length || !keep) {
+            break;
+        }
+    }
+
+    close(fd);
+    return NULL;
+}
+
+/*
+ * read_proxy_stats - read the request and hit counters of the proxy
+ *                    return -1 if the proxy does not report them
+ */
+static int read_proxy_stats(unsigned long* requests, unsigned long* hits) {
+
+    char buf[MAXLINE];
+    int fd, found = 0;
+    rio_t rio;
+
+    if ((fd = open_clientfd(load.proxy_host, load.proxy_port)) < 0) {
+        return -1;
+    }
+    snprintf(buf, sizeof(buf), "GET http://%s%s HTTP/1.0\r\n\r\n",
+             METRICS_HOST, METRICS_PATH);
+    if (rio_writen(fd, buf, strlen(buf)) == -1) {
+        close(fd);
+        return -1;
+    }
+    rio_readinitb(&rio, fd);
+    while (rio_readlineb(&rio, buf, MAXLINE) > 0) {
+        if (sscanf(buf, "requests %lu", requests) == 1 ||
+            sscanf(buf, "hits %lu", hits) == 1) {
+            found++;
+        }
+    }
+    close(fd);
+    return (found == 2) ? 0 : -1;
+}
+
+/*
+ * usage - print the command line usage and exit
+ */
+static void usage(char *prog) {
+
+    printf("usage: %s [-c conns] [-r rate] [-d secs] [-n urls] "
+           "[-s exponent]\n"
+           "       [-b bytes] [-o host:port] [-u prefix] [-k] "
+           "<proxy host> <proxy port>\n", prog);
+    printf("  -c  connections, the most requests in flight (default %d)\n",
+           LOADGEN_CONNS);
+    printf("  -r  requests per second (default %d), 0 runs closed loop\n",
+           LOADGEN_RATE);
+    printf("  -d  seconds of the run (default %d)\n", LOADGEN_SECONDS);
+    printf("  -n  distinct urls (default %d)\n", LOADGEN_URLS);
+    printf("  -s  exponent of the Zipf popularity (default %.2f)\n",
+           LOADGEN_EXPONENT);
+    printf("  -b  body bytes of the stub origin (default %d)\n",
+           LOADGEN_BODY);
+    printf("  -o  origin server instead of the stub, e.g. tiny\n");
+    printf("  -u  path prefix the id is appended to (default %s),\n",
+           LOADGEN_PREFIX);
+    printf("      \"/cgi-bin/adder?0&\" gives distinct urls on tiny\n");
+    printf("  -k  keep the connections to the proxy open\n");
+    exit(0);
+}
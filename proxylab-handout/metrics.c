@@ -0,0 +1,453 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * metrics.c - request counters and latency histograms of the proxy.
+ * Implementation idea:
+ * 1. every thread counts into a block of its own, found through a thread
+ *    local pointer; only that thread writes the block, with plain relaxed
+ *    stores, so counting needs neither a lock nor a locked instruction
+ *    and no cache line is shared between threads
+ * 2. blocks are linked into a list that only grows, the collector walks
+ *    it without a lock and sums the blocks with relaxed loads; a thread
+ *    that exits hands its block over to the next new thread, so the
+ *    counts of short lived threads are kept and the number of blocks
+ *    stays at the number of threads alive at once
+ * 3. latencies go into HdrHistogram style log-linear buckets of bounded
+ *    relative error, the percentiles are read from the merged buckets
+ * 4. the report is plain text, answered to GET http://proxy.local/stats
+ *    and printed on SIGUSR1 together with the cache counters
+ *
+ */
+#include <stdarg.h>
+#include <time.h>
+#include "csapp.h"
+#include "cache.h"
+#include "metrics.h"
+
+/* Names of the phases in the report */
+static const char* phase_names[METRIC_PHASE_NUM] = {
+    "parse", "lookup", "connect", "first_byte", "total"
+};
+
+/* Every block ever handed out, the newest first */
+static metrics_t* all_metrics = NULL;
+
+/* Blocks of exited threads, protected by metrics_mutex */
+static metrics_t* free_metrics = NULL;
+static pthread_mutex_t metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* The block of the calling thread, returned to the free list on exit */
+static __thread metrics_t* thread_metrics = NULL;
+static pthread_key_t metrics_key;
+
+/* Time of the start and of the previous report, protected by the mutex */
+static long start_time;
+static long last_report_time;
+static unsigned long last_report_requests;
+
+/* Static helper functions for the metrics implementation */
+static metrics_t* metrics_self();
+static void release_metrics(void* vargp);
+static void metrics_add(unsigned long* counter, unsigned long n);
+static int metrics_bucket(unsigned long value);
+static unsigned long metrics_bucket_value(int bucket);
+static void collect_metrics(metrics_t* sum);
+static void append_report(char* buf, size_t size, size_t* length,
+                          const char* format, ...);
+
+/*
+ * init_metrics - start the clock of the statistics, before any thread
+ *                counts
+ */
+void init_metrics() {
+
+    if (pthread_key_create(&metrics_key, release_metrics) != 0) {
+        app_error("pthread_key_create error");
+    }
+    start_time = metrics_clock();
+    last_report_time = start_time;
+    last_report_requests = 0;
+}
+
+/*
+ * metrics_clock - monotonic time in microseconds
+ */
+long metrics_clock() {
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+/*
+ * metrics_count - add n to a counter of the calling thread
+ */
+void metrics_count(int counter, unsigned long n) {
+
+    metrics_add(&metrics_self() -> counters[counter], n);
+}
+
+/*
+ * metrics_record - record the latency of a phase started at start
+ *                  return the current time, the start of the next phase
+ */
+long metrics_record(int phase, long start) {
+
+    long now = metrics_clock();
+
+    histogram_record(&metrics_self() -> phases[phase],
+                     (now > start) ? now - start : 0);
+    return now;
+}
+
+/*
+ * metrics_total - the sum of one counter over every thread
+ */
+unsigned long metrics_total(int counter) {
+
+    metrics_t* metrics;
+    unsigned long total = 0;
+
+    for (metrics = __atomic_load_n(&all_metrics, __ATOMIC_ACQUIRE);
+         metrics != NULL; metrics = metrics -> next) {
+        total += __atomic_load_n(&metrics -> counters[counter],
+                                 __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+/*
+ * histogram_record - count value in a histogram only the calling thread
+ *                    writes
+ */
+void histogram_record(metrics_histogram_t* histogram, unsigned long value) {
+
+    metrics_add(&histogram -> buckets[metrics_bucket(value)], 1);
+    metrics_add(&histogram -> count, 1);
+    metrics_add(&histogram -> sum, value);
+    if (value > histogram -> max) {
+        __atomic_store_n(&histogram -> max, value, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * histogram_merge - add the values of from, which another thread may
+ *                   still be writing, to the histogram to
+ */
+void histogram_merge(metrics_histogram_t* to, metrics_histogram_t* from) {
+
+    unsigned long max;
+    int i;
+
+    to -> count += __atomic_load_n(&from -> count, __ATOMIC_RELAXED);
+    to -> sum += __atomic_load_n(&from -> sum, __ATOMIC_RELAXED);
+    max = __atomic_load_n(&from -> max, __ATOMIC_RELAXED);
+    if (max > to -> max) {
+        to -> max = max;
+    }
+    for (i = 0; i < METRICS_BUCKET_NUM; i++) {
+        to -> buckets[i] += __atomic_load_n(&from -> buckets[i],
+                                            __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * is_metrics_request - return 1 if the request is for the statistics
+ *                      of the proxy itself
+ */
+int is_metrics_request(char* host, char* path) {
+
+    return !strcasecmp(host, METRICS_HOST) && !strcmp(path, METRICS_PATH);
+}
+
+/*
+ * metrics_report - write the statistics as "name value" lines into buf
+ *                  return the length of the report
+ */
+size_t metrics_report(cache_list_t* list, char* buf, size_t size) {
+
+    metrics_t* sum;
+    metrics_histogram_t* histogram;
+    unsigned long* counters;
+    unsigned long requests;
+    long now, elapsed;
+    double rate;
+    size_t length = 0;
+    int i;
+
+    buf[0] = '\0';
+    sum = (metrics_t *)Malloc(sizeof(metrics_t));
+    collect_metrics(sum);
+    counters = sum -> counters;
+
+    // the rate over the time since the previous report
+    now = metrics_clock();
+    requests = counters[COUNT_REQUESTS];
+    pthread_mutex_lock(&metrics_mutex);
+    elapsed = now - last_report_time;
+    rate = (elapsed > 0) ?
+        (requests - last_report_requests) * 1e6 / elapsed : 0.0;
+    last_report_time = now;
+    last_report_requests = requests;
+    pthread_mutex_unlock(&metrics_mutex);
+
+    append_report(buf, size, &length, "uptime_seconds %ld\n",
+                  (now - start_time) / 1000000);
+    append_report(buf, size, &length, "requests %lu\n", requests);
+    append_report(buf, size, &length, "requests_per_second %.1f\n", rate);
+    append_report(buf, size, &length, "hits %lu\n", counters[COUNT_HITS]);
+    append_report(buf, size, &length, "misses %lu\n",
+                  counters[COUNT_MISSES]);
+    append_report(buf, size, &length, "coalesced %lu\n",
+                  counters[COUNT_COALESCED]);
+    append_report(buf, size, &length, "revalidated %lu\n",
+                  counters[COUNT_REVALIDATED]);
+    append_report(buf, size, &length, "errors %lu\n",
+                  counters[COUNT_ERRORS]);
+    append_report(buf, size, &length, "connections_open %ld\n",
+                  (long)(counters[COUNT_CONN_OPENED] -
+                         counters[COUNT_CONN_CLOSED]));
+    append_report(buf, size, &length, "connections_total %lu\n",
+                  counters[COUNT_CONN_OPENED]);
+    append_report(buf, size, &length, "upstream_connects %lu\n",
+                  counters[COUNT_UPSTREAM_CONNECTS]);
+    append_report(buf, size, &length, "upstream_reused %lu\n",
+                  counters[COUNT_UPSTREAM_REUSED]);
+    append_report(buf, size, &length, "upstream_timeouts %lu\n",
+                  counters[COUNT_UPSTREAM_TIMEOUTS]);
+    append_report(buf, size, &length, "upstream_fail_fast %lu\n",
+                  counters[COUNT_FAIL_FAST]);
+
+    append_report(buf, size, &length, "cache_policy %s\n",
+                  list -> policy -> name);
+    append_report(buf, size, &length, "cache_capacity_bytes %zu\n",
+                  list -> capacity);
+    append_report(buf, size, &length, "cache_max_object_bytes %zu\n",
+                  __atomic_load_n(&list -> max_object, __ATOMIC_RELAXED));
+    append_report(buf, size, &length, "cache_lookups %lu\n",
+                  counters[COUNT_CACHE_LOOKUPS]);
+    append_report(buf, size, &length, "cache_hits %lu\n",
+                  counters[COUNT_CACHE_HITS]);
+    append_report(buf, size, &length, "cache_admissions %lu\n",
+                  counters[COUNT_CACHE_ADMISSIONS]);
+    append_report(buf, size, &length, "cache_rejections %lu\n",
+                  counters[COUNT_CACHE_REJECTIONS]);
+    append_report(buf, size, &length, "cache_evictions %lu\n",
+                  counters[COUNT_CACHE_EVICTIONS]);
+    append_report(buf, size, &length, "cache_disk_hits %lu\n",
+                  counters[COUNT_CACHE_DISK_HITS]);
+    append_report(buf, size, &length, "cache_demotions %lu\n",
+                  counters[COUNT_CACHE_DEMOTIONS]);
+    append_report(buf, size, &length, "bytes_from_cache %lu\n",
+                  counters[COUNT_CACHE_HIT_BYTES]);
+    append_report(buf, size, &length, "bytes_from_origin %lu\n",
+                  counters[COUNT_CACHE_MISS_BYTES]);
+
+    for (i = 0; i < METRIC_PHASE_NUM; i++) {
+        histogram = &sum -> phases[i];
+        append_report(buf, size, &length,
+                      "latency_us %s count=%lu mean=%lu p50=%lu p90=%lu "
+                      "p99=%lu p999=%lu max=%lu\n", phase_names[i],
+                      histogram -> count,
+                      histogram -> count ?
+                          histogram -> sum / histogram -> count : 0,
+                      histogram_percentile(histogram, 50.0),
+                      histogram_percentile(histogram, 90.0),
+                      histogram_percentile(histogram, 99.0),
+                      histogram_percentile(histogram, 99.9),
+                      histogram -> max);
+    }
+
+    Free(sum);
+    return length;
+}
+
+/*
+ * metrics_response - write the whole HTTP response to a statistics
+ *                    request into buf
+ *                    return the length of the response
+ */
+size_t metrics_response(cache_list_t* list, char* buf, size_t size) {
+
+    char body[MAXBUF];
+    size_t body_length;
+    int length;
+
+    body_length = metrics_report(list, body, sizeof(body));
+    length = snprintf(buf, size, "HTTP/1.1 200 OK\r\n"
+                      "Content-Type: text/plain\r\n"
+                      "Content-Length: %zu\r\n"
+                      "Cache-Control: no-store\r\n\r\n%s",
+                      body_length, body);
+    if (length < 0) {
+        return 0;
+    }
+    return ((size_t)length < size) ? (size_t)length : size - 1;
+}
+
+/*
+ * metrics_self - the block of the calling thread, taken over from an
+ *                exited thread or allocated on its first count
+ */
+static metrics_t* metrics_self() {
+
+    metrics_t* metrics;
+
+    if ((metrics = thread_metrics) != NULL) {
+        return metrics;
+    }
+
+    pthread_mutex_lock(&metrics_mutex);
+    if ((metrics = free_metrics) != NULL) {
+        free_metrics = metrics -> next_free;
+    } else {
+        metrics = (metrics_t *)Calloc(1, sizeof(metrics_t));
+        metrics -> next = all_metrics;
+        // the collector walks the list without the mutex
+        __atomic_store_n(&all_metrics, metrics, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&metrics_mutex);
+
+    pthread_setspecific(metrics_key, metrics);
+    thread_metrics = metrics;
+    return metrics;
+}
+
+/*
+ * release_metrics - hand the block of an exiting thread over to the
+ *                   next new thread, its counts stay in the totals
+ */
+static void release_metrics(void* vargp) {
+
+    metrics_t* metrics = (metrics_t *)vargp;
+
+    pthread_mutex_lock(&metrics_mutex);
+    metrics -> next_free = free_metrics;
+    free_metrics = metrics;
+    pthread_mutex_unlock(&metrics_mutex);
+}
+
+/*
+ * metrics_add - add n to a counter only the calling thread writes,
+ *               a relaxed store is enough for the collector to read it
+ */
+static void metrics_add(unsigned long* counter, unsigned long n) {
+
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n,
+                     __ATOMIC_RELAXED);
+}
+
+/*
+ * metrics_bucket - index of the histogram bucket of value
+ */
+static int metrics_bucket(unsigned long value) {
+
+    int msb, shift;
+
+    if (value < METRICS_SUB_COUNT) {
+        return (int)value;
+    }
+    msb = 63 - __builtin_clzl(value);
+    if (msb >= METRICS_MAX_BITS) {
+        return METRICS_BUCKET_NUM - 1;
+    }
+    // the value shifted down keeps METRICS_SUB_BITS significant bits
+    shift = msb - (METRICS_SUB_BITS - 1);
+    return METRICS_SUB_COUNT + (shift - 1) * (METRICS_SUB_COUNT / 2) +
+        (int)((value >> shift) - METRICS_SUB_COUNT / 2);
+}
+
+/*
+ * metrics_bucket_value - the highest value counted in a bucket
+ */
+static unsigned long metrics_bucket_value(int bucket) {
+
+    unsigned long sub;
+    int shift;
+
+    if (bucket < METRICS_SUB_COUNT) {
+        return bucket;
+    }
+    shift = (bucket - METRICS_SUB_COUNT) / (METRICS_SUB_COUNT / 2) + 1;
+    sub = (bucket - METRICS_SUB_COUNT) % (METRICS_SUB_COUNT / 2) +
+        METRICS_SUB_COUNT / 2;
+    return ((sub + 1) << shift) - 1;
+}
+
+/*
+ * collect_metrics - sum the blocks of every thread into sum
+ */
+static void collect_metrics(metrics_t* sum) {
+
+    metrics_t* metrics;
+    int i;
+
+    memset(sum, 0, sizeof(metrics_t));
+    for (metrics = __atomic_load_n(&all_metrics, __ATOMIC_ACQUIRE);
+         metrics != NULL; metrics = metrics -> next) {
+
+        for (i = 0; i < COUNT_NUM; i++) {
+            sum -> counters[i] += __atomic_load_n(&metrics -> counters[i],
+                                                  __ATOMIC_RELAXED);
+        }
+
+        for (i = 0; i < METRIC_PHASE_NUM; i++) {
+            histogram_merge(&sum -> phases[i], &metrics -> phases[i]);
+        }
+    }
+}
+
+/*
+ * histogram_percentile - the value percentile percent of the recorded
+ *                        values are at or below, within the bucket error
+ */
+unsigned long histogram_percentile(metrics_histogram_t* histogram,
+                                   double percentile) {
+
+    unsigned long total = 0, target, seen = 0, value;
+    int i;
+
+    // the buckets, not the count, a count may be ahead of its bucket
+    for (i = 0; i < METRICS_BUCKET_NUM; i++) {
+        total += histogram -> buckets[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    target = (unsigned long)(total * percentile / 100.0 + 0.5);
+    if (target < 1) {
+        target = 1;
+    }
+    for (i = 0; i < METRICS_BUCKET_NUM; i++) {
+        seen += histogram -> buckets[i];
+        if (seen >= target) {
+            break;
+        }
+    }
+    value = metrics_bucket_value(i);
+    return (value < histogram -> max) ? value : histogram -> max;
+}
+
+/*
+ * append_report - append a formatted line to the report, a report
+ *                 larger than the buffer is cut
+ */
+static void append_report(char* buf, size_t size, size_t* length,
+                          const char* format, ...) {
+
+    va_list ap;
+    int n;
+
+    if (*length + 1 >= size) {
+        return;
+    }
+    va_start(ap, format);
+    n = vsnprintf(buf + *length, size - *length, format, ap);
+    va_end(ap);
+    if (n > 0) {
+        *length += ((size_t)n < size - *length) ? (size_t)n : size - *length - 1;
+    }
+}
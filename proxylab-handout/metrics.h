@@ -0,0 +1,97 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * metrics.h - prototypes and definitions for metrics.c
+ */
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include "csapp.h"
+#include "cache.h"
+
+/* The proxy answers this URI itself with its statistics */
+#define METRICS_HOST "proxy.local"
+#define METRICS_PATH "/stats"
+
+/* Phases of a request whose latency is recorded, in microseconds */
+#define METRIC_PARSE       0    // complete head to dispatch
+#define METRIC_LOOKUP      1    // cache lookup
+#define METRIC_CONNECT     2    // new connection to the server
+#define METRIC_FIRST_BYTE  3    // request sent to the status line
+#define METRIC_TOTAL       4    // complete head to the response sent
+#define METRIC_PHASE_NUM   5
+
+/* Counters kept per thread */
+#define COUNT_REQUESTS          0
+#define COUNT_HITS              1   // answered from the cache
+#define COUNT_MISSES            2   // fetched from the server
+#define COUNT_COALESCED         3   // streamed from a fetch in flight
+#define COUNT_REVALIDATED       4   // the server confirmed the cached copy
+#define COUNT_ERRORS            5   // answered with an error
+#define COUNT_CONN_OPENED       6
+#define COUNT_CONN_CLOSED       7
+#define COUNT_UPSTREAM_CONNECTS 8
+#define COUNT_UPSTREAM_REUSED   9
+#define COUNT_UPSTREAM_TIMEOUTS 10  // the server missed a timeout
+#define COUNT_FAIL_FAST         11  // answered at once, the origin is down
+#define COUNT_CACHE_LOOKUPS     12
+#define COUNT_CACHE_HITS        13
+#define COUNT_CACHE_HIT_BYTES   14
+#define COUNT_CACHE_MISS_BYTES  15  // bytes served from the servers
+#define COUNT_CACHE_ADMISSIONS  16
+#define COUNT_CACHE_REJECTIONS  17
+#define COUNT_CACHE_EVICTIONS   18
+#define COUNT_CACHE_DISK_HITS   19  // misses in memory promoted from disk
+#define COUNT_CACHE_DEMOTIONS   20  // objects written to the disk tier
+#define COUNT_NUM               21
+
+/*
+ * Latency histograms use the HdrHistogram layout: values below
+ * METRICS_SUB_COUNT have a bucket each, every further power of 2 is split
+ * into METRICS_SUB_COUNT / 2 buckets, so a bucket is within 1/32 (3%) of
+ * its values; values from 2^METRICS_MAX_BITS us (19 hours) on share the
+ * last bucket
+ */
+#define METRICS_SUB_BITS 6
+#define METRICS_SUB_COUNT (1 << METRICS_SUB_BITS)
+#define METRICS_MAX_BITS 36
+#define METRICS_BUCKET_NUM \
+    (METRICS_SUB_COUNT + \
+     (METRICS_MAX_BITS - METRICS_SUB_BITS) * (METRICS_SUB_COUNT / 2))
+
+/* Defined a struct representing the latency histogram of one phase */
+typedef struct metrics_histogram_t {
+    unsigned long count;
+    unsigned long sum;
+    unsigned long max;
+    unsigned long buckets[METRICS_BUCKET_NUM];
+} metrics_histogram_t;
+
+/*
+ * Defined a struct representing the counters of one thread; only its
+ * thread writes them, without locks, the collector reads every block;
+ * the block of an exited thread is taken over by the next new one
+ */
+typedef struct metrics_t {
+    unsigned long counters[COUNT_NUM];
+    metrics_histogram_t phases[METRIC_PHASE_NUM];
+    struct metrics_t* next;         // every block, never removed
+    struct metrics_t* next_free;    // blocks without a thread
+} metrics_t;
+
+/* Defined function keeping and reporting the proxy statistics */
+void init_metrics();
+long metrics_clock();
+void metrics_count(int counter, unsigned long n);
+long metrics_record(int phase, long start);
+unsigned long metrics_total(int counter);
+int is_metrics_request(char* host, char* path);
+size_t metrics_report(cache_list_t* list, char* buf, size_t size);
+size_t metrics_response(cache_list_t* list, char* buf, size_t size);
+void histogram_record(metrics_histogram_t* histogram, unsigned long value);
+void histogram_merge(metrics_histogram_t* to, metrics_histogram_t* from);
+unsigned long histogram_percentile(metrics_histogram_t* histogram,
+                                   double percentile);
+
+#endif /* __METRICS_H__ */
@@ -0,0 +1,162 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * outvec.c - scatter/gather output builder.
+ * Implementation idea:
+ * 1. an output is a list of iovecs pointing at its pieces where they
+ *    already are: constant header strings, header tokens parsed in place
+ *    in the request buffer, a head built on the stack or the segments of
+ *    a cached object; nothing is copied into a contiguous buffer
+ * 2. the whole output goes out with one writev, a partial write is
+ *    resumed from a cursor (piece index, bytes written of it) so a
+ *    non-blocking writer can continue after EAGAIN
+ * 3. the pieces themselves are never modified by a write, rewinding the
+ *    cursor sends the same output again (e.g. a request retried on a
+ *    fresh server connection)
+ *
+ */
+#include "csapp.h"
+#include "cache.h"
+#include "httpparse.h"
+#include "outvec.h"
+
+/*
+ * init_outvec - an empty output
+ */
+void init_outvec(outvec_t* out) {
+
+    out -> count = 0;
+    out -> length = 0;
+    outvec_rewind(out);
+}
+
+/*
+ * outvec_add - append a piece of length bytes, empty ones are skipped
+ *              return -1 if the output is full
+ */
+int outvec_add(outvec_t* out, const void* base, size_t length) {
+
+    if (length == 0) {
+        return 0;
+    }
+    if (out -> count == OUTVEC_IOV_NUM) {
+        return -1;
+    }
+    out -> iov[out -> count].iov_base = (void *)base;
+    out -> iov[out -> count].iov_len = length;
+    out -> count++;
+    out -> length += length;
+    return 0;
+}
+
+/*
+ * outvec_add_str - append a NUL terminated string
+ *                  return -1 if the output is full
+ */
+int outvec_add_str(outvec_t* out, const char* str) {
+
+    return outvec_add(out, str, strlen(str));
+}
+
+/*
+ * outvec_add_header - append the line "name: value\r\n" of a header parsed
+ *                     in place, all of it or nothing
+ *                     return -1 if the output is full
+ */
+int outvec_add_header(outvec_t* out, http_header_t* header) {
+
+    if (out -> count + 4 > OUTVEC_IOV_NUM) {
+        return -1;
+    }
+    outvec_add(out, header -> name, header -> name_length);
+    outvec_add(out, ": ", 2);
+    outvec_add(out, header -> value, header -> value_length);
+    outvec_add(out, "\r\n", 2);
+    return 0;
+}
+
+/*
+ * outvec_add_object - append up to length bytes of a cached object from
+ *                     offset, as many segments as the output has room for
+ *                     return the number of bytes appended
+ */
+size_t outvec_add_object(outvec_t* out, cache_object_t* object,
+                         size_t offset, size_t length) {
+
+    size_t added = 0;
+    int i, count;
+
+    count = object_iov(object, offset, length, out -> iov + out -> count,
+                       OUTVEC_IOV_NUM - out -> count);
+    for (i = out -> count; i < out -> count + count; i++) {
+        added += out -> iov[i].iov_len;
+    }
+    out -> count += count;
+    out -> length += added;
+    return added;
+}
+
+/*
+ * outvec_write - write what is left of the output with one writev
+ *                return the number of bytes written, -1 on error
+ *                (errno EAGAIN for a non-blocking fd that is full)
+ */
+ssize_t outvec_write(int fd, outvec_t* out) {
+
+    struct iovec first;
+    ssize_t n;
+    size_t done;
+
+    if (out -> next == out -> count) {
+        return 0;
+    }
+
+    // start inside the piece written partly, put it back afterwards
+    first = out -> iov[out -> next];
+    out -> iov[out -> next].iov_base = (char *)first.iov_base + out -> skip;
+    out -> iov[out -> next].iov_len = first.iov_len - out -> skip;
+    while ((n = writev(fd, out -> iov + out -> next,
+                       out -> count - out -> next)) == -1 && errno == EINTR) {
+        ;
+    }
+    out -> iov[out -> next] = first;
+    if (n <= 0) {
+        return n;
+    }
+
+    // move the cursor past the written bytes
+    out -> sent += n;
+    done = n + out -> skip;
+    while (out -> next < out -> count &&
+           done >= out -> iov[out -> next].iov_len) {
+        done -= out -> iov[out -> next].iov_len;
+        out -> next++;
+    }
+    out -> skip = done;
+    return n;
+}
+
+/*
+ * outvec_flush - write the rest of the output to a blocking fd
+ *                return -1 on error
+ */
+int outvec_flush(int fd, outvec_t* out) {
+
+    while (out -> sent < out -> length) {
+        if (outvec_write(fd, out) <= 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * outvec_rewind - make the whole output unwritten again
+ */
+void outvec_rewind(outvec_t* out) {
+
+    out -> next = 0;
+    out -> skip = 0;
+    out -> sent = 0;
+}
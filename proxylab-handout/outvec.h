@@ -0,0 +1,45 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * outvec.h - prototypes and definitions for outvec.c
+ */
+#ifndef __OUTVEC_H__
+#define __OUTVEC_H__
+
+#include <sys/uio.h>
+#include "csapp.h"
+#include "cache.h"
+#include "httpparse.h"
+
+/*
+ * Max pieces of one output: a request line, four per forwarded header and
+ * the added ones; well below IOV_MAX so one writev takes all of them
+ */
+#define OUTVEC_IOV_NUM (4 * HTTP_MAX_HEADERS + 64)
+
+/*
+ * Defined a struct representing an output gathered from pieces that
+ * stay where they are, written with writev
+ */
+typedef struct outvec_t {
+    struct iovec iov[OUTVEC_IOV_NUM];
+    int count;
+    size_t length;              // bytes of all the pieces
+    int next;                   // first piece not completely written
+    size_t skip;                // bytes of it written already
+    size_t sent;                // bytes written so far
+} outvec_t;
+
+/* Defined function building and writing gathered outputs */
+void init_outvec(outvec_t* out);
+int outvec_add(outvec_t* out, const void* base, size_t length);
+int outvec_add_str(outvec_t* out, const char* str);
+int outvec_add_header(outvec_t* out, http_header_t* header);
+size_t outvec_add_object(outvec_t* out, cache_object_t* object,
+                         size_t offset, size_t length);
+ssize_t outvec_write(int fd, outvec_t* out);
+int outvec_flush(int fd, outvec_t* out);
+void outvec_rewind(outvec_t* out);
+
+#endif /* __OUTVEC_H__ */
@@ -0,0 +1,181 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * parker.c - quiet persistent client connections of the worker pool.
+ * Implementation idea:
+ * 1. a pool worker that answered every request a client sent parks the
+ *    connection here instead of blocking on the next read, so a quiet
+ *    keep-alive client never holds one of the few workers
+ * 2. a thread watches the parked descriptors with a one-shot epoll
+ *    registration; once a client sends again (or hangs up) its
+ *    connection is taken out and put back into the connection queue,
+ *    where the next free worker finds it like a new one
+ * 3. every parked connection has a deadline of the client idle timeout,
+ *    the thread sweeps them every PARKER_SWEEP_MS and closes the late
+ *    ones; when the process drains it closes all of them at once
+ *
+ */
+#include <sys/epoll.h>
+#include "csapp.h"
+#include "sbuf.h"
+#include "parker.h"
+#include "metrics.h"
+#include "upgrade.h"
+
+/* the ptr registered for the drain descriptor */
+static char drain_marker;
+
+/* Static helper functions for the parker implementation */
+static void *parker_thread(void *vargp);
+static void unpark(parker_t* parker, parked_conn_t* conn);
+static void sweep_parked(parker_t* parker, int drain);
+
+/*
+ * init_parker - start the thread handing readable connections back
+ *               to queue
+ */
+void init_parker(parker_t* parker, sbuf_t* queue) {
+
+    struct epoll_event ev;
+
+    if ((parker -> epfd = epoll_create1(0)) == -1) {
+        unix_error("epoll_create1 error");
+    }
+    parker -> queue = queue;
+    parker -> parked = NULL;
+    pthread_mutex_init(&parker -> mutex, NULL);
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &drain_marker;
+    if (epoll_ctl(parker -> epfd, EPOLL_CTL_ADD, drain_event_fd(),
+                  &ev) == -1) {
+        unix_error("epoll_ctl drain fd error");
+    }
+
+    Pthread_create(&parker -> tid, NULL, parker_thread, parker);
+}
+
+/*
+ * park_connection - wait for the next request of fd without a worker,
+ *                   close it after idle_timeout seconds without one
+ *                   the parker owns fd from now on
+ */
+void park_connection(parker_t* parker, int fd, int idle_timeout) {
+
+    struct epoll_event ev;
+    parked_conn_t* conn = (parked_conn_t *)Malloc(sizeof(parked_conn_t));
+
+    conn -> fd = fd;
+    conn -> deadline = metrics_clock() + idle_timeout * 1000000L;
+    conn -> prev = NULL;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.ptr = conn;
+
+    // the thread handles the event or sweeps only once conn is linked
+    pthread_mutex_lock(&parker -> mutex);
+    if (epoll_ctl(parker -> epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        pthread_mutex_unlock(&parker -> mutex);
+        Free(conn);
+        // a worker must not wait for a queue slot, the client reconnects
+        Close(fd);
+        metrics_count(COUNT_CONN_CLOSED, 1);
+        return;
+    }
+    conn -> next = parker -> parked;
+    if (parker -> parked != NULL) {
+        parker -> parked -> prev = conn;
+    }
+    parker -> parked = conn;
+    pthread_mutex_unlock(&parker -> mutex);
+}
+
+/*
+ * parker_thread - Thread routine, queue the connections that became
+ *                 readable and close the ones that stayed quiet
+ */
+static void *parker_thread(void *vargp) {
+
+    parker_t* parker = (parker_t *)vargp;
+    struct epoll_event events[PARKER_BATCH];
+    parked_conn_t* conn;
+    int i, n, fd, drain = 0;
+
+    Pthread_detach(pthread_self());
+    while (1) {
+
+        if ((n = epoll_wait(parker -> epfd, events, PARKER_BATCH,
+                            PARKER_SWEEP_MS)) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            unix_error("epoll_wait error");
+        }
+
+        for (i = 0; i < n; i++) {
+            conn = (parked_conn_t *)events[i].data.ptr;
+            if (conn == (parked_conn_t *)&drain_marker) {
+                // level-triggered, once is enough
+                epoll_ctl(parker -> epfd, EPOLL_CTL_DEL, drain_event_fd(),
+                          NULL);
+                drain = 1;
+                continue;
+            }
+            pthread_mutex_lock(&parker -> mutex);
+            unpark(parker, conn);
+            pthread_mutex_unlock(&parker -> mutex);
+            fd = conn -> fd;
+            Free(conn);
+            // may wait for a slot, the workers never wait for the parker
+            sbuf_insert(parker -> queue, fd);
+        }
+
+        // a connection parked while the drain began is closed next time
+        sweep_parked(parker, drain);
+    }
+    return NULL;
+
+}
+
+/*
+ * unpark - take conn out of the parked list and of the epoll instance,
+ *          with the mutex held
+ */
+static void unpark(parker_t* parker, parked_conn_t* conn) {
+
+    if (conn -> prev != NULL) {
+        conn -> prev -> next = conn -> next;
+    } else {
+        parker -> parked = conn -> next;
+    }
+    if (conn -> next != NULL) {
+        conn -> next -> prev = conn -> prev;
+    }
+    epoll_ctl(parker -> epfd, EPOLL_CTL_DEL, conn -> fd, NULL);
+}
+
+/*
+ * sweep_parked - close the connections past their deadline, or all of
+ *                them if the process drains
+ */
+static void sweep_parked(parker_t* parker, int drain) {
+
+    parked_conn_t *conn, *next;
+    long now = metrics_clock();
+
+    pthread_mutex_lock(&parker -> mutex);
+    for (conn = parker -> parked; conn != NULL; conn = next) {
+        next = conn -> next;
+        if (!drain && conn -> deadline > now) {
+            continue;
+        }
+        unpark(parker, conn);
+        Close(conn -> fd);
+        Free(conn);
+        metrics_count(COUNT_CONN_CLOSED, 1);
+    }
+    pthread_mutex_unlock(&parker -> mutex);
+}
@@ -0,0 +1,40 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * parker.h - prototypes and definitions for parker.c
+ */
+#ifndef __PARKER_H__
+#define __PARKER_H__
+
+#include "csapp.h"
+#include "sbuf.h"
+
+/* Most parked connections handled per epoll_wait */
+#define PARKER_BATCH 64
+
+/* Milliseconds between two sweeps of the quiet connections */
+#define PARKER_SWEEP_MS 500
+
+/* Defined a struct representing a client connection waiting for a request */
+typedef struct parked_conn_t {
+    int fd;
+    long deadline;                  // metrics_clock time it is closed at
+    struct parked_conn_t* prev;
+    struct parked_conn_t* next;
+} parked_conn_t;
+
+/* Defined a struct representing the quiet connections of the worker pool */
+typedef struct parker_t {
+    int epfd;
+    sbuf_t* queue;                  // readable connections go back here
+    parked_conn_t* parked;          // protected by mutex
+    pthread_mutex_t mutex;
+    pthread_t tid;
+} parker_t;
+
+/* Defined function parking the idle connections of the worker pool */
+void init_parker(parker_t* parker, sbuf_t* queue);
+void park_connection(parker_t* parker, int fd, int idle_timeout);
+
+#endif /* __PARKER_H__ */
@@ -0,0 +1,245 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * parsebench.c - micro benchmark of the request parser in httpparse.c.
+ * Implementation idea:
+ * 1. a browser-like request head is parsed again and again, every run
+ *    first copies it into the buffer because the parser works in place
+ * 2. it is parsed whole, fed in small pieces like partial reads of the
+ *    event loop, and followed by hash lookups of the headers the proxy
+ *    needs; the line-by-line sscanf/strstr/strcat way the proxy used
+ *    before is timed the same way as the baseline
+ * 3. each case runs BENCH_ROUNDS times and prints the nanoseconds per
+ *    request of its best round, the others being slowed by noise
+ *
+ * usage: ./parsebench [iterations]
+ */
+#include <time.h>
+#include "csapp.h"
+#include "httpparse.h"
+
+/* Default number of requests parsed per round */
+#define BENCH_ITERATIONS 200000
+
+/* Rounds of every case, the best one is reported */
+#define BENCH_ROUNDS 5
+
+/* Size of the pieces of the incremental case */
+#define BENCH_PIECE_SIZE 64
+
+static const char* bench_request =
+    "GET http://www.cmu.edu:8080/academics/index.html?lang=en HTTP/1.1\r\n"
+    "Host: www.cmu.edu:8080\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) "
+    "Gecko/20100101 Firefox/115.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+    "image/avif,image/webp,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Referer: http://www.cmu.edu:8080/\r\n"
+    "Cookie: session=3f2a9c1e7b; theme=dark; tz=America%2FNew_York\r\n"
+    "Connection: keep-alive\r\n"
+    "Proxy-Connection: keep-alive\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "If-None-Match: \"5e1f-61a2b3c4\"\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "\r\n";
+
+/* Header names the old line-by-line parse looked for with strstr */
+static const char* baseline_names[] = {
+    "Host:", "User-Agent:", "Accept:", "Accept-Encoding:",
+    "Proxy-Connection:", "Connection:", "Keep-Alive:", "If-None-Match:",
+    "If-Modified-Since:", "If-Range:", "Range:", "Cache-Control:", "Pragma:"
+};
+
+/* The same names as looked up in a parsed request */
+static const char* lookup_names[] = {
+    "Host", "User-Agent", "Accept", "Accept-Encoding",
+    "Proxy-Connection", "Connection", "Keep-Alive", "If-None-Match",
+    "If-Modified-Since", "If-Range", "Range", "Cache-Control", "Pragma"
+};
+
+/* the result of every run feeds this, so that no run is optimized out */
+static volatile size_t bench_sink;
+
+/* Defined a bench case, it returns the ns per request of one round */
+typedef double (*bench_fn)(char* buf, size_t length, long iterations);
+
+static double now_ns();
+static void run_case(const char* name, bench_fn fn, char* buf,
+                     size_t length, long iterations);
+static double bench_whole(char* buf, size_t length, long iterations);
+static double bench_pieces(char* buf, size_t length, long iterations);
+static double bench_lookup(char* buf, size_t length, long iterations);
+static double bench_baseline(char* buf, size_t length, long iterations);
+
+int main(int argc, char **argv) {
+
+    char buf[MAXLINE];
+    size_t length = strlen(bench_request);
+    long iterations = BENCH_ITERATIONS;
+
+    if (argc > 1 && (iterations = atol(argv[1])) <= 0) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        exit(1);
+    }
+
+    printf("request head of %zu bytes, %ld iterations\n", length,
+           iterations);
+    run_case("parse, one read", bench_whole, buf, length, iterations);
+    run_case("parse, reads of 64 bytes", bench_pieces, buf, length,
+             iterations);
+    run_case("parse + 13 header lookups", bench_lookup, buf, length,
+             iterations);
+    run_case("baseline sscanf/strstr/strcat", bench_baseline, buf, length,
+             iterations);
+    return 0;
+}
+
+/*
+ * now_ns - monotonic time in nanoseconds
+ */
+static double now_ns() {
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * run_case - run a case BENCH_ROUNDS times and print its best round
+ */
+static void run_case(const char* name, bench_fn fn, char* buf,
+                     size_t length, long iterations) {
+
+    double ns, best = 0;
+    int round;
+
+    for (round = 0; round < BENCH_ROUNDS; round++) {
+        ns = fn(buf, length, iterations);
+        if (round == 0 || ns < best) {
+            best = ns;
+        }
+    }
+    printf("%-34s %8.1f ns/request\n", name, best);
+}
+
+/*
+ * bench_whole - the head arrived in one read
+ */
+static double bench_whole(char* buf, size_t length, long iterations) {
+
+    http_request_t req;
+    double start = now_ns();
+    long i;
+
+    for (i = 0; i < iterations; i++) {
+        memcpy(buf, bench_request, length);
+        init_http_request(&req);
+        if (parse_http_request(&req, buf, length) != HTTP_PARSE_DONE ||
+            parse_http_uri(&req) == -1) {
+            app_error("parse error");
+        }
+        bench_sink += req.header_num;
+    }
+    return (now_ns() - start) / iterations;
+}
+
+/*
+ * bench_pieces - the head arrived in reads of BENCH_PIECE_SIZE bytes
+ */
+static double bench_pieces(char* buf, size_t length, long iterations) {
+
+    http_request_t req;
+    double start = now_ns();
+    size_t arrived;
+    long i;
+    int rc;
+
+    for (i = 0; i < iterations; i++) {
+        memcpy(buf, bench_request, length);
+        init_http_request(&req);
+        arrived = 0;
+        do {
+            arrived += BENCH_PIECE_SIZE;
+            if (arrived > length) {
+                arrived = length;
+            }
+            rc = parse_http_request(&req, buf, arrived);
+        } while (rc == HTTP_PARSE_AGAIN && arrived < length);
+        if (rc != HTTP_PARSE_DONE) {
+            app_error("parse error");
+        }
+        bench_sink += req.header_num;
+    }
+    return (now_ns() - start) / iterations;
+}
+
+/*
+ * bench_lookup - parse and look up the headers the proxy acts on
+ */
+static double bench_lookup(char* buf, size_t length, long iterations) {
+
+    http_request_t req;
+    http_header_t* header;
+    double start = now_ns();
+    long i;
+    size_t j;
+
+    for (i = 0; i < iterations; i++) {
+        memcpy(buf, bench_request, length);
+        init_http_request(&req);
+        if (parse_http_request(&req, buf, length) != HTTP_PARSE_DONE) {
+            app_error("parse error");
+        }
+        for (j = 0; j < sizeof(lookup_names) / sizeof(char *); j++) {
+            if ((header = find_http_header(&req, lookup_names[j])) != NULL) {
+                bench_sink += header -> value_length;
+            }
+        }
+    }
+    return (now_ns() - start) / iterations;
+}
+
+/*
+ * bench_baseline - the previous parse: sscanf of the request line,
+ *                  a copy and strstr scans per header line, strcat
+ *                  of the upstream header and the cache id
+ */
+static double bench_baseline(char* buf, size_t length, long iterations) {
+
+    char line[MAXLINE], header[MAXLINE], cache_id[MAXLINE];
+    char method[MAXLINE], uri[MAXLINE], version[MAXLINE];
+    char *cursor, *line_end;
+    double start = now_ns();
+    long i;
+    size_t j;
+
+    for (i = 0; i < iterations; i++) {
+        memcpy(buf, bench_request, length + 1);
+        sscanf(buf, "%s %s %s", method, uri, version);
+        header[0] = '\0';
+        cursor = strstr(buf, "\r\n") + 2;
+        while (strncmp(cursor, "\r\n", 2)) {
+            line_end = strstr(cursor, "\r\n") + 2;
+            memcpy(line, cursor, line_end - cursor);
+            line[line_end - cursor] = '\0';
+            for (j = 0; j < sizeof(baseline_names) / sizeof(char *); j++) {
+                if (strstr(line, baseline_names[j]) != NULL) {
+                    break;
+                }
+            }
+            strcat(header, line);
+            cursor = line_end;
+        }
+        strcpy(cache_id, method);
+        strcat(cache_id, " ");
+        strcat(cache_id, uri);
+        strcat(cache_id, " ");
+        strcat(cache_id, version);
+        bench_sink += strlen(header) + strlen(cache_id);
+    }
+    return (now_ns() - start) / iterations;
+}
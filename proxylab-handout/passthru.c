@@ -0,0 +1,69 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * passthru.c - pass-through relay of response bodies with splice.
+ * Implementation idea:
+ * 1. a socket cannot be spliced to another socket directly, so the bytes
+ *    go server socket - pipe - client socket, the pages are moved between
+ *    the kernel buffers and never copied to user space
+ * 2. kept apart from csapp.c because splice needs _GNU_SOURCE, which
+ *    clashes with the declarations of csapp.h
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "passthru.h"
+
+/*
+ * splice_relay - move exactly length bytes from fromfd to tofd
+ *                return 0 on success, SPLICE_FROM_ERROR if fromfd failed
+ *                or ended early, SPLICE_TO_ERROR if tofd failed and
+ *                SPLICE_NO_PIPE if no pipe could be created
+ */
+int splice_relay(int fromfd, int tofd, long length) {
+
+    int pipefd[2];
+    ssize_t n, m;
+    int rc = 0;
+
+    if (pipe(pipefd) == -1) {
+        return SPLICE_NO_PIPE;
+    }
+
+    while (length > 0 && rc == 0) {
+        // source socket to the pipe
+        n = splice(fromfd, NULL, pipefd[1], NULL,
+                   (length < SPLICE_CHUNK) ? length : SPLICE_CHUNK,
+                   SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            rc = SPLICE_FROM_ERROR;
+            break;
+        }
+        length -= n;
+
+        // pipe to the destination socket
+        while (n > 0) {
+            m = splice(pipefd[0], NULL, tofd, NULL, n,
+                       SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (m == -1 && errno == EINTR) {
+                continue;
+            }
+            if (m <= 0) {
+                rc = SPLICE_TO_ERROR;
+                break;
+            }
+            n -= m;
+        }
+    }
+
+    close(pipefd[0]);
+    close(pipefd[1]);
+    return rc;
+}
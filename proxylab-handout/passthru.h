@@ -0,0 +1,21 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * passthru.h - prototypes and definitions for passthru.c
+ */
+#ifndef __PASSTHRU_H__
+#define __PASSTHRU_H__
+
+/* Max bytes moved by one splice of a pass-through body */
+#define SPLICE_CHUNK 65536
+
+/* Results of splice_relay besides 0 for success */
+#define SPLICE_FROM_ERROR -1
+#define SPLICE_TO_ERROR   -2
+#define SPLICE_NO_PIPE    -3
+
+/* Defined function moving bytes between sockets inside the kernel */
+int splice_relay(int fromfd, int tofd, long length);
+
+#endif /* __PASSTHRU_H__ */
@@ -7,14 +7,67 @@
  * 1. use multi-thread to allow concurrency
  * 2. maintain global variable(cache list) update thread safe
  *    using read and write lock
- * 3. parse client request - form cache id - search for cache
+ * 3. parse client request in place (httpparse.c) - form cache id -
+ *    search for cache
  *    if cache hit - form response and return
  *    if cache miss - request from server and update cache
+ * 4. concurrent misses on the same cache id are coalesced, the first
+ *    one fetches from the server and the others stream its bytes
+ * 5. client and server connections persist across requests when the
+ *    response length is known, pipelined requests are answered in order;
+ *    in pool mode a quiet client connection waits for its next request
+ *    without a worker (parker.c)
+ * 6. Range and If-* requests are answered from the cached full response
+ *    (see conditional.c); on a miss they go to the server without joining
+ *    a flight and only a full 200 response is cached; a client asking to
+ *    revalidate makes the proxy send the cached validators upstream and a
+ *    304 from the server is answered from the cache
+ * 7. cached objects expire as their caching headers say (freshness.c),
+ *    a stale one is revalidated the same way before it is served, or in
+ *    a background thread while it is still within stale-while-revalidate
+ * 8. output is gathered with writev (outvec.c): the upstream request from
+ *    the parsed client headers, a cached response from its head and
+ *    segments, and a relayed head goes out with the first body bytes
+ * 9. every thread counts its requests and the latency of their phases
+ *    without locks (metrics.c), GET http://proxy.local/stats reports them
+ * 10. a control thread takes the signals: SIGHUP reads the settings again
+ *    and applies those that can change at runtime, SIGUSR2 starts the
+ *    binary again on the same listening socket, optionally with a cache
+ *    snapshot, and SIGQUIT makes the process drain (upgrade.c)
+ * 11. reuseport mode opens one SO_REUSEPORT listening socket per epoll
+ *    loop, each loop thread pinned to a cpu, so no accept is shared
+ * 12. the connect, the first byte and every further read of a response
+ *    have a timeout; origins that keep failing are marked down
+ *    (breaker.c) and their requests get the stale cached copy or a 504
+ *    at once, until a probe request finds the origin back
+ * 13. the server is asked for gzip only when the client accepts it; text
+ *    is cached compressed and decoded for the clients that do not accept
+ *    gzip (encoding.c), so one object serves both; their misses never
+ *    share a flight
  *
  */
 #include <stdio.h>
+#include <poll.h>
 #include "csapp.h"
 #include "cache.h"
+#include "proxy.h"
+#include "event.h"
+#include "sbuf.h"
+#include "parker.h"
+#include "inflight.h"
+#include "upstream.h"
+#include "dnscache.h"
+#include "passthru.h"
+#include "diskcache.h"
+#include "conditional.h"
+#include "freshness.h"
+#include "outvec.h"
+#include "metrics.h"
+#include "config.h"
+#include "upgrade.h"
+#include "encoding.h"
+#include "affinity.h"
+#include "breaker.h"
 
 //#define DEBUG
 #ifdef DEBUG
@@ -23,37 +76,153 @@
 # define dbg_printf(...)
 #endif
 
-/* Recommended max cache and object sizes */
-#define MAX_CACHE_SIZE 1049000
-#define MAX_OBJECT_SIZE 102400
+/* Default worker pool size and connection queue depth in pool mode */
+#define DEFAULT_WORKER_NUM  16
+#define DEFAULT_QUEUE_DEPTH 64
+
+/* Default seconds before a quiet persistent client connection is closed */
+#define DEFAULT_CLIENT_IDLE_TIMEOUT 15
+
+/* Default seconds of the upstream connect, first byte and idle reads */
+#define DEFAULT_CONNECT_TIMEOUT    5
+#define DEFAULT_FIRST_BYTE_TIMEOUT 30
+#define DEFAULT_READ_TIMEOUT       30
+
+/* generate_response result when the server closed without a status line */
+#define RESPONSE_NOTHING -2
+
+/* generate_response result when the server confirmed the cached copy */
+#define RESPONSE_NOT_MODIFIED 1
 
 /*
- * Defined indices for identify flags in the flag array
- * to check wether the request header contains the corresponding fields
+ * Kinds of upstream fetch: a plain miss, a request carrying the client
+ * Range or If-* headers, or a revalidation with the cached validators
  */
-#define HOST             0
-#define USER_AGENT       1
-#define ACCEPT           2
-#define ACCEPT_ENCODING  3
-#define CONNECTION       4
-#define PROXY_CONNECTION 5
+#define FETCH_PLAIN       0
+#define FETCH_CONDITIONAL 1
+#define FETCH_REVALIDATE  2
+
+/*
+ * Defined a struct representing the settings given on the command line
+ * or in the configuration file
+ */
+typedef struct proxy_options_t {
+    char* mode;                 // serving mode, thread per connection default
+    int thread_num;             // number of epoll loops or pool workers
+    int queue_depth;
+    int reject_when_full;       // answer 503 instead of pausing accept
+    int max_idle;               // idle server connections per host
+    int max_open;               // server connections per host, 0 no limit
+    int dns_ttl;                // seconds a resolved host is cached
+    char* policy;               // cache replacement policy, lru
+    char* disk_path;            // file of the disk tier, none
+    int disk_size;              // megabytes of the disk tier
+    size_t cache_size;          // bytes of the cache in memory
+    size_t object_size;         // larger objects are never cached
+    int client_idle_timeout;    // seconds, 0 serves one request
+    int default_lifetime;       // seconds a response without expiry is fresh
+    int warm_upgrade;           // hand the cache over on SIGUSR2
+    int connect_timeout;        // seconds, 0 waits as long as the system
+    int first_byte_timeout;     // seconds from the request to the status
+    int read_timeout;           // seconds between two reads of a response
+    int breaker_failures;       // failures marking an origin down, 0 never
+    int breaker_cooldown;       // seconds before a down origin is probed
+    int compress_level;         // zlib level of cached text, 0 stores as is
+} proxy_options_t;
+
+/* Defined a struct representing the destinations of a relayed response */
+typedef struct relay_t {
+    int clientfd;
+    int client_alive;           // the followers still need it if not
+    flight_t* flight;
+    cache_fill_t* fill;         // the object dropped once too large
+    encoder_t* encoder;         // encodes the body of fill as it grows
+    size_t length;              // bytes relayed to the client
+    int fetch;                  // FETCH_* kind of the request
+    long requested;             // time the request was sent
+    char pending[MAXBUF];       // head lines not written to the client yet
+    size_t pending_length;
+    int dechunk;                // HTTP/1.0 receivers, chunk framing removed
+} relay_t;
+
+/* Defined a struct representing how a response body is delimited */
+typedef struct response_info_t {
+    int status;
+    long content_length;        // -1 if the header does not give it
+    int chunked;
+    int keep_alive;             // the server keeps the connection open
+    int delimited;              // the body does not end with the connection
+    freshness_t fresh;          // caching headers
+} response_info_t;
+
+/* Defined a struct representing a background revalidation */
+typedef struct refresh_t {
+    cache_object_t* object;     // pinned until the revalidation ends
+    char cache_id[MAXLINE];
+    char host[MAXLINE];
+    char port[MAXLINE];
+    char resource[MAXLINE];
+    char validators[MAXLINE];
+    outvec_t request;           // pieces point into the fields above
+} refresh_t;
 
 /* Static helper functions for the proxy implementation */
+static int serve_request(rio_t* rio, int fd);
+static void serve_pooled(int fd);
+static int client_readable(int fd);
 static int request_from_server(int clientfd, char* remote_host_name,
-         char* remote_host_port, char* req_buf, cache_list_t* list,
-         char* cache_id);
+         char* remote_host_port, outvec_t* request, cache_list_t* list,
+         char* cache_id, flight_t* flight, int fetch, int* delimited);
 static int generate_response(int clientfd, int serverfd,
-         cache_list_t* list, char* cache_id);
-static int* generate_request_header(char* buf,
-         char* request_header, int* flag);
-static void check_request_header(char* request_header, int *flag,
-         char* remote_host_name);
-static void parse_uri(char *uri, char *host_name, char *host_port,
-         char *protocal, char *resource);
+         cache_list_t* list, char* cache_id, flight_t* flight, int fetch,
+         int* reusable, int* delimited);
+static int relay_response(rio_t* rio, relay_t* relay, response_info_t* info);
+static int serve_cached_response(int fd, request_cond_t* cond,
+                                 cache_object_t* object);
+static int write_cached_response(int fd, char* head, size_t head_length,
+                                 cache_object_t* object, size_t offset,
+                                 size_t length);
+static int write_decoded_response(int fd, char* head, size_t head_length,
+                                  cache_object_t* object, size_t offset,
+                                  size_t length);
+static void parse_response_status(char* buf, response_info_t* info);
+static int parse_response_header(char* buf, response_info_t* info);
+static int relay_body(rio_t* rio, relay_t* relay, long length);
+static int can_splice_body(relay_t* relay, long length);
+static int splice_body(rio_t* rio, relay_t* relay, long length);
+static int relay_chunked_body(rio_t* rio, relay_t* relay);
+static int id_is_http10(char* cache_id);
+static int relay_to_client(relay_t* relay, char* buf, size_t length);
+static void relay_defer(relay_t* relay, char* buf, size_t length);
+static int relay_send(relay_t* relay, char* buf, size_t length);
+static int follow_flight(int clientfd, flight_t* flight,
+                         flight_reader_t* reader);
+static int serve_origin_down(int fd, request_cond_t* cond,
+                             cache_object_t* object, int keep_alive);
+static void set_read_timeout(int fd, int seconds);
+static int server_timed_out(int serverfd);
+static int load_options(int argc, char** argv, proxy_options_t* options);
+static void free_options(proxy_options_t* options);
+static int apply_option(void* arg, int opt, char* value);
+static int parse_flag(char* value, int* flag);
+static int same_string(char* a, char* b);
+static void control_signals(sigset_t* mask);
+static void reload_options();
+static void report_restart(char* name, int changed);
+static void resize_worker_pool(int wanted);
+static int retire_worker();
+static void start_upgrade();
+static void reap_upgrade();
+static long open_connections();
+static void drain_and_exit();
 static int isValidPort(char *port);
+static void usage(char *prog);
 
 /* thread main routine and workding functions */
 void *thread(void *vargp);
+void *worker(void *vargp);
+void *control_thread(void *vargp);
+void *refresh_thread(void *vargp);
 void echo(int fd);
 
 /* Constant strings for constructing request/response header */
@@ -61,9 +230,52 @@ static const char *user_agent_hdr = "User-Agent: Mozilla/5.0 \
 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 Firefox/10.0.3\r\n";
 static const char *accept_str = "Accept: text/html,\
 application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n";
-static const char *accept_encoding_str = "Accept-Encoding: gzip, deflate\r\n";
+static const char *accept_gzip_str = "Accept-Encoding: gzip\r\n";
+static const char *accept_identity_str = "Accept-Encoding: identity\r\n";
 static const char *connection_str = "Connection: close\r\n";
 static const char *proxy_connection_str = "Proxy-Connection: close\r\n";
+static const char *keep_alive_connection_str = "Connection: keep-alive\r\n";
+static const char *keep_alive_proxy_connection_str =
+    "Proxy-Connection: keep-alive\r\n";
+
+/* Settings of the configuration file, named after the long options */
+static const config_key_t config_keys[] = {
+    {"mode", 'm'},
+    {"threads", 'n'},
+    {"queue-depth", 'q'},
+    {"reject-when-full", 'r'},
+    {"upstream-idle", 'u'},
+    {"upstream-max", 'U'},
+    {"client-idle-timeout", 'k'},
+    {"dns-ttl", 'd'},
+    {"policy", 'p'},
+    {"cache-size", 'C'},
+    {"object-size", 'O'},
+    {"default-lifetime", 'f'},
+    {"disk-file", 'D'},
+    {"disk-size", 'S'},
+    {"warm-upgrade", 'w'},
+    {"connect-timeout", 'T'},
+    {"first-byte-timeout", 'F'},
+    {"read-timeout", 'I'},
+    {"breaker-failures", 'B'},
+    {"breaker-cooldown", 'b'},
+    {"compress-level", 'Z'},
+    {NULL, 0}
+};
+
+/* Command line options, -c names the configuration file */
+#define PROXY_OPTSTRING "B:b:C:c:D:d:F:f:I:k:m:n:O:p:q:rS:T:U:u:wZ:"
+
+/* Settings before the configuration file and the command line */
+static const proxy_options_t default_options = {
+    "thread", 0, DEFAULT_QUEUE_DEPTH, 0, UPSTREAM_MAX_IDLE, UPSTREAM_MAX_OPEN,
+    DNS_DEFAULT_TTL,
+    NULL, NULL, DISK_DEFAULT_SIZE, DEFAULT_CACHE_SIZE, DEFAULT_OBJECT_SIZE,
+    DEFAULT_CLIENT_IDLE_TIMEOUT, FRESH_DEFAULT_LIFETIME, 0,
+    DEFAULT_CONNECT_TIMEOUT, DEFAULT_FIRST_BYTE_TIMEOUT, DEFAULT_READ_TIMEOUT,
+    BREAKER_DEFAULT_FAILURES, BREAKER_DEFAULT_COOLDOWN, ENCODING_DEFAULT_LEVEL
+};
 
 /* Shared variables for constructing bad request */
 char *method_error_str = "Not implemented.\
@@ -72,57 +284,226 @@ char *uri_error_str = "Not found. Invalid URI.\r\n";
 char *invalid_request_response_str = "HTTP/1.1 400 \
 Bad Request\r\nConnection: close\r\nContent-Type: text/html\r\n\r\n \
 <html><head></head><body><p>Webpage not found.</p></body></html>";
+char *busy_response_str = "HTTP/1.0 503 \
+Service Unavailable\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+char *gateway_timeout_response_str = "HTTP/1.0 504 \
+Gateway Timeout\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
 
 /* cache for the proxy */
 cache_list_t* cache_list = NULL;
 
+/* connected descriptors waiting for a worker in pool mode */
+sbuf_t conn_queue;
+
+/* quiet persistent connections waiting for a request in pool mode */
+parker_t parker;
+
+/* upstream fetches in flight, shared by concurrent misses */
+flight_table_t* flight_table = NULL;
+
+/* idle persistent connections to the origin servers */
+upstream_pool_t* upstream_pool = NULL;
+
+/* seconds a persistent client connection may stay quiet, 0 disables reuse */
+int client_idle_timeout = DEFAULT_CLIENT_IDLE_TIMEOUT;
+
+/* seconds a response without Cache-Control or Expires stays fresh */
+int default_lifetime = FRESH_DEFAULT_LIFETIME;
+
+/* seconds an upstream connect, the first byte and later reads may take */
+int connect_timeout = DEFAULT_CONNECT_TIMEOUT;
+int first_byte_timeout = DEFAULT_FIRST_BYTE_TIMEOUT;
+int read_timeout = DEFAULT_READ_TIMEOUT;
+
+/* origins marked down after failing in a row */
+breaker_t* origin_breaker = NULL;
+
+/* zlib level the text responses are cached with, 0 caches them as received */
+int compress_level = ENCODING_DEFAULT_LEVEL;
+
+/* settings in effect, a reload updates those that can change at runtime */
+static proxy_options_t proxy_options;
+
+/* arguments of the proxy, read again on reload and for an upgrade */
+static int proxy_argc;
+static char** proxy_argv;
+
+/* listening sockets, one per loop in reuseport mode, handed over on upgrade */
+static int listen_fds[UPGRADE_MAX_LISTEN];
+static int listen_num = 0;
+
+/* workers running and wanted in pool mode */
+static int worker_num = 0;
+static int worker_target = 0;
+
+/* process started by SIGUSR2 and its cache snapshot, until it takes over */
+static pid_t upgrade_pid = 0;
+static char* upgrade_snapshot = NULL;
+
 /* main entrance for the proxy */
 int main(int argc, char **argv) {
-    int listenfd, *connfd, port;
+    int listenfd, *connfd, port, fd, i;
 	char* port_str;
+    disk_cache_t* disk;
+    sigset_t mask;
     struct sockaddr_in clientaddr;
     socklen_t clientlen;
     pthread_t tid;
 
     Signal(SIGPIPE, SIG_IGN);   // ignore SIGPIPE signal
 
+    // the control thread takes the signals, every thread inherits the mask
+    control_signals(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    // the configuration file comes first, the command line overrides it
+    proxy_argc = argc;
+    proxy_argv = argv;
+    if (load_options(argc, argv, &proxy_options) == -1) {
+        usage(argv[0]);
+    }
+    client_idle_timeout = proxy_options.client_idle_timeout;
+    default_lifetime = proxy_options.default_lifetime;
+    connect_timeout = proxy_options.connect_timeout;
+    first_byte_timeout = proxy_options.first_byte_timeout;
+    read_timeout = proxy_options.read_timeout;
+    compress_level = proxy_options.compress_level;
+
     // check whether the input argument is legal
-    if (argc != 2) {
-        printf("Illegal Argument.\n");
-        exit(0);
+    if ((argc - optind) != 1) {
+        usage(argv[0]);
     }
 
     // check whether the input port is legal numbers
-    if (!isValidPort(argv[1])) {
+    if (!isValidPort(argv[optind])) {
         printf("Illegal Port.\n");
         exit(0);
     }
 
-    port = atoi(argv[1]);   // get the port number
+    port = atoi(argv[optind]);   // get the port number
 	dbg_printf("Port number:%d\n", port);
     // check whether the port is within the legal range
     if ((port < 1000) || (port > 65535)) {
         printf("Illegal port.\n");
     }
 
-	port_str = argv[1];
-    cache_list = init_cache_list();     // initialize cache list
+	port_str = argv[optind];
+    // the cache counts into the metrics from its first object on
+    init_metrics();
+    // initialize cache list
+    cache_list = init_cache_list(proxy_options.policy,
+                                 proxy_options.cache_size,
+                                 proxy_options.object_size);
+    if (cache_list == NULL) {
+        usage(argv[0]);
+    }
+    if (proxy_options.disk_path != NULL) {
+        disk = open_disk_cache(proxy_options.disk_path,
+                               (size_t)proxy_options.disk_size << 20,
+                               proxy_options.object_size);
+        if (disk == NULL) {
+            exit(1);
+        }
+        attach_disk_cache(cache_list, disk);
+    }
+    // the objects of the process this one replaces, if it left them
+    restore_cache_snapshot(cache_list);
     dbg_printf("Cache list initialized successfully.\n");
+    flight_table = init_flight_table();
+    upstream_pool = init_upstream_pool(proxy_options.max_idle,
+                                       proxy_options.max_open,
+                                       UPSTREAM_IDLE_TIMEOUT);
+    init_dns_cache(proxy_options.dns_ttl, DNS_NEGATIVE_TTL, 1);
+    origin_breaker = init_breaker(proxy_options.breaker_failures,
+                                  proxy_options.breaker_cooldown);
+    Pthread_create(&tid, NULL, control_thread, NULL);
+
+    // an upgraded process serves the sockets of the one it replaces
+    listen_num = inherited_listenfds(listen_fds, UPGRADE_MAX_LISTEN);
+    if (listen_num == 0 && !strcmp(proxy_options.mode, "reuseport")) {
+        while (listen_num < proxy_options.thread_num) {
+            listen_fds[listen_num++] = Open_reuseport_listenfd(port_str);
+        }
+    } else if (listen_num == 0) {
+        // ready for client request
+        listen_fds[listen_num++] = Open_listenfd(port_str);
+    }
+    // the other modes serve one socket of an inherited reuseport group
+    while (listen_num > 1 && strcmp(proxy_options.mode, "reuseport")) {
+        Close(listen_fds[--listen_num]);
+    }
+    // the sockets may be shared with another process, see accept_client
+    for (i = 0; i < listen_num; i++) {
+        if (fcntl(listen_fds[i], F_SETFL,
+                  fcntl(listen_fds[i], F_GETFL, 0) | O_NONBLOCK) == -1) {
+            unix_error("Set listenfd non-blocking error");
+        }
+    }
+    listenfd = listen_fds[0];
+    upgrade_ready();
+
+    // event-driven mode serves every connection from the epoll loops
+    if (!strcmp(proxy_options.mode, "event")) {
+        run_event_loops(listenfd, proxy_options.thread_num);
+        return 0;
+    }
+
+    // reuseport mode: an epoll loop per listening socket, pinned to a cpu
+    if (!strcmp(proxy_options.mode, "reuseport")) {
+        run_reuseport_loops(listen_fds, listen_num);
+        return 0;
+    }
 
-	listenfd = Open_listenfd(port_str);     // ready for client request
+    /*
+     * pool mode: prethreaded workers take connections from a bounded queue,
+     * when the queue is full either accept pauses or the client gets a 503
+     */
+    if (!strcmp(proxy_options.mode, "pool")) {
+        sbuf_init(&conn_queue, proxy_options.queue_depth);
+        init_parker(&parker, &conn_queue);
+        resize_worker_pool(proxy_options.thread_num);
+
+        while (1) {
+            clientlen = sizeof(struct sockaddr_in);
+            if ((fd = accept_client(listenfd, (SA *) &clientaddr,
+                                    &clientlen)) == -1) {
+                break;
+            }
+            metrics_count(COUNT_CONN_OPENED, 1);
+            if (!proxy_options.reject_when_full) {
+                sbuf_insert(&conn_queue, fd);
+            } else if (sbuf_tryinsert(&conn_queue, fd) == -1) {
+                // best effort, the client may already be gone
+                rio_writen(fd, busy_response_str, strlen(busy_response_str));
+                Close(fd);
+                metrics_count(COUNT_CONN_CLOSED, 1);
+            }
+        }
+
+        // draining, the workers serve the connections still queued
+        Close(listenfd);
+        pthread_exit(NULL);
+    }
 
     // proxy runs for accepting client request continuously
     while (1) {
 
         clientlen = sizeof(struct sockaddr_in);
+        if ((fd = accept_client(listenfd, (SA *) &clientaddr,
+                                &clientlen)) == -1) {
+            break;
+        }
+        metrics_count(COUNT_CONN_OPENED, 1);
         connfd = Malloc(sizeof(int));
-        *connfd = Accept(listenfd, (SA *) &clientaddr, &clientlen);
+        *connfd = fd;
         // create a thread to maintain concurrency
         Pthread_create(&tid, NULL, thread, connfd);
 
     }
 
-    return 0;
+    // draining, the control thread exits once the connections are served
+    Close(listenfd);
+    pthread_exit(NULL);
 }
 
 /*
@@ -140,95 +521,247 @@ void *thread(void *vargp) {
 }
 
 /*
- * echo - the main function for the proxy to parse request and return response
+ * worker - Pool worker routine, serve connections from the queue until
+ *          a reload shrinks the pool
+ */
+void *worker(void *vargp) {
+
+    int connfd;
+    Pthread_detach(pthread_self());
+    do {
+        connfd = sbuf_remove(&conn_queue);
+        serve_pooled(connfd);
+    } while (!retire_worker());
+    return NULL;
+
+}
+
+/*
+ * control_thread - handle the signals of the proxy: SIGUSR1 prints the
+ *                  cache counters and the request statistics, SIGHUP
+ *                  reloads the settings, SIGUSR2 starts an upgrade and
+ *                  SIGQUIT drains the process
+ */
+void *control_thread(void *vargp) {
+
+    char report[MAXBUF];
+    sigset_t mask;
+    int sig;
+
+    Pthread_detach(pthread_self());
+    control_signals(&mask);
+    while (1) {
+        if (sigwait(&mask, &sig) != 0) {
+            continue;
+        }
+        switch (sig) {
+        case SIGUSR1:
+            print_cache_stats(cache_list);
+            metrics_report(cache_list, report, sizeof(report));
+            printf("%s", report);
+            break;
+        case SIGHUP:
+            reload_options();
+            break;
+        case SIGUSR2:
+            start_upgrade();
+            break;
+        case SIGCHLD:
+            reap_upgrade();
+            break;
+        case SIGQUIT:
+            drain_and_exit();
+            break;
+        }
+        fflush(stdout);
+    }
+    return NULL;
+
+}
+
+/*
+ * echo - the main function for the proxy to parse request and return response,
+ *        requests on a persistent connection are served in order until
+ *        the client closes it, stays quiet for the idle timeout or
+ *        the process drains
+ *        the caller owns fd and closes it after echo returns
  */
 void echo(int fd) {
 	dbg_printf("Enter echo\n");
 
     rio_t rio;
-    char buf[MAXLINE], req_buf[MAXLINE], req_header_buf[MAXLINE];
-    char method[MAXLINE], uri[MAXLINE], version[MAXLINE];
-    char protocol[MAXLINE];
-    char resource[MAXLINE];
-    char remote_host_name[MAXLINE], remote_host_port[MAXLINE];
-    char uri_check[7];  // for check whether the uri starting with "http://"
-    char cache_id[MAXLINE], cache_content[MAX_OBJECT_SIZE];
 
-    int flag[6];    // flag array to indentify request head settings
-	int i;
-    for (i = 0; i < 6; i++) {
-        flag[i] = 0;
+    // a quiet client makes the read fail with EAGAIN
+    if (client_idle_timeout > 0) {
+        set_read_timeout(fd, client_idle_timeout);
     }
 
-    // read the request from the connfd
-    Rio_readinitb(&rio, fd);
-    if (Rio_readlineb(&rio, buf, MAXLINE) == -1) {
-        printf("Null request.\n");
+    // the read buffer keeps pipelined requests across the loop
+    rio_readinitb(&rio, fd);
+    while (serve_request(&rio, fd) && client_idle_timeout > 0 &&
+           !is_draining()) {
+        dbg_printf("Keep the client connection.\n");
+    }
+    metrics_count(COUNT_CONN_CLOSED, 1);
+
+}
+
+/*
+ * serve_pooled - serve the requests a pool worker finds on fd, then park
+ *                the connection until the client sends the next one,
+ *                so no worker waits on a quiet client; a connection
+ *                that cannot carry another request is closed
+ */
+static void serve_pooled(int fd) {
+
+    rio_t rio;
 
-        // when error happens, safely close the fd
-        if (fd >= 0) {
+    // one request per connection, it may as well be waited for
+    if (client_idle_timeout == 0) {
+        echo(fd);
+        Close(fd);
+        return;
+    }
+
+    // a request that stalls half way still ends after the idle timeout
+    set_read_timeout(fd, client_idle_timeout);
+
+    // pipelined requests left in the read buffer are served before parking
+    rio_readinitb(&rio, fd);
+    while (rio.rio_cnt > 0 || client_readable(fd)) {
+        if (!serve_request(&rio, fd) || is_draining()) {
+            metrics_count(COUNT_CONN_CLOSED, 1);
             Close(fd);
+            return;
         }
-        // when error happens, safely close the thread without crash the proxy
-        Pthread_exit(NULL);
-
     }
+    park_connection(&parker, fd, client_idle_timeout);
+}
 
-    // get the content of the request
-    sscanf(buf, "%s %s %s", method, uri, version);
-	dbg_printf("method: %s\n", method);
-	dbg_printf("uri: %s\n", uri);
-	dbg_printf("version: %s\n", version);
+/*
+ * client_readable - check whether the client sent something, or closed,
+ *                   without waiting
+ */
+static int client_readable(int fd) {
 
-    // check whether the request method is legal (only implement GET)
-    if (strcmp(method, "GET")) {
-		dbg_printf("Enter not GET.\n");
+    struct pollfd pfd;
 
-        // return error message to the client
-        Rio_writen(fd, method_error_str, strlen(method_error_str));
-        printf("Not implemented. Sever only implements GET method.\n");
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    return poll(&pfd, 1, 0) == 1;
+}
 
-        // safely close clientfd and exit the thread
-        if (fd >= 0) {
-            Close(fd);
+/*
+ * serve_request - parse one request from the client and return its response
+ *                 return 1 if the connection can carry another request
+ */
+static int serve_request(rio_t* rio, int fd) {
+
+    http_request_t req;
+    http_header_t* header;
+    outvec_t request;
+    char *remote_host_name, *remote_host_port, *resource;
+    char cache_id[MAXLINE];
+    char flight_id[MAXLINE + 16];
+    char validators[MAXLINE];
+    char is_cond[HTTP_MAX_HEADERS];    // Range and If-* headers, kept apart
+    cache_object_t* cache_object;
+    cached_header_t cached_header;
+    request_cond_t cond;
+    flight_t* flight = NULL;
+    flight_reader_t reader;
+    int leader, delimited, keep_alive, rc, freshness;
+    int fetch = FETCH_PLAIN;
+    long start, now;
+    size_t length;
+
+    int flag[HEADER_FLAG_NUM];  // flag array to indentify request head settings
+	int i;
+    for (i = 0; i < HEADER_FLAG_NUM; i++) {
+        flag[i] = 0;
+    }
+    init_request_cond(&cond);
+
+    // read and parse the whole request header in the read buffer
+    if ((rc = rio_read_request(rio, &req)) <= 0) {
+        dbg_printf("Client closed, timed out or sent a bad request.\n");
+        if (rc == -1) {
+            metrics_count(COUNT_ERRORS, 1);
+            rio_writen(fd, invalid_request_response_str,
+                       strlen(invalid_request_response_str));
+        }
+
+        // when error happens, return and let the caller close the fd
+        return 0;
+
+    }
+    start = metrics_clock();
+	dbg_printf("method: %s\n", req.method);
+	dbg_printf("uri: %s\n", req.uri);
+	dbg_printf("version: %s\n", req.version);
+
+    // HTTP/1.1 clients keep the connection unless they ask to close it
+    keep_alive = !strcmp(req.version, "HTTP/1.1");
+
+    // look for the client persistence and conditions
+    for (i = 0; i < req.header_num; i++) {
+        header = &req.headers[i];
+        if ((header -> id == HDR_CONNECTION ||
+             header -> id == HDR_PROXY_CONNECTION) &&
+            contains_token(header -> value, "close")) {
+            keep_alive = 0;
         }
-        Pthread_exit(NULL);
+        is_cond[i] = parse_request_cond(header, &cond);
+    }
+
+    // check whether the request method is legal (only implement GET)
+    if (strcasecmp(req.method, "GET")) {
+		dbg_printf("Enter not GET method.\n");
+
+        metrics_count(COUNT_ERRORS, 1);
+        rio_writen(fd, method_error_str, strlen(method_error_str));
+        printf("Not implemented. Proxy only implements GET method.\n");
+        return 0;
 
     }
 
     // check whether the request uri is legal
-    strncpy(uri_check, uri, 7);
-	dbg_printf("uri_check: %s\n", uri_check);
-    if (strcmp(uri_check, "http://")) {
+    if (strncmp(req.uri, "http://", 7) || parse_http_uri(&req) == -1) {
 		dbg_printf("Enter bad uri.\n");
 
-        Rio_writen(fd, uri_error_str, strlen(uri_error_str));
+        metrics_count(COUNT_ERRORS, 1);
+        rio_writen(fd, uri_error_str, strlen(uri_error_str));
         printf("Not found. Invalid URI.\n");
-
-        // safely close clientfd and exit the thread
-        if (fd >= 0) {
-            dbg_printf("fd: %d\n", fd);
-			Close(fd);
-        }
-        Pthread_exit(NULL);
+        return 0;
     }
-
-    // parse needed information from the client request
-    parse_uri(uri, remote_host_name, remote_host_port, protocol, resource);
+    remote_host_name = req.host;
+    remote_host_port = req.port;
+    resource = req.path;
 	dbg_printf("remote_host_name: %s\n", remote_host_name);
 	dbg_printf("remote_host_port: %s\n", remote_host_port);
-	dbg_printf("protocol: %s\n", protocol);
 	dbg_printf("resource: %s\n", resource);
 
+    // the statistics of the proxy itself, not counted as a request
+    if (is_metrics_request(remote_host_name, resource)) {
+        char response[MAXBUF + MAXLINE];
+
+        length = metrics_response(cache_list, response, sizeof(response));
+        if (rio_writen(fd, response, length) == -1) {
+            return 0;
+        }
+        return keep_alive;
+    }
+    metrics_count(COUNT_REQUESTS, 1);
+
     // generate cache id (GET www.cmu.edu:80/home.html HTTP/1.0)
-    strcpy(cache_id, method);
-    strcat(cache_id, " ");
-    strcat(cache_id, remote_host_name);
-    strcat(cache_id, ":");
-    strcat(cache_id, remote_host_port);
-    strcat(cache_id, resource);
-    strcat(cache_id, " ");
-    strcat(cache_id, version);
+    if (snprintf(cache_id, MAXLINE, "%s %s:%s%s %s", req.method,
+                 remote_host_name, remote_host_port, resource,
+                 req.version) >= MAXLINE) {
+        metrics_count(COUNT_ERRORS, 1);
+        rio_writen(fd, uri_error_str, strlen(uri_error_str));
+        printf("Not found. URI too long.\n");
+        return 0;
+    }
 
 	dbg_printf("cache_id: %s\n", cache_id);
 
@@ -236,80 +769,169 @@ void echo(int fd) {
      * check whether the request page is in cache
      * if hit, return to the client directly; if not, request from server
      */
-    if (read_cache_list(cache_list, cache_id, cache_content) != -1) {
+    now = metrics_record(METRIC_PARSE, start);
+    cache_object = read_cache_list(cache_list, cache_id);
+    metrics_record(METRIC_LOOKUP, now);
+    if (cache_object != NULL) {
 		dbg_printf("Enter cache hit.\n");
 
-        // read from cache and write to response directly
-        Rio_writen(fd, cache_content, strlen(cache_content));
+        freshness = object_freshness(cache_object);
+        if (!cond.no_cache && freshness != FRESH_STALE) {
+            // a stale copy within its window is refreshed behind the client
+            if (freshness == FRESH_STALE_OK) {
+                refresh_cached_object(cache_object, cache_id,
+                                      remote_host_name, remote_host_port,
+                                      resource);
+            }
+            // write the pinned object to the client directly, without a copy
+            if (!serve_cached_response(fd, &cond, cache_object)) {
+                keep_alive = 0;
+            }
+            release_cache_object(cache_object);
+            metrics_count(COUNT_HITS, 1);
+            metrics_record(METRIC_TOTAL, start);
+            return keep_alive;
+        }
 
-        // safely close the clientfd and exit the thread
-        if (fd >= 0) {
-            Close(fd);
+        // stale, or the client asks to revalidate: ask the server with
+        // our validators
+        if (parse_cached_header(cache_object, &cached_header) == 0 &&
+            cached_header.status == 200) {
+            validators[0] = '\0';
+            if (add_validators(&cached_header, validators)) {
+                fetch = FETCH_REVALIDATE;
+            }
         }
-        Pthread_exit(NULL);
+    }
 
-    } else {
+    // the origin is down, answer at once instead of waiting for it
+    if (!breaker_allow(origin_breaker, remote_host_name, remote_host_port)) {
+        keep_alive = serve_origin_down(fd, &cond, cache_object, keep_alive);
+        release_cache_object(cache_object);
+        metrics_record(METRIC_TOTAL, start);
+        return keep_alive;
+    }
+    if (fetch != FETCH_REVALIDATE) {
+        release_cache_object(cache_object);
+        cache_object = NULL;
+    }
 
-		dbg_printf("Enter request from server.\n");
-        // generate request line
-        strcpy(req_buf, method);
-        strcat(req_buf, " ");
-        strcat(req_buf, resource);
-        strcat(req_buf, " ");
-        strcat(req_buf, version);
-        strcat(req_buf, "\r\n");
-
-		dbg_printf("req_buf: %s\n", req_buf);
-
-		Rio_readlineb(&rio, buf, MAXLINE);
-        // generate request headers according to the client header
-        while (strcmp(buf, "\r\n")) {
-			dbg_printf("Enter loop to generate request header.\n");
-            generate_request_header(buf, req_header_buf, flag);
-			Rio_readlineb(&rio, buf, MAXLINE);
-        }
-        // check whether request header contains all the required information
-        check_request_header(req_header_buf, flag, remote_host_name);
-		dbg_printf("request header after check: %s\n", req_header_buf);
-        // generate complete request string
-        strcat(req_buf, req_header_buf);
-        strcat(req_buf, "\r\n");
-
-		dbg_printf("Complete request: %s\n", req_buf);
-
-        if (request_from_server(fd, remote_host_name, remote_host_port,
-                                req_buf, cache_list, cache_id) == -1) {
-            printf("request from server error.\n");
-
-            // safely close the clientfd and exit the thread
-            if (fd >= 0) {
-                Close(fd);
+    // the server may answer the client conditions with part of the body
+    if (fetch == FETCH_PLAIN && request_is_conditional(&cond)) {
+        fetch = FETCH_CONDITIONAL;
+    }
+
+    // stream the response of the same miss already in flight, only to
+    // clients taking the same encoding
+    if (fetch == FETCH_PLAIN) {
+        snprintf(flight_id, sizeof(flight_id), "%s%s", cache_id,
+                 cond.accept_gzip ? "" : " identity");
+        flight = join_flight(flight_table, flight_id,
+                             __atomic_load_n(&cache_list -> max_object,
+                                             __ATOMIC_RELAXED),
+                             &reader, &leader);
+        if (!leader) {
+            dbg_printf("Enter follow flight.\n");
+            // the framing is only known to the leader, close afterwards
+            if (follow_flight(fd, flight, &reader) == -1) {
+                metrics_count(COUNT_ERRORS, 1);
+            } else {
+                metrics_count(COUNT_COALESCED, 1);
+                metrics_record(METRIC_TOTAL, start);
             }
-            Pthread_exit(NULL);
+            leave_flight(flight, &reader);
+            return 0;
+        }
+    }
+
+	dbg_printf("Enter request from server.\n");
+    // generate request line, the pieces are written in place with writev;
+    // persistent upstream connections need HTTP/1.1 framing
+    init_outvec(&request);
+    outvec_add_str(&request, req.method);
+    outvec_add(&request, " ", 1);
+    outvec_add_str(&request, resource);
+    outvec_add(&request, " ", 1);
+    outvec_add_str(&request, upstream_pool -> max_idle ?
+                   "HTTP/1.1" : req.version);
+    outvec_add(&request, "\r\n", 2);
+
+    // generate request headers according to the client header
+    for (i = 0; i < req.header_num; i++) {
+        if (!is_cond[i]) {
+            generate_request_header(&req.headers[i], &request, flag,
+                                    upstream_pool -> max_idle);
         }
+    }
+    // check whether request header contains all the required information
+    check_request_header(&request, flag, remote_host_name, cond.accept_gzip,
+                         upstream_pool -> max_idle);
 
-        // safely close the clientfd and exit the thread
-        if (fd >= 0) {
-            Close(fd);
+    // a revalidation sends the cached validators instead of the client ones
+    if (fetch == FETCH_REVALIDATE) {
+        outvec_add_str(&request, validators);
+    } else {
+        for (i = 0; i < req.header_num; i++) {
+            if (is_cond[i]) {
+                outvec_add_header(&request, &req.headers[i]);
+            }
         }
-		Pthread_exit(NULL);
+    }
+    outvec_add(&request, "\r\n", 2);
+
+    delimited = 0;
+    rc = request_from_server(fd, remote_host_name, remote_host_port,
+                             &request, cache_list, cache_id, flight, fetch,
+                             &delimited);
+    if (flight != NULL) {
+        finish_flight(flight_table, flight, rc != -1);
+    }
+    if (rc == -1) {
+        printf("request from server error.\n");
+        metrics_count(COUNT_ERRORS, 1);
+        release_cache_object(cache_object);
+        return 0;
+    }
 
+    // the server confirmed the cached copy
+    if (rc == RESPONSE_NOT_MODIFIED) {
+        renew_object_freshness(cache_object);
+        if (!serve_cached_response(fd, &cond, cache_object)) {
+            keep_alive = 0;
+        }
+        delimited = 1;
+        metrics_count(COUNT_REVALIDATED, 1);
+    } else {
+        metrics_count(COUNT_MISSES, 1);
     }
+    release_cache_object(cache_object);
+    metrics_record(METRIC_TOTAL, start);
+
+    return keep_alive && delimited;
 
 }
 
 /*
  * request_from_server - send request to the server to get response and cache it.
+ *                       a pooled connection the server closed meanwhile
+ *                       is retried once on a fresh connection
+ *                       *delimited is set if the client can tell where
+ *                       the response ends without the connection closing;
+ *                       whether the server answered in time goes to the
+ *                       breaker of the origin
  *                       return -1 on error
  */
 static int request_from_server(int clientfd, char* remote_host_name,
-char* remote_host_port, char* req_buf, cache_list_t* list, char* cache_id) {
+char* remote_host_port, outvec_t* request, cache_list_t* list, char* cache_id,
+flight_t* flight, int fetch, int* delimited) {
 
     // file descriptor to connect to server
     int serverfd;
+    int rc, reused, reusable, attempt, timed_out = 0;
+    long start;
 
     // check arguments
-    if (req_buf == NULL) {
+    if (request == NULL) {
         printf("request error.\n");
         return -1;
     }
@@ -320,247 +942,901 @@ char* remote_host_port, char* req_buf, cache_list_t* list, char* cache_id) {
     }
 
 	dbg_printf("Enter request_from_server.\n");
-	dbg_printf("Request: %s\n.", req_buf);
 
-    /*
-     * Request to server
-     */
-    // open listenfd to establish connection to server
-    if ((serverfd = Open_clientfd(remote_host_name, remote_host_port)) < 0) {
-        printf("Connection to server error.\n");
-        Rio_writen(clientfd, invalid_request_response_str, strlen(invalid_request_response_str));
-        // when error happens, safely server connfd, then exit
-        if (serverfd >= 0) {
-            Close(serverfd);
+    for (attempt = 0; attempt < 2; attempt++) {
+
+        /*
+         * Request to server
+         */
+        // take an idle connection to the server or open a new one
+        start = metrics_clock();
+        serverfd = acquire_upstream(upstream_pool, remote_host_name,
+                                    remote_host_port, connect_timeout,
+                                    &reused);
+        if (serverfd < 0) {
+            // every connection to the origin busy is no failure of it
+            timed_out = (errno == ETIMEDOUT || errno == EAGAIN);
+            if (errno != EAGAIN) {
+                breaker_report(origin_breaker, remote_host_name,
+                               remote_host_port, 0);
+            }
+            break;
+        }
+        if (reused) {
+            metrics_count(COUNT_UPSTREAM_REUSED, 1);
+        } else {
+            metrics_count(COUNT_UPSTREAM_CONNECTS, 1);
+            metrics_record(METRIC_CONNECT, start);
         }
-        return -1;
-    } else {
-        Rio_writen(serverfd, req_buf, strlen(req_buf));
 
         /*
          * successfully connect to server and get server response
          * then write to clientfd and cache response
          */
-        if (generate_response(clientfd, serverfd, list, cache_id) == -1) {
-            printf("Generate client response error.\n");
+        reusable = 0;
+        outvec_rewind(request);
+        // the status line must come within the first-byte timeout
+        set_read_timeout(serverfd, first_byte_timeout);
+        if (outvec_flush(serverfd, request) == -1) {
+            rc = RESPONSE_NOTHING;
+        } else {
+            rc = generate_response(clientfd, serverfd, list, cache_id,
+                                   flight, fetch, &reusable, delimited);
+        }
+        timed_out = (rc < 0 && server_timed_out(serverfd));
+        if (timed_out) {
+            metrics_count(COUNT_UPSTREAM_TIMEOUTS, 1);
         }
 
-        /* close server fd */
-        if (serverfd >= 0) {
-            Close(serverfd);
+        // a stale pooled connection, nothing reached the client yet
+        if (rc == RESPONSE_NOTHING && reused && !timed_out) {
+            release_upstream(upstream_pool, remote_host_name,
+                             remote_host_port, serverfd, 0);
+            continue;
         }
+        // a status line in time tells that the origin is up
+        breaker_report(origin_breaker, remote_host_name, remote_host_port,
+                       rc != RESPONSE_NOTHING && !timed_out);
 
-        return 0;
+        // keep the server fd for the next request if the response allows
+        release_upstream(upstream_pool, remote_host_name, remote_host_port,
+                         serverfd, rc >= 0 && reusable);
+
+        if (rc >= 0) {
+            return rc;
+        }
+        printf("Generate client response error.\n");
+        if (rc == -1) {
+            return -1;
+        }
+        break;
+    }
+
+    printf("Connection to server error.\n");
+    if (clientfd >= 0 && timed_out) {
+        rio_writen(clientfd, gateway_timeout_response_str,
+                   strlen(gateway_timeout_response_str));
+    } else if (clientfd >= 0) {
+        rio_writen(clientfd, invalid_request_response_str,
+                   strlen(invalid_request_response_str));
+    }
+    return -1;
+}
+
+/*
+ * refresh_cached_object - revalidate a stale object in a detached thread
+ *                         while the clients keep getting the stale copy;
+ *                         at most one revalidation runs per object
+ */
+void refresh_cached_object(cache_object_t* object, char* cache_id,
+                           char* remote_host_name, char* remote_host_port,
+                           char* resource) {
+
+    refresh_t* refresh;
+    cached_header_t header;
+    int flag[HEADER_FLAG_NUM];
+    pthread_t tid;
+    int i;
 
+    if (__atomic_exchange_n(&object -> refreshing, 1, __ATOMIC_ACQ_REL)) {
+        return;
     }
+    // a down origin is not asked, the stale copy keeps being served
+    if (parse_cached_header(object, &header) == -1 ||
+        !breaker_allow(origin_breaker, remote_host_name, remote_host_port)) {
+        __atomic_store_n(&object -> refreshing, 0, __ATOMIC_RELEASE);
+        return;
+    }
+
+    refresh = (refresh_t *)Malloc(sizeof(refresh_t));
+    strcpy(refresh -> cache_id, cache_id);
+    strcpy(refresh -> host, remote_host_name);
+    strcpy(refresh -> port, remote_host_port);
+    strcpy(refresh -> resource, resource);
+    refresh -> validators[0] = '\0';
+    add_validators(&header, refresh -> validators);
+
+    // a request of our own, the client headers belong to its request
+    for (i = 0; i < HEADER_FLAG_NUM; i++) {
+        flag[i] = 0;
+    }
+    init_outvec(&refresh -> request);
+    outvec_add_str(&refresh -> request, "GET ");
+    outvec_add_str(&refresh -> request, refresh -> resource);
+    outvec_add_str(&refresh -> request, upstream_pool -> max_idle ?
+                   " HTTP/1.1\r\n" : " HTTP/1.0\r\n");
+    check_request_header(&refresh -> request, flag, refresh -> host, 1,
+                         upstream_pool -> max_idle);
+    outvec_add_str(&refresh -> request, refresh -> validators);
+    outvec_add(&refresh -> request, "\r\n", 2);
+
+    __atomic_add_fetch(&object -> refcnt, 1, __ATOMIC_RELAXED);
+    refresh -> object = object;
+
+    if (pthread_create(&tid, NULL, refresh_thread, refresh) != 0) {
+        // a later hit retries
+        __atomic_store_n(&object -> refreshing, 0, __ATOMIC_RELEASE);
+        release_cache_object(object);
+        Free(refresh);
+    }
+}
+
+/*
+ * refresh_thread - background revalidation routine; a 304 renews the
+ *                  object, a 200 replaces it in the cache
+ */
+void *refresh_thread(void *vargp) {
+
+    refresh_t* refresh = (refresh_t *)vargp;
+    int delimited = 0;
+
+    Pthread_detach(pthread_self());
+
+    if (request_from_server(-1, refresh -> host, refresh -> port,
+                            &refresh -> request, cache_list,
+                            refresh -> cache_id, NULL, FETCH_REVALIDATE,
+                            &delimited) == RESPONSE_NOT_MODIFIED) {
+        renew_object_freshness(refresh -> object);
+    }
+
+    __atomic_store_n(&refresh -> object -> refreshing, 0, __ATOMIC_RELEASE);
+    release_cache_object(refresh -> object);
+    Free(refresh);
+    return NULL;
 }
 
 /*
  * generate_response - helper function to generate response to the client
+ *                     and the followers of the flight,
  *                     and add the response to cache
- *                     return -1 on error
+ *                     *reusable is set if the body was delimited and
+ *                     the server keeps the connection open,
+ *                     *delimited if the client got a delimited body
+ *                     return RESPONSE_NOTHING if the server sent nothing,
+ *                     RESPONSE_NOT_MODIFIED if it confirmed the cached
+ *                     copy of a revalidation, -1 on other errors
  */
 static int generate_response(int clientfd, int serverfd,
-                             cache_list_t* list, char* cache_id) {
+                             cache_list_t* list, char* cache_id,
+                             flight_t* flight, int fetch, int* reusable,
+                             int* delimited) {
     rio_t rio;
-    char buf[MAXLINE];
-    char cache_content[MAX_OBJECT_SIZE];
-    unsigned int line_length = 0;
-    unsigned int curr_cache_length = 0;
-    // flag to check whether cache node size is within MAX_OBJECT_SIZE
-    int valid_cache_size = 1;
-    cache_node_t* node = NULL;
+    relay_t relay;
+    response_info_t info;
+    int rc;
 
 	dbg_printf("Enter generate_response.\n");
 
+    relay.clientfd = clientfd;
+    relay.client_alive = (clientfd >= 0);
+    relay.flight = flight;
+    relay.length = 0;
+    relay.fetch = fetch;
+    relay.pending_length = 0;
+    relay.requested = metrics_clock();
+    // the id carries the version of the clients the response is for
+    relay.dechunk = id_is_http10(cache_id);
+    // the response is filled into the cache as it is relayed
+    relay.fill = begin_cache_fill(cache_list, cache_id);
+    relay.encoder = NULL;
+
     // asscociate the serverfd with the read buffer
-    Rio_readinitb(&rio, serverfd);
+    rio_readinitb(&rio, serverfd);
+
+    rc = relay_response(&rio, &relay, &info);
+    // a response without a body still has its head waiting
+    relay_send(&relay, NULL, 0);
+    count_cache_miss_bytes(list, relay.length);
+    if (rc != 0 && rc != RESPONSE_NOT_MODIFIED) {
+        free_encoder(relay.encoder);
+        abort_cache_fill(relay.fill);
+        return rc;
+    }
+
+    // nothing may be left over for the next request on this connection
+    *reusable = info.keep_alive && rio.rio_cnt == 0;
+    *delimited = info.delimited && relay.client_alive;
+
+    // add cache to cache list, a fill over the size was dropped already;
+    // the answer to a conditional request is only cached if it is full
+    if (rc == 0 && relay.fill != NULL && relay.fill -> object != NULL &&
+        (fetch == FETCH_PLAIN || info.status == 200)) {
+        relay.fill = encode_cache_fill(relay.fill, relay.encoder);
+        if (relay.fill != NULL) {
+            set_object_freshness(relay.fill -> object, &info.fresh,
+                                 default_lifetime);
+            if (commit_cache_fill(list, relay.fill) == -1) {
+                printf("Add to cache error.\n");
+            }
+        }
+    } else {
+        free_encoder(relay.encoder);
+        abort_cache_fill(relay.fill);
+    }
+
+    return rc;
+}
+
+/*
+ * relay_response - relay the status line, the header and the body
+ *                  of the server response
+ *                  return RESPONSE_NOTHING if the server sent nothing,
+ *                  RESPONSE_NOT_MODIFIED if a revalidation got a 304,
+ *                  which does not reach the client, -1 on other errors
+ */
+static int relay_response(rio_t* rio, relay_t* relay, response_info_t* info) {
+
+    char buf[MAXLINE];
+    ssize_t line_length = 0;
+    int rc;
 
     // read the server response status line
-    if (Rio_readlineb(&rio, buf, MAXLINE) == -1) {
+    if (rio_readlineb(rio, buf, MAXLINE) <= 0) {
         // read response status error
         printf("rio_readline response status error.\n");
-        return -1;
+        return RESPONSE_NOTHING;
     }
+    metrics_record(METRIC_FIRST_BYTE, relay -> requested);
+    // from now on the server may only pause for the read timeout
+    set_read_timeout(rio -> rio_fd, read_timeout);
 	dbg_printf("response status: %s\n", buf);
-    Rio_writen(clientfd, buf, strlen(buf));
-
-    if (valid_cache_size && (curr_cache_length + strlen(buf)) < MAX_OBJECT_SIZE) {
-        memcpy(cache_content + curr_cache_length, buf, strlen(buf));
-        curr_cache_length += strlen(buf);
-    } else {
-        valid_cache_size = 0;
+    parse_response_status(buf, info);
+
+    // the cached copy is still valid, its header stays as it was
+    if (relay -> fetch == FETCH_REVALIDATE && info -> status == 304) {
+        do {
+            if (rio_readlineb(rio, buf, MAXLINE) <= 0) {
+                printf("rio_readline response header error.\n");
+                return -1;
+            }
+            parse_response_header(buf, info);
+        } while (strcmp(buf, "\r\n") != 0);
+        return RESPONSE_NOT_MODIFIED;
     }
+    relay_defer(relay, buf, strlen(buf));
 
     // read the server response header
-    if (Rio_readlineb(&rio, buf, MAXLINE) == -1) {
+    if (rio_readlineb(rio, buf, MAXLINE) <= 0) {
         printf("rio_readline response header error.\n");
         return -1;
     }
     while (strcmp(buf, "\r\n") != 0) {
 
         dbg_printf("response header: %s", buf);
-		// write a line of header to the clientfd
-		Rio_writen(clientfd, buf, strlen(buf));
-        // write a line of header to cache content if within the size
-        if (valid_cache_size && (curr_cache_length + strlen(buf)) < MAX_OBJECT_SIZE) {
-            memcpy(cache_content + curr_cache_length, buf, strlen(buf));
-            curr_cache_length += strlen(buf);
-        } else {
-            valid_cache_size = 0;
+		// write a line of header to the clientfd, hop-by-hop ones dropped;
+        // an HTTP/1.0 client does not know Transfer-Encoding
+        if (parse_response_header(buf, info) &&
+            !(relay -> dechunk &&
+              !strncasecmp(buf, "Transfer-Encoding:", 18))) {
+            relay_defer(relay, buf, strlen(buf));
         }
         // keep reading lines from the serverfd
-        if (Rio_readlineb(&rio, buf, MAXLINE) == -1) {
+        if (rio_readlineb(rio, buf, MAXLINE) <= 0) {
             printf("rio_readline response header error.\n");
             return -1;
         }
 
     }
+	relay_defer(relay, buf, strlen(buf));
 
-	Rio_writen(clientfd, buf, strlen(buf));
-    // write a line of header to cache content if within the size
-    if (valid_cache_size && (curr_cache_length + strlen(buf)) < MAX_OBJECT_SIZE) {
-        memcpy(cache_content + curr_cache_length, buf, strlen(buf));
-        curr_cache_length += strlen(buf);
-    } else {
-        valid_cache_size = 0;
+    // a response a shared cache must not keep is dropped before its body
+    if (relay -> fill != NULL && !response_storable(&info -> fresh)) {
+        abort_cache_fill(relay -> fill);
+        relay -> fill = NULL;
     }
-
-    // read the server response body
-    while ((line_length = Rio_readnb(&rio, buf, MAXLINE)) > 0) {
-        Rio_writen(clientfd, buf, line_length);
-        // write a line of response to cache content if within the size
-        if (valid_cache_size && (curr_cache_length + line_length) < MAX_OBJECT_SIZE) {
-            memcpy(cache_content + curr_cache_length, buf, line_length);
-            curr_cache_length += line_length;
-        } else {
-            valid_cache_size = 0;
+    // the body is encoded for the cache while it is relayed
+    relay -> encoder = begin_encoder(cache_list, relay -> fill,
+                                     compress_level);
+
+    // read the server response body, delimited as the header says
+    if ((info -> status >= 100 && info -> status < 200) ||
+        info -> status == 204 || info -> status == 304) {
+        rc = 0;
+    } else if (info -> chunked) {
+        // without the framing only the end of the connection delimits
+        // the body for the client, the server connection still persists
+        if (relay -> dechunk) {
+            info -> delimited = 0;
+        }
+        rc = relay_chunked_body(rio, relay);
+    } else if (can_splice_body(relay, info -> content_length)) {
+        rc = splice_body(rio, relay, info -> content_length);
+    } else if (info -> content_length >= 0) {
+        rc = relay_body(rio, relay, info -> content_length);
+    } else {
+        // only the end of the connection delimits the body
+        info -> keep_alive = 0;
+        info -> delimited = 0;
+        while ((line_length = rio_readnb(rio, buf, MAXLINE)) > 0) {
+            relay_to_client(relay, buf, line_length);
         }
+        rc = (line_length == -1) ? -1 : 0;
     }
-    if (line_length == -1) {
+    if (rc == -1) {
         printf("rio_readnb response body error.\n");
-        return -1;
     }
+    return rc;
+}
 
-    // add cache to cache list
-    if (valid_cache_size) {
-        node = create_cache_node(cache_id, cache_content, curr_cache_length, NULL);
-        if (node != NULL) {
-            if (add_cache_node_to_rear(list, node) == -1) {
-                printf("Add to cache error.\n");
-            }
+/*
+ * parse_response_status - get the status code and the default persistence
+ *                         of the connection from the status line
+ */
+static void parse_response_status(char* buf, response_info_t* info) {
+
+    int minor = 0;
+
+    info -> status = 0;
+    info -> content_length = -1;
+    info -> chunked = 0;
+    info -> delimited = 1;
+    init_freshness(&info -> fresh);
+    sscanf(buf, "HTTP/1.%d %d", &minor, &info -> status);
+    // HTTP/1.1 connections persist unless the server says close
+    info -> keep_alive = (minor >= 1);
+}
+
+/*
+ * parse_response_header - record how the body is delimited
+ *                         and whether the connection persists;
+ *                         connection headers only concern the server side
+ *                         and are dropped, so that cached responses fit
+ *                         any client connection
+ *                         return 0 if the line must not reach the client
+ */
+static int parse_response_header(char* buf, response_info_t* info) {
+
+    char* value = strchr(buf, ':');
+
+    if (value == NULL) {
+        return 1;
+    }
+    value++;
+    parse_freshness_header(buf, &info -> fresh);
+
+    if (!strncasecmp(buf, "Content-Length:", 15)) {
+        info -> content_length = strtol(value, NULL, 10);
+    } else if (!strncasecmp(buf, "Transfer-Encoding:", 18)) {
+        if (contains_token(value, "chunked")) {
+            info -> chunked = 1;
         }
+    } else if (!strncasecmp(buf, "Connection:", 11)) {
+        if (contains_token(value, "close")) {
+            info -> keep_alive = 0;
+        } else if (contains_token(value, "keep-alive")) {
+            info -> keep_alive = 1;
+        }
+        return 0;
+    } else if (!strncasecmp(buf, "Keep-Alive:", 11)) {
+        return 0;
     }
-
-    return 0;
+    return 1;
 }
 
 /*
- * generate_request_header - helper function to generate request header
- *                           return flag array indicating whether the field
- *                           is contained
+ * serve_cached_response - answer the request from the pinned cached
+ *                         object, in full or as a 304, 206 or 416 built
+ *                         from its header
+ *                         return 1 if the client can tell where it ends
  */
-static int* generate_request_header(char* buf, char* request_header, int* flag) {
-
-    if (strcmp(buf, "\r\n") == 0) {
-        return flag;
+static int serve_cached_response(int fd, request_cond_t* cond,
+                                 cache_object_t* object) {
+
+    cached_header_t header;
+    char head[MAXBUF];
+    size_t head_length = 0, offset = 0, length = object -> length;
+    int answer = ANSWER_FULL;
+
+    // a response without a complete header is sent as it is
+    if (parse_cached_header(object, &header) == 0) {
+        answer = answer_from_cache(cond, object, &header, head, &head_length,
+                                   &offset, &length);
     } else {
-        if (strstr(buf, "Host:") != NULL) {
-            strcat(request_header, buf);
-            flag[HOST] = 1;
-        } else if (strstr(buf, "User-Agent:") != NULL) {
-            strcat(request_header, user_agent_hdr);
-            flag[USER_AGENT] = 1;
-        } else if (strstr(buf, "Accept:") != NULL) {
-            strcat(request_header, accept_str);
-            flag[ACCEPT] = 1;
-        } else if (strstr(buf, "Accept-Encoding:") != NULL) {
-            strcat(request_header, accept_encoding_str);
-            flag[ACCEPT_ENCODING] = 1;
-        } else if (strstr(buf, "Connection:") != NULL) {
-            strcat(request_header, connection_str);
-            flag[CONNECTION] = 1;
-        } else if (strstr(buf, "Proxy-Connection:") != NULL) {
-            strcat(request_header, proxy_connection_str);
-            flag[PROXY_CONNECTION] = 1;
-        } else {
-            strcat(request_header, buf);
-        }
+        header.delimited = 0;
+    }
 
+    if ((answer == ANSWER_DECODED ?
+         write_decoded_response(fd, head, head_length, object, offset,
+                                length) :
+         write_cached_response(fd, head, head_length, object, offset,
+                               length)) == -1) {
+        printf("write cached response error.\n");
+        return 0;
     }
-    return flag;
+    return head_length > 0 || header.delimited;
 }
 
 /*
- * check_request_header - check to ensure that required information is all contained
- *                        in the request header
+ * write_cached_response - write the head and length bytes of a cached
+ *                         object from offset to the client, gathered
+ *                         into as few writev calls as the segments allow
+ *                         return -1 on error
  */
-static void check_request_header(char* request_header, int *flag, char* remote_host_name) {
+static int write_cached_response(int fd, char* head, size_t head_length,
+                                 cache_object_t* object, size_t offset,
+                                 size_t length) {
+
+    outvec_t out;
+    size_t added;
+
+    do {
+        init_outvec(&out);
+        outvec_add(&out, head, head_length);
+        added = outvec_add_object(&out, object, offset, length);
+        if (outvec_flush(fd, &out) == -1) {
+            return -1;
+        }
+        // the head only goes with the first round
+        head_length = 0;
+        offset += added;
+        length -= added;
+    } while (length > 0 && added > 0);
+
+    // the object ended before the range did
+    return (length > 0) ? -1 : 0;
+}
 
-    if (!flag[HOST]) {
-        strcat(request_header, "Host: ");
-        strcat(request_header, remote_host_name);
-        strcat(request_header, "\r\n");
-        flag[HOST] = 1;
+/*
+ * write_decoded_response - write head, then the length bytes of gzip body
+ *                          of the cached object from offset decoded; the
+ *                          head goes out with the first decoded buffer
+ *                          return -1 on error, the client then cannot
+ *                          tell where the body ended
+ */
+static int write_decoded_response(int fd, char* head, size_t head_length,
+                                  cache_object_t* object, size_t offset,
+                                  size_t length) {
+
+    gunzip_t gz;
+    outvec_t out;
+    char buf[MAXBUF];
+    ssize_t n;
+
+    if (init_gunzip(&gz, object, offset, length) == -1) {
+        return -1;
     }
-    if (!flag[USER_AGENT]) {
-        strcat(request_header, user_agent_hdr);
-        flag[USER_AGENT] = 1;
+    n = read_gunzip(&gz, buf, MAXBUF);
+    init_outvec(&out);
+    outvec_add(&out, head, head_length);
+    outvec_add(&out, buf, (n > 0) ? n : 0);
+    if (n == -1 || outvec_flush(fd, &out) == -1) {
+        free_gunzip(&gz);
+        return -1;
     }
-    if (!flag[ACCEPT]) {
-        strcat(request_header, accept_str);
-        flag[ACCEPT] = 1;
+
+    while ((n = read_gunzip(&gz, buf, MAXBUF)) > 0) {
+        if (rio_writen(fd, buf, n) == -1) {
+            break;
+        }
     }
-    if (!flag[ACCEPT_ENCODING]) {
-        strcat(request_header, accept_encoding_str);
-        flag[ACCEPT_ENCODING] = 1;
+    free_gunzip(&gz);
+    return (n == 0) ? 0 : -1;
+}
+
+/*
+ * contains_token - case-insensitive search of token in a header value
+ *                  return 1 if found
+ */
+int contains_token(char* value, char* token) {
+
+    size_t length = strlen(token);
+
+    for (; *value != '\0'; value++) {
+        if (!strncasecmp(value, token, length)) {
+            return 1;
+        }
     }
-    if (!flag[CONNECTION]) {
-        strcat(request_header, connection_str);
-        flag[CONNECTION] = 1;
+    return 0;
+}
+
+/*
+ * relay_body - relay exactly length bytes of the response body
+ *              return -1 on error
+ */
+static int relay_body(rio_t* rio, relay_t* relay, long length) {
+
+    char buf[MAXLINE];
+    ssize_t n;
+
+    while (length > 0) {
+        n = rio_readnb(rio, buf, (length < MAXLINE) ? length : MAXLINE);
+        if (n <= 0) {
+            return -1;
+        }
+        relay_to_client(relay, buf, n);
+        length -= n;
     }
-    if (!flag[PROXY_CONNECTION]) {
-        strcat(request_header, proxy_connection_str);
-        flag[PROXY_CONNECTION] = 1;
+    return 0;
+}
+
+/*
+ * can_splice_body - a body that is known to be too large for the cache
+ *                   and has nobody else waiting for it can bypass
+ *                   user space entirely
+ *                   return 1 if the body can be spliced
+ */
+static int can_splice_body(relay_t* relay, long length) {
+
+    // a body ending with the connection (-1) has no length to splice
+    if (length < 0 || (size_t)length < __atomic_load_n(
+            &cache_list -> max_object, __ATOMIC_RELAXED) ||
+        !relay -> client_alive) {
+        return 0;
+    }
+    // the followers of the flight read the bytes from user space
+    if (relay -> flight != NULL && !seal_flight(flight_table, relay -> flight)) {
+        return 0;
     }
 
+    // the object will never be cached, drop the fill now
+    abort_cache_fill(relay -> fill);
+    relay -> fill = NULL;
+    return 1;
 }
 
 /*
- * parse_uri - helper function to parse the fields in the request uri string
+ * splice_body - move exactly length bytes of the response body from the
+ *               server to the client through a pipe, without copying them
+ *               to user space; what rio already buffered is written first
+ *               return -1 on error
  */
-static void parse_uri(char *uri, char *host_name, char *host_port, char *protocol, char *resource) {
+static int splice_body(rio_t* rio, relay_t* relay, long length) {
 
-    char host_name_port[MAXLINE];
-    char *tmp;
-    // check whether the uri contains a protocal
-    if (strstr(uri, "://") != NULL) {
-		dbg_printf("Enter have a protocol\n");
-        // the uri contains a protocal
-        sscanf(uri, "%[^:]://%[^/]%s", protocol, host_name_port, resource);
-		dbg_printf("host_name_port: %s\n", host_name_port);
-    } else {
-        // the uri doesn't contain a protocal
-        sscanf(uri, "%[^/]%s", host_name_port, resource);
-		dbg_printf("host_name_port: %s\n", host_name_port);
-    }
-
-    // get the remote host name and remot host port
-    tmp = strstr(host_name_port, ":");
-    if (tmp != NULL) {
-		dbg_printf("Enter with a port.\n");
-        // if there is a host port, cut the str to "name" "port"
-        *tmp = '\0';
-        // get the host port
-        strcpy(host_port, tmp + 1);
-		dbg_printf("host_port_name with split: %s", tmp);
-    } else {
-        // if there is no host port, set it as default 80
-        strcpy(host_port, "80");
+    char buf[MAXLINE];
+    ssize_t n;
+
+    // the body bytes read ahead together with the header
+    while (rio -> rio_cnt > 0 && length > 0) {
+        n = rio_readnb(rio, buf, (length < MAXLINE) ? length : MAXLINE);
+        if (n <= 0) {
+            return -1;
+        }
+        if (relay_to_client(relay, buf, n) == -1) {
+            return -1;
+        }
+        length -= n;
+    }
+
+    if (length == 0) {
+        return 0;
+    }
+
+    // the rest goes from the server socket to the client socket directly,
+    // after the head if no body byte carried it yet
+    if (relay_send(relay, NULL, 0) == -1) {
+        return -1;
+    }
+    relay -> length += length;
+    switch (splice_relay(rio -> rio_fd, relay -> clientfd, length)) {
+    case 0:
+        return 0;
+    case SPLICE_NO_PIPE:
+        // no pipe left, fall back to copying
+        return relay_body(rio, relay, length);
+    case SPLICE_TO_ERROR:
+        printf("write response error.\n");
+        relay -> client_alive = 0;
+        return -1;
+    default:
+        printf("splice response body error.\n");
+        return -1;
+    }
+}
+
+/*
+ * relay_chunked_body - relay a chunked response body as it is,
+ *                      up to the last chunk and its trailers, or only
+ *                      the chunk data for HTTP/1.0 receivers
+ *                      return -1 on error
+ */
+static int relay_chunked_body(rio_t* rio, relay_t* relay) {
+
+    char buf[MAXLINE];
+    ssize_t n;
+    long chunk_size;
+
+    while (1) {
+        // chunk size line
+        if ((n = rio_readlineb(rio, buf, MAXLINE)) <= 0) {
+            return -1;
+        }
+        if (!relay -> dechunk) {
+            relay_defer(relay, buf, n);
+        }
+        if ((chunk_size = strtol(buf, NULL, 16)) <= 0) {
+            break;
+        }
+        // chunk data and its CRLF
+        if (!relay -> dechunk) {
+            if (relay_body(rio, relay, chunk_size + 2) == -1) {
+                return -1;
+            }
+        } else if (relay_body(rio, relay, chunk_size) == -1 ||
+                   rio_readnb(rio, buf, 2) != 2) {
+            return -1;
+        }
+    }
+
+    // trailers up to the empty line
+    do {
+        if ((n = rio_readlineb(rio, buf, MAXLINE)) <= 0) {
+            return -1;
+        }
+        if (!relay -> dechunk) {
+            relay_defer(relay, buf, n);
+        }
+    } while (strcmp(buf, "\r\n") != 0);
+
+    return 0;
+}
+
+/*
+ * id_is_http10 - check whether a cache id is the one of HTTP/1.0 requests,
+ *                its last word is the version of the client request
+ */
+static int id_is_http10(char* cache_id) {
+
+    size_t length = strlen(cache_id);
+
+    return length >= 9 && !strcmp(cache_id + length - 9, " HTTP/1.0");
+}
+
+/*
+ * relay_to_client - write a chunk of the response to the client,
+ *                   publish it to the followers of the flight
+ *                   and keep a copy for the cache while it fits;
+ *                   a failed client write is remembered and not retried
+ *                   return -1 if the client is gone
+ */
+static int relay_to_client(relay_t* relay, char* buf, size_t length) {
+
+    relay -> length += length;
+
+    if (relay -> flight != NULL) {
+        publish_flight(relay -> flight, buf, length);
+    }
+
+    relay_send(relay, buf, length);
+
+    // append a chunk of response to the cache fill if within the size
+    if (relay -> fill != NULL) {
+        append_cache_fill(relay -> fill, buf, length);
+        run_encoder(relay -> encoder, relay -> fill);
+    }
+
+    return relay -> client_alive ? 0 : -1;
+}
+
+/*
+ * relay_defer - relay a short piece of the response like relay_to_client,
+ *               but keep it for the client until the next write, so that
+ *               the status line, the header lines and the first body
+ *               bytes go out together
+ */
+static void relay_defer(relay_t* relay, char* buf, size_t length) {
+
+    relay -> length += length;
+
+    if (relay -> flight != NULL) {
+        publish_flight(relay -> flight, buf, length);
+    }
+
+    if (relay -> pending_length + length > sizeof(relay -> pending)) {
+        relay_send(relay, NULL, 0);
+    }
+    if (length > sizeof(relay -> pending)) {
+        relay_send(relay, buf, length);
+    } else if (relay -> client_alive) {
+        memcpy(relay -> pending + relay -> pending_length, buf, length);
+        relay -> pending_length += length;
+    }
+
+    if (relay -> fill != NULL) {
+        append_cache_fill(relay -> fill, buf, length);
+        run_encoder(relay -> encoder, relay -> fill);
+    }
+}
+
+/*
+ * relay_send - write the pending bytes followed by length bytes of buf
+ *              to the client with one writev
+ *              return -1 if the client is gone
+ */
+static int relay_send(relay_t* relay, char* buf, size_t length) {
+
+    outvec_t out;
+
+    if (relay -> client_alive) {
+        init_outvec(&out);
+        outvec_add(&out, relay -> pending, relay -> pending_length);
+        outvec_add(&out, buf, length);
+        if (outvec_flush(relay -> clientfd, &out) == -1) {
+            printf("write response error.\n");
+            relay -> client_alive = 0;
+        }
     }
-    // set the host name
-    strcpy(host_name, host_name_port);
+    relay -> pending_length = 0;
 
+    return relay -> client_alive ? 0 : -1;
+}
+
+/*
+ * follow_flight - stream the response of a fetch led by another request
+ *                 return -1 on error
+ */
+static int follow_flight(int clientfd, flight_t* flight,
+                         flight_reader_t* reader) {
+
+    char buf[MAXLINE];
+    ssize_t n;
+
+    while ((n = read_flight(flight, reader, buf, MAXLINE)) > 0) {
+        if (rio_writen(clientfd, buf, n) == -1) {
+            printf("write response error.\n");
+            count_cache_miss_bytes(cache_list, reader -> offset);
+            return -1;
+        }
+    }
+    count_cache_miss_bytes(cache_list, reader -> offset);
+
+    // the leader failed before sending anything, answer like it would
+    if (n == -1 && reader -> offset == 0) {
+        rio_writen(clientfd, invalid_request_response_str,
+                   strlen(invalid_request_response_str));
+    }
+
+    return (int)n;
+}
+
+/*
+ * serve_origin_down - answer a request to an origin marked down with the
+ *                     stale cached object if there is one, else a 504
+ *                     return 1 if the connection can carry another request
+ */
+static int serve_origin_down(int fd, request_cond_t* cond,
+                             cache_object_t* object, int keep_alive) {
+
+    metrics_count(COUNT_FAIL_FAST, 1);
+    if (object != NULL) {
+        metrics_count(COUNT_HITS, 1);
+        return serve_cached_response(fd, cond, object) && keep_alive;
+    }
+    metrics_count(COUNT_ERRORS, 1);
+    rio_writen(fd, gateway_timeout_response_str,
+               strlen(gateway_timeout_response_str));
+    return 0;
+}
+
+/*
+ * set_read_timeout - make a read on fd fail with EAGAIN after seconds
+ *                    without data, 0 waits forever
+ */
+static void set_read_timeout(int fd, int seconds) {
+
+    struct timeval timeout;
+
+    timeout.tv_sec = seconds;
+    timeout.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+}
+
+/*
+ * server_timed_out - check whether a failed response ran into a read
+ *                    timeout: the server neither sent anything nor
+ *                    closed the connection
+ */
+static int server_timed_out(int serverfd) {
+
+    struct pollfd pfd;
+
+    pfd.fd = serverfd;
+    pfd.events = POLLIN;
+    return poll(&pfd, 1, 0) == 0;
+}
+
+/*
+ * generate_request_header - helper function to generate request header,
+ *                           asking the server to keep the connection
+ *                           open if keep_alive is set; the header is
+ *                           added to the request in place, the replaced
+ *                           ones as constant strings
+ *                           flag records whether the field is contained
+ */
+void generate_request_header(http_header_t* header, outvec_t* request,
+                             int* flag, int keep_alive) {
+
+    switch (header -> id) {
+    case HDR_HOST:
+        outvec_add_header(request, header);
+        flag[HOST] = 1;
+        break;
+    case HDR_USER_AGENT:
+        outvec_add_str(request, user_agent_hdr);
+        flag[USER_AGENT] = 1;
+        break;
+    case HDR_ACCEPT:
+        outvec_add_str(request, accept_str);
+        flag[ACCEPT] = 1;
+        break;
+    case HDR_ACCEPT_ENCODING:
+        // replaced by the one check_request_header adds
+        break;
+    case HDR_PROXY_CONNECTION:
+        outvec_add_str(request, keep_alive ?
+                       keep_alive_proxy_connection_str : proxy_connection_str);
+        flag[PROXY_CONNECTION] = 1;
+        break;
+    case HDR_CONNECTION:
+        outvec_add_str(request, keep_alive ?
+                       keep_alive_connection_str : connection_str);
+        flag[CONNECTION] = 1;
+        break;
+    case HDR_KEEP_ALIVE:
+        // hop-by-hop, the proxy decides the upstream persistence
+        break;
+    default:
+        outvec_add_header(request, header);
+    }
+}
+
+/*
+ * check_request_header - check to ensure that required information is all contained
+ *                        in the request header; the server is asked for
+ *                        gzip if accept_gzip is set, else for identity
+ */
+void check_request_header(outvec_t* request, int *flag,
+                          char* remote_host_name, int accept_gzip,
+                          int keep_alive) {
+
+    if (!flag[HOST]) {
+        outvec_add(request, "Host: ", 6);
+        outvec_add_str(request, remote_host_name);
+        outvec_add(request, "\r\n", 2);
+        flag[HOST] = 1;
+    }
+    if (!flag[USER_AGENT]) {
+        outvec_add_str(request, user_agent_hdr);
+        flag[USER_AGENT] = 1;
+    }
+    if (!flag[ACCEPT]) {
+        outvec_add_str(request, accept_str);
+        flag[ACCEPT] = 1;
+    }
+    if (!flag[ACCEPT_ENCODING]) {
+        outvec_add_str(request, accept_gzip ?
+                       accept_gzip_str : accept_identity_str);
+        flag[ACCEPT_ENCODING] = 1;
+    }
+    if (!flag[CONNECTION]) {
+        outvec_add_str(request, keep_alive ?
+                       keep_alive_connection_str : connection_str);
+        flag[CONNECTION] = 1;
+    }
+    if (!flag[PROXY_CONNECTION]) {
+        outvec_add_str(request, keep_alive ?
+                       keep_alive_proxy_connection_str : proxy_connection_str);
+        flag[PROXY_CONNECTION] = 1;
+    }
 }
 
 /*
@@ -584,3 +1860,485 @@ static int isValidPort(char *port) {
 
     return flag;
 }
+
+/*
+ * control_signals - the signals only the control thread takes
+ */
+static void control_signals(sigset_t* mask) {
+
+    sigemptyset(mask);
+    sigaddset(mask, SIGUSR1);
+    sigaddset(mask, SIGHUP);
+    sigaddset(mask, SIGUSR2);
+    sigaddset(mask, SIGCHLD);
+    sigaddset(mask, SIGQUIT);
+}
+
+/*
+ * reload_options - read the configuration file and the command line again
+ *                  and apply the settings that can change at runtime, a
+ *                  change of the others is reported and waits for an
+ *                  upgrade; nothing changes if a setting is illegal
+ */
+static void reload_options() {
+
+    proxy_options_t options;
+    proxy_options_t* current = &proxy_options;
+    char* str;
+
+    if (load_options(proxy_argc, proxy_argv, &options) == -1) {
+        printf("Reload failed, the settings stay unchanged.\n");
+        free_options(&options);
+        return;
+    }
+
+    // the cached objects stay, an illegal size or policy is skipped
+    if ((options.cache_size != current -> cache_size ||
+         options.object_size != current -> object_size) &&
+        resize_cache_list(cache_list, options.cache_size,
+                          options.object_size) == 0) {
+        current -> cache_size = options.cache_size;
+        current -> object_size = options.object_size;
+    }
+    if (set_cache_policy(cache_list, options.policy) == 0) {
+        str = current -> policy;
+        current -> policy = options.policy;
+        options.policy = str;
+    }
+
+    current -> reject_when_full = options.reject_when_full;
+    current -> warm_upgrade = options.warm_upgrade;
+    current -> max_idle = options.max_idle;
+    __atomic_store_n(&upstream_pool -> max_idle, options.max_idle,
+                     __ATOMIC_RELAXED);
+    current -> max_open = options.max_open;
+    __atomic_store_n(&upstream_pool -> max_open, options.max_open,
+                     __ATOMIC_RELAXED);
+    current -> client_idle_timeout = options.client_idle_timeout;
+    client_idle_timeout = options.client_idle_timeout;
+    current -> default_lifetime = options.default_lifetime;
+    default_lifetime = options.default_lifetime;
+    current -> connect_timeout = options.connect_timeout;
+    connect_timeout = options.connect_timeout;
+    current -> first_byte_timeout = options.first_byte_timeout;
+    first_byte_timeout = options.first_byte_timeout;
+    current -> read_timeout = options.read_timeout;
+    read_timeout = options.read_timeout;
+    current -> breaker_failures = options.breaker_failures;
+    __atomic_store_n(&origin_breaker -> max_failures,
+                     options.breaker_failures, __ATOMIC_RELAXED);
+    current -> breaker_cooldown = options.breaker_cooldown;
+    __atomic_store_n(&origin_breaker -> cooldown, options.breaker_cooldown,
+                     __ATOMIC_RELAXED);
+    current -> compress_level = options.compress_level;
+    compress_level = options.compress_level;
+    if (!strcmp(current -> mode, "pool") &&
+        options.thread_num != current -> thread_num) {
+        current -> thread_num = options.thread_num;
+        resize_worker_pool(options.thread_num);
+    }
+
+    report_restart("mode", strcmp(options.mode, current -> mode));
+    report_restart("threads", strcmp(current -> mode, "pool") &&
+                              strcmp(current -> mode, "thread") &&
+                              options.thread_num != current -> thread_num);
+    report_restart("queue-depth",
+                   options.queue_depth != current -> queue_depth);
+    report_restart("dns-ttl", options.dns_ttl != current -> dns_ttl);
+    report_restart("disk-file",
+                   !same_string(options.disk_path, current -> disk_path));
+    report_restart("disk-size", options.disk_size != current -> disk_size);
+
+    free_options(&options);
+    printf("Settings reloaded.\n");
+}
+
+/*
+ * report_restart - tell that a setting which only takes effect at startup
+ *                  changed
+ */
+static void report_restart(char* name, int changed) {
+
+    if (changed) {
+        printf("Setting %s changes on the next upgrade (SIGUSR2).\n", name);
+    }
+}
+
+/*
+ * resize_worker_pool - start workers until wanted run in pool mode,
+ *                      the extra ones exit after their current connection
+ */
+static void resize_worker_pool(int wanted) {
+
+    pthread_t tid;
+
+    __atomic_store_n(&worker_target, wanted, __ATOMIC_RELAXED);
+    while (__atomic_load_n(&worker_num, __ATOMIC_RELAXED) < wanted) {
+        __atomic_add_fetch(&worker_num, 1, __ATOMIC_RELAXED);
+        Pthread_create(&tid, NULL, worker, NULL);
+    }
+}
+
+/*
+ * retire_worker - count the calling worker out if the pool has more
+ *                 workers than wanted
+ *                 return 1 if the worker must exit
+ */
+static int retire_worker() {
+
+    int num = __atomic_load_n(&worker_num, __ATOMIC_RELAXED);
+
+    while (num > __atomic_load_n(&worker_target, __ATOMIC_RELAXED)) {
+        if (__atomic_compare_exchange_n(&worker_num, &num, num - 1, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * start_upgrade - start the proxy binary again on the listening socket,
+ *                 with a snapshot of the cache if warm-upgrade is set;
+ *                 the new process makes this one drain once it accepts
+ */
+static void start_upgrade() {
+
+    if (upgrade_pid > 0 || is_draining()) {
+        printf("An upgrade is already in progress.\n");
+        return;
+    }
+
+    if (proxy_options.warm_upgrade) {
+        upgrade_snapshot = save_cache_snapshot(cache_list);
+    }
+    if ((upgrade_pid = spawn_upgrade(proxy_argv, listen_fds, listen_num,
+                                     upgrade_snapshot)) == -1) {
+        upgrade_pid = 0;
+        reap_upgrade();
+        return;
+    }
+    printf("Upgrade process %d started.\n", (int)upgrade_pid);
+}
+
+/*
+ * reap_upgrade - collect an upgrade process that exited before it took
+ *                over, this process keeps serving; its snapshot is removed
+ */
+static void reap_upgrade() {
+
+    pid_t pid;
+    int status;
+
+    while (upgrade_pid > 0 &&
+           (pid = waitpid(upgrade_pid, &status, WNOHANG)) > 0) {
+        if (WIFEXITED(status)) {
+            printf("Upgrade process %d exited with status %d.\n", (int)pid,
+                   WEXITSTATUS(status));
+        } else {
+            printf("Upgrade process %d killed by signal %d.\n", (int)pid,
+                   WTERMSIG(status));
+        }
+        upgrade_pid = 0;
+    }
+
+    if (upgrade_pid == 0 && upgrade_snapshot != NULL) {
+        unlink(upgrade_snapshot);
+        Free(upgrade_snapshot);
+        upgrade_snapshot = NULL;
+    }
+}
+
+/*
+ * open_connections - client connections accepted and not closed yet
+ */
+static long open_connections() {
+
+    // closed first, so a connection closed in between is not missed
+    unsigned long closed = metrics_total(COUNT_CONN_CLOSED);
+
+    return (long)(metrics_total(COUNT_CONN_OPENED) - closed);
+}
+
+/*
+ * drain_and_exit - stop accepting, then exit once every open connection
+ *                  is served or after UPGRADE_DRAIN_TIMEOUT seconds
+ */
+static void drain_and_exit() {
+
+    long waited;
+
+    start_draining();
+    printf("Draining %ld connections.\n", open_connections());
+    fflush(stdout);
+
+    for (waited = 0; waited < UPGRADE_DRAIN_TIMEOUT * 1000L &&
+                     open_connections() > 0; waited += UPGRADE_DRAIN_POLL) {
+        usleep(UPGRADE_DRAIN_POLL * 1000);
+    }
+
+    printf("Drained, %ld connections left.\n", open_connections());
+    fflush(stdout);
+    exit(0);
+}
+
+/*
+ * load_options - the defaults, overridden by the configuration file given
+ *                with -c, overridden by the command line
+ *                return -1 if an option is unknown or illegal
+ */
+static int load_options(int argc, char** argv, proxy_options_t* options) {
+
+    int opt;
+
+    *options = default_options;
+    optind = 1;
+    while ((opt = getopt(argc, argv, PROXY_OPTSTRING)) != -1) {
+        if (opt == '?') {
+            return -1;
+        }
+        if (opt == 'c' &&
+            read_config_file(optarg, config_keys, apply_option,
+                             options) == -1) {
+            return -1;
+        }
+    }
+    optind = 1;
+    while ((opt = getopt(argc, argv, PROXY_OPTSTRING)) != -1) {
+        if (opt != 'c' && apply_option(options, opt, optarg) == -1) {
+            return -1;
+        }
+    }
+
+    if (!strcmp(options -> mode, "pool") && options -> thread_num < 1) {
+        options -> thread_num = DEFAULT_WORKER_NUM;
+    }
+    // a listener per cpu by default
+    if (!strcmp(options -> mode, "reuseport")) {
+        if (options -> thread_num < 1) {
+            options -> thread_num = cpu_count();
+        }
+        if (options -> thread_num > UPGRADE_MAX_LISTEN) {
+            options -> thread_num = UPGRADE_MAX_LISTEN;
+        }
+    }
+    return 0;
+}
+
+/*
+ * free_options - free the strings copied by apply_option
+ */
+static void free_options(proxy_options_t* options) {
+
+    if (options -> mode != default_options.mode) {
+        Free(options -> mode);
+    }
+    Free(options -> policy);
+    Free(options -> disk_path);
+}
+
+/*
+ * apply_option - set the option opt of the proxy_options_t at arg to
+ *                value, taken from the command line or the configuration
+ *                file; string values are copied
+ *                return -1 if the value is illegal
+ */
+static int apply_option(void* arg, int opt, char* value) {
+
+    proxy_options_t* options = (proxy_options_t *)arg;
+    size_t size;
+
+    switch (opt) {
+    case 'B':
+        options -> breaker_failures = atoi(value);
+        return (options -> breaker_failures < 0) ? -1 : 0;
+    case 'b':
+        options -> breaker_cooldown = atoi(value);
+        return (options -> breaker_cooldown < 1) ? -1 : 0;
+    case 'C':
+        if (parse_size(value, &size) == -1 || size < CACHE_SLAB_PAGE_SIZE) {
+            return -1;
+        }
+        options -> cache_size = size;
+        break;
+    case 'D':
+        Free(options -> disk_path);
+        options -> disk_path = strdup(value);
+        break;
+    case 'd':
+        options -> dns_ttl = atoi(value);
+        return (options -> dns_ttl < 0) ? -1 : 0;
+    case 'F':
+        options -> first_byte_timeout = atoi(value);
+        return (options -> first_byte_timeout < 0) ? -1 : 0;
+    case 'f':
+        options -> default_lifetime = atoi(value);
+        return (options -> default_lifetime < 0) ? -1 : 0;
+    case 'I':
+        options -> read_timeout = atoi(value);
+        return (options -> read_timeout < 0) ? -1 : 0;
+    case 'k':
+        options -> client_idle_timeout = atoi(value);
+        return (options -> client_idle_timeout < 0) ? -1 : 0;
+    case 'm':
+        if (strcmp(value, "thread") && strcmp(value, "pool") &&
+            strcmp(value, "event") && strcmp(value, "reuseport")) {
+            return -1;
+        }
+        if (options -> mode != default_options.mode) {
+            Free(options -> mode);
+        }
+        options -> mode = strdup(value);
+        break;
+    case 'n':
+        options -> thread_num = atoi(value);
+        break;
+    case 'O':
+        if (parse_size(value, &size) == -1 || size == 0) {
+            return -1;
+        }
+        options -> object_size = size;
+        break;
+    case 'p':
+        Free(options -> policy);
+        options -> policy = strdup(value);
+        break;
+    case 'q':
+        options -> queue_depth = atoi(value);
+        return (options -> queue_depth < 1) ? -1 : 0;
+    case 'r':
+        return parse_flag(value, &options -> reject_when_full);
+    case 'S':
+        options -> disk_size = atoi(value);
+        return (options -> disk_size < 1) ? -1 : 0;
+    case 'T':
+        options -> connect_timeout = atoi(value);
+        return (options -> connect_timeout < 0) ? -1 : 0;
+    case 'U':
+        options -> max_open = atoi(value);
+        return (options -> max_open < 0) ? -1 : 0;
+    case 'u':
+        options -> max_idle = atoi(value);
+        return (options -> max_idle < 0) ? -1 : 0;
+    case 'w':
+        return parse_flag(value, &options -> warm_upgrade);
+    case 'Z':
+        options -> compress_level = atoi(value);
+        return (options -> compress_level < 0 ||
+                options -> compress_level > 9) ? -1 : 0;
+    default:
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * parse_flag - a flag is set on the command line, yes or no in the file
+ *              return -1 if value is neither
+ */
+static int parse_flag(char* value, int* flag) {
+
+    if (value != NULL && strcmp(value, "yes") && strcmp(value, "no")) {
+        return -1;
+    }
+    *flag = (value == NULL || !strcmp(value, "yes"));
+    return 0;
+}
+
+/*
+ * same_string - compare two settings that may be unset
+ */
+static int same_string(char* a, char* b) {
+
+    return (a == NULL || b == NULL) ? a == b : !strcmp(a, b);
+}
+
+/*
+ * usage - print the command line usage and exit
+ */
+static void usage(char *prog) {
+
+    printf("usage: %s [-m thread|pool|event|reuseport] [-n threads] [-q depth] [-r] "
+           "[-u idle] [-U conns] [-k secs] [-d ttl]\n"
+           "       [-p lru|tinylfu|gdsf] [-C size] [-O size] [-D file] "
+           "[-S megabytes]\n"
+           "       [-f secs] [-T secs] [-F secs] [-I secs] [-B failures] "
+           "[-b secs] [-w] [-Z level]\n"
+           "       [-c file] <port>\n",
+           prog);
+    printf("  -m  serving mode: thread per connection (default),\n");
+    printf("      prethreaded worker pool, edge-triggered epoll loops or\n");
+    printf("      epoll loops with a SO_REUSEPORT listener each, pinned\n");
+    printf("      to a cpu\n");
+    printf("  -n  pool workers (default %d), epoll loops (default 1) or\n",
+           DEFAULT_WORKER_NUM);
+    printf("      reuseport listeners (default one per cpu, at most %d)\n",
+           UPGRADE_MAX_LISTEN);
+    printf("  -q  connection queue depth in pool mode (default %d)\n",
+           DEFAULT_QUEUE_DEPTH);
+    printf("  -r  answer 503 when the queue is full instead of "
+           "pausing accept\n");
+    printf("  -u  idle server connections kept per host (default %d),\n",
+           UPSTREAM_MAX_IDLE);
+    printf("      0 closes every server connection after its response\n");
+    printf("  -U  server connections open per host, idle or in use\n");
+    printf("      (default %d), a request waits for one at most the\n",
+           UPSTREAM_MAX_OPEN);
+    printf("      connect timeout, then gets a 504; 0 does not limit them\n");
+    printf("  -k  seconds a quiet client connection is kept (default %d),\n",
+           DEFAULT_CLIENT_IDLE_TIMEOUT);
+    printf("      0 serves one request per client connection\n");
+    printf("  -d  seconds a resolved server address is cached "
+           "(default %d),\n", DNS_DEFAULT_TTL);
+    printf("      0 resolves the server on every connect\n");
+    printf("  -p  cache replacement policy (default lru),\n");
+    printf("      kill -USR1 prints its hit ratio and byte hit ratio\n");
+    printf("      and GET http://%s%s reports the request statistics\n",
+           METRICS_HOST, METRICS_PATH);
+    printf("  -C  bytes of the cache in memory, with a K, M or G suffix\n");
+    printf("      (default %d)\n", DEFAULT_CACHE_SIZE);
+    printf("  -O  largest object cached (default %d), at most an eighth\n",
+           DEFAULT_OBJECT_SIZE);
+    printf("      of the cache\n");
+    printf("  -f  seconds a response without Cache-Control or Expires "
+           "stays fresh\n      (default %d)\n", FRESH_DEFAULT_LIFETIME);
+    printf("  -D  file of the on-disk second tier of the cache, kept\n");
+    printf("      across restarts (default none)\n");
+    printf("  -S  size of the on-disk tier in megabytes (default %d)\n",
+           DISK_DEFAULT_SIZE);
+    printf("  -T  seconds a connect to a server may take (default %d),\n",
+           DEFAULT_CONNECT_TIMEOUT);
+    printf("      0 waits as long as the system\n");
+    printf("  -F  seconds from the request to the first byte of the\n");
+    printf("      response (default %d), then a 504; 0 waits forever\n",
+           DEFAULT_FIRST_BYTE_TIMEOUT);
+    printf("  -I  seconds the server may pause within a response "
+           "(default %d)\n", DEFAULT_READ_TIMEOUT);
+    printf("  -B  failures in a row that mark a server down (default %d),\n",
+           BREAKER_DEFAULT_FAILURES);
+    printf("      its requests then get the stale copy or a 504 at once;\n");
+    printf("      0 never marks a server down\n");
+    printf("  -b  seconds before a server marked down is probed again\n");
+    printf("      (default %d)\n", BREAKER_DEFAULT_COOLDOWN);
+    printf("  -Z  zlib level text responses are cached with (default %d),\n",
+           ENCODING_DEFAULT_LEVEL);
+    printf("      decoded for the clients without gzip; 0 caches them as\n");
+    printf("      received\n");
+    printf("  -c  configuration file of \"name value\" lines, named after\n");
+    printf("      the options above (e.g. \"cache-size 2G\"), the command\n");
+    printf("      line overrides it\n");
+    printf("  -w  hand the cached objects over to the process started by\n");
+    printf("      an upgrade, through a snapshot in %s\n",
+           UPGRADE_SNAPSHOT_DIR);
+    printf("signals:\n");
+    printf("  HUP   read the configuration file again; the cache, the\n");
+    printf("        timeouts, -r, -u, -U, -w, -B, -b, -Z and the pool\n");
+    printf("        workers change at once, the other settings on the next\n");
+    printf("        upgrade\n");
+    printf("  USR2  start the binary again on the same listening socket,\n");
+    printf("        the new process makes this one drain once it accepts\n");
+    printf("  QUIT  stop accepting and exit once the open connections\n");
+    printf("        are served (at most %d seconds)\n",
+           UPGRADE_DRAIN_TIMEOUT);
+    exit(0);
+}
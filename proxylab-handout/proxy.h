@@ -0,0 +1,59 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * proxy.h - request helpers and shared state exported by proxy.c
+ *           so that the alternative serving modes can reuse them
+ */
+#ifndef __PROXY_H__
+#define __PROXY_H__
+
+#include "csapp.h"
+#include "cache.h"
+#include "httpparse.h"
+#include "outvec.h"
+#include "breaker.h"
+
+/*
+ * Defined indices for identify flags in the flag array
+ * to check wether the request header contains the corresponding fields
+ */
+#define HOST             0
+#define USER_AGENT       1
+#define ACCEPT           2
+#define ACCEPT_ENCODING  3
+#define CONNECTION       4
+#define PROXY_CONNECTION 5
+#define HEADER_FLAG_NUM  6
+
+/* Shared variables for constructing bad request */
+extern char *method_error_str;
+extern char *uri_error_str;
+extern char *invalid_request_response_str;
+
+/* cache for the proxy */
+extern cache_list_t* cache_list;
+
+/* seconds a response without Cache-Control or Expires stays fresh */
+extern int default_lifetime;
+
+/* upstream timeouts in seconds, origins marked down and the 504 they get */
+extern int connect_timeout;
+extern int first_byte_timeout;
+extern int read_timeout;
+extern breaker_t* origin_breaker;
+extern char *gateway_timeout_response_str;
+
+/* zlib level the text responses are cached with, 0 caches them as received */
+extern int compress_level;
+
+/* Request helpers shared by the threaded and event-driven modes */
+void generate_request_header(http_header_t* header, outvec_t* request,
+         int* flag, int keep_alive);
+void check_request_header(outvec_t* request, int *flag,
+         char* remote_host_name, int accept_gzip, int keep_alive);
+int contains_token(char* value, char* token);
+void refresh_cached_object(cache_object_t* object, char* cache_id,
+         char* remote_host_name, char* remote_host_port, char* resource);
+
+#endif /* __PROXY_H__ */
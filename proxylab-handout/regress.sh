@@ -0,0 +1,192 @@
+#!/bin/bash
+#
+# regress.sh - regression checks of the response framing the autograder
+#     does not cover, in every serving mode: bodies from framing-server.py
+#     are fetched through the proxy, on a miss and on a hit, by HTTP/1.1
+#     and HTTP/1.0 clients, and compared with what the origin sent;
+#     the caching checks also count the requests that reached the origin
+#
+#     usage: ./regress.sh
+#
+
+MODES="thread pool event reuseport"
+TIMEOUT=5
+
+# Small objects are cached, large ones go past the -O limit of the proxy
+OBJECT_SIZE=20000
+
+#
+# wait_for_port - spins until something listens on the TCP port passed
+#     as an argument, gives up after 5 seconds
+#
+function wait_for_port {
+    for i in `seq 50`
+    do
+        netstat --numeric-ports --numeric-hosts -l --protocol=tcpip \
+            | grep -q ":${1} " && return 0
+        sleep 0.1
+    done
+    echo "Error: nothing listens on port $1."
+    return 1
+}
+
+#
+# check_body - fetch a path of the origin through the proxy and compare
+#     the body with the expected length
+#     usage: check_body <name> <curl version flag> <path> <length>
+#
+function check_body {
+    got=`curl --max-time ${TIMEOUT} --silent $2 \
+        --proxy http://localhost:${proxy_port} \
+        http://localhost:${origin_port}$3 | wc -c`
+    if [ "${got}" -eq "$4" ]
+    then
+        echo "${mode}: $1: ok"
+    else
+        echo "${mode}: $1: FAILED, ${got} of $4 bytes"
+        failed=$((failed + 1))
+    fi
+}
+
+#
+# check_response - fetch a path of the origin through the proxy and
+#     compare the status and the body length with the expected ones,
+#     the body is left in ${body_file}
+#     usage: check_response <name> <path> <status> <length> [curl args]
+#
+function check_response {
+    name=$1
+    path=$2
+    status=$3
+    length=$4
+    shift 4
+    got_status=`curl --max-time ${TIMEOUT} --silent --output ${body_file} \
+        --write-out "%{http_code}" "$@" \
+        --proxy http://localhost:${proxy_port} \
+        http://localhost:${origin_port}${path}`
+    got=`wc -c < ${body_file}`
+    if [ "${got_status}" = "${status}" ] && [ "${got}" -eq "${length}" ]
+    then
+        echo "${mode}: ${name}: ok"
+    else
+        echo "${mode}: ${name}: FAILED, ${got_status} with ${got} bytes," \
+            "expected ${status} with ${length}"
+        failed=$((failed + 1))
+    fi
+}
+
+#
+# check_content - compare ${body_file} with the bytes the origin sends
+#     from an offset of its bodies
+#     usage: check_content <name> <offset> <length>
+#
+function check_content {
+    expected=`printf "0123456789abcdef%.0s" $(seq $((($2 + $3) / 16 + 1))) \
+        | tail -c +$(($2 + 1)) | head -c $3`
+    if [ "`cat ${body_file}`" = "${expected}" ]
+    then
+        echo "${mode}: $1: ok"
+    else
+        echo "${mode}: $1: FAILED, the bytes differ"
+        failed=$((failed + 1))
+    fi
+}
+
+#
+# check_origin - compare the requests and the conditional requests the
+#     origin got for a path since the last check_origin of that path
+#     usage: check_origin <name> <path> <requests> <conditional>
+#
+function check_origin {
+    got=`curl --max-time ${TIMEOUT} --silent --noproxy "*" \
+        http://localhost:${origin_port}/count$2`
+    if [ "${got}" = "$3 $4" ]
+    then
+        echo "${mode}: $1: ok"
+    else
+        echo "${mode}: $1: FAILED, the origin got ${got} requests," \
+            "expected $3 $4"
+        failed=$((failed + 1))
+    fi
+}
+
+make -s proxy dnscheck || exit 1
+
+# the address cache with a stub resolver, every failure is counted
+./dnscheck
+failed=$?
+
+body_file=`mktemp`
+origin_port=`./free-port.sh`
+./framing-server.py ${origin_port} &> /dev/null &
+origin_pid=$!
+wait_for_port ${origin_port} || exit 1
+
+for mode in ${MODES}
+do
+    proxy_port=`./free-port.sh`
+    ./proxy -m ${mode} -O ${OBJECT_SIZE} ${proxy_port} &> /dev/null &
+    proxy_pid=$!
+    wait_for_port ${proxy_port} || break
+
+    # a body that ends when the server closes, cached or too large
+    check_body "eof miss, HTTP/1.1" "" /eof/5000 5000
+    check_body "eof hit, HTTP/1.1" "" /eof/5000 5000
+    check_body "eof miss, HTTP/1.0" "--http1.0" /eof/5001 5001
+    check_body "eof hit, HTTP/1.0" "--http1.0" /eof/5001 5001
+    check_body "eof too large, HTTP/1.1" "" /eof/50000 50000
+    check_body "eof too large, HTTP/1.0" "--http1.0" /eof/50001 50001
+
+    # a chunked body reaches HTTP/1.0 clients without its framing, curl
+    # --raw would count the chunk size lines
+    check_body "chunked miss, HTTP/1.1" "" /chunked/5000 5000
+    check_body "chunked hit, HTTP/1.1" "" /chunked/5000 5000
+    check_body "chunked miss, HTTP/1.0" "--http1.0 --raw" /chunked/5001 5001
+    check_body "chunked hit, HTTP/1.0" "--http1.0 --raw" /chunked/5001 5001
+    check_body "chunked too large, HTTP/1.0" "--http1.0 --raw" \
+        /chunked/50001 50001
+
+    # Range and If-* requests of a cached object never reach the origin
+    check_response "validators miss" /cond/5000 200 5000
+    check_response "range hit" /cond/5000 206 100 \
+        -H "Range: bytes=100-199"
+    check_content "range hit body" 100 100
+    check_response "range out of bounds" /cond/5000 416 0 \
+        -H "Range: bytes=6000-6099"
+    check_response "if-none-match hit" /cond/5000 304 0 \
+        -H 'If-None-Match: "c5000"'
+    check_response "if-modified-since hit" /cond/5000 304 0 \
+        -H "If-Modified-Since: Mon, 01 Jan 2024 00:00:00 GMT"
+    check_origin "validators from the cache" /cond/5000 1 0
+
+    # a no-store response is never cached, an expired one is revalidated
+    check_response "no-store miss" /nostore/5000 200 5000
+    check_response "no-store again" /nostore/5000 200 5000
+    check_origin "no-store not cached" /nostore/5000 2 0
+    check_response "max-age miss" /maxage/5000 200 5000
+    check_response "max-age hit" /maxage/5000 200 5000
+    sleep 2
+    check_response "max-age expired" /maxage/5000 200 5000
+    check_content "max-age expired body" 0 5000
+    # the epoll loops send no validators, they fetch the object again
+    case ${mode} in
+        event|reuseport) conditional=0 ;;
+        *) conditional=1 ;;
+    esac
+    check_origin "max-age revalidated" /maxage/5000 2 ${conditional}
+
+    # a gzip object serves a client that does not accept gzip decoded
+    check_response "gzip miss" /gzip/5000 200 5000 --compressed
+    check_response "gzip hit, identity" /gzip/5000 200 5000
+    check_content "gzip hit, identity body" 0 5000
+    check_origin "gzip decoded from the cache" /gzip/5000 1 0
+    kill ${proxy_pid}
+    wait ${proxy_pid} 2> /dev/null
+done
+
+kill ${origin_pid}
+wait ${origin_pid} 2> /dev/null
+rm -f ${body_file}
+
+echo "${failed} checks failed."
+[ ${failed} -eq 0 ]
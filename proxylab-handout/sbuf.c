@@ -0,0 +1,89 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * sbuf.c - bounded producer/consumer buffer of connected descriptors.
+ * Implementation idea:
+ * 1. circular array of n slots
+ * 2. slots/items semaphores count free and used slots, so producers
+ *    block when the buffer is full and consumers block when it is empty
+ * 3. sbuf_tryinsert never blocks, the caller decides what to do
+ *    with a descriptor that does not fit
+ *
+ */
+#include "csapp.h"
+#include "sbuf.h"
+
+/*
+ * sbuf_init - Create an empty, bounded, shared FIFO buffer with n slots
+ */
+void sbuf_init(sbuf_t *sp, int n) {
+
+    sp -> buf = Calloc(n, sizeof(int));
+    sp -> n = n;                        // buffer holds max of n items
+    sp -> front = sp -> rear = 0;       // empty buffer iff front == rear
+    Sem_init(&sp -> mutex, 0, 1);       // binary semaphore for locking
+    Sem_init(&sp -> slots, 0, n);       // initially, buf has n empty slots
+    Sem_init(&sp -> items, 0, 0);       // initially, buf has zero items
+
+}
+
+/*
+ * sbuf_deinit - Clean up buffer sp
+ */
+void sbuf_deinit(sbuf_t *sp) {
+
+    Free(sp -> buf);
+
+}
+
+/*
+ * sbuf_insert - Insert item onto the rear of shared buffer sp,
+ *               wait for a free slot if the buffer is full
+ */
+void sbuf_insert(sbuf_t *sp, int item) {
+
+    P(&sp -> slots);                    // wait for available slot
+    P(&sp -> mutex);                    // lock the buffer
+    sp -> buf[(++sp -> rear) % (sp -> n)] = item;
+    V(&sp -> mutex);                    // unlock the buffer
+    V(&sp -> items);                    // announce available item
+
+}
+
+/*
+ * sbuf_tryinsert - Insert item onto the rear of shared buffer sp
+ *                  return -1 without waiting if the buffer is full
+ */
+int sbuf_tryinsert(sbuf_t *sp, int item) {
+
+    // take a free slot only if there is one
+    while (sem_trywait(&sp -> slots) < 0) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    P(&sp -> mutex);
+    sp -> buf[(++sp -> rear) % (sp -> n)] = item;
+    V(&sp -> mutex);
+    V(&sp -> items);
+
+    return 0;
+}
+
+/*
+ * sbuf_remove - Remove and return the first item from buffer sp,
+ *               wait for an item if the buffer is empty
+ */
+int sbuf_remove(sbuf_t *sp) {
+
+    int item;
+
+    P(&sp -> items);                    // wait for available item
+    P(&sp -> mutex);                    // lock the buffer
+    item = sp -> buf[(++sp -> front) % (sp -> n)];
+    V(&sp -> mutex);                    // unlock the buffer
+    V(&sp -> slots);                    // announce available slot
+
+    return item;
+}
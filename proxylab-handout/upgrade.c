@@ -0,0 +1,377 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * upgrade.c - graceful restart of the proxy without dropping connections.
+ * Implementation idea:
+ * 1. on SIGUSR2 the old process forks and executes its binary again (the
+ *    new one, if it was replaced on disk); the listening sockets (one,
+ *    or one per loop in reuseport mode) are inherited and their fds are
+ *    passed in the environment, so connections keep queueing on the
+ *    same sockets while the processes change
+ * 2. optionally the old process first writes every cached object into a
+ *    snapshot in the shared memory file system, with the record layout
+ *    of the disk tier (diskcache.c); the new process loads it into its
+ *    own cache and removes it, so it starts warm
+ * 3. once the new process accepts, it sends SIGQUIT to the old one; if it
+ *    fails to start, the old one simply keeps serving
+ * 4. SIGQUIT makes a process drain: a pipe becomes readable, which every
+ *    accept loop watches next to the listening socket, so nothing is
+ *    accepted any more; persistent connections end after their current
+ *    response and the process exits when its last connection is closed
+ *    or after UPGRADE_DRAIN_TIMEOUT seconds
+ * 5. the listening sockets are shared by both processes during the
+ *    switch, they are non-blocking and accept only follows poll, so a
+ *    connection taken by the other process never blocks an accept loop
+ *
+ */
+#include <poll.h>
+#include <sys/syscall.h>
+#include "csapp.h"
+#include "cache.h"
+#include "diskcache.h"
+#include "upgrade.h"
+
+/* the pipe becomes readable once the process drains, never written before */
+static int drain_pipe[2] = {-1, -1};
+static pthread_once_t drain_once = PTHREAD_ONCE_INIT;
+static int draining = 0;
+
+/* Static helper functions for the graceful restart */
+static void init_drain_pipe();
+static void create_drain_pipe();
+static char** upgrade_environ(int* listenfds, int listen_num,
+                              char* snapshot);
+static void close_other_fds(int* keep, int keep_num);
+
+/*
+ * inherited_listenfds - the listening sockets handed over by the process
+ *                       being upgraded, at most max of them into fds
+ *                       return their number, 0 if the proxy was started
+ *                       on its own
+ */
+int inherited_listenfds(int* fds, int max) {
+
+    char* value = getenv(UPGRADE_LISTEN_ENV);
+    char* end;
+    long fd;
+    int num = 0;
+
+    if (value == NULL) {
+        return 0;
+    }
+
+    // a comma separated list of descriptors
+    while (*value != '\0' && num < max) {
+        fd = strtol(value, &end, 10);
+        if (end == value || fd < 0 || fcntl(fd, F_GETFD) == -1) {
+            printf("Inherited listen socket %s is not open.\n", value);
+            break;
+        }
+        fds[num++] = fd;
+        value = (*end == ',') ? end + 1 : end;
+    }
+    unsetenv(UPGRADE_LISTEN_ENV);
+    return num;
+}
+
+/*
+ * accept_client - wait for a client on listenfd and accept it, clients
+ *                 taken by another process sharing the socket are skipped
+ *                 return the connected descriptor, -1 once draining
+ */
+int accept_client(int listenfd, SA* addr, socklen_t* addrlen) {
+
+    struct pollfd fds[2];
+    socklen_t length = *addrlen;
+    int fd;
+
+    fds[0].fd = listenfd;
+    fds[0].events = POLLIN;
+    fds[1].fd = drain_event_fd();
+    fds[1].events = POLLIN;
+
+    while (1) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            unix_error("Poll listen socket error");
+        }
+        if (fds[1].revents != 0) {
+            return -1;
+        }
+
+        *addrlen = length;
+        if ((fd = accept(listenfd, addr, addrlen)) >= 0) {
+            return fd;
+        }
+        // another process or thread was faster, or the client gave up
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+            errno != ECONNABORTED) {
+            unix_error("Accept error");
+        }
+    }
+}
+
+/*
+ * start_draining - stop accepting in every loop of the process
+ */
+void start_draining() {
+
+    char c = 0;
+
+    init_drain_pipe();
+    if (__atomic_exchange_n(&draining, 1, __ATOMIC_SEQ_CST) == 0) {
+        if (write(drain_pipe[1], &c, 1) != 1) {
+            unix_error("Write drain pipe error");
+        }
+    }
+}
+
+/*
+ * is_draining - check whether the process stopped accepting
+ */
+int is_draining() {
+
+    return __atomic_load_n(&draining, __ATOMIC_RELAXED);
+}
+
+/*
+ * drain_event_fd - a descriptor that becomes readable once the process
+ *                  drains, to be watched next to the listening socket
+ */
+int drain_event_fd() {
+
+    init_drain_pipe();
+    return drain_pipe[0];
+}
+
+/*
+ * save_cache_snapshot - write every cached object into a new snapshot
+ *                       return its path, NULL on error
+ */
+char* save_cache_snapshot(cache_list_t* list) {
+
+    disk_cache_t* snapshot;
+    char* path = (char *)Malloc(MAXLINE);
+    size_t size;
+    int stored;
+
+    // the objects take less room in records than in the cache
+    size = cache_used_bytes(list) + DISK_SUPER_SIZE + 2 * list -> max_object;
+    size = (size + DISK_SUPER_SIZE - 1) / DISK_SUPER_SIZE * DISK_SUPER_SIZE;
+
+    snprintf(path, MAXLINE, "%s/proxy-snapshot-%d", UPGRADE_SNAPSHOT_DIR,
+             (int)getpid());
+    unlink(path);
+    if ((snapshot = open_disk_cache(path, size, list -> max_object)) == NULL) {
+        Free(path);
+        return NULL;
+    }
+    stored = snapshot_cache_list(list, snapshot);
+    close_disk_cache(snapshot);
+
+    printf("Cache snapshot %s: %d objects.\n", path, stored);
+    fflush(stdout);
+    return path;
+}
+
+/*
+ * restore_cache_snapshot - load the snapshot left by the process being
+ *                          upgraded, if any, and remove it
+ *                          return the number of objects restored
+ */
+int restore_cache_snapshot(cache_list_t* list) {
+
+    disk_cache_t* snapshot;
+    struct stat st;
+    char path[MAXLINE];
+    int restored;
+
+    if (getenv(UPGRADE_SNAPSHOT_ENV) == NULL) {
+        return 0;
+    }
+    snprintf(path, MAXLINE, "%s", getenv(UPGRADE_SNAPSHOT_ENV));
+    unsetenv(UPGRADE_SNAPSHOT_ENV);
+
+    if (stat(path, &st) == -1 ||
+        (snapshot = open_disk_cache(path, st.st_size,
+                                    list -> max_object)) == NULL) {
+        printf("Cache snapshot %s cannot be read.\n", path);
+        unlink(path);
+        return 0;
+    }
+    restored = restore_disk_objects(snapshot, list);
+    close_disk_cache(snapshot);
+    unlink(path);
+
+    printf("Cache snapshot %s: %d objects restored.\n", path, restored);
+    fflush(stdout);
+    return restored;
+}
+
+/*
+ * spawn_upgrade - start the proxy binary again with the same arguments,
+ *                 handing it the listen_num listenfds and the snapshot
+ *                 (NULL if none)
+ *                 return the pid of the new process, -1 on error
+ */
+pid_t spawn_upgrade(char** argv, int* listenfds, int listen_num,
+                    char* snapshot) {
+
+    char** envp = upgrade_environ(listenfds, listen_num, snapshot);
+    int keep[UPGRADE_MAX_LISTEN];
+    sigset_t mask;
+    pid_t pid;
+    int i, j, fd;
+
+    // the descriptors to keep, in ascending order
+    for (i = 0; i < listen_num; i++) {
+        fd = listenfds[i];
+        for (j = i; j > 0 && keep[j - 1] > fd; j--) {
+            keep[j] = keep[j - 1];
+        }
+        keep[j] = fd;
+    }
+
+    if ((pid = fork()) == 0) {
+        // only the listening sockets go to the new process
+        sigemptyset(&mask);
+        sigprocmask(SIG_SETMASK, &mask, NULL);
+        close_other_fds(keep, listen_num);
+        for (i = 0; i < listen_num; i++) {
+            fcntl(keep[i], F_SETFD, 0);
+        }
+        execve(argv[0], argv, envp);
+        // argv[0] may not be a path, run the binary of this process
+        execve("/proc/self/exe", argv, envp);
+        _exit(127);
+    }
+    if (pid == -1) {
+        printf("Fork upgrade process error: %s\n", strerror(errno));
+    }
+
+    for (i = 0; envp[i] != NULL; i++) {
+        if (!strncmp(envp[i], "PROXY_", 6)) {
+            Free(envp[i]);
+        }
+    }
+    Free(envp);
+    return pid;
+}
+
+/*
+ * upgrade_ready - tell the process being upgraded that this one accepts
+ *                 now, so that it drains
+ */
+void upgrade_ready() {
+
+    char* value = getenv(UPGRADE_PARENT_ENV);
+    pid_t pid;
+
+    if (value == NULL) {
+        return;
+    }
+    pid = atoi(value);
+    unsetenv(UPGRADE_PARENT_ENV);
+    if (pid > 1 && kill(pid, SIGQUIT) == -1) {
+        printf("Signal process %d to drain error: %s\n", (int)pid,
+               strerror(errno));
+    }
+}
+
+/*
+ * init_drain_pipe - create the drain pipe, only the first call does
+ */
+static void init_drain_pipe() {
+
+    pthread_once(&drain_once, create_drain_pipe);
+}
+
+/*
+ * create_drain_pipe - pthread_once routine of init_drain_pipe
+ */
+static void create_drain_pipe() {
+
+    if (pipe(drain_pipe) == -1) {
+        unix_error("Create drain pipe error");
+    }
+    fcntl(drain_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(drain_pipe[1], F_SETFD, FD_CLOEXEC);
+}
+
+/*
+ * upgrade_environ - the environment of this process without the upgrade
+ *                   variables it may have been started with, plus the
+ *                   ones for the new process; built before the fork since
+ *                   the child of a threaded process must not allocate
+ */
+static char** upgrade_environ(int* listenfds, int listen_num,
+                              char* snapshot) {
+
+    char** envp;
+    size_t length;
+    int i, n = 0;
+
+    for (i = 0; environ[i] != NULL; i++) {
+        ;
+    }
+    envp = (char **)Calloc(i + 4, sizeof(char *));
+    for (i = 0; environ[i] != NULL; i++) {
+        if (strncmp(environ[i], "PROXY_", 6)) {
+            envp[n++] = environ[i];
+        }
+    }
+
+    envp[n] = (char *)Malloc(MAXLINE);
+    length = snprintf(envp[n], MAXLINE, "%s=", UPGRADE_LISTEN_ENV);
+    for (i = 0; i < listen_num && length < MAXLINE; i++) {
+        length += snprintf(envp[n] + length, MAXLINE - length,
+                           (i == 0) ? "%d" : ",%d", listenfds[i]);
+    }
+    n++;
+    envp[n] = (char *)Malloc(MAXLINE);
+    snprintf(envp[n++], MAXLINE, "%s=%d", UPGRADE_PARENT_ENV, (int)getpid());
+    if (snapshot != NULL) {
+        envp[n] = (char *)Malloc(MAXLINE);
+        snprintf(envp[n++], MAXLINE, "%s=%s", UPGRADE_SNAPSHOT_ENV, snapshot);
+    }
+    envp[n] = NULL;
+    return envp;
+}
+
+/*
+ * close_other_fds - close every descriptor above stderr but the keep_num
+ *                   ones of keep, in ascending order, in the child before
+ *                   it executes the new binary
+ */
+static void close_other_fds(int* keep, int keep_num) {
+
+    long fd, max = sysconf(_SC_OPEN_MAX);
+    int i;
+
+#ifdef SYS_close_range
+    unsigned int low = 3;
+
+    // the ranges between the descriptors kept
+    for (i = 0; i < keep_num; i++) {
+        if ((unsigned int)keep[i] > low &&
+            syscall(SYS_close_range, low, keep[i] - 1, 0) != 0) {
+            break;
+        }
+        low = keep[i] + 1;
+    }
+    if (i == keep_num && syscall(SYS_close_range, low, ~0U, 0) == 0) {
+        return;
+    }
+#endif
+    for (fd = 3; fd < max; fd++) {
+        for (i = 0; i < keep_num && keep[i] != fd; i++) {
+            ;
+        }
+        if (i == keep_num) {
+            close(fd);
+        }
+    }
+}
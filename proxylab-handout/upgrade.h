@@ -0,0 +1,42 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * upgrade.h - prototypes and definitions for upgrade.c
+ */
+#ifndef __UPGRADE_H__
+#define __UPGRADE_H__
+
+#include "csapp.h"
+#include "cache.h"
+
+/* Environment handed to the new process of a graceful upgrade */
+#define UPGRADE_LISTEN_ENV   "PROXY_LISTEN_FD"     // inherited listen sockets
+#define UPGRADE_SNAPSHOT_ENV "PROXY_SNAPSHOT"      // cache snapshot, if any
+#define UPGRADE_PARENT_ENV   "PROXY_UPGRADE_FROM"  // pid told to drain
+
+/* Most listening sockets handed over, one per reuseport listener */
+#define UPGRADE_MAX_LISTEN 64
+
+/* Cache snapshots are files in the shared memory file system */
+#define UPGRADE_SNAPSHOT_DIR "/dev/shm"
+
+/* Seconds the old process waits for its connections to finish */
+#define UPGRADE_DRAIN_TIMEOUT 30
+
+/* Milliseconds between two checks of the connections left */
+#define UPGRADE_DRAIN_POLL 100
+
+/* Defined function restarting the proxy without dropping connections */
+int inherited_listenfds(int* fds, int max);
+int accept_client(int listenfd, SA* addr, socklen_t* addrlen);
+void start_draining();
+int is_draining();
+int drain_event_fd();
+char* save_cache_snapshot(cache_list_t* list);
+int restore_cache_snapshot(cache_list_t* list);
+pid_t spawn_upgrade(char** argv, int* listenfds, int listen_num,
+                    char* snapshot);
+void upgrade_ready();
+
+#endif /* __UPGRADE_H__ */
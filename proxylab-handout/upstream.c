@@ -0,0 +1,243 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * upstream.c - pool of idle persistent connections to origin servers.
+ * Implementation idea:
+ * 1. index the origins by "host:port" in a hash table, every origin keeps
+ *    a stack of idle connections, the most recently released on top
+ * 2. acquire pops an idle connection that is neither expired nor closed
+ *    by the server, or opens a new one
+ * 3. release pushes a connection back only if its response was fully
+ *    delimited and the origin has fewer than max_idle idle connections
+ * 4. expired connections are closed lazily whenever an origin is touched
+ * 5. an origin has at most max_open connections, idle or in use; a request
+ *    finding them all in use waits for one to be released or closed, for
+ *    at most the connect timeout
+ *
+ */
+#include "csapp.h"
+#include "cache.h"
+#include "upstream.h"
+#include "dnscache.h"
+
+/* Static helper functions for the upstream pool */
+static upstream_host_t* find_host(upstream_pool_t* pool, char* key,
+                                  int create);
+static void close_expired(upstream_pool_t* pool, upstream_host_t* host,
+                          time_t now);
+static int is_alive(int fd);
+static void close_origin_conn(upstream_pool_t* pool, upstream_host_t* origin,
+                              int fd);
+static int wait_for_slot(upstream_pool_t* pool, struct timespec* deadline);
+
+/*
+ * init_upstream_pool - initialize an empty pool
+ *                      return a pointer to the pool
+ */
+upstream_pool_t* init_upstream_pool(int max_idle, int max_open,
+                                    int idle_timeout) {
+
+    upstream_pool_t* pool =
+        (upstream_pool_t *)Calloc(1, sizeof(upstream_pool_t));
+    pool -> max_idle = max_idle;
+    pool -> max_open = max_open;
+    pool -> idle_timeout = idle_timeout;
+    pthread_mutex_init(&pool -> mutex, NULL);
+    pthread_cond_init(&pool -> released, NULL);
+    return pool;
+
+}
+
+/*
+ * acquire_upstream - get a connection to host:port, *reused is set to 1
+ *                    if it comes from the pool; a new connection gives up
+ *                    after connect_timeout seconds, 0 waits, and so does
+ *                    the wait for an origin with max_open connections
+ *                    return the fd, -1 if the server cannot be reached,
+ *                    with errno EAGAIN if no connection was released
+ */
+int acquire_upstream(upstream_pool_t* pool, char* host, char* port,
+                     int connect_timeout, int* reused) {
+
+    char key[MAXLINE];
+    upstream_host_t* origin;
+    upstream_conn_t* conn;
+    struct timespec deadline;
+    int fd, waiting = 0;
+
+    *reused = 0;
+    snprintf(key, MAXLINE, "%s:%s", host, port);
+
+    pthread_mutex_lock(&pool -> mutex);
+    origin = find_host(pool, key, 1);
+    while (1) {
+        close_expired(pool, origin, time(NULL));
+        // skip the connections the server closed meanwhile
+        while ((conn = origin -> idle) != NULL) {
+            origin -> idle = conn -> next;
+            origin -> idle_num--;
+            fd = conn -> fd;
+            Free(conn);
+            if (is_alive(fd)) {
+                pthread_mutex_unlock(&pool -> mutex);
+                *reused = 1;
+                return fd;
+            }
+            close_origin_conn(pool, origin, fd);
+        }
+        if (pool -> max_open <= 0 || origin -> open_num < pool -> max_open) {
+            break;
+        }
+        // every connection is in use, one of them may come back idle
+        if (!waiting) {
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += connect_timeout;
+            waiting = 1;
+        }
+        if (wait_for_slot(pool, (connect_timeout > 0) ?
+                          &deadline : NULL) == -1) {
+            pthread_mutex_unlock(&pool -> mutex);
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+    origin -> open_num++;
+    pthread_mutex_unlock(&pool -> mutex);
+
+    if ((fd = open_cached_clientfd(host, port,
+                                   connect_timeout * 1000)) < 0) {
+        pthread_mutex_lock(&pool -> mutex);
+        close_origin_conn(pool, origin, -1);
+        pthread_mutex_unlock(&pool -> mutex);
+    }
+    return fd;
+}
+
+/*
+ * release_upstream - give back a connection after a response, it is kept
+ *                    only if reusable and the origin has room, else closed
+ */
+void release_upstream(upstream_pool_t* pool, char* host, char* port,
+                      int fd, int reusable) {
+
+    char key[MAXLINE];
+    upstream_host_t* origin;
+    upstream_conn_t* conn;
+    time_t now;
+
+    snprintf(key, MAXLINE, "%s:%s", host, port);
+    now = time(NULL);
+
+    pthread_mutex_lock(&pool -> mutex);
+    origin = find_host(pool, key, 1);
+    close_expired(pool, origin, now);
+    if (!reusable || origin -> idle_num >= pool -> max_idle) {
+        close_origin_conn(pool, origin, fd);
+        pthread_mutex_unlock(&pool -> mutex);
+        return;
+    }
+
+    conn = (upstream_conn_t *)Malloc(sizeof(upstream_conn_t));
+    conn -> fd = fd;
+    conn -> idle_since = now;
+    conn -> next = origin -> idle;
+    origin -> idle = conn;
+    origin -> idle_num++;
+    pthread_cond_broadcast(&pool -> released);
+    pthread_mutex_unlock(&pool -> mutex);
+}
+
+/*
+ * find_host - look up the idle list of an origin, create it if asked
+ *             the caller must hold the pool mutex
+ */
+static upstream_host_t* find_host(upstream_pool_t* pool, char* key,
+                                  int create) {
+
+    unsigned int index = hash_cache_id(key) & (UPSTREAM_BUCKET_NUM - 1);
+    upstream_host_t* origin;
+
+    for (origin = pool -> buckets[index]; origin; origin = origin -> next) {
+        if (strcmp(origin -> host_key, key) == 0) {
+            return origin;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+
+    origin = (upstream_host_t *)Calloc(1, sizeof(upstream_host_t));
+    origin -> host_key = (char *)Malloc(strlen(key) + 1);
+    strcpy(origin -> host_key, key);
+    origin -> next = pool -> buckets[index];
+    pool -> buckets[index] = origin;
+    return origin;
+}
+
+/*
+ * close_expired - close the connections idle for longer than the timeout,
+ *                 the oldest ones are at the bottom of the stack
+ */
+static void close_expired(upstream_pool_t* pool, upstream_host_t* origin,
+                          time_t now) {
+
+    upstream_conn_t** link = &origin -> idle;
+    upstream_conn_t* conn;
+
+    while ((conn = *link) != NULL) {
+        if (now - conn -> idle_since >= pool -> idle_timeout) {
+            *link = conn -> next;
+            origin -> idle_num--;
+            close_origin_conn(pool, origin, conn -> fd);
+            Free(conn);
+        } else {
+            link = &conn -> next;
+        }
+    }
+}
+
+/*
+ * is_alive - check that an idle connection was not closed by the server,
+ *            an idle connection must have nothing to read
+ */
+static int is_alive(int fd) {
+
+    char c;
+    ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+
+    return n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+/*
+ * close_origin_conn - close a connection of the origin, -1 for one that
+ *                     never opened, and wake up the requests waiting for
+ *                     the origin to have room
+ *                     the caller must hold the pool mutex
+ */
+static void close_origin_conn(upstream_pool_t* pool, upstream_host_t* origin,
+                              int fd) {
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    origin -> open_num--;
+    pthread_cond_broadcast(&pool -> released);
+}
+
+/*
+ * wait_for_slot - wait until a connection of some origin is released or
+ *                 closed, until the deadline, NULL waits as long as it
+ *                 takes
+ *                 the caller must hold the pool mutex
+ *                 return -1 once the deadline passed
+ */
+static int wait_for_slot(upstream_pool_t* pool, struct timespec* deadline) {
+
+    if (deadline == NULL) {
+        pthread_cond_wait(&pool -> released, &pool -> mutex);
+        return 0;
+    }
+    return (pthread_cond_timedwait(&pool -> released, &pool -> mutex,
+                                   deadline) == ETIMEDOUT) ? -1 : 0;
+}
@@ -0,0 +1,58 @@
+/*
+ * Name: Gao Jiang
+ * Andrew ID: gaoj
+ *
+ * upstream.h - prototypes and definitions for upstream.c
+ */
+#ifndef __UPSTREAM_H__
+#define __UPSTREAM_H__
+
+#include "csapp.h"
+
+/* Number of buckets of the origin table, always a power of 2 */
+#define UPSTREAM_BUCKET_NUM 64
+
+/* Default max idle connections kept per origin */
+#define UPSTREAM_MAX_IDLE 8
+
+/* Seconds an idle connection is kept before it is closed */
+#define UPSTREAM_IDLE_TIMEOUT 30
+
+/* Default max connections open per origin, idle or in use */
+#define UPSTREAM_MAX_OPEN 64
+
+/* Defined a struct representing one idle persistent connection */
+typedef struct upstream_conn_t {
+    int fd;
+    time_t idle_since;
+    struct upstream_conn_t* next;
+} upstream_conn_t;
+
+/* Defined a struct representing the connections to one host:port */
+typedef struct upstream_host_t {
+    char* host_key;
+    upstream_conn_t* idle;          // most recently released first
+    int idle_num;
+    int open_num;                   // idle, in use or connecting
+    struct upstream_host_t* next;
+} upstream_host_t;
+
+/* Defined a struct representing the pool of every origin */
+typedef struct upstream_pool_t {
+    upstream_host_t* buckets[UPSTREAM_BUCKET_NUM];
+    int max_idle;                   // 0 disables pooling
+    int max_open;                   // 0 does not limit the connections
+    int idle_timeout;
+    pthread_mutex_t mutex;
+    pthread_cond_t released;        // an origin closed a connection
+} upstream_pool_t;
+
+/* Defined function pooling persistent upstream connections */
+upstream_pool_t* init_upstream_pool(int max_idle, int max_open,
+                                    int idle_timeout);
+int acquire_upstream(upstream_pool_t* pool, char* host, char* port,
+                     int connect_timeout, int* reused);
+void release_upstream(upstream_pool_t* pool, char* host, char* port,
+                      int fd, int reusable);
+
+#endif /* __UPSTREAM_H__ */